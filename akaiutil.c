@@ -294,7 +294,6 @@ akai_free_fatchain(struct part_s *pp,u_int bstart,int writeflag)
 	u_int fblk,nblk;
 	u_int bc;
 	u_int i;
-	u_int hdsiz;
 
 	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)||(bstart>pp->bsize)){
 		return -1;
@@ -340,37 +339,8 @@ akai_free_fatchain(struct part_s *pp,u_int bstart,int writeflag)
 		pp->bfree+=bc;
 
 		/* write new FAT to partition */
-		if ((pp->type==PART_TYPE_FLL)||(pp->type==PART_TYPE_FLH)){
-			/* write floppy header */
-			if (pp->type==PART_TYPE_FLL){
-				hdsiz=AKAI_FLLHEAD_BLKS; /* floppy header */
-			}else{
-				hdsiz=AKAI_FLHHEAD_BLKS; /* floppy header */
-			}
-			if (akai_io_blks(pp,(u_char *)&pp->head.flh,
-							 0,
-							 hdsiz,
-							 1,IO_BLKS_WRITE)<0){ /* 1: allocate cache if possible */
-				return -1;
-			}
-		}else if (pp->type==PART_TYPE_HD9){
-			/* copy first FAT entries */
-			bcopy((u_char *)&pp->head.hd9.fatblk,(u_char *)&pp->head.hd9.fatblk0,AKAI_HD9FAT0_ENTRIES*2);
-			/* write S900 harddisk header */
-			if (akai_io_blks(pp,(u_char *)&pp->head.hd9,
-							 0,
-							 AKAI_HD9HEAD_BLKS,
-							 1,IO_BLKS_WRITE)<0){ /* 1: allocate cache if possible */
-				return -1;
-			}
-		}else if (pp->type==PART_TYPE_HD){
-			/* write S1000/S3000 partition header */
-			if (akai_io_blks(pp,(u_char *)&pp->head.hd,
-							 0,
-							 AKAI_PARTHEAD_BLKS,
-							 1,IO_BLKS_WRITE)<0){ /* 1: allocate cache if possible */
-				return -1;
-			}
+		if (akai_write_fat(pp)<0){
+			return -1;
 		}
 	}
 
@@ -386,7 +356,6 @@ akai_allocate_fatchain(struct part_s *pp,u_int bsize,u_int *bstartp,u_int bcont0
 	int ret;
 	u_int fblk,pblk;
 	u_int bc;
-	u_int hdsiz;
 
 	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)){
 		return -1;
@@ -498,6 +467,138 @@ akai_allocate_fatchain_done:
 		akai_countfree_part(pp);
 	}
 	/* write new FAT to partition */
+	if (akai_write_fat(pp)<0){
+		ret=-1;
+	}
+
+	return ret;
+}
+
+
+
+/* allocate num FAT chains in one pass, sizes in bsizep[], returns first blocks in bstartp[] */
+/* Note: same result as num calls of akai_allocate_fatchain() with bcont0<=1, but FAT is written once */
+/* Note: sizes must not be 0 */
+int
+akai_allocate_fatchains(struct part_s *pp,u_int num,u_int *bsizep,u_int *bstartp,u_int endcode)
+{
+	int ret;
+	u_int fblk,pblk;
+	u_int bc,btot;
+	u_int i;
+
+	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)){
+		return -1;
+	}
+	if (pp->type==PART_TYPE_DD){
+		return -1;
+	}
+	if ((bsizep==NULL)||(bstartp==NULL)){
+		return -1;
+	}
+
+	/* check if enough space left */
+	btot=0;
+	for (i=0;i<num;i++){
+		if (bsizep[i]==0){
+			return -1;
+		}
+		if (bsizep[i]>pp->bsize){
+			fprintf(stderr,"not enough space left\n");
+			return -1;
+		}
+		btot+=bsizep[i];
+	}
+	if (btot>pp->bfree){
+		fprintf(stderr,"not enough space left\n");
+		return -1;
+	}
+	/* now there should be enough free blocks */
+
+	/* check code for end of chain */
+	if ( /* Note: don't check for AKAI_FAT_CODE_SYS900FL here since it is ==AKAI_FAT_CODE_FREE !!! */
+		  (endcode!=AKAI_FAT_CODE_SYS900HD)
+		&&(endcode!=AKAI_FAT_CODE_SYS)
+		&&(endcode!=AKAI_FAT_CODE_DIREND900HD)
+		&&(endcode!=AKAI_FAT_CODE_DIREND1000HD)
+		&&(endcode!=AKAI_FAT_CODE_DIREND3000)
+		&&(endcode!=AKAI_FAT_CODE_FILEEND900)
+		&&(endcode!=AKAI_FAT_CODE_FILEEND)){
+		return -1;
+	}
+
+	/* scan FAT once for all chains */
+	ret=0; /* no error so far */
+	i=0; /* current chain */
+	bc=0; /* block counter of current chain */
+	pblk=0;
+	/* Note: start at block pp->bsyssize in order to skip reserved system blocks */
+	/*       => also avoids problem due to AKAI_FAT_CODE_SYS900FL==AKAI_FAT_CODE_FREE */
+	for (fblk=pp->bsyssize;(fblk<pp->bsize)&&(i<num);fblk++){ /* block */
+		/* check if fblk is free */
+		if (((pp->fat[fblk][1]<<8)+pp->fat[fblk][0])!=AKAI_FAT_CODE_FREE){
+			continue; /* not free, next */
+		}
+		/* is free */
+
+		/* allocate */
+		if (bc==0){ /* is first free block? */
+			/* start of chain */
+			bstartp[i]=fblk;
+		}else{
+			/* link chain in previous free block */
+			pp->fat[pblk][1]=0xff&(fblk>>8);
+			pp->fat[pblk][0]=0xff&fblk;
+		}
+		bc++; /* found one */
+		/* temporarily mark end of chain */
+		pp->fat[fblk][1]=0xff&(endcode>>8);
+		pp->fat[fblk][0]=0xff&endcode;
+		pblk=fblk; /* save for next element */
+
+		if (bc==bsizep[i]){ /* enough for this chain? */
+			/* keep end mark */
+			pp->bfree-=bc;
+			bc=0;
+			i++; /* next chain */
+		}
+	}
+
+	if (i<num){ /* not enough? */
+		/* XXX should not happen, since enough free blocks */
+		fprintf(stderr,"not enough space left\n");
+		ret=-1;
+		/* free chains allocated so far */
+		if (bc>0){
+			akai_free_fatchain(pp,bstartp[i],0); /* 0: don't write FAT yet */
+		}
+		while (i>0){
+			i--;
+			akai_free_fatchain(pp,bstartp[i],0); /* 0: don't write FAT yet */
+		}
+		akai_countfree_part(pp);
+	}
+
+	/* write new FAT to partition */
+	if (akai_write_fat(pp)<0){
+		ret=-1;
+	}
+
+	return ret;
+}
+
+
+
+/* write FAT in header to partition */
+int
+akai_write_fat(struct part_s *pp)
+{
+	u_int hdsiz;
+
+	if ((pp==NULL)||(pp->fd<0)){
+		return -1;
+	}
+
 	if ((pp->type==PART_TYPE_FLL)||(pp->type==PART_TYPE_FLH)){
 		/* write floppy header */
 		if (pp->type==PART_TYPE_FLL){
@@ -509,7 +610,7 @@ akai_allocate_fatchain_done:
 						 0,
 						 hdsiz,
 						 1,IO_BLKS_WRITE)<0){ /* 1: allocate cache if possible */
-			ret=-1;
+			return -1;
 		}
 	}else if (pp->type==PART_TYPE_HD9){
 		/* copy first FAT entries */
@@ -519,7 +620,7 @@ akai_allocate_fatchain_done:
 						 0,
 						 AKAI_HD9HEAD_BLKS,
 						 1,IO_BLKS_WRITE)<0){ /* 1: allocate cache if possible */
-			ret=-1;
+			return -1;
 		}
 	}else if (pp->type==PART_TYPE_HD){
 		/* write S1000/S3000 partition header */
@@ -527,11 +628,11 @@ akai_allocate_fatchain_done:
 						 0,
 						 AKAI_PARTHEAD_BLKS,
 						 1,IO_BLKS_WRITE)<0){ /* 1: allocate cache if possible */
-			ret=-1;
+			return -1;
 		}
 	}
 
-	return ret;
+	return 0;
 }
 
 
@@ -539,8 +640,9 @@ akai_allocate_fatchain_done:
 int
 akai_read_file(int outfd,u_char *outbuf,struct file_s *fp,u_int begin,u_int end)
 {
-	u_char fbuf[AKAI_HD_BLOCKSIZE];
+	u_char fbuf[AKAI_READFILE_EXTBLKS*AKAI_HD_BLOCKSIZE];
 	u_int fblk,fchunk,fremain,skipbyte;
+	u_int fnum,nblk;
 	u_char (*fatp)[2];
 
 	if ((outfd<0)&&(outbuf==NULL)){
@@ -587,6 +689,41 @@ akai_read_file(int outfd,u_char *outbuf,struct file_s *fp,u_int begin,u_int end)
 			fprintf(stderr,"invalid block in file\n");
 			return -1;
 		}
+		if ((skipbyte==0)&&(fchunk==fp->volp->partp->blksize)){
+			/* FAT extent: find run of contiguous full blocks */
+			/* Note: to file: limited by size of fbuf */
+			for (fnum=1;(fremain-fnum*fchunk>=fchunk)&&((outbuf!=NULL)||(fnum<AKAI_READFILE_EXTBLKS));fnum++){
+				nblk=(fatp[fblk+fnum-1][1]<<8)+fatp[fblk+fnum-1][0];
+				if ((nblk!=fblk+fnum)
+					||(akai_check_fatblk(nblk,fp->volp->partp->bsize,fp->volp->partp->bsyssize)<0)){
+					break;
+				}
+			}
+			/* read blocks */
+			/* Note: io_blks() reads all non-cached blocks of extent with one call */
+			if (akai_io_blks(fp->volp->partp,(outbuf!=NULL)?outbuf:fbuf,
+							 fblk,
+							 fnum,
+							 0,IO_BLKS_READ)<0){ /* 0: don't alloc cache */
+				return -1;
+			}
+			if (outbuf!=NULL){
+				/* directly to buffer */
+				outbuf+=fnum*fchunk;
+			}else{
+				/* write to file */
+				if (WRITE(outfd,(void *)fbuf,fnum*fchunk)!=(int)(fnum*fchunk)){
+					perror("write");
+					return -1;
+				}
+			}
+			/* next block after extent */
+			fblk+=fnum-1;
+			fblk=(fatp[fblk][1]<<8)+fatp[fblk][0];
+			/* extent done */
+			fremain-=fnum*fchunk;
+			continue;
+		}
 		if (skipbyte<fchunk){
 			/* read block */
 			if (akai_io_blks(fp->volp->partp,(u_char *)fbuf,
@@ -621,11 +758,69 @@ akai_read_file(int outfd,u_char *outbuf,struct file_s *fp,u_int begin,u_int end)
 
 
 
+/* resolve bytes of file into extents on disk, returns number of extents, -1 if error */
+/* Note: extents beyond extmax are counted but not stored, extp may be NULL */
+int
+akai_file_extents(struct file_s *fp,struct io_ext_s *extp,u_int extmax)
+{
+	struct part_s *pp;
+	u_int fblk,fchunk,fremain;
+	u_int extnum;
+	OFF_T off,endoff;
+
+	if (fp==NULL){
+		return -1;
+	}
+	if ((fp->volp==NULL)||(fp->volp->type==AKAI_VOL_TYPE_INACT)){
+		return -1;
+	}
+	pp=fp->volp->partp;
+	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)||(pp->blksize==0)){
+		return -1;
+	}
+	if (fp->type==AKAI_FTYPE_FREE){
+		return -1;
+	}
+
+	extnum=0;
+	endoff=0;
+	fblk=fp->bstart; /* start block */
+	for (fremain=fp->size;fremain>0;fremain-=fchunk){ /* byte counter */
+		fchunk=(fremain>=pp->blksize)?pp->blksize:fremain;
+		/* check fblk */
+		if (akai_check_fatblk(fblk,pp->bsize,pp->bsyssize)<0){
+			fprintf(stderr,"invalid block in file\n");
+			return -1;
+		}
+		off=((OFF_T)(pp->bstart+fblk))*((OFF_T)pp->blksize);
+		if ((extnum>0)&&(off==endoff)){
+			/* contiguous: extend previous extent */
+			if (extnum<=extmax){
+				extp[extnum-1].size+=fchunk;
+			}
+		}else{
+			if (extnum<extmax){
+				extp[extnum].off=off;
+				extp[extnum].size=fchunk;
+			}
+			extnum++;
+		}
+		endoff=off+(OFF_T)fchunk;
+		/* next block */
+		fblk=(pp->fat[fblk][1]<<8)+pp->fat[fblk][0];
+	}
+
+	return (int)extnum;
+}
+
+
+
 int
 akai_write_file(int inpfd,u_char *inpbuf,struct file_s *fp,u_int begin,u_int end)
 {
 	u_char fbuf[AKAI_HD_BLOCKSIZE];
 	u_int fblk,fchunk,fremain,skipbyte;
+	u_int fnum,nblk;
 	u_char (*fatp)[2];
 
 	if ((inpfd<0)&&(inpbuf==NULL)){
@@ -672,6 +867,30 @@ akai_write_file(int inpfd,u_char *inpbuf,struct file_s *fp,u_int begin,u_int end
 			fprintf(stderr,"invalid block in file\n");
 			return -1;
 		}
+		if ((inpbuf!=NULL)&&(skipbyte==0)&&(fchunk==fp->volp->partp->blksize)){
+			/* FAT extent: find run of contiguous full blocks */
+			for (fnum=1;fremain-fnum*fchunk>=fchunk;fnum++){
+				nblk=(fatp[fblk+fnum-1][1]<<8)+fatp[fblk+fnum-1][0];
+				if ((nblk!=fblk+fnum)
+					||(akai_check_fatblk(nblk,fp->volp->partp->bsize,fp->volp->partp->bsyssize)<0)){
+					break;
+				}
+			}
+			/* write blocks directly from buffer */
+			if (akai_io_blks(fp->volp->partp,inpbuf,
+							 fblk,
+							 fnum,
+							 0,IO_BLKS_WRITE)<0){ /* 0: don't alloc cache */
+				return -1;
+			}
+			inpbuf+=fnum*fchunk;
+			/* next block after extent */
+			fblk+=fnum-1;
+			fblk=(fatp[fblk][1]<<8)+fatp[fblk][0];
+			/* extent done */
+			fremain-=fnum*fchunk;
+			continue;
+		}
 		if (skipbyte<fchunk){
 			if ((skipbyte>0)||(fchunk<fp->volp->partp->blksize)){ /* need to read? */
 				/* read block */
@@ -766,24 +985,61 @@ print_ddfatchain(struct part_s *pp,u_int cstart)
 
 
 
-u_int
-akai_count_ddfatchain(struct part_s *pp,u_int cstart)
+/* Note: must be called after any change of DD FAT */
+void
+akai_ddchain_invalidate(struct part_s *pp)
 {
+	u_int cl;
+
+	if ((pp==NULL)||(pp->ddchain==NULL)){
+		return;
+	}
+
+	for (cl=0;cl<AKAI_DDFAT_ENTRIES;cl++){
+		if (pp->ddchain[cl]!=NULL){
+			free(pp->ddchain[cl]);
+		}
+	}
+	free(pp->ddchain);
+	pp->ddchain=NULL;
+}
+
+/* returns resolved cluster chain starting at cstart, NULL if error */
+/* Note: cached until DD FAT changes, see akai_ddchain_invalidate() */
+struct akai_ddchain_s *
+akai_get_ddchain(struct part_s *pp,u_int cstart)
+{
+	struct akai_ddchain_s *chp;
 	u_int cc;
 	u_int i;
 	u_int cl,nextcl;
+	int endok;
 
 	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)){
-		return 0;
+		return NULL;
 	}
 	if (pp->type!=PART_TYPE_DD){
-		return 0;
+		return NULL;
 	}
-	if (cstart>=pp->csize){
-		return 0;
+	if ((cstart>=pp->csize)||(cstart>=AKAI_DDFAT_ENTRIES)){
+		return NULL;
 	}
 
+	if (pp->ddchain==NULL){
+		/* allocate cache */
+		pp->ddchain=(struct akai_ddchain_s **)calloc(AKAI_DDFAT_ENTRIES,sizeof(struct akai_ddchain_s *));
+		if (pp->ddchain==NULL){
+			perror("calloc");
+			return NULL;
+		}
+	}
+	if (pp->ddchain[cstart]!=NULL){ /* cached? */
+		return pp->ddchain[cstart];
+	}
+
+	/* count clusters */
 	cc=0;
+	endok=0;
 	cl=cstart;
 	for (i=0;i<pp->csize;i++){ /* XXX to avoid loop */
 		/* check cl */
@@ -798,12 +1054,43 @@ akai_count_ddfatchain(struct part_s *pp,u_int cstart)
 		cc++; /* +1 cluster */
 		/* advance */
 		if (nextcl==AKAI_DDFAT_CODE_END){
+			endok=1;
 			break; /* end of chain, done */
 		}
 		cl=nextcl;
 	}
 
-	return cc;
+	/* resolve chain */
+	chp=(struct akai_ddchain_s *)malloc(sizeof(struct akai_ddchain_s)+cc*sizeof(u_short));
+	if (chp==NULL){
+		perror("malloc");
+		return NULL;
+	}
+	chp->cnum=cc;
+	chp->endok=endok;
+	cl=cstart;
+	for (i=0;i<cc;i++){
+		chp->cl[i]=(u_short)cl;
+		cl=(pp->fat[cl][1]<<8)+pp->fat[cl][0];
+	}
+
+	pp->ddchain[cstart]=chp;
+	return chp;
+}
+
+
+
+u_int
+akai_count_ddfatchain(struct part_s *pp,u_int cstart)
+{
+	struct akai_ddchain_s *chp;
+
+	chp=akai_get_ddchain(pp,cstart);
+	if (chp==NULL){
+		return 0;
+	}
+
+	return chp->cnum;
 }
 
 
@@ -826,6 +1113,9 @@ akai_free_ddfatchain(struct part_s *pp,u_int cstart,int writeflag)
 
 	ret=0; /* OK so far */
 
+	/* DD FAT will change */
+	akai_ddchain_invalidate(pp);
+
 	/* free DD FAT chain */
 	cl=cstart;
 	cc=0; /* cluster counter */
@@ -903,6 +1193,9 @@ akai_allocate_ddfatchain(struct part_s *pp,u_int csize,u_int *cstartp,u_int ccon
 		return 0; /* done */
 	}
 
+	/* DD FAT will change */
+	akai_ddchain_invalidate(pp);
+
 	/* scan FAT */
 	ret=0; /* no error so far */
 	cc=0; /* cluster counter */
@@ -987,13 +1280,82 @@ akai_allocate_ddfatchain_done:
 
 
 
+/* resolve bytes of DD cluster chain into extents on disk, returns number of extents, -1 if error */
+/* Note: extents beyond extmax are counted but not stored, extp may be NULL */
+/* Note: like akai_export_ddfatchain(), range is truncated at end of chain */
+int
+akai_ddfatchain_extents(struct part_s *pp,u_int cstart,u_int bstart,u_int bsize,struct io_ext_s *extp,u_int extmax)
+{
+	struct akai_ddchain_s *chp;
+	u_int bufsiz;
+	u_int i,i0,i1;
+	u_int ei;
+	u_int extnum;
+	u_int chunkoff,chunksiz;
+
+	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)){
+		return -1;
+	}
+	if (pp->type!=PART_TYPE_DD){
+		return -1;
+	}
+	if (cstart>=pp->csize){
+		return -1;
+	}
+
+	if (bsize==0){
+		return 0;
+	}
+
+	bufsiz=AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE; /* 1 cluster in bytes */
+
+	i0=bstart/bufsiz; /* first cluster */
+	i1=(bstart+bsize-1)/bufsiz; /* last cluster */
+	if (i1>=pp->csize){
+		return -1;
+	}
+
+	/* resolved cluster chain */
+	if ((chp=akai_get_ddchain(pp,cstart))==NULL){
+		return -1;
+	}
+	if (i1>=chp->cnum){ /* beyond chain? */
+		if (!chp->endok){ /* invalid cluster in chain? */
+			return -1;
+		}
+		/* end of chain, up to end */
+		if (i0>=chp->cnum){
+			return 0; /* nothing */
+		}
+		i1=chp->cnum-1;
+		bsize=(i1+1)*bufsiz-bstart;
+	}
+
+	extnum=0;
+	for (ei=i0;ei<=i1;ei=i+1){
+		/* find end of extent of contiguous clusters */
+		for (i=ei;(i<i1)&&(chp->cl[i+1]==chp->cl[i]+1);i++);
+		if ((extp!=NULL)&&(extnum<extmax)){
+			chunkoff=(ei==i0)?(bstart-i0*bufsiz):0;
+			chunksiz=((i==i1)?(bstart+bsize-ei*bufsiz):((i+1-ei)*bufsiz))-chunkoff;
+			extp[extnum].off=((OFF_T)(pp->bstart+chp->cl[ei]*AKAI_DDPART_CBLKS))*((OFF_T)pp->blksize)+(OFF_T)chunkoff;
+			extp[extnum].size=chunksiz;
+		}
+		extnum++;
+	}
+
+	return (int)extnum;
+}
+
+
+
 int
 akai_export_ddfatchain(struct part_s *pp,u_int cstart,u_int bstart,u_int bsize,int outfd,u_char *outbuf)
 {
 	static u_char buf[AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE];
+	struct akai_ddchain_s *chp;
 	u_int bufsiz;
 	u_int i,i0,i1;
-	u_int cl,nextcl;
 	u_int chunkoff,chunksiz;
 
 	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)){
@@ -1021,61 +1383,76 @@ akai_export_ddfatchain(struct part_s *pp,u_int cstart,u_int bstart,u_int bsize,i
 		return -1;
 	}
 
-	cl=cstart;
-	for (i=0;i<=i1;i++){
-		/* check cl */
-		if ((cl==AKAI_DDFAT_CODE_FREE)
-			||(cl==AKAI_DDFAT_CODE_SYS)
-			||(cl==AKAI_DDFAT_CODE_END)
-			||(cl>=pp->csize)){ /* invalid? */
+	/* resolved cluster chain */
+	if ((chp=akai_get_ddchain(pp,cstart))==NULL){
+		return -1;
+	}
+	if (i1>=chp->cnum){ /* beyond chain? */
+		if (!chp->endok){ /* invalid cluster in chain? */
 			return -1;
 		}
-		/* next cluster */
-		nextcl=(pp->fat[cl][1]<<8)+pp->fat[cl][0];
+		/* end of chain, export up to end */
+		if (i0>=chp->cnum){
+			return 0; /* nothing */
+		}
+		i1=chp->cnum-1;
+		bsize=(i1+1)*bufsiz-bstart;
+	}
 
-		if (i>=i0){ /* far enough? */
-			/* read cluster */
-			if (akai_io_blks(pp,buf,
-							 cl*AKAI_DDPART_CBLKS, /* block offset */
-							 AKAI_DDPART_CBLKS, /* 1 cluster */
-							 1,IO_BLKS_READ)<0){  /* 1: alloc cache if possible */
-				return -1;
-			}
+	if (outbuf==NULL){
+		/* to file: copy each extent of contiguous clusters */
+		/* directly from disk (zero-copy if possible) */
+		struct io_ext_s *extp;
+		int extnum,ei;
+		int ret;
 
-			if (i==i0){ /* first cluster? */
-				chunkoff=bstart-i0*bufsiz;
-				chunksiz=bufsiz-chunkoff;
-				/* Note: chunkoff and chunksiz <= bufsiz by definition of i0 */
-				if (chunksiz>bsize){
-					chunksiz=bsize;
-				}
-			}else if (i==i1){ /* last cluster? */
-				chunkoff=0;
-				chunksiz=bstart+bsize-i1*bufsiz;
-				/* Note: chunksiz <= bufsiz by definition of i1 */
-			}else{
-				chunkoff=0;
-				chunksiz=bufsiz; /* 1 cluster */
-			}
+		extnum=akai_ddfatchain_extents(pp,cstart,bstart,bsize,NULL,0);
+		if (extnum<=0){
+			return extnum;
+		}
+		if ((extp=(struct io_ext_s *)malloc(extnum*sizeof(struct io_ext_s)))==NULL){
+			perror("malloc");
+			return -1;
+		}
+		akai_ddfatchain_extents(pp,cstart,bstart,bsize,extp,(u_int)extnum);
+		/* make sure that disk contains current data */
+		ret=flush_blk_cache();
+		for (ei=0;(ret==0)&&(ei<extnum);ei++){
+			ret=io_copy_range(pp->fd,extp[ei].off,extp[ei].size,outfd);
+		}
+		free(extp);
 
-			if (outbuf!=NULL){
-				/* to buffer */
-				bcopy(buf+chunkoff,outbuf,chunksiz);
-				outbuf+=chunksiz;
-			}else{
-				/* write to file */
-				if (WRITE(outfd,buf+chunkoff,chunksiz)!=(int)chunksiz){
-					perror("write");
-					return -1;
-				}
-			}
+		return (ret<0)?-1:0;
+	}
+
+	for (i=i0;i<=i1;i++){
+		/* read cluster */
+		if (akai_io_blks(pp,buf,
+						 chp->cl[i]*AKAI_DDPART_CBLKS, /* block offset */
+						 AKAI_DDPART_CBLKS, /* 1 cluster */
+						 1,IO_BLKS_READ)<0){  /* 1: alloc cache if possible */
+			return -1;
 		}
 
-		/* advance */
-		if (nextcl==AKAI_DDFAT_CODE_END){
-			break; /* end of chain, done */
+		if (i==i0){ /* first cluster? */
+			chunkoff=bstart-i0*bufsiz;
+			chunksiz=bufsiz-chunkoff;
+			/* Note: chunkoff and chunksiz <= bufsiz by definition of i0 */
+			if (chunksiz>bsize){
+				chunksiz=bsize;
+			}
+		}else if (i==i1){ /* last cluster? */
+			chunkoff=0;
+			chunksiz=bstart+bsize-i1*bufsiz;
+			/* Note: chunksiz <= bufsiz by definition of i1 */
+		}else{
+			chunkoff=0;
+			chunksiz=bufsiz; /* 1 cluster */
 		}
-		cl=nextcl;
+
+		/* to buffer */
+		bcopy(buf+chunkoff,outbuf,chunksiz);
+		outbuf+=chunksiz;
 	}
 
 	return 0;
@@ -1087,9 +1464,9 @@ int
 akai_import_ddfatchain(struct part_s *pp,u_int cstart,u_int bstart,u_int bsize,int inpfd,u_char *inpbuf)
 {
 	static u_char buf[AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE];
+	struct akai_ddchain_s *chp;
 	u_int bufsiz;
 	u_int i,i0,i1;
-	u_int cl,nextcl;
 	u_int chunkoff,chunksiz;
 	int readflag;
 
@@ -1118,74 +1495,71 @@ akai_import_ddfatchain(struct part_s *pp,u_int cstart,u_int bstart,u_int bsize,i
 		return -1;
 	}
 
-	cl=cstart;
-	for (i=0;i<=i1;i++){
-		/* check cl */
-		if ((cl==AKAI_DDFAT_CODE_FREE)
-			||(cl==AKAI_DDFAT_CODE_SYS)
-			||(cl==AKAI_DDFAT_CODE_END)
-			||(cl>=pp->csize)){ /* invalid? */
+	/* resolved cluster chain */
+	if ((chp=akai_get_ddchain(pp,cstart))==NULL){
+		return -1;
+	}
+	if (i1>=chp->cnum){ /* beyond chain? */
+		if (!chp->endok){ /* invalid cluster in chain? */
 			return -1;
 		}
-		/* next cluster */
-		nextcl=(pp->fat[cl][1]<<8)+pp->fat[cl][0];
-
-		if (i>=i0){ /* far enough? */
-			if (i==i0){ /* first cluster? */
-				chunkoff=bstart-i0*bufsiz;
-				chunksiz=bufsiz-chunkoff;
-				/* Note: chunkoff and chunksiz <= bufsiz by definition of i0 */
-				if (chunksiz>bsize){
-					chunksiz=bsize;
-				}
-				readflag=1;
-			}else if (i==i1){ /* last cluster? */
-				chunkoff=0;
-				chunksiz=bstart+bsize-i1*bufsiz;
-				/* Note: chunksiz <= bufsiz by definition of i1 */
-				readflag=1;
-			}else{
-				chunkoff=0;
-				chunksiz=bufsiz; /* 1 cluster */
-				readflag=0;
-			}
-
-			if (readflag){
-				/* read cluster */
-				if (akai_io_blks(pp,buf,
-								 cl*AKAI_DDPART_CBLKS, /* block offset */
-								 AKAI_DDPART_CBLKS, /* 1 cluster */
-								 1,IO_BLKS_READ)<0){  /* 1: alloc cache if possible */
-					return -1;
-				}
-			}
+		/* end of chain, import up to end */
+		if (i0>=chp->cnum){
+			return 0; /* nothing */
+		}
+		i1=chp->cnum-1;
+		bsize=(i1+1)*bufsiz-bstart;
+	}
 
-			if (inpbuf!=NULL){
-				/* from buffer */
-				bcopy(inpbuf,buf+chunkoff,chunksiz);
-				inpbuf+=chunksiz;
-			}else{
-				/* read from file */
-				if (READ(inpfd,buf+chunkoff,chunksiz)!=(int)chunksiz){
-					perror("write");
-					return -1;
-				}
+	for (i=i0;i<=i1;i++){
+		if (i==i0){ /* first cluster? */
+			chunkoff=bstart-i0*bufsiz;
+			chunksiz=bufsiz-chunkoff;
+			/* Note: chunkoff and chunksiz <= bufsiz by definition of i0 */
+			if (chunksiz>bsize){
+				chunksiz=bsize;
 			}
+			readflag=1;
+		}else if (i==i1){ /* last cluster? */
+			chunkoff=0;
+			chunksiz=bstart+bsize-i1*bufsiz;
+			/* Note: chunksiz <= bufsiz by definition of i1 */
+			readflag=1;
+		}else{
+			chunkoff=0;
+			chunksiz=bufsiz; /* 1 cluster */
+			readflag=0;
+		}
 
-			/* write cluster */
+		if (readflag){
+			/* read cluster */
 			if (akai_io_blks(pp,buf,
-							 cl*AKAI_DDPART_CBLKS, /* block offset */
+							 chp->cl[i]*AKAI_DDPART_CBLKS, /* block offset */
 							 AKAI_DDPART_CBLKS, /* 1 cluster */
-							 1,IO_BLKS_WRITE)<0){  /* 1: alloc cache if possible */
+							 1,IO_BLKS_READ)<0){  /* 1: alloc cache if possible */
 				return -1;
 			}
 		}
 
-		/* advance */
-		if (nextcl==AKAI_DDFAT_CODE_END){
-			break; /* end of chain, done */
+		if (inpbuf!=NULL){
+			/* from buffer */
+			bcopy(inpbuf,buf+chunkoff,chunksiz);
+			inpbuf+=chunksiz;
+		}else{
+			/* read from file */
+			if (READ(inpfd,buf+chunkoff,chunksiz)!=(int)chunksiz){
+				perror("write");
+				return -1;
+			}
+		}
+
+		/* write cluster */
+		if (akai_io_blks(pp,buf,
+						 chp->cl[i]*AKAI_DDPART_CBLKS, /* block offset */
+						 AKAI_DDPART_CBLKS, /* 1 cluster */
+						 1,IO_BLKS_WRITE)<0){  /* 1: alloc cache if possible */
+			return -1;
 		}
-		cl=nextcl;
 	}
 
 	return 0;
@@ -1193,6 +1567,7 @@ akai_import_ddfatchain(struct part_s *pp,u_int cstart,u_int bstart,u_int bsize,i
 
 
 
+
 /* convert char for S1000/S3000 */
 char
 akai2ascii(u_char c)
@@ -1809,6 +2184,48 @@ akai_write_voldir(struct vol_s *vp,u_int fi)
 
 
 
+/* write whole volume directory */
+int
+akai_write_voldir_all(struct vol_s *vp)
+{
+	u_int i,imax;
+	u_int blk;
+	u_char *addr;
+
+	if ((vp==NULL)||(vp->type==AKAI_VOL_TYPE_INACT)||(vp->file==NULL)){
+		return -1;
+	}
+	if ((vp->partp==NULL)||(!vp->partp->valid)||(vp->partp->fd<0)||(vp->partp->blksize==0)){
+		return -1;
+	}
+
+	/* number of blocks */
+	imax=vp->fimax*sizeof(struct akai_voldir_entry_s);
+	imax=(imax+vp->partp->blksize-1)/vp->partp->blksize; /* round up */
+	if (imax>VOL_DIRBLKS){
+		return -1;
+	}
+
+	/* Note: first file starts at byte 0 in first block */
+	addr=(u_char *)vp->file;
+	for (i=0;i<imax;i++){
+		blk=vp->dirblk[i];
+		/* write volume directory block */
+		if (akai_io_blks(vp->partp,addr,
+						 blk,
+						 1,
+						 1,IO_BLKS_WRITE)<0){ /* 1: allocate cache if possible */
+			return -1;
+		}
+
+		addr+=vp->partp->blksize; /* next */
+	}
+
+	return 0;
+}
+
+
+
 /* Note: see comment in akaiutil.h for struct vol_s about copying vol_s!!! */
 void
 akai_copy_structvol(struct vol_s *srcvp,struct vol_s *dstvp)
@@ -4145,6 +4562,15 @@ akai_rename_file(struct file_s *fp,char *name,struct vol_s *vp,u_int dstindex,u_
 /* size in bytes */
 int
 akai_create_file(struct vol_s *vp,struct file_s *fp,u_int size,u_int index,char *name,u_int osver,u_char *tagp)
+{
+
+	return akai_create_file_chain(vp,fp,size,index,name,osver,tagp,AKAI_CREATE_FILE_NOCHAIN,1); /* 1: write volume directory */
+}
+
+/* as akai_create_file(), but with FAT chain starting at bstart if preallocated */
+/* Note: if dirflag==0, volume directory is not written (caller must use akai_write_voldir_all() later) */
+int
+akai_create_file_chain(struct vol_s *vp,struct file_s *fp,u_int size,u_int index,char *name,u_int osver,u_char *tagp,u_int bstart,int dirflag)
 {
 	u_char ft;
 	u_int bsize;
@@ -4251,13 +4677,18 @@ akai_create_file(struct vol_s *vp,struct file_s *fp,u_int size,u_int index,char
 		}
 	}
 
-	/* allocate space */
-	bsize=(fp->size+fp->volp->partp->blksize-1)/fp->volp->partp->blksize; /* round up */
-	if (akai_allocate_fatchain(vp->partp,bsize,
-							   &fp->bstart,
-							   1,
-							   (vp->type==AKAI_VOL_TYPE_S900)?AKAI_FAT_CODE_FILEEND900:AKAI_FAT_CODE_FILEEND)<0){ /* end code */
-		return -1;
+	if (bstart==AKAI_CREATE_FILE_NOCHAIN){
+		/* allocate space */
+		bsize=(fp->size+fp->volp->partp->blksize-1)/fp->volp->partp->blksize; /* round up */
+		if (akai_allocate_fatchain(vp->partp,bsize,
+								   &fp->bstart,
+								   1,
+								   (vp->type==AKAI_VOL_TYPE_S900)?AKAI_FAT_CODE_FILEEND900:AKAI_FAT_CODE_FILEEND)<0){ /* end code */
+			return -1;
+		}
+	}else{
+		/* preallocated FAT chain */
+		fp->bstart=bstart;
 	}
 
 	/* create volume directory entry */
@@ -4290,7 +4721,7 @@ akai_create_file(struct vol_s *vp,struct file_s *fp,u_int size,u_int index,char
 	vp->file[fi].osver[0]=0xff&fp->osver;
 
 	/* write volume directory */
-	if (akai_write_voldir(vp,fi)<0){
+	if (dirflag&&(akai_write_voldir(vp,fi)<0)){
 		return -1;
 	}
 
@@ -4926,6 +5357,8 @@ akai_scan_ddpart(struct disk_s *dp,struct akai_parttab_s *ptp,u_int bstart,u_int
 
 		/* start of FAT */
 		part[part_num].fat=&part[part_num].head.dd.fatcl[0];
+		/* discard old resolved cluster chains */
+		akai_ddchain_invalidate(&part[part_num]);
 
 		/* count free blocks, even if not valid */
 		akai_countfree_part(&part[part_num]);
@@ -5213,6 +5646,7 @@ akai_wipe_part(struct part_s *pp,int wipeflag,struct part_s *plistp,u_int pimax,
 
 			/* update partition header in memory */
 			bcopy(hp,&pp->head.dd,sizeof(struct akai_ddparthead_s));
+			akai_ddchain_invalidate(pp);
 
 			/* write cluster 0 */
 			if (akai_io_blks(pp,buf,
@@ -93,6 +93,10 @@ SOURCE=.\akaiutil_file.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\akaiutil_hash.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\akaiutil_io.c
 # End Source File
 # Begin Source File
@@ -101,6 +105,10 @@ SOURCE=.\akaiutil_main.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\akaiutil_par.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\akaiutil_take.c
 # End Source File
 # Begin Source File
@@ -129,10 +137,18 @@ SOURCE=.\akaiutil_file.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\akaiutil_hash.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\akaiutil_io.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\akaiutil_par.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\akaiutil_take.h
 # End Source File
 # Begin Source File
@@ -405,6 +405,13 @@ struct disk_s{
 	u_int totsize; /* total size in blocks */
 };
 
+/* resolved DD cluster chain */
+struct akai_ddchain_s{
+	u_int cnum; /* number of valid clusters in chain */
+	int endok; /* chain properly terminated */
+	u_short cl[1]; /* clusters, Note: allocated for cnum entries */
+};
+
 /* partition */
 struct part_s{
 	struct disk_s *diskp; /* pointer to disk */
@@ -424,6 +431,7 @@ struct part_s{
 	u_int bsyssize; /* if not DD partition: reserved blocks for system (partition header or floppy header) */
 	u_int bfree; /* free blocks */
 	u_char (*fat)[2]; /* start of FAT */
+	struct akai_ddchain_s **ddchain; /* if DD partition: cache of resolved cluster chains indexed by start cluster, NULL if none */
 	union akai_head_u head; /* whole header */
 	u_int volnummax; /* if not DD partition: max. number of volumes */
 	char letter; /* letter (ASCII) */
@@ -516,15 +524,22 @@ extern int akai_check_fatblk(u_int blk,u_int bsize,u_int bsyssize);
 extern int print_fatchain(struct part_s *pp,u_int blk);
 extern int akai_free_fatchain(struct part_s *pp,u_int bstart,int writeflag);
 extern int akai_allocate_fatchain(struct part_s *pp,u_int bsize,u_int *bstartp,u_int bcont0,u_int endcode);
+extern int akai_allocate_fatchains(struct part_s *pp,u_int num,u_int *bsizep,u_int *bstartp,u_int endcode);
+extern int akai_write_fat(struct part_s *pp);
 
+#define AKAI_READFILE_EXTBLKS	8 /* max. number of blocks per write to file */
 extern int akai_read_file(int outfd,u_char *outbuf,struct file_s *fp,u_int begin,u_int end);
+extern int akai_file_extents(struct file_s *fp,struct io_ext_s *extp,u_int extmax);
 extern int akai_write_file(int inpfd,u_char *inpbuf,struct file_s *fp,u_int begin,u_int end);
 
 extern int print_ddfatchain(struct part_s *pp,u_int cstart);
+extern void akai_ddchain_invalidate(struct part_s *pp);
+extern struct akai_ddchain_s *akai_get_ddchain(struct part_s *pp,u_int cstart);
 extern u_int akai_count_ddfatchain(struct part_s *pp,u_int cstart);
 extern int akai_free_ddfatchain(struct part_s *pp,u_int cstart,int writeflag);
 extern int akai_allocate_ddfatchain(struct part_s *pp,u_int csize,u_int *cstartp,u_int ccont0);
 
+extern int akai_ddfatchain_extents(struct part_s *pp,u_int cstart,u_int bstart,u_int bsize,struct io_ext_s *extp,u_int extmax);
 extern int akai_export_ddfatchain(struct part_s *pp,u_int cstart,u_int bstart,u_int bsize,int outfd,u_char *outbuf);
 extern int akai_import_ddfatchain(struct part_s *pp,u_int cstart,u_int bstart,u_int bsize,int inpfd,u_char *inpbuf);
 
@@ -541,6 +556,7 @@ extern void akai_vol_info(struct vol_s *vp,u_int ai,int verbose);
 extern void akai_list_vol(struct vol_s *vp,u_char *filtertagp);
 extern int akai_read_voldir(struct vol_s *vp);
 extern int akai_write_voldir(struct vol_s *vp,u_int fi);
+extern int akai_write_voldir_all(struct vol_s *vp);
 extern void akai_copy_structvol(struct vol_s *srcvp,struct vol_s *dstvp);
 extern int akai_get_vol(struct part_s *pp,struct vol_s *vp,u_int vi);
 extern int akai_find_vol(struct part_s *pp,struct vol_s *vp,char *name);
@@ -579,6 +595,8 @@ extern int akai_find_file(struct vol_s *vp,struct file_s *fp,char *name);
 extern int akai_rename_file(struct file_s *fp,char *name,struct vol_s *vp,u_int dstindex,u_char *tagp,u_int osver);
 #define AKAI_CREATE_FILE_NOINDEX	((u_int)-1) /* no user-supplied index */
 extern int akai_create_file(struct vol_s *vp,struct file_s *fp,u_int size,u_int index,char *name,u_int osver,u_char *tagp);
+#define AKAI_CREATE_FILE_NOCHAIN	((u_int)-1) /* no preallocated FAT chain */
+extern int akai_create_file_chain(struct vol_s *vp,struct file_s *fp,u_int size,u_int index,char *name,u_int osver,u_char *tagp,u_int bstart,int dirflag);
 extern void akai_fvol1000_initfile(struct akai_voldir_entry_s *ep,u_int osver,u_int tag);
 extern int akai_delete_file(struct file_s *fp);
 
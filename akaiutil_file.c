@@ -27,6 +27,11 @@
 
 
 
+/* S900 compressed sample encoder mode */
+int sample900compr_mode=SAMPLE900COMPR_MODE_GROUP;
+
+
+
 /* AKAI file info */
 int
 akai_file_info(struct file_s *fp,int verbose)
@@ -1033,7 +1038,7 @@ akai_sample900compr_setbits(u_char *buf,u_int bitpos,u_int bitnum,u_int val)
 }
 
 int
-akai_sample900compr_wav2sample(u_char *sbuf,u_char *wavbuf,u_int samplecountpart)
+akai_sample900compr_wav2sample_group(u_char *sbuf,u_char *wavbuf,u_int samplecountpart)
 {
 	/* must be static for multiple calls, must be initialized */
 	static u_char *upbitnumbuf=NULL;
@@ -1056,7 +1061,7 @@ akai_sample900compr_wav2sample(u_char *sbuf,u_char *wavbuf,u_int samplecountpart
 	if ((sbuf==NULL)&&(wavbuf==NULL)){
 		ret=0; /* no error */
 		/* free buffers if still allocated */
-		goto akai_sample900compr_wav2sample_freebufexit;
+		goto akai_sample900compr_wav2sample_group_freebufexit;
 	}
 
 	ret=-1; /* no success so far */
@@ -1088,17 +1093,17 @@ akai_sample900compr_wav2sample(u_char *sbuf,u_char *wavbuf,u_int samplecountpart
 		upbitnumbuf=(u_char *)malloc(groupcount*sizeof(u_char));
 		if (upbitnumbuf==NULL){
 			perror("cannot allocate upbitnumbuf");
-			goto akai_sample900compr_wav2sample_freebufexit;
+			goto akai_sample900compr_wav2sample_group_freebufexit;
 		}
 		upsignbuf=(u_int *)malloc(groupcount*sizeof(u_int));
 		if (upsignbuf==NULL){
 			perror("cannot allocate upsignbuf");
-			goto akai_sample900compr_wav2sample_freebufexit;
+			goto akai_sample900compr_wav2sample_group_freebufexit;
 		}
 		upabsvalbuf=(u_short *)malloc(groupcount*SAMPLE900COMPR_GROUP_SAMPNUM*sizeof(u_short));
 		if (upabsvalbuf==NULL){
 			perror("cannot allocate upabsvalbuf");
-			goto akai_sample900compr_wav2sample_freebufexit;
+			goto akai_sample900compr_wav2sample_group_freebufexit;
 		}
 
 		/* gather groups */
@@ -1159,7 +1164,7 @@ akai_sample900compr_wav2sample(u_char *sbuf,u_char *wavbuf,u_int samplecountpart
 				if ((SAMPLE900COMPR_BITMASK&(curval-sval))!=0){
 					/* XXX should not happen */
 					fprintf(stderr,"%06x,%02x: error: sval=%i curval=%i\n",g,i,sval,curval);
-					goto akai_sample900compr_wav2sample_freebufexit;
+					goto akai_sample900compr_wav2sample_group_freebufexit;
 				}
 			}
 #ifdef SAMPLE900COMPR_DEBUG
@@ -1182,18 +1187,18 @@ akai_sample900compr_wav2sample(u_char *sbuf,u_char *wavbuf,u_int samplecountpart
 
 		ret=(int)(bitpos>>3); /* success, return number of required bytes in sbuf for second pass */
 		/* keep buffers for second pass */
-		goto akai_sample900compr_wav2sample_keepbufexit;
+		goto akai_sample900compr_wav2sample_group_keepbufexit;
 	}else{
 		/* second pass */
 
 		if (wavbuf==NULL){
-			goto akai_sample900compr_wav2sample_freebufexit;
+			goto akai_sample900compr_wav2sample_group_freebufexit;
 		}
 
 		/* check allocation of buffers */
 		if ((upbitnumbuf==NULL)||(upsignbuf==NULL)||(upabsvalbuf==NULL)){
 			fprintf(stderr,"error: buffers not allocated in second pass\n");
-			goto akai_sample900compr_wav2sample_freebufexit;
+			goto akai_sample900compr_wav2sample_group_freebufexit;
 		}
 
 		/* XXX ignore samplecountpart in second pass */
@@ -1245,10 +1250,10 @@ akai_sample900compr_wav2sample(u_char *sbuf,u_char *wavbuf,u_int samplecountpart
 
 		ret=(int)(bitpos>>3); /* success, return number of used bytes in sbuf */
 		/* free buffers */
-		goto akai_sample900compr_wav2sample_freebufexit;
+		goto akai_sample900compr_wav2sample_group_freebufexit;
 	}
 
-akai_sample900compr_wav2sample_freebufexit:
+akai_sample900compr_wav2sample_group_freebufexit:
 	if (upbitnumbuf!=NULL){
 		free(upbitnumbuf);
 		upbitnumbuf=NULL;
@@ -1262,10 +1267,292 @@ akai_sample900compr_wav2sample_freebufexit:
 		upabsvalbuf=NULL;
 	}
 
-akai_sample900compr_wav2sample_keepbufexit:
+akai_sample900compr_wav2sample_group_keepbufexit:
+	return ret;
+}
+
+int
+akai_sample900compr_wav2sample_opt(u_char *sbuf,u_char *wavbuf,u_int samplecountpart)
+{
+	/* must be static for multiple calls, must be initialized */
+	static short *upvalbuf=NULL;
+	static u_char *movebuf=NULL;
+
+	u_int *costbuf;
+	u_int scount;
+	u_int scountpad;
+	int sval;
+	int prevval;
+	int curinc;
+	int previnc;
+	int upval;
+	u_short upabsval;
+	u_short upabsmax;
+	u_char upbitnum;
+	u_int upsign;
+	u_int bitpos;
+	u_int bitnum;
+	u_char code;
+	u_int s,i,j,p,q;
+	int ret;
+
+	if ((sbuf==NULL)&&(wavbuf==NULL)){
+		ret=0; /* no error */
+		/* free buffers if still allocated */
+		goto akai_sample900compr_wav2sample_opt_freebufexit;
+	}
+
+	ret=-1; /* no success so far */
+
+	/* convert 16bit WAV sample format into S900 compressed sample format */
+	/* Note: same code alphabet as akai_sample900compr_wav2sample_group(), but minimize total number of bits */
+	/*       by a shortest path search over all sample positions: at every position, the encoder may either */
+	/*       emit a full group (code 0x0 or 0x4..0xf) or a short group (code 0x1..0x3) which repeats curinc */
+	/* Note: for an exact encoding, curinc before sample s is always equal to the previous sample increment, */
+	/*       i.e. the encoder state only depends on the sample position */
+
+	if (sbuf==NULL){
+		/* first pass */
+
+		/* free buffers if still allocated */
+		if (upvalbuf!=NULL){
+			free(upvalbuf);
+			upvalbuf=NULL;
+		}
+		if (movebuf!=NULL){
+			free(movebuf);
+			movebuf=NULL;
+		}
+
+		/* number of samples to encode */
+		/* Note: 2*samplecountpart+1 to encode at least one additional zero sample behind end */
+		scount=2*samplecountpart+1;
+		/* padded number of samples, last full group may extend behind scount */
+		scountpad=scount+SAMPLE900COMPR_GROUP_SAMPNUM-1;
+
+		/* allocate buffers */
+		upvalbuf=(short *)malloc(scountpad*sizeof(short));
+		if (upvalbuf==NULL){
+			perror("cannot allocate upvalbuf");
+			goto akai_sample900compr_wav2sample_opt_freebufexit;
+		}
+		movebuf=(u_char *)malloc((scountpad+1)*sizeof(u_char));
+		if (movebuf==NULL){
+			perror("cannot allocate movebuf");
+			goto akai_sample900compr_wav2sample_opt_freebufexit;
+		}
+		costbuf=(u_int *)malloc((scountpad+1)*sizeof(u_int));
+		if (costbuf==NULL){
+			perror("cannot allocate costbuf");
+			goto akai_sample900compr_wav2sample_opt_freebufexit;
+		}
+
+		/* determine required increment update value for each sample */
+		prevval=0;
+		previnc=0;
+		for (s=0;s<scountpad;s++){
+			if (s<2*samplecountpart){
+				/* get 12bit sample from 16bit WAV sample */
+				sval=(((int)(char)wavbuf[s*2+1])<<4)+(((int)(u_char)wavbuf[s*2+0])>>4);
+			}else{
+				/* encode zero sample behind end */
+				sval=0;
+			}
+			curinc=sval-prevval;
+			/* choose optimum interval position for min. abs. value */
+			upval=SAMPLE900COMPR_BITMASK&(curinc-previnc);
+			if (upval>SAMPLE900COMPR_INTERVALSIZ2){
+				upval-=SAMPLE900COMPR_INTERVALSIZ;
+			}
+			upvalbuf[s]=(short)upval;
+			prevval=sval;
+			previnc=curinc;
+		}
+
+		/* search path with min. number of bits */
+		/* Note: costbuf[q] is min. number of bits to encode samples 0..q-1, */
+		/*       movebuf[q] is number of samples of last group on that path */
+		costbuf[0]=0;
+		movebuf[0]=0;
+		for (q=1;q<=scountpad;q++){
+			costbuf[q]=~(u_int)0; /* not reached so far */
+			movebuf[q]=0;
+		}
+		for (p=0;p<scount;p++){
+			if (costbuf[p]==~(u_int)0){
+				continue; /* not reachable */
+			}
+			/* short groups: code 0x1..0x3, only if curinc is not updated */
+			for (i=0;(i<SAMPLE900COMPR_BITNUM_OFF-SAMPLE900COMPR_BITNUM_MAX-1)&&(upvalbuf[p+i]==0);i++){
+				q=p+i+1;
+				if (costbuf[p]+4<costbuf[q]){
+					costbuf[q]=costbuf[p]+4;
+					movebuf[q]=(u_char)(i+1);
+				}
+			}
+			/* full group */
+			upabsmax=0;
+			for (i=0;i<SAMPLE900COMPR_GROUP_SAMPNUM;i++){
+				upabsval=(u_short)((upvalbuf[p+i]<0)?-upvalbuf[p+i]:upvalbuf[p+i]);
+				if (upabsval>upabsmax){
+					upabsmax=upabsval;
+				}
+			}
+			for (upbitnum=0;(upabsmax>>upbitnum)!=0;upbitnum++);
+			bitnum=4;
+			if (upbitnum!=0){
+				bitnum+=SAMPLE900COMPR_GROUP_SAMPNUM*(1+upbitnum);
+			}
+			q=p+SAMPLE900COMPR_GROUP_SAMPNUM;
+			if (costbuf[p]+bitnum<=costbuf[q]){ /* Note: prefer full group */
+				costbuf[q]=costbuf[p]+bitnum;
+				movebuf[q]=SAMPLE900COMPR_GROUP_SAMPNUM;
+			}
+		}
+		/* best end position */
+		j=scount;
+		for (q=scount+1;q<=scountpad;q++){
+			if (costbuf[q]<costbuf[j]){
+				j=q;
+			}
+		}
+		bitpos=costbuf[j];
+		free(costbuf);
+
+		/* backtrack: movebuf[p] becomes number of samples of group starting at p, 0 at end */
+		i=movebuf[j];
+		movebuf[j]=0;
+		for (q=j;q>0;q=p){
+			p=q-i;
+			j=movebuf[p];
+			movebuf[p]=(u_char)i;
+			i=j;
+		}
+
+		bitpos+=(7&(8-(7&bitpos))); /* number of bits missing to full byte */
+
+		ret=(int)(bitpos>>3); /* success, return number of required bytes in sbuf for second pass */
+		/* keep buffers for second pass */
+		goto akai_sample900compr_wav2sample_opt_keepbufexit;
+	}else{
+		/* second pass */
+
+		if (wavbuf==NULL){
+			goto akai_sample900compr_wav2sample_opt_freebufexit;
+		}
+
+		/* check allocation of buffers */
+		if ((upvalbuf==NULL)||(movebuf==NULL)){
+			fprintf(stderr,"error: buffers not allocated in second pass\n");
+			goto akai_sample900compr_wav2sample_opt_freebufexit;
+		}
+
+		/* XXX ignore samplecountpart in second pass */
+
+		/* encode groups along path */
+		bitpos=0;
+		for (s=0;movebuf[s]!=0;s+=j){
+			j=movebuf[s];
+			if (j<SAMPLE900COMPR_GROUP_SAMPNUM){
+				/* short group */
+				code=(u_char)j;
+#ifdef SAMPLE900COMPR_DEBUG
+				printf("%08x: code=%x\n",bitpos,code);
+#endif
+				akai_sample900compr_setbits(sbuf,bitpos,4,(u_int)code);
+				bitpos+=4;
+				continue; /* next */
+			}
+			/* full group */
+			upabsmax=0;
+			upsign=0;
+			for (i=0;i<SAMPLE900COMPR_GROUP_SAMPNUM;i++){
+				upsign<<=1;
+				if (upvalbuf[s+i]<0){
+					upsign|=1;
+					upabsval=(u_short)(-upvalbuf[s+i]);
+				}else{
+					upabsval=(u_short)upvalbuf[s+i];
+				}
+				if (upabsval>upabsmax){
+					upabsmax=upabsval;
+				}
+			}
+			for (upbitnum=0;(upabsmax>>upbitnum)!=0;upbitnum++);
+			if (upbitnum==0){
+				code=0x0;
+			}else{
+				code=SAMPLE900COMPR_BITNUM_OFF-upbitnum;
+			}
+#ifdef SAMPLE900COMPR_DEBUG
+			printf("%08x: code=%x\n",bitpos,code);
+#endif
+			/* save code nibble */
+			akai_sample900compr_setbits(sbuf,bitpos,4,(u_int)code);
+			bitpos+=4;
+			if (upbitnum==0){
+				continue; /* no further bits to save for this group */
+			}
+			/* save upsign */
+			akai_sample900compr_setbits(sbuf,bitpos,SAMPLE900COMPR_GROUP_SAMPNUM,upsign);
+			bitpos+=SAMPLE900COMPR_GROUP_SAMPNUM;
+			/* save upabsval */
+			for (i=0;i<SAMPLE900COMPR_GROUP_SAMPNUM;i++){
+				upabsval=(u_short)((upvalbuf[s+i]<0)?-upvalbuf[s+i]:upvalbuf[s+i]);
+				akai_sample900compr_setbits(sbuf,bitpos,(u_int)upbitnum,(u_int)upabsval);
+				bitpos+=(u_int)upbitnum;
+			}
+		}
+		j=(7&(8-(7&bitpos))); /* number of bits missing to full byte */
+		if (j!=0){
+			/* zero padding to full byte */
+			akai_sample900compr_setbits(sbuf,bitpos,j,0);
+			bitpos+=j;
+		}
+
+		ret=(int)(bitpos>>3); /* success, return number of used bytes in sbuf */
+		/* free buffers */
+		goto akai_sample900compr_wav2sample_opt_freebufexit;
+	}
+
+akai_sample900compr_wav2sample_opt_freebufexit:
+	if (upvalbuf!=NULL){
+		free(upvalbuf);
+		upvalbuf=NULL;
+	}
+	if (movebuf!=NULL){
+		free(movebuf);
+		movebuf=NULL;
+	}
+
+akai_sample900compr_wav2sample_opt_keepbufexit:
 	return ret;
 }
 
+int
+akai_sample900compr_wav2sample(u_char *sbuf,u_char *wavbuf,u_int samplecountpart)
+{
+	/* must be static for multiple calls */
+	static int mode=SAMPLE900COMPR_MODE_GROUP; /* mode of first pass */
+
+	if ((sbuf==NULL)&&(wavbuf==NULL)){
+		/* free buffers of both encoders if still allocated */
+		akai_sample900compr_wav2sample_group(NULL,NULL,0);
+		akai_sample900compr_wav2sample_opt(NULL,NULL,0);
+		return 0;
+	}
+
+	if (sbuf==NULL){
+		/* first pass: latch current mode for second pass */
+		mode=sample900compr_mode;
+	}
+
+	if (mode==SAMPLE900COMPR_MODE_OPT){
+		return akai_sample900compr_wav2sample_opt(sbuf,wavbuf,samplecountpart);
+	}
+	return akai_sample900compr_wav2sample_group(sbuf,wavbuf,samplecountpart);
+}
+
 
 
 int
@@ -1556,6 +1843,19 @@ akai_sample900_noncompr2compr(struct file_s *fp,struct vol_s *volp)
 	}
 	/* S900 compressed sample size in bytes */
 	samplesizecompr=(u_int)r;
+	if (samplesizenoncompr>0){
+		printf("compressed size: %u bytes (%.1f%% of non-compressed)\n",
+			samplesizecompr,100.0*(double)samplesizecompr/(double)samplesizenoncompr);
+	}
+	if (sample900compr_mode==SAMPLE900COMPR_MODE_OPT){
+		/* compare with group encoder */
+		r=akai_sample900compr_wav2sample_group(NULL,wavbuf,samplecountpart); /* NULL: first pass only */
+		akai_sample900compr_wav2sample_group(NULL,NULL,0); /* NULL,NULL: free buffers */
+		if (r>0){
+			printf("group encoder:   %u bytes (optimum encoder: %.1f%% of group encoder)\n",
+				(u_int)r,100.0*(double)samplesizecompr/(double)r);
+		}
+	}
 
 	/* create compressed sample file name */
 	/* Note: use RAM name as basis (-> akai_fixramname() not needed afterwards) */
@@ -1658,303 +1958,440 @@ akai_sample900_noncompr2compr_exit:
 
 
 int
-akai_sample2wav(struct file_s *fp,int wavfd,u_int *sizep,char **wavnamep,int what)
+akai_sample2wav_check(struct sample2wav_s *cp,struct file_s *fp)
 {
-	/* Note: static for multiple calls with different what */
-	static struct akai_sample3000_s s3000hdr;
-	static struct akai_sample900_s *s900hdrp;
-	static u_int hdrsize;
-	static u_int samplecount;
-	static u_int samplecountpart;
-	static u_int samplesize;
-	static u_int samplerate;
-	static u_char *sbuf;
-	static u_int wavsamplesize;
-	static u_char *wavbuf;
-	static int ret;
-	static char wavname[AKAI_NAME_LEN+4+1]; /* name (ASCII), +4 for ".<type>", +1 for '\0' */
-	static int nlen;
-	static u_int i;
+	struct akai_sample900_s *s900hdrp;
+	int nlen;
 
-	if (fp==NULL){
+	if (cp==NULL){
 		return -1;
 	}
 
-	if (what&SAMPLE2WAV_CHECK){
+	/* initialize context */
+	cp->fp=fp;
+	cp->sbuf=NULL; /* no sample so far */
+	cp->wavbuf=NULL; /* no sample so far */
+	cp->wavfd=-1; /* no WAV file created so far */
+	cp->wavsize=0;
+	cp->wavname[0]='\0';
 
-		/* file type */
-		if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){
-			/* S900 sample */
-			hdrsize=sizeof(struct akai_sample900_s);
-		}else if (fp->type==(u_char)AKAI_SAMPLE1000_FTYPE){
-			/* S1000 sample */
-			hdrsize=sizeof(struct akai_sample1000_s);
-		}else if (fp->type==(u_char)AKAI_SAMPLE3000_FTYPE){
-			/* S3000 sample */
-			hdrsize=sizeof(struct akai_sample3000_s);
-		}else{
-			/* unknown or unsupported */
-			return 1; /* no error */
-		}
+	if (fp==NULL){
+		return -1;
+	}
 
-		sbuf=NULL; /* no sample so far */
-		wavbuf=NULL; /* no sample so far */
-		ret=-1; /* no success so far */
+	/* file type */
+	if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){
+		/* S900 sample */
+		cp->hdrsize=sizeof(struct akai_sample900_s);
+	}else if (fp->type==(u_char)AKAI_SAMPLE1000_FTYPE){
+		/* S1000 sample */
+		cp->hdrsize=sizeof(struct akai_sample1000_s);
+	}else if (fp->type==(u_char)AKAI_SAMPLE3000_FTYPE){
+		/* S3000 sample */
+		cp->hdrsize=sizeof(struct akai_sample3000_s);
+	}else{
+		/* unknown or unsupported */
+		return 1; /* no error */
+	}
 
-		/* read header to memory */
-		/* Note: use S3000 header as buffer for S900 header */
-		if (akai_read_file(0,(u_char *)&s3000hdr,fp,0,hdrsize)<0){
-			fprintf(stderr,"cannot read sample\n");
-			goto akai_sample2wav_exit;
-		}
+	/* read header to memory */
+	/* Note: use S3000 header as buffer for S900 header */
+	if (akai_read_file(0,(u_char *)&cp->s3000hdr,fp,0,cp->hdrsize)<0){
+		fprintf(stderr,"cannot read sample\n");
+		return -1;
+	}
 
-		/* parse header */
-		if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){
-			/* S900 sample */
-			s900hdrp=(struct akai_sample900_s *)&s3000hdr;
-			/* number of samples */
-			/* XXX should be an even number */
-			samplecount=(s900hdrp->slen[3]<<24)
-				+(s900hdrp->slen[2]<<16)
-				+(s900hdrp->slen[1]<<8)
-				+s900hdrp->slen[0];
-			/* number of samples per part  */
-			samplecountpart=(samplecount+1)/2; /* round up */
-			samplecount=2*samplecountpart; /* XXX correct samplecount */
-			if (fp->osver==0){
-				/* S900 non-compressed sample format */
-				/* size in bytes */
-				samplesize=3*samplecountpart;
-			}else{
-				/* S900 compressed sample format */
-				/* size in bytes */
-				if (fp->size<hdrsize){
-					fprintf(stderr,"invalid sample size\n");
-					goto akai_sample2wav_exit;
-				}
-				samplesize=fp->size-hdrsize;
-			}
-			samplerate=(s900hdrp->srate[1]<<8)
-				+s900hdrp->srate[0];
+	/* parse header */
+	if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){
+		/* S900 sample */
+		s900hdrp=(struct akai_sample900_s *)&cp->s3000hdr;
+		/* number of samples */
+		/* XXX should be an even number */
+		cp->samplecount=(s900hdrp->slen[3]<<24)
+			+(s900hdrp->slen[2]<<16)
+			+(s900hdrp->slen[1]<<8)
+			+s900hdrp->slen[0];
+		/* number of samples per part  */
+		cp->samplecountpart=(cp->samplecount+1)/2; /* round up */
+		cp->samplecount=2*cp->samplecountpart; /* XXX correct samplecount */
+		if (fp->osver==0){
+			/* S900 non-compressed sample format */
+			/* size in bytes */
+			cp->samplesize=3*cp->samplecountpart;
 		}else{
-			/* S1000/S3000 sample */
-			/* Note: S1000 header is contained within S3000 header */
-			/* number of samples */
-			samplecount=(s3000hdr.s1000.slen[3]<<24)
-				+(s3000hdr.s1000.slen[2]<<16)
-				+(s3000hdr.s1000.slen[1]<<8)
-				+s3000hdr.s1000.slen[0];
+			/* S900 compressed sample format */
 			/* size in bytes */
-			samplesize=samplecount*2; /* *2 for 16bit per sample word */
-			samplecountpart=0;
-			samplerate=(s3000hdr.s1000.srate[1]<<8)
-				+s3000hdr.s1000.srate[0];
+			if (fp->size<cp->hdrsize){
+				fprintf(stderr,"invalid sample size\n");
+				return -1;
+			}
+			cp->samplesize=fp->size-cp->hdrsize;
 		}
+		cp->samplerate=(s900hdrp->srate[1]<<8)
+			+s900hdrp->srate[0];
+	}else{
+		/* S1000/S3000 sample */
+		/* Note: S1000 header is contained within S3000 header */
+		/* number of samples */
+		cp->samplecount=(cp->s3000hdr.s1000.slen[3]<<24)
+			+(cp->s3000hdr.s1000.slen[2]<<16)
+			+(cp->s3000hdr.s1000.slen[1]<<8)
+			+cp->s3000hdr.s1000.slen[0];
 		/* size in bytes */
-		wavsamplesize=samplecount*2; /* *2 for 16bit per WAV sample word */
+		cp->samplesize=cp->samplecount*2; /* *2 for 16bit per sample word */
+		cp->samplecountpart=0;
+		cp->samplerate=(cp->s3000hdr.s1000.srate[1]<<8)
+			+cp->s3000hdr.s1000.srate[0];
+	}
+	/* size in bytes */
+	cp->wavsamplesize=cp->samplecount*2; /* *2 for 16bit per WAV sample word */
 
 #ifdef DEBUG
-		printf("type:        %15i\n",fp->type);
-		printf("samplecount: %15u\n",samplecount);
-		printf("samplesize:  %15u bytes\n",samplesize);
-		printf("samplerate:  %15u Hz\n",samplerate);
+	printf("type:        %15i\n",fp->type);
+	printf("samplecount: %15u\n",cp->samplecount);
+	printf("samplesize:  %15u bytes\n",cp->samplesize);
+	printf("samplerate:  %15u Hz\n",cp->samplerate);
 #endif
 
-		/* check size */
-		if (hdrsize+samplesize>fp->size){
-			fprintf(stderr,"invalid sample size\n");
-			goto akai_sample2wav_exit;
-		}
+	/* check size */
+	if (cp->hdrsize+cp->samplesize>fp->size){
+		fprintf(stderr,"invalid sample size\n");
+		return -1;
+	}
 
-		if (sizep!=NULL){
-			/* WAV file size */
-			*sizep=WAV_HEAD_SIZE+wavsamplesize;
+	/* WAV file size */
+	cp->wavsize=WAV_HEAD_SIZE+cp->wavsamplesize;
 #ifndef WAV_AKAIHEAD_DISABLE
-			*sizep+=sizeof(struct wav_chunkhead_s)+hdrsize; /* sample header chunk (see below) */
+	cp->wavsize+=sizeof(struct wav_chunkhead_s)+cp->hdrsize; /* sample header chunk (see below) */
 #endif
-		}
 
-		/* create WAV name */
-		if ((fp->volp!=NULL)&&(fp->index<fp->volp->fimax)){
-			akai2ascii_name(fp->volp->file[fp->index].name,wavname,fp->volp->type==AKAI_VOL_TYPE_S900);
-			nlen=(int)strlen(wavname);
-		}else{
-			nlen=0;
-		}
-		bcopy(".wav",wavname+nlen,5);
+	/* create WAV name */
+	if ((fp->volp!=NULL)&&(fp->index<fp->volp->fimax)){
+		akai2ascii_name(fp->volp->file[fp->index].name,cp->wavname,fp->volp->type==AKAI_VOL_TYPE_S900);
+		nlen=(int)strlen(cp->wavname);
+	}else{
+		nlen=0;
+	}
+	bcopy(".wav",cp->wavname+nlen,5);
 
-		if (wavnamep!=NULL){
-			/* pointer to name (wavname must be static!) */
-			*wavnamep=wavname;
-		}
+	return 0;
+}
+
+int
+akai_sample2wav_read(struct sample2wav_s *cp)
+{
+	struct file_s *fp;
+
+	/* Note: disk I/O, must not run concurrently with other disk accesses */
+
+	if ((cp==NULL)||(cp->fp==NULL)){
+		return -1;
 	}
+	fp=cp->fp;
 
-	if (what&SAMPLE2WAV_EXPORT){
+	/* allocate WAV sample buffer */
+	cp->wavbuf=(u_char *)malloc(cp->wavsamplesize);
+	if (cp->wavbuf==NULL){
+		perror("malloc");
+		return -1;
+	}
 
-		/* allocate WAV sample buffer */
-		wavbuf=(u_char *)malloc(wavsamplesize);
-		if (wavbuf==NULL){
+	if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
+		/* allocate sample buffer */
+		cp->sbuf=(u_char *)malloc(cp->samplesize);
+		if (cp->sbuf==NULL){
 			perror("malloc");
-			goto akai_sample2wav_exit;
+			return -1;
 		}
+	}
+	/* Note: no sample format conversion necessary for S1000/S3000, sbuf not needed */
 
-		if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
-			/* allocate sample buffer */
-			sbuf=(u_char *)malloc(samplesize);
-			if (sbuf==NULL){
-				perror("malloc");
-				goto akai_sample2wav_exit;
-			}
-		}else{
-			/* Note: no sample format conversion necessary for S1000/S3000 */
-			sbuf=wavbuf;
-		}
+	/* read sample to memory */
+	if (akai_read_file(0,(cp->sbuf!=NULL)?cp->sbuf:cp->wavbuf,fp,cp->hdrsize,cp->hdrsize+cp->samplesize)<0){
+		fprintf(stderr,"cannot read sample\n");
+		return -1;
+	}
 
-		/* read sample to memory */
-		if (akai_read_file(0,sbuf,fp,hdrsize,hdrsize+samplesize)<0){
-			fprintf(stderr,"cannot read sample\n");
-			goto akai_sample2wav_exit;
-		}
+	return 0;
+}
 
-		if (what&SAMPLE2WAV_CREATE){
-			/* create WAV file */
-			if ((wavfd=OPEN(wavname,O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666))<0){
-				perror("create WAV");
-				goto akai_sample2wav_exit;
-			}
-		}
+int
+akai_sample2wav_conv(struct sample2wav_s *cp)
+{
+	struct file_s *fp;
+	u_int i;
 
-		if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
-			if (fp->osver==0){
-				/* S900 non-compressed sample format */
-				/* convert S900 non-compressed sample format into 16bit WAV sample format */
-				akai_sample900noncompr_sample2wav(sbuf,wavbuf,samplecountpart);
-			}else{
-				/* S900 compressed sample format */
-				/* convert S900 compressed sample format into 16bit WAV sample format */
-				i=akai_sample900compr_sample2wav(sbuf,wavbuf,samplesize,wavsamplesize);
-				if (i<wavsamplesize){
-					fprintf(stderr,"warning: incomplete sample data\n");
-					/* zero padding */
-					bzero(wavbuf+i,wavsamplesize-i);
-				}
-			}
-		}
-		/* Note: no sample format conversion necessary for S1000/S3000 */
+	/* Note: no disk I/O, may run in parallel for different contexts */
 
-		/* write WAV header */
-		if (wav_write_head(wavfd,
-						   wavsamplesize,1,samplerate,16, /* 1: mono, 16: 16bit */
-#ifndef WAV_AKAIHEAD_DISABLE
-						   sizeof(struct wav_chunkhead_s)+hdrsize /* sample header chunk (see below) */
-#else
-						   0
-#endif
-						   )<0){
-			fprintf(stderr,"cannot write WAV header\n");
-			goto akai_sample2wav_exit;
-		}
+	if ((cp==NULL)||(cp->fp==NULL)){
+		return -1;
+	}
+	fp=cp->fp;
 
-		/* write WAV sample to WAV file */
-		if (WRITE(wavfd,wavbuf,wavsamplesize)!=(int)wavsamplesize){
-			perror("write WAV samples");
-			goto akai_sample2wav_exit;
+	if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
+		if ((cp->sbuf==NULL)||(cp->wavbuf==NULL)){
+			return -1;
+		}
+		if (fp->osver==0){
+			/* S900 non-compressed sample format */
+			/* convert S900 non-compressed sample format into 16bit WAV sample format */
+			akai_sample900noncompr_sample2wav(cp->sbuf,cp->wavbuf,cp->samplecountpart);
+		}else{
+			/* S900 compressed sample format */
+			/* convert S900 compressed sample format into 16bit WAV sample format */
+			i=akai_sample900compr_sample2wav(cp->sbuf,cp->wavbuf,cp->samplesize,cp->wavsamplesize);
+			if (i<cp->wavsamplesize){
+				fprintf(stderr,"warning: incomplete sample data\n");
+				/* zero padding */
+				bzero(cp->wavbuf+i,cp->wavsamplesize-i);
+			}
 		}
+		/* sample buffer not needed anymore */
+		free(cp->sbuf);
+		cp->sbuf=NULL;
+	}
+	/* Note: no sample format conversion necessary for S1000/S3000 */
 
-#ifndef WAV_AKAIHEAD_DISABLE
-		{
-			struct wav_chunkhead_s wavchunkhead;
+	return 0;
+}
 
-			/* create sample header chunk */
-			if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){
-				/* S900 sample */
-				bcopy(WAV_CHUNKHEAD_AKAIS900SAMPLEHEADSTR,wavchunkhead.typestr,4);
-			}else if (fp->type==(u_char)AKAI_SAMPLE1000_FTYPE){
-				/* S1000 sample */
-				bcopy(WAV_CHUNKHEAD_AKAIS1000SAMPLEHEADSTR,wavchunkhead.typestr,4);
-			}else{
-				/* S3000 sample */
-				bcopy(WAV_CHUNKHEAD_AKAIS3000SAMPLEHEADSTR,wavchunkhead.typestr,4);
-			}
-			wavchunkhead.csize[0]=0xff&hdrsize;
-			wavchunkhead.csize[1]=0xff&(hdrsize>>8);
-			wavchunkhead.csize[2]=0xff&(hdrsize>>16);
-			wavchunkhead.csize[3]=0xff&(hdrsize>>24);
+int
+akai_sample2wav_load(struct sample2wav_s *cp)
+{
+
+	if ((cp==NULL)||(cp->fp==NULL)){
+		return -1;
+	}
+
+	if (cp->fp->type!=(u_char)AKAI_SAMPLE900_FTYPE){ /* not S900 sample? */
+		/* Note: no sample format conversion necessary for S1000/S3000 */
+		/*       akai_sample2wav_write() will stream sample from disk to WAV file */
+		return 0;
+	}
+
+	/* S900 sample: read and convert */
+	if (akai_sample2wav_read(cp)<0){
+		return -1;
+	}
+	return akai_sample2wav_conv(cp);
+}
+
+/* write WAV file to wavfd or to outbuf (cp->wavsize bytes) if outbuf!=NULL */
+/* Note: wavfd<0 and outbuf==NULL: create WAV file */
+int
+akai_sample2wav_write(struct sample2wav_s *cp,int wavfd,u_char *outbuf)
+{
+	struct file_s *fp;
+
+	if ((cp==NULL)||(cp->fp==NULL)){
+		return -1;
+	}
+	fp=cp->fp;
+	if ((cp->wavbuf==NULL)&&(fp->type==(u_char)AKAI_SAMPLE900_FTYPE)){
+		/* S900 sample must have been converted */
+		return -1;
+	}
+
+	if ((wavfd<0)&&(outbuf==NULL)){
+		/* create WAV file */
+		if ((cp->wavfd=OPEN(cp->wavname,O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666))<0){
+			perror("create WAV");
+			return -1;
+		}
+		/* Note: akai_sample2wav_finish() will close WAV file */
+		wavfd=cp->wavfd;
+	}
+
+	/* write WAV header */
+	if (outbuf!=NULL){
+		wav_set_head(outbuf,
+					 cp->wavsamplesize,1,cp->samplerate,16, /* 1: mono, 16: 16bit */
+#ifndef WAV_AKAIHEAD_DISABLE
+					 sizeof(struct wav_chunkhead_s)+cp->hdrsize /* sample header chunk (see below) */
+#else
+					 0
+#endif
+					 );
+		outbuf+=WAV_HEAD_SIZE;
+	}else if (wav_write_head(wavfd,
+							 cp->wavsamplesize,1,cp->samplerate,16, /* 1: mono, 16: 16bit */
+#ifndef WAV_AKAIHEAD_DISABLE
+							 sizeof(struct wav_chunkhead_s)+cp->hdrsize /* sample header chunk (see below) */
+#else
+							 0
+#endif
+							 )<0){
+		fprintf(stderr,"cannot write WAV header\n");
+		return -1;
+	}
+
+	if (cp->wavbuf!=NULL){
+		/* write WAV sample to WAV file */
+		if (outbuf!=NULL){
+			bcopy(cp->wavbuf,outbuf,cp->wavsamplesize);
+		}else if (WRITE(wavfd,cp->wavbuf,cp->wavsamplesize)!=(int)cp->wavsamplesize){
+			perror("write WAV samples");
+			return -1;
+		}
+	}else{
+		/* stream S1000/S3000 sample from disk to WAV file */
+		/* Note: disk I/O */
+		if (akai_read_file(wavfd,outbuf,fp,cp->hdrsize,cp->hdrsize+cp->samplesize)<0){
+			fprintf(stderr,"cannot export sample\n");
+			return -1;
+		}
+	}
+	if (outbuf!=NULL){
+		outbuf+=cp->wavsamplesize;
+	}
+
+#ifndef WAV_AKAIHEAD_DISABLE
+	{
+		struct wav_chunkhead_s wavchunkhead;
+
+		/* create sample header chunk */
+		if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){
+			/* S900 sample */
+			bcopy(WAV_CHUNKHEAD_AKAIS900SAMPLEHEADSTR,wavchunkhead.typestr,4);
+		}else if (fp->type==(u_char)AKAI_SAMPLE1000_FTYPE){
+			/* S1000 sample */
+			bcopy(WAV_CHUNKHEAD_AKAIS1000SAMPLEHEADSTR,wavchunkhead.typestr,4);
+		}else{
+			/* S3000 sample */
+			bcopy(WAV_CHUNKHEAD_AKAIS3000SAMPLEHEADSTR,wavchunkhead.typestr,4);
+		}
+		wavchunkhead.csize[0]=0xff&cp->hdrsize;
+		wavchunkhead.csize[1]=0xff&(cp->hdrsize>>8);
+		wavchunkhead.csize[2]=0xff&(cp->hdrsize>>16);
+		wavchunkhead.csize[3]=0xff&(cp->hdrsize>>24);
+		/* Note: use S3000 header as buffer for S900 header */
+		/* Note: S1000 header is contained within S3000 header */
+		if (outbuf!=NULL){
+			bcopy((u_char *)&wavchunkhead,outbuf,sizeof(struct wav_chunkhead_s));
+			bcopy((u_char *)&cp->s3000hdr,outbuf+sizeof(struct wav_chunkhead_s),cp->hdrsize);
+		}else{
 			/* write WAV chunk header */
 			if (WRITE(wavfd,(u_char *)&wavchunkhead,sizeof(struct wav_chunkhead_s))!=(int)sizeof(struct wav_chunkhead_s)){
 				perror("write WAV chunk");
-				goto akai_sample2wav_exit;
+				return -1;
 			}
 			/* write sample header */
-			/* Note: use S3000 header as buffer for S900 header */
-			/* Note: S1000 header is contained within S3000 header */
-			if (WRITE(wavfd,(u_char *)&s3000hdr,hdrsize)!=(int)hdrsize){
+			if (WRITE(wavfd,(u_char *)&cp->s3000hdr,cp->hdrsize)!=(int)cp->hdrsize){
 				perror("write WAV chunk");
-				goto akai_sample2wav_exit;
+				return -1;
 			}
 		}
+	}
 #endif
 #if 1
-		printf("sample exported to WAV\n");
+	printf("sample exported to WAV\n");
 #endif
+
+	return 0;
+}
+
+int
+akai_sample2wav_export(struct sample2wav_s *cp,int wavfd)
+{
+
+	/* read and convert sample if necessary */
+	if (akai_sample2wav_load(cp)<0){
+		return -1;
 	}
 
-	ret=0; /* success */
+	/* write WAV file */
+	return akai_sample2wav_write(cp,wavfd,NULL);
+}
 
-akai_sample2wav_exit:
-	if (wavbuf!=NULL){
-		free(wavbuf);
+void
+akai_sample2wav_finish(struct sample2wav_s *cp)
+{
+
+	if (cp==NULL){
+		return;
 	}
-	if (fp->type==(u_char)AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
-		if (sbuf!=NULL){
-			free(sbuf);
-		}
+
+	if (cp->wavbuf!=NULL){
+		free(cp->wavbuf);
+		cp->wavbuf=NULL;
+	}
+	if (cp->sbuf!=NULL){
+		free(cp->sbuf);
+		cp->sbuf=NULL;
 	}
-	if (what&SAMPLE2WAV_CREATE){
-		if (wavfd>=0){
-			CLOSE(wavfd);
+	if (cp->wavfd>=0){
+		CLOSE(cp->wavfd);
+		cp->wavfd=-1;
+	}
+}
+
+int
+akai_sample2wav(struct file_s *fp,int wavfd,u_int *sizep,char **wavnamep,int what)
+{
+	/* Note: static for multiple calls with different what */
+	/* Note: not reentrant, use akai_sample2wav_check()/_export()/_finish() with own context instead */
+	static struct sample2wav_s ctx;
+	int ret;
+
+	if (fp==NULL){
+		return -1;
+	}
+
+	if (what&SAMPLE2WAV_CHECK){
+		ret=akai_sample2wav_check(&ctx,fp);
+		if (ret!=0){
+			return ret;
+		}
+		if (sizep!=NULL){
+			/* WAV file size */
+			*sizep=ctx.wavsize;
+		}
+		if (wavnamep!=NULL){
+			/* pointer to name (ctx must be static!) */
+			*wavnamep=ctx.wavname;
 		}
 	}
+
+	ret=0; /* success */
+
+	if (what&SAMPLE2WAV_EXPORT){
+		ctx.fp=fp;
+		ret=akai_sample2wav_export(&ctx,(what&SAMPLE2WAV_CREATE)?-1:wavfd);
+		akai_sample2wav_finish(&ctx);
+	}
+
 	return ret;
 }
 
 
 
 int
-akai_wav2sample(int wavfd,char *wavname,struct vol_s *volp,u_int findex,
-				u_int type,int s9cflag,u_int osver,u_char *tagp,
-				u_int *bcountp,int what)
+akai_wav2sample_check(struct wav2sample_s *cp,int wavfd,char *wavname,struct vol_s *volp,u_int findex,
+					  u_int type,int s9cflag,u_int osver,u_char *tagp)
 {
-	/* Note: static for multiple calls with different what */
-	struct file_s tmpfile;
-	struct akai_sample900_s s900hdr;
-	struct akai_sample3000_s s3000hdr;
-	static u_int hdrsize;
-	static u_int chnr;
-	static u_int samplerate;
-	static u_int bitnr;
-	static u_int samplecount;
-	static u_int samplecountpart;
-	static u_int samplesize;
-	static u_char *sbuf;
-	static u_int wavsamplesize;
-	static u_int wavsamplesizealloc;
-	static u_int wavsamplecount;
-	static u_char *wavbuf, *tempbuf = NULL;
-	static char *errstrp;
-	static int nlen;
-	static char *tname;
-	static char fname[AKAI_NAME_LEN+4+1]; /* name (ASCII), +4 for ".<type>", +1 for '\0' */
-	static char sname[AKAI_NAME_LEN+1]; /* +1 for '\0' */
-	static int r;
-	static u_int bcount;
-#ifndef WAV_AKAIHEAD_DISABLE
-	static u_int extrasize;
-	static int wavakaiheadfound;
-#endif
-	static int ret;
-	int ltype = -1;
-	u_int ch, lstart, lend;
+	char *errstrp;
+
+	if (cp==NULL){
+		return -1;
+	}
+
+	/* initialize context */
+	cp->wavname=wavname;
+	cp->volp=volp;
+	cp->findex=findex;
+	cp->type=type;
+	cp->s9cflag=s9cflag;
+	cp->tagp=tagp;
+	cp->wavfd=wavfd;
+	cp->openflag=0; /* not opened by context so far */
+	cp->wavbuf=NULL; /* no sample so far */
+	cp->sbuf=NULL; /* no sample so far */
+	cp->bcount=0; /* no bytes read yet */
+	cp->extrasize=0;
+	cp->ltype=-1; /* no loop so far */
+	cp->lstart=0;
+	cp->lend=0;
+	wav_conv_init(&cp->conv,WAV_HEAD_FTAG,16); /* no conversion so far */
 
 	if (wavname==NULL){
 		return -1;
@@ -1997,313 +2434,439 @@ akai_wav2sample(int wavfd,char *wavname,struct vol_s *volp,u_int findex,
 	}
 	if (type==AKAI_SAMPLE900_FTYPE){
 		/* S900 sample */
-		hdrsize=sizeof(struct akai_sample900_s);
+		cp->hdrsize=sizeof(struct akai_sample900_s);
 		if (s9cflag){
 			/* S900 compressed sample format */
-			tname=".S9C";
+			cp->tname=".S9C";
 		}else{
 			/* S900 non-compressed sample format */
-			tname=".S9";
+			cp->tname=".S9";
 		}
 	}else if (type==AKAI_SAMPLE1000_FTYPE){
 		/* S1000 sample */
-		hdrsize=sizeof(struct akai_sample1000_s);
-		tname=".S1";
+		cp->hdrsize=sizeof(struct akai_sample1000_s);
+		cp->tname=".S1";
 	}else if (type==AKAI_SAMPLE3000_FTYPE){
 		/* S3000 sample */
-		hdrsize=sizeof(struct akai_sample3000_s);
-		tname=".S3";
+		cp->hdrsize=sizeof(struct akai_sample3000_s);
+		cp->tname=".S3";
 	}else{
 		return -1;
 	}
-
-	sbuf=NULL; /* no sample so far */
-	wavbuf=NULL; /* no sample so far */
-	ret=-1; /* no success so far */
-	bcount=0; /* no bytes read yet */
+	cp->type=type;
+	cp->osver=osver;
 
 	/* check WAV name */
-	nlen=(int)strlen(wavname);
-	if ((nlen<4)||(strncasecmp(wavname+nlen-4,".wav",4)!=0)){
+	cp->nlen=(int)strlen(wavname);
+	if ((cp->nlen<4)||(strncasecmp(wavname+cp->nlen-4,".wav",4)!=0)){
 		/* unknown or unsupported */
-		ret=1; /* no error */
-		goto akai_wav2sample_exit;
+		return 1; /* no error */
 	}
-	nlen-=4; /* remove suffix */
+	cp->nlen-=4; /* remove suffix */
 
-	if (what&WAV2SAMPLE_OPEN){
+	if (wavfd<0){
 		/* open external WAV file */
-		if ((wavfd=OPEN(wavname,O_RDONLY|O_BINARY,0))<0){
+		if ((cp->wavfd=OPEN(wavname,O_RDONLY|O_BINARY,0))<0){
 			perror("open WAV");
-			goto akai_wav2sample_exit;
+			return -1;
 		}
+		/* Note: akai_wav2sample_finish() will close WAV file */
+		cp->openflag=1;
 	}
 
 	/* read and parse WAV header */
-	if (wav_read_head(wavfd,&bcount,
-							&wavsamplesize,&chnr,&samplerate,&bitnr,
+	if (wav_read_head(cp->wavfd,&cp->bcount,
+					  &cp->wavdatasize,&cp->chnr,&cp->samplerate,&cp->bitnr,&cp->ftag,
 #ifndef WAV_AKAIHEAD_DISABLE
-							&extrasize,
+					  &cp->extrasize,
 #else
-							NULL,
+					  NULL,
 #endif
-							&errstrp,
-							&ltype, &lstart, &lend)<0){
+					  &errstrp,
+					  &cp->ltype,&cp->lstart,&cp->lend)<0){
 		if (errstrp!=NULL){
 			fprintf(stderr,"%s\n",errstrp);
 		}
 		/* error, don't know how many bytes read */
-		goto akai_wav2sample_exit;
+		return -1;
+	}
+	/* conversion to 16bit */
+	if (wav_conv_init(&cp->conv,cp->ftag,cp->bitnr)<0){
+		fprintf(stderr,"WAV must be 8/16/24/32bit or 32bit float\n");
+		/* unknown or unsupported */
+		return 1; /* no error */
 	}
+	cp->wavsamplesize=(cp->wavdatasize/cp->conv.bytenr)*2; /* *2 for 16bit per sample word */
 
-	printf("bcount: %d, wavsamplesize: %d, chnr: %d, samplerate: %d, bitnr: %d, extrasize: %d\n",
-		bcount, wavsamplesize, chnr, samplerate, bitnr, extrasize);
+#ifdef DEBUG
+	printf("bcount:        %15u\n",cp->bcount);
+	printf("wavsamplesize: %15u bytes\n",cp->wavsamplesize);
+	printf("chnr:          %15u\n",cp->chnr);
+	printf("samplerate:    %15u Hz\n",cp->samplerate);
+	printf("bitnr:         %15u\n",cp->bitnr);
+	printf("extrasize:     %15u bytes\n",cp->extrasize);
+#endif
 
 	/* check parameters */
-	if (type == AKAI_SAMPLE900_FTYPE) {
-		if (chnr!=1){
+	if ((cp->chnr<1)||(cp->chnr>2)){
+		fprintf(stderr,"WAV must be mono or stereo\n");
+		/* unknown or unsupported */
+		return 1; /* no error */
+	}
+	if (type==AKAI_SAMPLE900_FTYPE){
+		if (cp->chnr!=1){
 			fprintf(stderr,"WAV must be mono on S900\n");
 			/* unknown or unsupported */
-			ret=1; /* no error */
-			goto akai_wav2sample_exit;
-		}
-	} else {
-		if(chnr == 2) {
-			tempbuf = (u_char *)malloc(wavsamplesize);
-			if (READ(wavfd,tempbuf,wavsamplesize)!=(int)wavsamplesize){
-				fprintf(stderr,"cannot read stereo sample\n");
-				goto akai_wav2sample_exit;
-			}
-			wavsamplesize /= 2;
-		} else {
-			tempbuf = NULL;
+			return 1; /* no error */
 		}
 	}
-	if (bitnr!=16){
-		fprintf(stderr,"WAV must be 16bit\n");
-		/* unknown or unsupported */
-		ret=1; /* no error */
-		goto akai_wav2sample_exit;
+
+	/* resampling */
+	if ((wav_rsrate!=0)&&(wav_rsrate!=cp->samplerate)){
+		u_int framenr;
+		int r;
+
+		r=wav_conv_resample(&cp->conv,cp->chnr,cp->samplerate,wav_rsrate,
+							cp->wavdatasize/(cp->chnr*cp->conv.bytenr),&framenr);
+		if (r!=0){
+			return r;
+		}
+		printf("resampling from %u Hz to %u Hz\n",cp->samplerate,wav_rsrate);
+		/* loop */
+		cp->lstart=(u_int)((((U_INT64)cp->lstart)*wav_rsrate+cp->samplerate/2)/cp->samplerate);
+		cp->lend=(u_int)((((U_INT64)cp->lend)*wav_rsrate+cp->samplerate/2)/cp->samplerate);
+		cp->samplerate=wav_rsrate;
+		cp->wavsamplesize=framenr*cp->chnr*2; /* *2 for 16bit per sample word */
 	}
-	
 
-	for(ch = 0; ch < chnr; ch++) {
-		printf("writing channel %d (wavsamplesize = %d)\n", ch, wavsamplesize);
+	return 0;
+}
 
-		/* number of samples in WAV file */
-		/* Note: can be an odd number */
-		wavsamplecount=wavsamplesize/2; /* /2 for 16bit per WAV sample word */
+int
+akai_wav2sample_import(struct wav2sample_s *cp,int what)
+{
+	struct file_s tmpfile[2]; /* Note: one file per channel */
+	struct akai_sample900_s s900hdr;
+	struct akai_sample3000_s s3000hdr;
+	u_int type;
+	u_int hdrsize;
+	u_int wavsamplesize;
+	u_int wavsamplesizealloc;
+	u_int wavsamplecount;
+	u_int samplecount;
+	u_int samplecountpart;
+	u_int samplesize;
+	u_int blksize;
+	u_int pos,n;
+	int nlen;
+	int namelen;
+	char fname[AKAI_NAME_LEN+4+1]; /* name (ASCII), +4 for ".<type>", +1 for '\0' */
+	char sname[2][AKAI_NAME_LEN+1]; /* +1 for '\0' */
+	int r;
+#ifndef WAV_AKAIHEAD_DISABLE
+	int wavakaiheadfound;
+#endif
+	u_int ch;
+	u_int fnum; /* number of created files */
+
+	if ((cp==NULL)||(cp->volp==NULL)||(cp->volp->partp==NULL)||(cp->wavfd<0)){
+		return -1;
+	}
+	if ((cp->chnr<1)||(cp->chnr>2)){
+		return -1;
+	}
+	type=cp->type;
+	hdrsize=cp->hdrsize;
+	nlen=cp->nlen;
+
+	/* WAV sample size per channel */
+	/* Note: can be an odd number for mono, rest of stereo frame is skipped */
+	wavsamplesize=cp->wavsamplesize;
+	if (cp->chnr==2){
+		wavsamplesize=(wavsamplesize/4)*2; /* /4 for 16bit per WAV sample word and 2 channels */
+	}
 
+	/* number of samples in WAV file per channel */
+	/* Note: can be an odd number */
+	wavsamplecount=wavsamplesize/2; /* /2 for 16bit per WAV sample word */
+
+	/* sample size */
+	if (type==AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
+		/* S900 sample */
+		/* Note: mono only (see akai_wav2sample_check()) */
+		/* Note: S900 samples are small, conversion needs whole WAV sample in memory */
 		/* allocate WAV sample buffer */
-		if (type==AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
-			/* Note: allocate WAV buffer for an rounded up even number of samples */
-			wavsamplesizealloc=(0xfffffffe&(wavsamplecount+1))*2; /* *2 for 16bit per WAV sample word */
-		}else{
-			wavsamplesizealloc=wavsamplesize;
-		}
-		wavbuf=(u_char *)malloc(wavsamplesizealloc);
-		if (wavbuf==NULL){
+		/* Note: allocate WAV buffer for an rounded up even number of samples */
+		wavsamplesizealloc=(0xfffffffe&(wavsamplecount+1))*2; /* *2 for 16bit per WAV sample word */
+		cp->wavbuf=(u_char *)malloc(wavsamplesizealloc);
+		if (cp->wavbuf==NULL){
 			perror("malloc");
-			goto akai_wav2sample_exit;
+			return -1;
 		}
+		/* read WAV sample to memory, convert to 16bit */
+		if (wav_read16(&cp->conv,cp->wavfd,cp->wavbuf,wavsamplecount)<0){
+			fprintf(stderr,"cannot read sample\n");
+			return -1;
+		}
+		cp->bcount+=cp->conv.bcount;
+		/* skip unused rest of WAV sample */
+		n=cp->wavdatasize-cp->conv.bcount;
+		if (n>0){
+			u_char rbuf[4]; /* Note: less than one sample */
 
-		if(chnr==2) {
-			u_int i, j;
-			u_short * d = (u_short*)wavbuf;
-			u_short * s = (u_short*)tempbuf;
-
-			for(i = ch, j = 0; i < wavsamplesize; i+=2, j++) {
-				d[j] = s[i];
+			if ((cp->conv.bcount>cp->wavdatasize)||(n>sizeof(rbuf))){
+				fprintf(stderr,"inconsistent WAV data size\n");
+				return -1;
 			}
-		} else {
-			/* read WAV sample to memory */
-			if (READ(wavfd,wavbuf,wavsamplesize)!=(int)wavsamplesize){
+			if (READ(cp->wavfd,rbuf,n)!=(int)n){
 				fprintf(stderr,"cannot read sample\n");
-				goto akai_wav2sample_exit;
+				return -1;
 			}
+			cp->bcount+=n;
 		}
-
-		bcount+=wavsamplesize;
 		if (wavsamplesize<wavsamplesizealloc){
 			/* zero padding */
-			bzero(wavbuf+wavsamplesize,wavsamplesizealloc-wavsamplesize);
+			bzero(cp->wavbuf+wavsamplesize,wavsamplesizealloc-wavsamplesize);
 		}
-
-		/* sample size */
-		if (type==AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
-			/* S900 sample */
-			/* number of samples per part  */
-			samplecountpart=(wavsamplecount+1)/2; /* round up */
-			samplecount=2*samplecountpart; /* samplecount must be an even number */
-			if (s9cflag){
-				/* S900 compressed sample format */
-				/* first pass to convert 16bit WAV sample format into S900 compressed sample format */
-				/* Note: first pass of akai_sample900compr_wav2sample() requires WAV sample to be loaded to wavbuf */
-				r=akai_sample900compr_wav2sample(NULL,wavbuf,samplecountpart); /* NULL: first pass */
-				if (r<0){
-					goto akai_wav2sample_exit;
-				}
-				/* size in bytes */
-				samplesize=(u_int)r;
-			}else{
-				/* S900 non-compressed sample format */
-				/* size in bytes */
-				samplesize=3*samplecountpart;
+		/* number of samples per part  */
+		samplecountpart=(wavsamplecount+1)/2; /* round up */
+		samplecount=2*samplecountpart; /* samplecount must be an even number */
+		if (cp->s9cflag){
+			/* S900 compressed sample format */
+			/* first pass to convert 16bit WAV sample format into S900 compressed sample format */
+			/* Note: first pass of akai_sample900compr_wav2sample() requires WAV sample to be loaded to wavbuf */
+			r=akai_sample900compr_wav2sample(NULL,cp->wavbuf,samplecountpart); /* NULL: first pass */
+			if (r<0){
+				return -1;
 			}
+			/* size in bytes */
+			samplesize=(u_int)r;
 		}else{
-			/* S1000/S3000 sample */
-			samplecountpart=0;
-			samplecount=wavsamplecount;
+			/* S900 non-compressed sample format */
 			/* size in bytes */
-			samplesize=samplecount*2; /* *2 for 16bit per sample word */
-		}
-		if (hdrsize+samplesize>AKAI_FILE_SIZEMAX){
-			fprintf(stderr,"WAV too large\n");
-			/* unknown or unsupported */
-			ret=1; /* no error */
-			goto akai_wav2sample_exit;
+			samplesize=3*samplecountpart;
 		}
+	}else{
+		/* S1000/S3000 sample */
+		samplecountpart=0;
+		samplecount=wavsamplecount;
+		/* size in bytes */
+		samplesize=samplecount*2; /* *2 for 16bit per sample word */
+	}
+	if (hdrsize+samplesize>AKAI_FILE_SIZEMAX){
+		fprintf(stderr,"WAV too large\n");
+		/* unknown or unsupported */
+		return 1; /* no error */
+	}
 
-		if (type==AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
-			/* allocate sample buffer */
-			sbuf=(u_char *)malloc(samplesize);
-			if (sbuf==NULL){
-				perror("malloc");
-				goto akai_wav2sample_exit;
-			}
-		}else{
-			/* Note: no sample format conversion necessary for S1000/S3000 */
-			sbuf=wavbuf;
+	if (type==AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
+		/* allocate sample buffer */
+		cp->sbuf=(u_char *)malloc(samplesize);
+		if (cp->sbuf==NULL){
+			perror("malloc");
+			return -1;
 		}
+	}
+
+	/* sample name */
+	if ((type==AKAI_SAMPLE900_FTYPE)||(cp->volp->type==AKAI_VOL_TYPE_S900)){ /* S900 sample or S900 volume? */
+		namelen=AKAI_NAME_LEN_S900;
+	}else{
+		namelen=AKAI_NAME_LEN;
+	}
+	if (cp->chnr==2){
+		namelen-=2; /* space for "-L"/"-R" */
+	}
+	if (nlen>namelen){
+		nlen=namelen;
+	}
 
-		/* sample name */
-		if ((type==AKAI_SAMPLE900_FTYPE)||(volp->type==AKAI_VOL_TYPE_S900)){ /* S900 sample or S900 volume? */
-			if (nlen>AKAI_NAME_LEN_S900){
-				nlen=AKAI_NAME_LEN_S900;
+	/* correct osver if necessary */
+	if (type==AKAI_SAMPLE900_FTYPE){
+		/* S900 sample */
+		if (cp->s9cflag){
+			/* S900 compressed sample format */
+			/* non-compressed sample size in bytes */
+			cp->osver=3*samplecountpart;
+			/* number of un-compressed floppy blocks */
+			/* Note: without sample header */
+			cp->osver=(cp->osver+AKAI_FL_BLOCKSIZE-1)/AKAI_FL_BLOCKSIZE; /* round up */
+			if (cp->osver==0){ /* unsuitable osver? */
+				cp->osver=1; /* XXX non zero */
 			}
 		}else{
-			if (nlen>AKAI_NAME_LEN){
-				nlen=AKAI_NAME_LEN;
-			}
+			/* S900 non-compressed sample format */
+			cp->osver=0;
 		}
-		bcopy(wavname,sname,nlen);
-		sname[nlen]='\0';
-
-		if(chnr == 1) {
-			sprintf(fname,"%-12s%s",sname,tname);
-		} else {
-			if(ch == 0) {
-				sprintf(fname,"%-10s-L%s",sname,tname);
-				sprintf(sname,"%-10s-L",sname);
-			} else {
-				sprintf(fname,"%-10s-R%s",sname,tname);
-				sprintf(sname,"%-10s-R",sname);
-			}
+	}else if (type==AKAI_SAMPLE1000_FTYPE){
+		/* S1000 sample */
+		if ((cp->osver==AKAI_OSVER_S900VOL)||(cp->osver>AKAI_OSVER_S1100MAX)){
+			cp->osver=AKAI_OSVER_S1000MAX; /* XXX */
 		}
-		
-		printf("fname=%s, sname=%s\n", fname, sname);
+	}else{
+		/* S3000 sample */
+		if ((cp->osver==AKAI_OSVER_S900VOL)||(cp->osver>AKAI_OSVER_S3000MAX)){
+			cp->osver=AKAI_OSVER_S3000MAX; /* XXX */
+		}
+	}
 
-	#ifdef WAV2SAMPLE_OVERWRITE
-		if ((findex==AKAI_CREATE_FILE_NOINDEX)
+	/* create files */
+	/* Note: FAT chain of each file is allocated once, sample is written into it afterwards */
+	fnum=0;
+	for (ch=0;ch<cp->chnr;ch++){
+		bcopy(cp->wavname,sname[ch],nlen);
+		sname[ch][nlen]='\0';
+		if (cp->chnr==2){
+			/* stereo: append "-L"/"-R" */
+			sprintf(sname[ch]+nlen,"%*s-%c",namelen-nlen,"",(ch==0)?'L':'R');
+		}
+		/* Note: name at most AKAI_NAME_LEN, type at most 4 */
+		sprintf(fname,"%-12.12s%.4s",sname[ch],cp->tname);
+
+#ifdef WAV2SAMPLE_OVERWRITE
+		if ((cp->findex==AKAI_CREATE_FILE_NOINDEX)
 			/* check if destination file already exists */
-			&&(akai_find_file(volp,&tmpfile,fname)==0)){
+			&&(akai_find_file(cp->volp,&tmpfile[ch],fname)==0)){
 			/* exists */
 			if (what&WAV2SAMPLE_OVERWRITE){
 				/* delete file */
 				printf("overwriting\n");
-				if (akai_delete_file(&tmpfile)<0){
+				if (akai_delete_file(&tmpfile[ch])<0){
 					fprintf(stderr,"cannot overwrite existing file\n");
-					goto akai_wav2sample_exit;
+					goto akai_wav2sample_import_delete;
 				}
 			}else{
 				fprintf(stderr,"file name already used\n");
-				goto akai_wav2sample_exit;
-			}
-		}
-	#endif
-
-		/* correct osver if necessary */
-		if (type==AKAI_SAMPLE900_FTYPE){
-			/* S900 sample */
-			if (s9cflag){
-				/* S900 compressed sample format */
-				/* non-compressed sample size in bytes */
-				osver=3*samplecountpart;
-				/* number of un-compressed floppy blocks */
-				/* Note: without sample header */
-				osver=(osver+AKAI_FL_BLOCKSIZE-1)/AKAI_FL_BLOCKSIZE; /* round up */
-				if (osver==0){ /* unsuitable osver? */
-					osver=1; /* XXX non zero */
-				}
-			}else{
-				/* S900 non-compressed sample format */
-				osver=0;
-			}
-		}else if (type==AKAI_SAMPLE1000_FTYPE){
-			/* S1000 sample */
-			if ((osver==AKAI_OSVER_S900VOL)||(osver>AKAI_OSVER_S1100MAX)){
-				osver=AKAI_OSVER_S1000MAX; /* XXX */
-			}
-		}else{
-			/* S3000 sample */
-			if ((osver==AKAI_OSVER_S900VOL)||(osver>AKAI_OSVER_S3000MAX)){
-				osver=AKAI_OSVER_S3000MAX; /* XXX */
+				goto akai_wav2sample_import_delete;
 			}
 		}
+#endif
 
 		/* create file */
 		/* Note: akai_create_file() will correct osver if necessary */
-		if (akai_create_file(volp,&tmpfile,
+		if (akai_create_file(cp->volp,&tmpfile[ch],
 							 hdrsize+samplesize,
-							 findex,
+							 cp->findex,
 							 fname,
-							 osver,
-							 tagp)<0){
+							 cp->osver,
+							 cp->tagp)<0){
 			fprintf(stderr,"cannot create file\n");
-			goto akai_wav2sample_exit;
+			goto akai_wav2sample_import_delete;
 		}
+		fnum++;
+	}
 
-#ifndef WAV_AKAIHEAD_DISABLE
-		/* check for sample header chunk in WAV file */
-		{
-			u_int wavakaiheadsearchtype;
-			int wavakaiheadtype;
-			u_int wavakaiheadsize;
-			u_int bc;
-
-			/* matching type */
-			if (type==AKAI_SAMPLE900_FTYPE){
-				wavakaiheadsearchtype=WAV_AKAIHEADTYPE_SAMPLE900;
-			}else if (type==AKAI_SAMPLE1000_FTYPE){
-				wavakaiheadsearchtype=WAV_AKAIHEADTYPE_SAMPLE1000;
-			}else{
-				wavakaiheadsearchtype=WAV_AKAIHEADTYPE_SAMPLE3000;
+	if (type!=AKAI_SAMPLE900_FTYPE){
+		/* S1000/S3000 sample */
+		/* Note: no sample format conversion necessary for S1000/S3000 */
+		/* allocate chunk buffers */
+		cp->wavbuf=(u_char *)malloc(cp->chnr*WAV2SAMPLE_CHUNKSIZ);
+		if (cp->wavbuf==NULL){
+			perror("malloc");
+			goto akai_wav2sample_import_delete;
+		}
+		if (cp->chnr==2){
+			/* buffer for de-interleaved channels */
+			cp->sbuf=(u_char *)malloc(2*WAV2SAMPLE_CHUNKSIZ);
+			if (cp->sbuf==NULL){
+				perror("malloc");
+				goto akai_wav2sample_import_delete;
 			}
-
-			wavakaiheadtype=wav_find_akaihead(wavfd,&bc,&wavakaiheadsize,extrasize,wavakaiheadsearchtype);
-			if (wavakaiheadtype<0){
-				goto akai_wav2sample_exit;
+		}
+		blksize=cp->volp->partp->blksize;
+		if ((blksize==0)||(blksize>WAV2SAMPLE_CHUNKSIZ)){
+			goto akai_wav2sample_import_delete;
+		}
+		/* stream WAV sample to files */
+		for (pos=0;pos<samplesize;pos+=n){
+			/* chunk ends at block boundary in destination files */
+			n=WAV2SAMPLE_CHUNKSIZ-((hdrsize+pos)%blksize);
+			n&=~1; /* 16bit per sample word */
+			if (n>samplesize-pos){
+				n=samplesize-pos;
+			}
+			/* read chunk (all channels), convert to 16bit */
+			if (wav_read16(&cp->conv,cp->wavfd,cp->wavbuf,cp->chnr*n/2)<0){ /* /2 for 16bit per sample word */
+				fprintf(stderr,"cannot read sample\n");
+				goto akai_wav2sample_import_delete;
+			}
+			if (cp->chnr==2){
+				/* de-interleave both channels in a single pass */
+				wav_deinterleave16(cp->sbuf,cp->sbuf+n,cp->wavbuf,n/2); /* /2 for 16bit per sample word */
+			}
+			/* write chunk */
+			for (ch=0;ch<cp->chnr;ch++){
+				if (akai_write_file(0,(cp->chnr==2)?(cp->sbuf+ch*n):cp->wavbuf,&tmpfile[ch],hdrsize+pos,hdrsize+pos+n)<0){
+					fprintf(stderr,"cannot write sample\n");
+					goto akai_wav2sample_import_delete;
+				}
+			}
+		}
+		cp->bcount+=cp->conv.bcount;
+		/* skip unused rest of WAV sample */
+		n=cp->wavdatasize-cp->conv.bcount;
+		if (n>0){
+			/* Note: less than one frame */
+			if ((cp->conv.bcount>cp->wavdatasize)||(n>cp->chnr*WAV2SAMPLE_CHUNKSIZ)){
+				fprintf(stderr,"inconsistent WAV data size\n");
+				goto akai_wav2sample_import_delete;
+			}
+			if (READ(cp->wavfd,cp->wavbuf,n)!=(int)n){
+				fprintf(stderr,"cannot read sample\n");
+				goto akai_wav2sample_import_delete;
 			}
-			bcount+=bc;
+			cp->bcount+=n;
+		}
+	}
 
-			if ((wavakaiheadtype==(int)wavakaiheadsearchtype)&&(wavakaiheadsize==hdrsize)){
-				/* found matching sample header chunk */
-				wavakaiheadfound=1;
-			}else{
+#ifndef WAV_AKAIHEAD_DISABLE
+	/* check for sample header chunk in WAV file */
+	{
+		u_int wavakaiheadsearchtype;
+		int wavakaiheadtype;
+		u_int wavakaiheadsize;
+		u_int bc;
+
+		/* matching type */
+		if (type==AKAI_SAMPLE900_FTYPE){
+			wavakaiheadsearchtype=WAV_AKAIHEADTYPE_SAMPLE900;
+		}else if (type==AKAI_SAMPLE1000_FTYPE){
+			wavakaiheadsearchtype=WAV_AKAIHEADTYPE_SAMPLE1000;
+		}else{
+			wavakaiheadsearchtype=WAV_AKAIHEADTYPE_SAMPLE3000;
+		}
+
+		wavakaiheadtype=wav_find_akaihead(cp->wavfd,&bc,&wavakaiheadsize,cp->extrasize,wavakaiheadsearchtype);
+		if (wavakaiheadtype<0){
+			goto akai_wav2sample_import_delete;
+		}
+		cp->bcount+=bc;
+
+		if ((wavakaiheadtype==(int)wavakaiheadsearchtype)&&(wavakaiheadsize==hdrsize)){
+			/* found matching sample header chunk */
+			wavakaiheadfound=1;
+			if (cp->conv.rsp!=NULL){
+				/* Note: sample positions in header would not match */
+				printf("sample header in WAV ignored due to resampling\n");
 				wavakaiheadfound=0;
 			}
+		}else{
+			wavakaiheadfound=0;
 		}
+	}
 #endif
 
+	/* sample headers */
+	for (ch=0;ch<cp->chnr;ch++){
 		if (type==AKAI_SAMPLE900_FTYPE){
 #ifndef WAV_AKAIHEAD_DISABLE
 			if (wavakaiheadfound){
 				/* read S900 sample header */
-				if (READ(wavfd,(u_char *)&s900hdr,hdrsize)!=(int)hdrsize){
+				if (READ(cp->wavfd,(u_char *)&s900hdr,hdrsize)!=(int)hdrsize){
 					fprintf(stderr,"cannot read sample header\n");
-					goto akai_wav2sample_exit;
+					goto akai_wav2sample_import_delete;
 				}
-				bcount+=hdrsize;
+				cp->bcount+=hdrsize;
 #if 1
 				printf("S900 sample header imported from WAV\n");
 #endif
@@ -2313,8 +2876,8 @@ akai_wav2sample(int wavfd,char *wavname,struct vol_s *volp,u_int findex,
 				/* create S900 sample header */
 				bzero(&s900hdr,sizeof(struct akai_sample900_s));
 
-				s900hdr.srate[1]=0xff&(samplerate>>8);
-				s900hdr.srate[0]=0xff&samplerate;
+				s900hdr.srate[1]=0xff&(cp->samplerate>>8);
+				s900hdr.srate[0]=0xff&cp->samplerate;
 
 				s900hdr.npitch[1]=0xff&(SAMPLE900_NPITCH_DEF>>8); /* XXX */
 				s900hdr.npitch[0]=0xff&SAMPLE900_NPITCH_DEF; /* XXX */
@@ -2344,33 +2907,40 @@ akai_wav2sample(int wavfd,char *wavname,struct vol_s *volp,u_int findex,
 
 			/* set RAM name of sample */
 			/* Note: akai_fixramname() not needed afterwards */
-			ascii2akai_name(sname,(u_char *)s900hdr.name,1); /* 1: S900 */
+			ascii2akai_name(sname[ch],(u_char *)s900hdr.name,1); /* 1: S900 */
 
 			/* write sample header */
-			if (akai_write_file(0,(u_char *)&s900hdr,&tmpfile,0,hdrsize)<0){
+			if (akai_write_file(0,(u_char *)&s900hdr,&tmpfile[ch],0,hdrsize)<0){
 				fprintf(stderr,"cannot write sample header\n");
-				goto akai_wav2sample_exit;
+				goto akai_wav2sample_import_delete;
 			}
 
-			if (s9cflag){
+			if (cp->s9cflag){
 				/* second pass to convert 16bit WAV sample format into S900 compressed sample format */
-				if (akai_sample900compr_wav2sample(sbuf,wavbuf,samplecountpart)<0){ /* sbuf!=NULL: second pass */
-					goto akai_wav2sample_exit;
+				if (akai_sample900compr_wav2sample(cp->sbuf,cp->wavbuf,samplecountpart)<0){ /* sbuf!=NULL: second pass */
+					goto akai_wav2sample_import_delete;
 				}
 			}else{
 				/* convert 16bit WAV sample format into S900 non-compressed sample format */
-				akai_sample900noncompr_wav2sample(sbuf,wavbuf,samplecountpart);
+				akai_sample900noncompr_wav2sample(cp->sbuf,cp->wavbuf,samplecountpart);
+			}
+
+			/* write sample */
+			if (akai_write_file(0,cp->sbuf,&tmpfile[ch],hdrsize,hdrsize+samplesize)<0){
+				fprintf(stderr,"cannot write sample\n");
+				goto akai_wav2sample_import_delete;
 			}
 		}else{
 #ifndef WAV_AKAIHEAD_DISABLE
-			if (wavakaiheadfound){
+			/* Note: sample header chunk only for first channel */
+			if (wavakaiheadfound&&(ch==0)){
 				/* read S1000/S3000 sample header */
 				/* Note: S1000 header is contained within S3000 header */
-				if (READ(wavfd,(u_char *)&s3000hdr,hdrsize)!=(int)hdrsize){
+				if (READ(cp->wavfd,(u_char *)&s3000hdr,hdrsize)!=(int)hdrsize){
 					fprintf(stderr,"cannot read sample header\n");
-					goto akai_wav2sample_exit;
+					goto akai_wav2sample_import_delete;
 				}
-				bcount+=hdrsize;
+				cp->bcount+=hdrsize;
 #if 1
 				if (type==AKAI_SAMPLE1000_FTYPE){
 					printf("S1000 sample header imported from WAV\n");
@@ -2399,8 +2969,8 @@ akai_wav2sample(int wavfd,char *wavname,struct vol_s *volp,u_int findex,
 				s3000hdr.s1000.stpaira[1]=0xff&(AKAI_SAMPLE1000_STPAIRA_NONE>>8);
 				s3000hdr.s1000.stpaira[0]=0xff&AKAI_SAMPLE1000_STPAIRA_NONE;
 
-				s3000hdr.s1000.srate[1]=0xff&(samplerate>>8);
-				s3000hdr.s1000.srate[0]=0xff&samplerate;
+				s3000hdr.s1000.srate[1]=0xff&(cp->samplerate>>8);
+				s3000hdr.s1000.srate[0]=0xff&cp->samplerate;
 			}
 
 			/* set correct slen */
@@ -2410,17 +2980,17 @@ akai_wav2sample(int wavfd,char *wavname,struct vol_s *volp,u_int findex,
 			s3000hdr.s1000.slen[0]=0xff&samplecount;
 
 			/* set loop data */
-			if(ltype >= 0) {
-				if(ltype == 0) {
-					u_int llen = lend - lstart;
+			if(cp->ltype >= 0) {
+				if(cp->ltype == 0) {
+					u_int llen = cp->lend - cp->lstart;
 
 					s3000hdr.s1000.lnum = 1;
 					s3000hdr.s1000.lfirst = 0;
 					
-					s3000hdr.s1000.loop[0].at[3]=0xff&(lend>>24);
-					s3000hdr.s1000.loop[0].at[2]=0xff&(lend>>16);
-					s3000hdr.s1000.loop[0].at[1]=0xff&(lend>>8);
-					s3000hdr.s1000.loop[0].at[0]=0xff&lend;
+					s3000hdr.s1000.loop[0].at[3]=0xff&(cp->lend>>24);
+					s3000hdr.s1000.loop[0].at[2]=0xff&(cp->lend>>16);
+					s3000hdr.s1000.loop[0].at[1]=0xff&(cp->lend>>8);
+					s3000hdr.s1000.loop[0].at[0]=0xff&cp->lend;
 
 					s3000hdr.s1000.loop[0].flen[1]=0;
 					s3000hdr.s1000.loop[0].flen[0]=0;
@@ -2433,58 +3003,82 @@ akai_wav2sample(int wavfd,char *wavname,struct vol_s *volp,u_int findex,
 					s3000hdr.s1000.loop[0].time[1]=0xff&(SAMPLE1000LOOP_TIME_HOLD>>8);
 					s3000hdr.s1000.loop[0].time[0]=0xff&SAMPLE1000LOOP_TIME_HOLD;
 
-					printf("created loop at %d with length %d\n", lend, llen);
+					printf("created loop at %d with length %d\n", cp->lend, llen);
 				} else {
-					printf("unsupported loop type %d\n", ltype);
+					printf("unsupported loop type %d\n", cp->ltype);
 				}
 			}
 
 			/* set RAM name of sample */
 			/* Note: akai_fixramname() not needed afterwards */
-			ascii2akai_name(sname,s3000hdr.s1000.name,0); /* 0: not S900 */
+			ascii2akai_name(sname[ch],s3000hdr.s1000.name,0); /* 0: not S900 */
 
 			/* write sample header */
-			if (akai_write_file(0,(u_char *)&s3000hdr,&tmpfile,0,hdrsize)<0){
+			if (akai_write_file(0,(u_char *)&s3000hdr,&tmpfile[ch],0,hdrsize)<0){
 				fprintf(stderr,"cannot write sample header\n");
-				goto akai_wav2sample_exit;
+				goto akai_wav2sample_import_delete;
 			}
-
-			/* Note: no sample format conversion necessary for S1000/S3000 */
-		}
-
-		/* write sample */
-		if (akai_write_file(0,sbuf,&tmpfile,hdrsize,hdrsize+samplesize)<0){
-			fprintf(stderr,"cannot write sample\n");
-			goto akai_wav2sample_exit;
 		}
 	}
 
 	printf("sample imported from WAV\n");
 
-	ret=0; /* success */
+	return 0;
 
-akai_wav2sample_exit:
-	if (tempbuf!=NULL){
-		free(tempbuf);
+akai_wav2sample_import_delete:
+	/* Note: no partly imported sample left in volume */
+	while (fnum>0){
+		fnum--;
+		akai_delete_file(&tmpfile[fnum]); /* XXX ignore error */
 	}
-	if (wavbuf!=NULL){
-		free(wavbuf);
+	return -1;
+}
+
+void
+akai_wav2sample_finish(struct wav2sample_s *cp)
+{
+
+	if (cp==NULL){
+		return;
 	}
-	if (type==AKAI_SAMPLE900_FTYPE){ /* S900 sample? */
-		if (sbuf!=NULL){
-			free(sbuf);
-		}
-		if (s9cflag){
-			akai_sample900compr_wav2sample(NULL,NULL,0); /* NULL,NULL: free buffers if still allocated */
-		}
+
+	if (cp->wavbuf!=NULL){
+		free(cp->wavbuf);
+		cp->wavbuf=NULL;
+	}
+	if (cp->sbuf!=NULL){
+		free(cp->sbuf);
+		cp->sbuf=NULL;
+	}
+	wav_conv_free(&cp->conv);
+	if ((cp->type==AKAI_SAMPLE900_FTYPE)&&cp->s9cflag){
+		akai_sample900compr_wav2sample(NULL,NULL,0); /* NULL,NULL: free buffers if still allocated */
 	}
-	if (what&WAV2SAMPLE_OPEN){
-		if (wavfd>=0){
-			CLOSE(wavfd);
+	if (cp->openflag){
+		if (cp->wavfd>=0){
+			CLOSE(cp->wavfd);
 		}
+		cp->wavfd=-1;
+		cp->openflag=0;
 	}
+}
+
+int
+akai_wav2sample(int wavfd,char *wavname,struct vol_s *volp,u_int findex,
+				u_int type,int s9cflag,u_int osver,u_char *tagp,
+				u_int *bcountp,int what)
+{
+	struct wav2sample_s ctx;
+	int ret;
+
+	ret=akai_wav2sample_check(&ctx,(what&WAV2SAMPLE_OPEN)?-1:wavfd,wavname,volp,findex,type,s9cflag,osver,tagp);
+	if (ret==0){
+		ret=akai_wav2sample_import(&ctx,what);
+	}
+	akai_wav2sample_finish(&ctx);
+
 	if (bcountp!=NULL){
-		*bcountp=bcount;
+		*bcountp=ctx.bcount;
 	}
 	return ret;
 }
@@ -23,6 +23,7 @@
 
 
 #include "akaiutil_io.h"
+#include "akaiutil_wav.h"
 
 
 
@@ -80,6 +81,9 @@ struct akai_sample900_s{
 #define SAMPLE900COMPR_INTERVALSIZ		(1<<SAMPLE900COMPR_BITNUM_MAX)  /* interval size for max. bit number */
 #define SAMPLE900COMPR_BITMASK			(SAMPLE900COMPR_INTERVALSIZ-1)  /* bit mask for interval */
 #define SAMPLE900COMPR_INTERVALSIZ2		(SAMPLE900COMPR_INTERVALSIZ>>1) /* half interval size */
+/* encoder modes */
+#define SAMPLE900COMPR_MODE_GROUP		0 /* full groups only, bit number from max. increment update */
+#define SAMPLE900COMPR_MODE_OPT			1 /* min. number of bits, including short groups */
 
 #define AKAI_SAMPLE900_FTYPE	'S' /* file type */
 
@@ -392,6 +396,57 @@ struct akai_cdsetup3000_entry_s{
 
 
 
+/* converter contexts */
+
+/* sampler file to WAV */
+struct sample2wav_s{
+	struct file_s *fp;
+	struct akai_sample3000_s s3000hdr; /* Note: also buffer for S900 and S1000 header */
+	u_int hdrsize;
+	u_int samplecount;
+	u_int samplecountpart;
+	u_int samplesize;
+	u_int samplerate;
+	u_int wavsamplesize;
+	u_int wavsize; /* WAV file size */
+	char wavname[AKAI_NAME_LEN+4+1]; /* name (ASCII), +4 for ".<type>", +1 for '\0' */
+	u_char *sbuf;
+	u_char *wavbuf;
+	int wavfd; /* WAV file created by context, -1 if none */
+};
+
+/* WAV to sampler file */
+struct wav2sample_s{
+	char *wavname;
+	struct vol_s *volp;
+	u_int findex;
+	u_int type;
+	int s9cflag;
+	u_int osver;
+	u_char *tagp;
+	int wavfd;
+	int openflag; /* WAV file opened by context */
+	u_int hdrsize;
+	char *tname;
+	int nlen;
+	u_int chnr;
+	u_int samplerate;
+	u_int bitnr;
+	u_int ftag;
+	u_int wavsamplesize; /* in bytes after conversion to 16bit */
+	u_int wavdatasize; /* in bytes in WAV file */
+	struct wav_conv_s conv;
+	u_int extrasize;
+	int ltype;
+	u_int lstart;
+	u_int lend;
+	u_int bcount; /* number of bytes read from WAV file */
+	u_char *wavbuf;
+	u_char *sbuf;
+};
+
+
+
 /* Declarations */
 
 extern int akai_file_info(struct file_s *fp,int verbose);
@@ -411,6 +466,9 @@ extern void akai_sample900noncompr_wav2sample(u_char *sbuf,u_char *wavbuf,u_int
 extern u_int akai_sample900compr_getbits(u_char *buf,u_int bitpos,u_int bitnum);
 extern u_int akai_sample900compr_sample2wav(u_char *sbuf,u_char *wavbuf,u_int sbufsiz,u_int wavbufsiz);
 extern void akai_sample900compr_setbits(u_char *buf,u_int bitpos,u_int bitnum,u_int val);
+extern int sample900compr_mode; /* SAMPLE900COMPR_MODE_* used by akai_sample900compr_wav2sample() */
+extern int akai_sample900compr_wav2sample_group(u_char *sbuf,u_char *wavbuf,u_int samplecountpart);
+extern int akai_sample900compr_wav2sample_opt(u_char *sbuf,u_char *wavbuf,u_int samplecountpart);
 extern int akai_sample900compr_wav2sample(u_char *sbuf,u_char *wavbuf,u_int samplecountpart);
 
 extern int akai_sample900_noncompr2compr(struct file_s *fp,struct vol_s *volp);
@@ -420,10 +478,22 @@ extern int akai_sample900_compr2noncompr(struct file_s *fp,struct vol_s *volp);
 #define SAMPLE2WAV_EXPORT		2
 #define SAMPLE2WAV_CREATE		4
 #define SAMPLE2WAV_ALL			0xff
+extern int akai_sample2wav_check(struct sample2wav_s *cp,struct file_s *fp);
+extern int akai_sample2wav_read(struct sample2wav_s *cp);
+extern int akai_sample2wav_conv(struct sample2wav_s *cp);
+extern int akai_sample2wav_load(struct sample2wav_s *cp);
+extern int akai_sample2wav_write(struct sample2wav_s *cp,int wavfd,u_char *outbuf);
+extern int akai_sample2wav_export(struct sample2wav_s *cp,int wavfd);
+extern void akai_sample2wav_finish(struct sample2wav_s *cp);
 extern int akai_sample2wav(struct file_s *fp,int wavfd,u_int *sizep,char **wavnamep,int what);
 
 #define WAV2SAMPLE_OPEN			1
 #define WAV2SAMPLE_OVERWRITE	2
+#define WAV2SAMPLE_CHUNKSIZ		0x10000 /* chunk size in bytes per channel for streaming import */
+extern int akai_wav2sample_check(struct wav2sample_s *cp,int wavfd,char *wavname,struct vol_s *volp,u_int findex,
+								 u_int type,int s9cflag,u_int osver,u_char *tagp);
+extern int akai_wav2sample_import(struct wav2sample_s *cp,int what);
+extern void akai_wav2sample_finish(struct wav2sample_s *cp);
 extern int akai_wav2sample(int wavfd,char *wavname,struct vol_s *volp,u_int findex,
 						   u_int type,int s9cflag,u_int osver,u_char *tagp,
 						   u_int *bcountp,int what);
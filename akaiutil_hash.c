@@ -0,0 +1,399 @@
+/*
+* Copyright (C) 2026 akaiutil contributors.
+*
+* XXH64 and SHA-256 checksums, based on akaiutil
+* by Klaus Michael Indlekofer <m.indlekofer@gmx.de>.
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+
+
+
+
+#include "akaiutil_io.h"
+#include "akaiutil_hash.h"
+
+
+
+/* XXH64 */
+/* Note: see xxHash specification, result is identical to xxh64sum */
+/* Note: 64bit constants composed of 32bit halves for older compilers */
+
+#define XXH64_PRIME1	((((U_INT64)0x9e3779b1)<<32)|((U_INT64)0x85ebca87))
+#define XXH64_PRIME2	((((U_INT64)0xc2b2ae3d)<<32)|((U_INT64)0x27d4eb4f))
+#define XXH64_PRIME3	((((U_INT64)0x165667b1)<<32)|((U_INT64)0x9e3779f9))
+#define XXH64_PRIME4	((((U_INT64)0x85ebca77)<<32)|((U_INT64)0xc2b2ae63))
+#define XXH64_PRIME5	((((U_INT64)0x27d4eb2f)<<32)|((U_INT64)0x165667c5))
+
+#define XXH64_ROTL(x,r)	(((x)<<(r))|((x)>>(64-(r))))
+
+/* read little endian, no alignment required */
+static U_INT64
+xxh64_read64(u_char *p)
+{
+
+	return ((U_INT64)p[0])
+		|(((U_INT64)p[1])<<8)
+		|(((U_INT64)p[2])<<16)
+		|(((U_INT64)p[3])<<24)
+		|(((U_INT64)p[4])<<32)
+		|(((U_INT64)p[5])<<40)
+		|(((U_INT64)p[6])<<48)
+		|(((U_INT64)p[7])<<56);
+}
+
+static U_INT64
+xxh64_read32(u_char *p)
+{
+
+	return ((U_INT64)p[0])
+		|(((U_INT64)p[1])<<8)
+		|(((U_INT64)p[2])<<16)
+		|(((U_INT64)p[3])<<24);
+}
+
+static U_INT64
+xxh64_round(U_INT64 acc,U_INT64 input)
+{
+
+	acc+=input*XXH64_PRIME2;
+	acc=XXH64_ROTL(acc,31);
+	acc*=XXH64_PRIME1;
+	return acc;
+}
+
+static U_INT64
+xxh64_merge(U_INT64 acc,U_INT64 val)
+{
+
+	acc^=xxh64_round(0,val);
+	acc=acc*XXH64_PRIME1+XXH64_PRIME4;
+	return acc;
+}
+
+void
+hash_xxh64_init(struct hash_xxh64_s *hp,U_INT64 seed)
+{
+
+	if (hp==NULL){
+		return;
+	}
+
+	hp->v[0]=seed+XXH64_PRIME1+XXH64_PRIME2;
+	hp->v[1]=seed+XXH64_PRIME2;
+	hp->v[2]=seed;
+	hp->v[3]=seed-XXH64_PRIME1;
+	hp->total=0;
+	hp->memsize=0;
+}
+
+void
+hash_xxh64_update(struct hash_xxh64_s *hp,u_char *buf,u_int size)
+{
+	U_INT64 v0,v1,v2,v3;
+	u_int n;
+
+	if ((hp==NULL)||(buf==NULL)){
+		return;
+	}
+
+	hp->total+=(U_INT64)size;
+
+	if (hp->memsize>0){
+		/* fill incomplete stripe */
+		n=32-hp->memsize;
+		if (n>size){
+			n=size;
+		}
+		bcopy(buf,hp->mem+hp->memsize,n);
+		hp->memsize+=n;
+		buf+=n;
+		size-=n;
+		if (hp->memsize<32){
+			return;
+		}
+		hp->v[0]=xxh64_round(hp->v[0],xxh64_read64(hp->mem+0));
+		hp->v[1]=xxh64_round(hp->v[1],xxh64_read64(hp->mem+8));
+		hp->v[2]=xxh64_round(hp->v[2],xxh64_read64(hp->mem+16));
+		hp->v[3]=xxh64_round(hp->v[3],xxh64_read64(hp->mem+24));
+		hp->memsize=0;
+	}
+
+	/* stripes of 32 bytes */
+	v0=hp->v[0];
+	v1=hp->v[1];
+	v2=hp->v[2];
+	v3=hp->v[3];
+	for (;size>=32;buf+=32,size-=32){
+		v0=xxh64_round(v0,xxh64_read64(buf+0));
+		v1=xxh64_round(v1,xxh64_read64(buf+8));
+		v2=xxh64_round(v2,xxh64_read64(buf+16));
+		v3=xxh64_round(v3,xxh64_read64(buf+24));
+	}
+	hp->v[0]=v0;
+	hp->v[1]=v1;
+	hp->v[2]=v2;
+	hp->v[3]=v3;
+
+	/* rest */
+	if (size>0){
+		bcopy(buf,hp->mem,size);
+		hp->memsize=size;
+	}
+}
+
+U_INT64
+hash_xxh64_final(struct hash_xxh64_s *hp)
+{
+	U_INT64 h;
+	u_char *p;
+	u_int n;
+
+	if (hp==NULL){
+		return 0;
+	}
+
+	if (hp->total>=32){
+		h=XXH64_ROTL(hp->v[0],1)+XXH64_ROTL(hp->v[1],7)+XXH64_ROTL(hp->v[2],12)+XXH64_ROTL(hp->v[3],18);
+		h=xxh64_merge(h,hp->v[0]);
+		h=xxh64_merge(h,hp->v[1]);
+		h=xxh64_merge(h,hp->v[2]);
+		h=xxh64_merge(h,hp->v[3]);
+	}else{
+		h=hp->v[2]+XXH64_PRIME5; /* Note: v[2] is seed */
+	}
+	h+=hp->total;
+
+	/* remaining bytes */
+	p=hp->mem;
+	n=hp->memsize;
+	for (;n>=8;p+=8,n-=8){
+		h^=xxh64_round(0,xxh64_read64(p));
+		h=XXH64_ROTL(h,27)*XXH64_PRIME1+XXH64_PRIME4;
+	}
+	if (n>=4){
+		h^=xxh64_read32(p)*XXH64_PRIME1;
+		h=XXH64_ROTL(h,23)*XXH64_PRIME2+XXH64_PRIME3;
+		p+=4;
+		n-=4;
+	}
+	for (;n>0;p++,n--){
+		h^=((U_INT64)*p)*XXH64_PRIME5;
+		h=XXH64_ROTL(h,11)*XXH64_PRIME1;
+	}
+
+	/* avalanche */
+	h^=h>>33;
+	h*=XXH64_PRIME2;
+	h^=h>>29;
+	h*=XXH64_PRIME3;
+	h^=h>>32;
+
+	return h;
+}
+
+/* hex string, canonical (big endian) representation, str must have space for HASH_XXH64_STRLEN+1 */
+void
+hash_xxh64_str(U_INT64 h,char *str)
+{
+
+	if (str==NULL){
+		return;
+	}
+
+	sprintf(str,"%08x%08x",(u_int)(h>>32),(u_int)(h&0xffffffff));
+}
+
+
+/* SHA-256 */
+/* Note: see FIPS 180-4, result is identical to sha256sum */
+
+static u_int sha256_k[64]={
+	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+	0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+	0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+#define SHA256_ROTR(x,r)	((((x)&0xffffffff)>>(r))|(((x)<<(32-(r)))&0xffffffff))
+
+/* process one block of 64 bytes */
+static void
+sha256_block(u_int *h,u_char *p)
+{
+	u_int w[64];
+	u_int a,b,c,d,e,f,g,hh;
+	u_int t1,t2;
+	u_int i;
+
+	for (i=0;i<16;i++,p+=4){
+		w[i]=(((u_int)p[0])<<24)|(((u_int)p[1])<<16)|(((u_int)p[2])<<8)|((u_int)p[3]);
+	}
+	for (;i<64;i++){
+		t1=SHA256_ROTR(w[i-2],17)^SHA256_ROTR(w[i-2],19)^((w[i-2]&0xffffffff)>>10);
+		t2=SHA256_ROTR(w[i-15],7)^SHA256_ROTR(w[i-15],18)^((w[i-15]&0xffffffff)>>3);
+		w[i]=(t1+w[i-7]+t2+w[i-16])&0xffffffff;
+	}
+
+	a=h[0];
+	b=h[1];
+	c=h[2];
+	d=h[3];
+	e=h[4];
+	f=h[5];
+	g=h[6];
+	hh=h[7];
+	for (i=0;i<64;i++){
+		t1=hh+(SHA256_ROTR(e,6)^SHA256_ROTR(e,11)^SHA256_ROTR(e,25))+((e&f)^((~e)&g))+sha256_k[i]+w[i];
+		t2=(SHA256_ROTR(a,2)^SHA256_ROTR(a,13)^SHA256_ROTR(a,22))+((a&b)^(a&c)^(b&c));
+		hh=g;
+		g=f;
+		f=e;
+		e=(d+t1)&0xffffffff;
+		d=c;
+		c=b;
+		b=a;
+		a=(t1+t2)&0xffffffff;
+	}
+	h[0]=(h[0]+a)&0xffffffff;
+	h[1]=(h[1]+b)&0xffffffff;
+	h[2]=(h[2]+c)&0xffffffff;
+	h[3]=(h[3]+d)&0xffffffff;
+	h[4]=(h[4]+e)&0xffffffff;
+	h[5]=(h[5]+f)&0xffffffff;
+	h[6]=(h[6]+g)&0xffffffff;
+	h[7]=(h[7]+hh)&0xffffffff;
+}
+
+void
+hash_sha256_init(struct hash_sha256_s *hp)
+{
+
+	if (hp==NULL){
+		return;
+	}
+
+	hp->h[0]=0x6a09e667;
+	hp->h[1]=0xbb67ae85;
+	hp->h[2]=0x3c6ef372;
+	hp->h[3]=0xa54ff53a;
+	hp->h[4]=0x510e527f;
+	hp->h[5]=0x9b05688c;
+	hp->h[6]=0x1f83d9ab;
+	hp->h[7]=0x5be0cd19;
+	hp->total=0;
+	hp->memsize=0;
+}
+
+void
+hash_sha256_update(struct hash_sha256_s *hp,u_char *buf,u_int size)
+{
+	u_int n;
+
+	if ((hp==NULL)||(buf==NULL)){
+		return;
+	}
+
+	hp->total+=(U_INT64)size;
+
+	if (hp->memsize>0){
+		/* fill incomplete block */
+		n=64-hp->memsize;
+		if (n>size){
+			n=size;
+		}
+		bcopy(buf,hp->mem+hp->memsize,n);
+		hp->memsize+=n;
+		buf+=n;
+		size-=n;
+		if (hp->memsize<64){
+			return;
+		}
+		sha256_block(hp->h,hp->mem);
+		hp->memsize=0;
+	}
+
+	/* blocks of 64 bytes */
+	for (;size>=64;buf+=64,size-=64){
+		sha256_block(hp->h,buf);
+	}
+
+	/* rest */
+	if (size>0){
+		bcopy(buf,hp->mem,size);
+		hp->memsize=size;
+	}
+}
+
+/* digest in md, md must have space for HASH_SHA256_SIZE bytes */
+void
+hash_sha256_final(struct hash_sha256_s *hp,u_char *md)
+{
+	U_INT64 bits;
+	u_int i;
+
+	if ((hp==NULL)||(md==NULL)){
+		return;
+	}
+
+	bits=hp->total<<3;
+
+	/* padding */
+	hp->mem[hp->memsize++]=0x80;
+	if (hp->memsize>56){
+		bzero(hp->mem+hp->memsize,64-hp->memsize);
+		sha256_block(hp->h,hp->mem);
+		hp->memsize=0;
+	}
+	bzero(hp->mem+hp->memsize,56-hp->memsize);
+	for (i=0;i<8;i++){
+		hp->mem[56+i]=(u_char)(0xff&(bits>>(56-8*i)));
+	}
+	sha256_block(hp->h,hp->mem);
+	hp->memsize=0;
+
+	/* big endian */
+	for (i=0;i<8;i++){
+		md[4*i+0]=(u_char)(0xff&(hp->h[i]>>24));
+		md[4*i+1]=(u_char)(0xff&(hp->h[i]>>16));
+		md[4*i+2]=(u_char)(0xff&(hp->h[i]>>8));
+		md[4*i+3]=(u_char)(0xff&hp->h[i]);
+	}
+}
+
+/* hex string, str must have space for HASH_SHA256_STRLEN+1 */
+void
+hash_sha256_str(u_char *md,char *str)
+{
+	u_int i;
+
+	if ((md==NULL)||(str==NULL)){
+		return;
+	}
+
+	for (i=0;i<HASH_SHA256_SIZE;i++){
+		sprintf(str+2*i,"%02x",(u_int)md[i]);
+	}
+}
+
+
+
+/* EOF */
@@ -0,0 +1,71 @@
+#ifndef __AKAIUTIL_HASH_H
+#define __AKAIUTIL_HASH_H
+/*
+* Copyright (C) 2026 akaiutil contributors.
+*
+* XXH64 and SHA-256 checksums, based on akaiutil
+* by Klaus Michael Indlekofer <m.indlekofer@gmx.de>.
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+
+
+
+
+#include "akaiutil_io.h"
+
+
+
+/* hash functions */
+
+/* XXH64 (xxHash 64bit), fast non-cryptographic hash */
+#define HASH_XXH64_SIZE		8 /* size of hash value in bytes */
+#define HASH_XXH64_STRLEN	(2*HASH_XXH64_SIZE) /* length of hex string */
+struct hash_xxh64_s{
+	U_INT64 v[4]; /* accumulators */
+	U_INT64 total; /* total number of bytes */
+	u_char mem[32]; /* incomplete stripe */
+	u_int memsize; /* number of bytes in mem */
+};
+
+/* SHA-256, cryptographic hash */
+#define HASH_SHA256_SIZE	32 /* size of hash value in bytes */
+#define HASH_SHA256_STRLEN	(2*HASH_SHA256_SIZE) /* length of hex string */
+struct hash_sha256_s{
+	u_int h[8]; /* state */
+	U_INT64 total; /* total number of bytes */
+	u_char mem[64]; /* incomplete block */
+	u_int memsize; /* number of bytes in mem */
+};
+
+
+
+/* Declarations */
+
+extern void hash_xxh64_init(struct hash_xxh64_s *hp,U_INT64 seed);
+extern void hash_xxh64_update(struct hash_xxh64_s *hp,u_char *buf,u_int size);
+extern U_INT64 hash_xxh64_final(struct hash_xxh64_s *hp);
+extern void hash_xxh64_str(U_INT64 h,char *str);
+
+extern void hash_sha256_init(struct hash_sha256_s *hp);
+extern void hash_sha256_update(struct hash_sha256_s *hp,u_char *buf,u_int size);
+extern void hash_sha256_final(struct hash_sha256_s *hp,u_char *md);
+extern void hash_sha256_str(u_char *md,char *str);
+
+
+
+#endif /* !__AKAIUTIL_HASH_H */
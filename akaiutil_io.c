@@ -20,8 +20,24 @@
 
 
 
+#if defined(__linux__)&&!defined(IO_ZEROCOPY_DISABLE)
+#define _GNU_SOURCE /* for copy_file_range() */
+#endif
+
 #include "akaiutil_io.h"
 
+#ifndef WIN32
+#include <errno.h>
+#endif
+
+#if defined(__linux__)&&!defined(IO_ZEROCOPY_DISABLE)
+#include <sys/sendfile.h>
+#define IO_ZEROCOPY_SENDFILE
+#if defined(__GLIBC__)&&((__GLIBC__>2)||((__GLIBC__==2)&&(__GLIBC_MINOR__>=27)))
+#define IO_ZEROCOPY_COPYFILERANGE
+#endif
+#endif
+
 
 
 /* cache */
@@ -397,4 +413,207 @@ io_blks(int fd,u_char *buf,u_int bstart,u_int bsize,u_int blksize,int cachealloc
 
 
 
+#ifndef WIN32
+/* read size bytes from current position of fd */
+/* Note: unlike read(), also complete for pipes, less than size only at EOF */
+int
+io_read(int fd,void *buf,u_int size)
+{
+	ssize_t n;
+	u_int count;
+
+	for (count=0;count<size;count+=(u_int)n){
+		n=read(fd,(u_char *)buf+count,size-count);
+		if (n<0){
+			if (errno==EINTR){
+				n=0;
+				continue;
+			}
+			return -1;
+		}
+		if (n==0){ /* EOF? */
+			break;
+		}
+	}
+
+	return (int)count;
+}
+#endif
+
+/* skip size bytes forward from current position of fd */
+/* Note: reads and discards if fd is not seekable (e.g. pipe) */
+int
+io_skip(int fd,OFF_T size)
+{
+#ifndef WIN32
+	u_char *buf;
+	u_int n;
+#endif
+
+	if (size==0){
+		return 0;
+	}
+	if (LSEEK(fd,size,SEEK_CUR)>=0){
+		return 0;
+	}
+#ifndef WIN32
+	if ((errno!=ESPIPE)||(size<0)){
+		return -1;
+	}
+	if ((buf=(u_char *)malloc(IO_SKIP_BUFSIZ))==NULL){
+		perror("malloc");
+		return -1;
+	}
+	while (size>0){
+		n=(size>(OFF_T)IO_SKIP_BUFSIZ)?IO_SKIP_BUFSIZ:(u_int)size;
+		if (READ(fd,buf,n)!=(int)n){
+			free(buf);
+			return -1;
+		}
+		size-=(OFF_T)n;
+	}
+	free(buf);
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/* read and discard until EOF (e.g. remainder of stream) */
+int
+io_skip_eof(int fd)
+{
+	u_char *buf;
+	int n;
+
+	if ((buf=(u_char *)malloc(IO_SKIP_BUFSIZ))==NULL){
+		perror("malloc");
+		return -1;
+	}
+	do{
+		n=READ(fd,buf,IO_SKIP_BUFSIZ);
+	}while (n==IO_SKIP_BUFSIZ);
+	free(buf);
+	return (n<0)?-1:0;
+}
+
+/* read bytes from fd at absolute offset */
+/* Note: doesn't change file position if possible, can be used by multiple threads */
+int
+io_pread(int fd,u_char *buf,u_int size,OFF_T off)
+{
+#ifndef WIN32
+	ssize_t n;
+
+	while (size>0){
+		n=pread(fd,(void *)buf,size,(off_t)off);
+		if (n<=0){
+			return -1;
+		}
+		buf+=n;
+		off+=(OFF_T)n;
+		size-=(u_int)n;
+	}
+#else
+	/* XXX not thread-safe */
+	if (LSEEK(fd,off,SEEK_SET)<0){
+		return -1;
+	}
+	if (READ(fd,(void *)buf,size)!=(int)size){
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+
+
+/* copy bytes from fd (at absolute offset) to current position of outfd */
+/* Note: bypasses cache, doesn't change file position of fd, */
+/*       can be used by multiple threads if cache has been flushed before */
+int
+io_copy_range(int fd,OFF_T off,u_int size,int outfd)
+{
+	u_char *buf;
+	u_int chunk;
+	int err;
+#ifdef IO_ZEROCOPY_SENDFILE
+	off_t o;
+	ssize_t n;
+#endif
+
+	if ((fd<0)||(outfd<0)||(off<0)){
+		return -1;
+	}
+
+	if (size==0){
+		return 0; /* done */
+	}
+
+#ifdef IO_ZEROCOPY_SENDFILE
+	o=(off_t)off;
+#ifdef IO_ZEROCOPY_COPYFILERANGE
+	/* in-kernel copy (or reflink) between regular files */
+	while (size>0){
+		n=copy_file_range(fd,&o,outfd,NULL,size,0);
+		if (n<=0){
+			break; /* try next method */
+		}
+		size-=(u_int)n;
+	}
+	if (size==0){
+		return 0; /* done */
+	}
+#endif
+	/* in-kernel copy to any output */
+	while (size>0){
+		n=sendfile(outfd,fd,&o,size);
+		if (n<=0){
+			if ((n<0)&&(errno!=EINVAL)&&(errno!=ENOSYS)){
+				perror("sendfile");
+				return -1;
+			}
+			break; /* try next method */
+		}
+		size-=(u_int)n;
+	}
+	if (size==0){
+		return 0; /* done */
+	}
+	off=(OFF_T)o;
+#endif
+
+	/* fallback: copy via buffer */
+	chunk=(size<IO_COPY_BUFSIZ)?size:IO_COPY_BUFSIZ;
+	buf=(u_char *)malloc(chunk);
+	if (buf==NULL){
+		perror("malloc");
+		return -1;
+	}
+	err=0;
+	while (size>0){
+		if (chunk>size){
+			chunk=size;
+		}
+		if (io_pread(fd,buf,chunk,off)<0){
+			perror("read");
+			err=1;
+			break;
+		}
+		if (WRITE(outfd,(void *)buf,chunk)!=(int)chunk){
+			perror("write");
+			err=1;
+			break;
+		}
+		off+=(OFF_T)chunk;
+		size-=chunk;
+	}
+	free(buf);
+
+	return err?-1:0;
+}
+
+
+
 /* EOF */
@@ -65,7 +65,7 @@
 #define CLOSE close
 #endif
 #ifndef READ
-#define READ read
+#define READ io_read /* Note: reads until size or EOF, also from pipes */
 #endif
 #ifndef WRITE
 #define WRITE write
@@ -79,6 +79,14 @@
 
 
 
+/* extent on disk */
+struct io_ext_s{
+	OFF_T off; /* absolute offset in bytes */
+	u_int size; /* in bytes */
+};
+
+
+
 /* cache */
 
 struct blk_cache_s{
@@ -112,6 +120,16 @@ extern int io_blks_direct(int fd,u_char *buf,u_int bstart,u_int bsize,u_int blks
 extern int flush_blk_cache(void);
 extern int io_blks(int fd,u_char *buf,u_int bstart,u_int bsize,u_int blksize,int cachealloc,int mode);
 
+extern int io_read(int fd,void *buf,u_int size);
+#define IO_SKIP_BUFSIZ	0x40000 /* buffer size for io_skip() if not seekable */
+extern int io_skip(int fd,OFF_T size);
+extern int io_skip_eof(int fd);
+
+extern int io_pread(int fd,u_char *buf,u_int size,OFF_T off);
+
+#define IO_COPY_BUFSIZ	0x40000 /* buffer size for io_copy_range() if no zero-copy */
+extern int io_copy_range(int fd,OFF_T off,u_int size,int outfd);
+
 
 
 #endif /* !__AKAIUTIL_IO_H */
@@ -27,6 +27,7 @@
 #include "akaiutil_tar.h"
 #include "akaiutil_file.h"
 #include "akaiutil_take.h"
+#include "akaiutil_par.h"
 
 #if (!defined(WIN32))&&(!defined(__CYGWIN__))
 /* e.g. UNIX-like systems */
@@ -52,6 +53,44 @@ extern int optopt;
 
 
 
+#ifndef WIN32
+/* stream mode: console output to stderr, stdin/stdout free for tar-file "-" */
+int stream_outfd=-1; /* saved stdout, <0: no stream mode */
+#endif
+
+/* open tar-file for tar c (outflag!=0) or tar x, "-": stdout or stdin in stream mode */
+int
+tar_file_open(char *name,int outflag)
+{
+	int fd;
+
+	if (strcmp(name,"-")==0){
+#ifndef WIN32
+		if (stream_outfd>=0){
+			/* Note: caller closes fd, stdin/stdout are kept open */
+			if ((fd=dup(outflag?stream_outfd:0))<0){
+				perror("dup");
+			}
+			return fd;
+		}
+#endif
+		fprintf(stderr,"tar-file \"-\" only in stream mode (-s)\n");
+		return -1;
+	}
+
+	if (outflag){
+		fd=OPEN(name,O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666);
+	}else{
+		fd=OPEN(name,O_RDONLY|O_BINARY,0);
+	}
+	if (fd<0){
+		perror("open");
+	}
+	return fd;
+}
+
+
+
 void
 print_progressbar(u_int end,u_int now)
 {
@@ -88,11 +127,14 @@ usage(char *name)
 #if defined(WIN32)||defined(__CYGWIN__)
 	fprintf(stderr,"usage: %s [-h] [-r] [-f] [-c <cdrom-nr> ...] [-p <physdrive-nr> ...] [<disk-file> ...]\n",name);
 #else
-	fprintf(stderr,"usage: %s [-h] [-r] [-f] <disk-file> ...\n",name);
+	fprintf(stderr,"usage: %s [-h] [-r] [-f] [-s] <disk-file> ...\n",name);
 #endif
 	fprintf(stderr,"\t-h\tprint this info\n");
 	fprintf(stderr,"\t-r\tread-only mode\n");
 	fprintf(stderr,"\t-f\tenable floppy format\n");
+#ifndef WIN32
+	fprintf(stderr,"\t-s\tstream mode, tar-file \"-\" is stdin/stdout, console output to stderr\n");
+#endif
 #if defined(WIN32)||defined(__CYGWIN__)
 	fprintf(stderr,"\t-c\tCD-ROM drive\n");
 	fprintf(stderr,"\t-p\tphysical drive\n");
@@ -106,6 +148,7 @@ main(int argc, char **argv)
 	int errflag;
 	int readonly;
 	int floppyenable;
+	int streamflag;
 	u_int i;
 
 	if (argc<=1){
@@ -116,12 +159,15 @@ main(int argc, char **argv)
 	readonly=0; /* R/W so far */
 	disk_num=0; /* no disks so far */
 	floppyenable=0; /* start with harddisk format only */
+	streamflag=0;
 
 	errflag=0;
-#if defined(WIN32)||defined(__CYGWIN__)
+#if defined(WIN32)
 #define OPT_STRING "hrfc:p:"
+#elif defined(__CYGWIN__)
+#define OPT_STRING "hrfsc:p:"
 #else
-#define OPT_STRING "hrf"
+#define OPT_STRING "hrfs"
 #endif
 	while ((op=getopt(argc,argv,OPT_STRING))!=EOF){
 		switch (op){
@@ -154,6 +200,11 @@ main(int argc, char **argv)
 		case 'f':
 			floppyenable=1; /* allow floppy format */
 			break;
+#ifndef WIN32
+		case 's':
+			streamflag=1; /* stream mode */
+			break;
+#endif
 		case '?':
 			/* FALL THROUGH */
 		default:
@@ -171,6 +222,19 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
+#ifndef WIN32
+	if (streamflag){
+		/* keep stdout for tar-file "-", console output to stderr */
+		fflush(stdout);
+		if (((stream_outfd=dup(1))<0)||(dup2(2,1)<0)){
+			perror("dup");
+			exit(1);
+		}
+		/* Note: commands unbuffered from stdin, tar-file "-" may follow command */
+		setvbuf(stdin,NULL,_IONBF,0);
+	}
+#endif
+
 	/* open disk files */
 	for (;(optind<argc)&&(disk_num<DISK_NUM_MAX);optind++){
 		if (open_disk(argv[optind],readonly)<0){
@@ -276,6 +340,7 @@ main_restart: /* restart with opened disks */
 			CMD_SAMPLE900COMPR,
 			CMD_SAMPLE900COMPRI,
 			CMD_SAMPLE900COMPRALL,
+			CMD_SAMPLE900COMPRMODE,
 			CMD_FIXRAMNAME,
 			CMD_FIXRAMNAMEI,
 			CMD_FIXRAMNAMEALL,
@@ -339,19 +404,27 @@ main_restart: /* restart with opened disks */
 			CMD_SAMPLE2WAV,
 			CMD_SAMPLE2WAVI,
 			CMD_SAMPLE2WAVALL,
+			CMD_EXPORTTHREADS,
 			CMD_PUT,
 			CMD_WAV2SAMPLE,
 			CMD_WAV2SAMPLE9,
 			CMD_WAV2SAMPLE9C,
 			CMD_WAV2SAMPLE1,
 			CMD_WAV2SAMPLE3,
+			CMD_WAVDITHER,
+			CMD_WAVRESAMPLE,
 			CMD_TGETI,
 			CMD_TAKE2WAVI,
+			CMD_TAKE2WAVMS,
+			CMD_TAKE2WAVSMP,
 			CMD_TAKE2WAVALL,
+			CMD_TGETALL,
 			CMD_TPUT,
 			CMD_WAV2TAKE,
 			CMD_TARC,
 			CMD_TARCWAV,
+			CMD_TARCINC,
+			CMD_TARCDEDUP,
 			CMD_TARX,
 			CMD_TARX9,
 			CMD_TARX1,
@@ -362,6 +435,14 @@ main_restart: /* restart with opened disks */
 			CMD_TARXWAV9C,
 			CMD_TARXWAV1,
 			CMD_TARXWAV3,
+			CMD_TARXSEL,
+			CMD_TARXWAVSEL,
+			CMD_TARXINC,
+			CMD_TARLS,
+			CMD_TARGZIP,
+			CMD_TARINDEX,
+			CMD_HASHALL,
+			CMD_HASHVERIFY,
 			CMD_MKVOL,
 			CMD_MKVOL9,
 			CMD_MKVOL1,
@@ -443,6 +524,8 @@ main_restart: /* restart with opened disks */
 			{CMD_SAMPLE900COMPRI,"s9compri",2,3,NULL,NULL},
 			{CMD_SAMPLE900COMPRALL,"sample900comprall",1,2,"[<dest-vol-path>]","compress all S900 non-compressed sample files in current volume"},
 			{CMD_SAMPLE900COMPRALL,"s9comprall",1,2,NULL,NULL},
+			{CMD_SAMPLE900COMPRMODE,"sample900comprmode",1,2,"[group|opt]","set or print S900 compression encoder mode"},
+			{CMD_SAMPLE900COMPRMODE,"s9comprmode",1,2,NULL,NULL},
 			{CMD_FIXRAMNAME,"fixramname",2,2,"<file-path>","fix name in file header"},
 			{CMD_FIXRAMNAMEI,"fixramnamei",2,2,"<file-index>","fix name in file header"},
 			{CMD_FIXRAMNAMEALL,"fixramnameall",1,1,"","fix name in file header of all files in current volume"},
@@ -565,6 +648,7 @@ main_restart: /* restart with opened disks */
 			{CMD_SAMPLE2WAVALL,"sample2wavall",1,1,NULL,"convert all sample files into external WAV files"},
 			{CMD_SAMPLE2WAVALL,"s2wavall",1,1,NULL,NULL},
 			{CMD_SAMPLE2WAVALL,"getwavall",1,1,NULL,NULL},
+			{CMD_EXPORTTHREADS,"exportthreads",1,4,"[<conv-threads> [<write-threads> [<mem-MB>]]]","set or print number of threads for sample2wavall, tarcwav, take2wavall, tgetall, hashall and tar gzip"},
 			{CMD_PUT,"put",2,3,"<file-name> [<file-index>]","put file (from external)"},
 			{CMD_PUT,"import",2,3,NULL,NULL},
 			{CMD_WAV2SAMPLE,"wav2sample",2,3,"<wav-file> [<file-index>]","convert external WAV file into sample file"},
@@ -582,16 +666,24 @@ main_restart: /* restart with opened disks */
 			{CMD_WAV2SAMPLE3,"wav2sample3",2,3,"<wav-file> [<file-index>]","convert external WAV file into S3000 sample file"},
 			{CMD_WAV2SAMPLE3,"wav2s3",2,3,NULL,NULL},
 			{CMD_WAV2SAMPLE3,"putwav3",2,3,NULL,NULL},
+			{CMD_WAVDITHER,"wavdither",1,2,"[on|off]","set or print dither for import of 24bit/32bit/float WAV files"},
+			{CMD_WAVRESAMPLE,"wavresample",1,2,"[<rate>|off]","set or print sample rate for resampling on import of WAV files"},
 			{CMD_TGETI,"tgeti",2,2,"<take-index>","get DD take (to external)"},
 			{CMD_TGETI,"texporti",2,2,NULL,NULL},
 			{CMD_TAKE2WAVI,"take2wavi",2,2,"<take-index>","convert DD take into external WAV file"},
 			{CMD_TAKE2WAVI,"t2wavi",2,2,NULL,NULL},
 			{CMD_TAKE2WAVI,"tgetwavi",2,2,NULL,NULL},
 			{CMD_TAKE2WAVI,"getwavti",2,2,NULL,NULL},
-			{CMD_TAKE2WAVALL,"take2wavall",1,1,NULL,"convert all DD takes into external WAV files"},
-			{CMD_TAKE2WAVALL,"t2wavall",1,1,NULL,NULL},
-			{CMD_TAKE2WAVALL,"tgetwavall",1,1,NULL,NULL},
-			{CMD_TAKE2WAVALL,"getwavtall",1,1,NULL,NULL},
+			{CMD_TAKE2WAVMS,"take2wavms",4,5,"<take-index> <start-ms> <end-ms> [<wav-file>]","convert range of DD take into external WAV file, range relative to take start (wstart)"},
+			{CMD_TAKE2WAVMS,"t2wavms",4,5,NULL,NULL},
+			{CMD_TAKE2WAVSMP,"take2wavsmp",4,5,"<take-index> <start-smp> <end-smp> [<wav-file>]","convert range of DD take into external WAV file, range relative to take start (wstart)"},
+			{CMD_TAKE2WAVSMP,"t2wavsmp",4,5,NULL,NULL},
+			{CMD_TAKE2WAVALL,"take2wavall",1,2,"[<manifest-file>]","convert all DD takes into external WAV files"},
+			{CMD_TAKE2WAVALL,"t2wavall",1,2,NULL,NULL},
+			{CMD_TAKE2WAVALL,"tgetwavall",1,2,NULL,NULL},
+			{CMD_TAKE2WAVALL,"getwavtall",1,2,NULL,NULL},
+			{CMD_TGETALL,"tgetall",1,2,"[<manifest-file>]","get all DD takes (to external)"},
+			{CMD_TGETALL,"texportall",1,2,NULL,NULL},
 			{CMD_TPUT,"tput",2,2,"<file-name>","put DD take (from external)"},
 			{CMD_TPUT,"timport",2,2,NULL,NULL},
 			{CMD_WAV2TAKE,"wav2take",2,2,"<wav-name>","convert external WAV file into DD take"},
@@ -604,6 +696,8 @@ main_restart: /* restart with opened disks */
 			{CMD_TARCWAV,"tarcwav",2,2,"<tar-file>","tar c from current directory (to external) with WAV conversion"},
 			{CMD_TARCWAV,"targetwav",2,2,NULL,NULL},
 			{CMD_TARCWAV,"gettarwav",2,2,NULL,NULL},
+			{CMD_TARCINC,"tarcinc",3,4,"<tar-file> <manifest-file> [quick]","incremental tar c from current directory (to external), only members changed since <manifest-file>"},
+			{CMD_TARCDEDUP,"tarcdedup",2,2,"<tar-file>","tar c from current directory (to external), identical sample data stored once"},
 			{CMD_TARX,"tarx",2,2,"<tar-file>","tar x in current directory (from external)"},
 			{CMD_TARX,"tarput",2,2,NULL,NULL},
 			{CMD_TARX,"puttar",2,2,NULL,NULL},
@@ -634,6 +728,14 @@ main_restart: /* restart with opened disks */
 			{CMD_TARXWAV3,"tarxwav3",2,2,"<tar-file>","tar x in current directory (from external) with WAV conversion to S3000 sample"},
 			{CMD_TARXWAV3,"tarputwav3",2,2,NULL,NULL},
 			{CMD_TARXWAV3,"puttarwav3",2,2,NULL,NULL},
+			{CMD_TARXSEL,"tarxsel",3,3,"<tar-file> <path>","tar x of <path> in current directory (from external), use index if present"},
+			{CMD_TARXWAVSEL,"tarxwavsel",3,3,"<tar-file> <path>","tar x of <path> in current directory (from external) with WAV conversion, use index if present"},
+			{CMD_TARXINC,"tarxinc",2,2,"<tar-file>","tar x of incremental tar-file in current directory (from external), apply deletions"},
+			{CMD_TARLS,"tarls",2,2,"<tar-file>","list tar-file (external) from index or from tar headers"},
+			{CMD_TARGZIP,"targzip",1,2,"[<level>|auto|off]","set or print gzip compression for tar c and tar x"},
+			{CMD_TARINDEX,"tarindex",1,2,"[on|off]","set or print creation of index <tar-file>.idx for tar c"},
+			{CMD_HASHALL,"hashall",2,3,"<manifest-file> [sha256]","write checksums of all files, DD takes and partition chunks in current directory to manifest (external)"},
+			{CMD_HASHVERIFY,"hashverify",2,2,"<manifest-file>","verify current directory against checksum manifest (external)"},
 			{CMD_MKVOL,"mkvol",1,2,"[<volume-path>]","create new volume"},
 			{CMD_MKVOL,"mkdir",1,2,NULL,NULL},
 			{CMD_MKVOL9,"mkvol9",1,2,"[<volume-path>]","create new volume for S900"},
@@ -666,7 +768,12 @@ main_restart: /* restart with opened disks */
 			curdir_info(0);
 			printf(" > ");
 			fflush(NULL);
-			fgets(cmd,CMDLEN,stdin);
+			if (fgets(cmd,CMDLEN,stdin)==NULL){
+				/* EOF (e.g. end of command pipe): exit */
+				printf("\n");
+				flush_blk_cache(); /* XXX if error, too late */
+				exit(0);
+			}
 			if (strlen(cmd)==0){
 				goto main_parser_next;
 			}
@@ -1597,6 +1704,20 @@ main_restart: /* restart with opened disks */
 					}
 				}
 				break;
+			case CMD_SAMPLE900COMPRMODE:
+				if (cmdtoknr>=2){
+					if (strcasecmp(cmdtok[1],"group")==0){
+						sample900compr_mode=SAMPLE900COMPR_MODE_GROUP;
+					}else if (strcasecmp(cmdtok[1],"opt")==0){
+						sample900compr_mode=SAMPLE900COMPR_MODE_OPT;
+					}else{
+						fprintf(stderr,"invalid mode\n");
+						goto main_parser_next;
+					}
+				}
+				printf("S900 compression encoder mode: %s\n",
+					(sample900compr_mode==SAMPLE900COMPR_MODE_OPT)?"opt":"group");
+				break;
 			case CMD_FIXRAMNAME:
 			case CMD_FIXRAMNAMEI:
 				{
@@ -3358,14 +3479,17 @@ main_restart: /* restart with opened disks */
 				{
 					struct file_s tmpfile;
 					u_int sfi;
-					u_int fcount;
+					struct par_s2w_s par;
 
 					if (check_curnosamplervol()){ /* not inside a sampler volume? */
 						fprintf(stderr,"must be inside a volume\n");
 						goto main_parser_next;
 					}
+					/* Note: serial if par_convnum==0 */
+					if (par_s2w_start(&par,par_convnum,par_writenum,par_memmax,par_s2w_writefile,NULL,0)<0){ /* 0: continue on error */
+						goto main_parser_next;
+					}
 					/* all files in current volume */
-					fcount=0;
 					for (sfi=0;sfi<curvolp->fimax;sfi++){
 						/* find file in current volume */
 						if (akai_get_file(curvolp,&tmpfile,sfi)<0){
@@ -3374,12 +3498,69 @@ main_restart: /* restart with opened disks */
 						/* export file */
 						printf("exporting \"%s\"\n",tmpfile.name);
 						fflush(NULL);
-						if (akai_sample2wav(&tmpfile,-1,NULL,NULL,SAMPLE2WAV_ALL)!=0){
-							continue; /* next */
-						}
-						fcount++;
+						par_s2w_submit(&par,&tmpfile);
+					}
+					par_s2w_end(&par);
+					printf("exported %u file(s)\n",par.count);
+				}
+				break;
+			case CMD_EXPORTTHREADS:
+				if (cmdtoknr>=2){
+					par_convnum=(u_int)atoi(cmdtok[1]);
+					if (par_convnum>PAR_THREADS_MAX){
+						par_convnum=PAR_THREADS_MAX;
+					}
+				}
+				if (cmdtoknr>=3){
+					par_writenum=(u_int)atoi(cmdtok[2]);
+					if (par_writenum>PAR_THREADS_MAX){
+						par_writenum=PAR_THREADS_MAX;
+					}
+				}
+				if (cmdtoknr>=4){
+					if ((atoi(cmdtok[3])<1)||(atoi(cmdtok[3])>4095)){
+						fprintf(stderr,"invalid memory size\n");
+						goto main_parser_next;
+					}
+					par_memmax=((u_int)atoi(cmdtok[3]))*1024*1024;
+				}
+#ifndef PAR_THREADS
+				if (par_convnum>0){
+					printf("no thread support, export is serial\n");
+				}
+#endif
+				printf("converter threads: %u%s\n",par_convnum,(par_convnum==0)?" (serial)":"");
+				printf("writer threads:    %u\n",par_writenum);
+				printf("memory in flight:  %u MB max.\n",par_memmax/(1024*1024));
+				break;
+			case CMD_WAVDITHER:
+				if (cmdtoknr>=2){
+					if (strcasecmp(cmdtok[1],"on")==0){
+						wav_dither=1;
+					}else if (strcasecmp(cmdtok[1],"off")==0){
+						wav_dither=0;
+					}else{
+						fprintf(stderr,"invalid mode\n");
+						goto main_parser_next;
+					}
+				}
+				printf("WAV import dither: %s\n",wav_dither?"on (TPDF)":"off");
+				break;
+			case CMD_WAVRESAMPLE:
+				if (cmdtoknr>=2){
+					if (strcasecmp(cmdtok[1],"off")==0){
+						wav_rsrate=0;
+					}else if ((atoi(cmdtok[1])>=WAV_RS_RATEMIN)&&(atoi(cmdtok[1])<=WAV_RS_RATEMAX)){
+						wav_rsrate=(u_int)atoi(cmdtok[1]);
+					}else{
+						fprintf(stderr,"invalid sample rate\n");
+						goto main_parser_next;
 					}
-					printf("exported %u file(s)\n",fcount);
+				}
+				if (wav_rsrate!=0){
+					printf("WAV import resampling: %u Hz\n",wav_rsrate);
+				}else{
+					printf("WAV import resampling: off\n");
 				}
 				break;
 			case CMD_PUT:
@@ -3627,33 +3808,88 @@ main_restart: /* restart with opened disks */
 					}
 				}
 				break;
-			case CMD_TAKE2WAVALL:
+			case CMD_TAKE2WAVMS:
+			case CMD_TAKE2WAVSMP:
 				{
+					struct take2wav_s t2w;
 					u_int ti;
-					u_int cstarts;
-					u_int tcount;
+					int wavfd;
+					int ret;
 
 					if (check_curnoddpart()){ /* not on DD partition level? */
 						fprintf(stderr,"must be inside a DD partition\n");
 						goto main_parser_next;
 					}
-					/* all DD takes in current DD partition */
-					tcount=0;
-					for (ti=0;ti<AKAI_DDTAKE_MAXNUM;ti++){
-						cstarts=(curpartp->head.dd.take[ti].cstarts[1]<<8)
-							    +curpartp->head.dd.take[ti].cstarts[0];
-						if (cstarts==0){ /* empty? */
-							continue; /* next */
+					/* index */
+					ti=(u_int)atoi(cmdtok[1]);
+					if ((ti<1)||(ti>AKAI_DDTAKE_MAXNUM)){
+						fprintf(stderr,"invalid take index\n");
+						goto main_parser_next;
+					}
+					if ((atoi(cmdtok[2])<0)||(atoi(cmdtok[3])<0)){
+						fprintf(stderr,"invalid range\n");
+						goto main_parser_next;
+					}
+					if (akai_take2wav_check(&t2w,curpartp,ti-1)<0){
+						fprintf(stderr,"take not found\n");
+						goto main_parser_next;
+					}
+					/* range */
+					if (cmdnr==CMD_TAKE2WAVMS){
+						ret=akai_take2wav_setrange_ms(&t2w,(u_int)atoi(cmdtok[2]),(u_int)atoi(cmdtok[3]));
+					}else{
+						ret=akai_take2wav_setrange(&t2w,(u_int)atoi(cmdtok[2]),(u_int)atoi(cmdtok[3]));
+					}
+					if (ret<0){
+						goto main_parser_next;
+					}
+					wavfd=-1; /* create WAV file with name of take */
+					if (cmdtoknr>=5){
+						/* create external WAV file */
+						if ((wavfd=OPEN(cmdtok[4],O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666))<0){
+							perror("create WAV");
+							goto main_parser_next;
 						}
-						/* export take to WAV */
-						printf("exporting take %u\n",ti+1);
-						fflush(NULL);
-						if (akai_take2wav(curpartp,ti,-1,NULL,NULL,TAKE2WAV_ALL)<0){
-							continue; /* next */
+					}
+					/* export range of take to WAV */
+					printf("exporting take %u (%u bytes)\n",ti,t2w.samplesize);
+					fflush(NULL);
+					if (akai_take2wav_export(&t2w,wavfd)<0){
+						fprintf(stderr,"cannot export take\n");
+					}
+					akai_take2wav_finish(&t2w);
+					if (wavfd>=0){
+						CLOSE(wavfd);
+					}
+				}
+				break;
+			case CMD_TAKE2WAVALL:
+			case CMD_TGETALL:
+				{
+					int manfd;
+					u_int tcount;
+
+					if (check_curnoddpart()){ /* not on DD partition level? */
+						fprintf(stderr,"must be inside a DD partition\n");
+						goto main_parser_next;
+					}
+					manfd=-1;
+					if (cmdtoknr>=2){
+						/* create manifest file */
+						if ((manfd=OPEN(cmdtok[1],O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666))<0){
+							perror("open");
+							goto main_parser_next;
 						}
-						tcount++;
 					}
+					/* all DD takes in current DD partition */
+					/* Note: files are written by par_convnum threads */
+					fflush(NULL);
+					tcount=0;
+					par_take_exportall(curpartp,par_convnum,(cmdnr==CMD_TAKE2WAVALL),manfd,&tcount);
 					printf("exported %u take(s)\n",tcount);
+					if (manfd>=0){
+						CLOSE(manfd);
+					}
 				}
 				break;
 			case CMD_TPUT:
@@ -3748,15 +3984,88 @@ main_restart: /* restart with opened disks */
 				break;
 			case CMD_TARC:
 			case CMD_TARCWAV:
+			case CMD_TARCINC:
+			case CMD_TARCDEDUP:
 				{
 					int outfd;
+					struct tar_out_s out;
+					struct tar_z_s z;
+					struct tar_inc_s inc;
+					struct tar_dedup_s dedup;
+					int zflag;
+					int idxfd;
 					u_int flags;
+					int err;
 
+					/* previous manifest */
+					if (cmdnr==CMD_TARCINC){
+						if ((cmdtoknr>3)&&(strcasecmp(cmdtok[3],"quick")!=0)){
+							fprintf(stderr,"invalid argument\n");
+							goto main_parser_next;
+						}
+						if (tar_inc_start(&inc,cmdtok[2],cmdtoknr>3)<0){
+							goto main_parser_next;
+						}
+					}
+					/* deduplication table */
+					if ((cmdnr==CMD_TARCDEDUP)&&(tar_dedup_start(&dedup)<0)){
+						fprintf(stderr,"cannot start deduplication\n");
+						goto main_parser_next;
+					}
 					/* create tar-file */
-					if ((outfd=OPEN(cmdtok[1],O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666))<0){
-						perror("open");
+					if ((outfd=tar_file_open(cmdtok[1],1))<0){ /* 1: output */
+						if (cmdnr==CMD_TARCINC){
+							tar_inc_free(&inc);
+						}
+						if (cmdnr==CMD_TARCDEDUP){
+							tar_dedup_end(&dedup);
+						}
 						goto main_parser_next;
 					}
+					/* gzip compression */
+					zflag=(tar_zlevel>0)||((tar_zlevel<0)&&tar_z_name(cmdtok[1]));
+					if (zflag){
+						if (tar_z_start(&z,outfd,TAR_Z_COMPRESS,tar_zlevel,par_convnum)<0){
+							CLOSE(outfd);
+							if (cmdnr==CMD_TARCINC){
+								tar_inc_free(&inc);
+							}
+							if (cmdnr==CMD_TARCDEDUP){
+								tar_dedup_end(&dedup);
+							}
+							goto main_parser_next;
+						}
+					}
+					if (tar_out_init(&out,zflag?z.fd:outfd)<0){
+						if (zflag){
+							tar_z_end(&z);
+						}
+						CLOSE(outfd);
+						if (cmdnr==CMD_TARCINC){
+							tar_inc_free(&inc);
+						}
+						if (cmdnr==CMD_TARCDEDUP){
+							tar_dedup_end(&dedup);
+						}
+						goto main_parser_next;
+					}
+					if (cmdnr==CMD_TARCINC){
+						out.incp=&inc;
+					}
+					if (cmdnr==CMD_TARCDEDUP){
+						out.dedupp=&dedup;
+					}
+					/* index */
+					idxfd=-1;
+					if (tar_idxflag){
+						if (zflag){
+							printf("no index for compressed tar-file\n");
+						}else if (strcmp(cmdtok[1],"-")==0){
+							printf("no index for tar-file on stdout\n");
+						}else if ((idxfd=tar_idx_open(cmdtok[1]))>=0){
+							out.idxfd=idxfd;
+						}
+					}
 					/* flags */
 					if (cmdnr==CMD_TARCWAV){
 						flags=TAR_EXPORT_WAV;
@@ -3764,13 +4073,46 @@ main_restart: /* restart with opened disks */
 						flags=0;
 					}
 					/* export tar-file */
-					if (tar_export_curdir(outfd,1,flags)<0){ /* 1: verbose */
+					err=0;
+					if (tar_export_curdir(&out,1,flags)<0){ /* 1: verbose */
+						fprintf(stderr,"tar error\n");
+						err=1;
+					}
+					if ((cmdnr==CMD_TARCINC)&&(!err)&&(tar_inc_end(&inc,&out,1)<0)){ /* 1: verbose */
+						fprintf(stderr,"tar error\n");
+						err=1;
+					}
+					if (tar_export_tailzero(&out)<0){
 						fprintf(stderr,"tar error\n");
+						err=1;
 					}
-					if (tar_export_tailzero(outfd)<0){
+					if (tar_out_end(&out)<0){
 						fprintf(stderr,"tar error\n");
+						err=1;
+					}
+					if (zflag&&(tar_z_end(&z)<0)){
+						fprintf(stderr,"gzip error\n");
+						err=1;
+					}
+					if ((idxfd>=0)&&(tar_idx_close(idxfd,outfd)<0)){
+						fprintf(stderr,"index error\n");
 					}
 					CLOSE(outfd);
+					if (cmdnr==CMD_TARCINC){
+						/* Note: new manifest only if tar-file complete */
+						if (err){
+							printf("manifest not updated\n");
+						}else if (tar_inc_save(&inc)<0){
+							fprintf(stderr,"cannot write manifest\n");
+						}
+						tar_inc_free(&inc);
+					}
+					if (cmdnr==CMD_TARCDEDUP){
+						if (!err){
+							tar_dedup_print(&dedup);
+						}
+						tar_dedup_end(&dedup);
+					}
 				}
 				break;
 			case CMD_TARX:
@@ -3783,16 +4125,35 @@ main_restart: /* restart with opened disks */
 			case CMD_TARXWAV9C:
 			case CMD_TARXWAV1:
 			case CMD_TARXWAV3:
+			case CMD_TARXSEL:
+			case CMD_TARXWAVSEL:
+			case CMD_TARXINC:
 				{
 					int inpfd;
+					char *tarname;
+					struct tar_z_s z;
+					int zflag;
 					u_int vtype;
 					u_int flags;
 
 					/* open tar-file */
-					if ((inpfd=OPEN(cmdtok[1],O_RDONLY|O_BINARY,0))<0){
-						perror("open");
+					if ((inpfd=tar_file_open(cmdtok[1],0))<0){ /* 0: input */
 						goto main_parser_next;
 					}
+					/* Note: no index if tar-file from stdin */
+					tarname=(strcmp(cmdtok[1],"-")==0)?NULL:cmdtok[1];
+					/* gzip decompression */
+					zflag=(tar_zlevel!=0)?tar_z_detect(inpfd):0;
+					if (zflag>0){
+						/* Note: 2 if not seekable */
+						if (tar_z_start(&z,inpfd,(zflag==2)?TAR_Z_AUTO:TAR_Z_DECOMPRESS,0,0)<0){
+							CLOSE(inpfd);
+							goto main_parser_next;
+						}
+						tarname=NULL;
+					}else{
+						zflag=0;
+					}
 					/* volume type */
 					if (cmdnr==CMD_TARX9){
 						vtype=AKAI_VOL_TYPE_S900; /* force to S900 */
@@ -3806,7 +4167,7 @@ main_restart: /* restart with opened disks */
 						vtype=AKAI_VOL_TYPE_INACT; /* INACT: auto-detect */
 					}
 					/* flags */
-					if (cmdnr==CMD_TARXWAV){
+					if ((cmdnr==CMD_TARXWAV)||(cmdnr==CMD_TARXWAVSEL)){
 						flags=TAR_IMPORT_WAV;
 					}else if (cmdnr==CMD_TARXWAV9){
 						flags=TAR_IMPORT_WAV|TAR_IMPORT_WAVS9;
@@ -3816,16 +4177,146 @@ main_restart: /* restart with opened disks */
 						flags=TAR_IMPORT_WAV|TAR_IMPORT_WAVS1;
 					}else if (cmdnr==CMD_TARXWAV3){
 						flags=TAR_IMPORT_WAV|TAR_IMPORT_WAVS3;
+					}else if (cmdnr==CMD_TARXINC){
+						flags=TAR_IMPORT_INC;
 					}else{
 						flags=0;
 					}
 					/* import tar-file */
-					if (tar_import_curdir(inpfd,vtype,1,flags)<0){ /* 1: verbose */
+					if ((cmdnr==CMD_TARXSEL)||(cmdnr==CMD_TARXWAVSEL)){
+						/* Note: no index for compressed tar-file */
+						if (tar_import_sel(zflag?z.fd:inpfd,tarname,cmdtok[2],vtype,1,flags)<0){ /* 1: verbose */
+							fprintf(stderr,"tar error\n");
+						}
+					}else if (tar_import_curdir(zflag?z.fd:inpfd,vtype,1,flags)<0){ /* 1: verbose */
+						fprintf(stderr,"tar error\n");
+					}
+					if (zflag&&(tar_z_end(&z)<0)){
+						fprintf(stderr,"gzip error\n");
+					}
+					if (strcmp(cmdtok[1],"-")==0){
+						/* Note: tar-file from stdin extends to EOF, nothing left for commands */
+						io_skip_eof(inpfd);
+					}
+					CLOSE(inpfd);
+				}
+				break;
+			case CMD_TARLS:
+				{
+					int inpfd;
+					char *tarname;
+					struct tar_z_s z;
+					int zflag;
+
+					/* open tar-file */
+					if ((inpfd=tar_file_open(cmdtok[1],0))<0){ /* 0: input */
+						goto main_parser_next;
+					}
+					/* Note: no index if tar-file from stdin */
+					tarname=(strcmp(cmdtok[1],"-")==0)?NULL:cmdtok[1];
+					/* gzip decompression */
+					zflag=(tar_zlevel!=0)?tar_z_detect(inpfd):0;
+					if (zflag>0){
+						/* Note: 2 if not seekable */
+						if (tar_z_start(&z,inpfd,(zflag==2)?TAR_Z_AUTO:TAR_Z_DECOMPRESS,0,0)<0){
+							CLOSE(inpfd);
+							goto main_parser_next;
+						}
+						tarname=NULL;
+					}else{
+						zflag=0;
+					}
+					if (tar_list(zflag?z.fd:inpfd,tarname)<0){
 						fprintf(stderr,"tar error\n");
 					}
+					if (zflag&&(tar_z_end(&z)<0)){
+						fprintf(stderr,"gzip error\n");
+					}
+					if (strcmp(cmdtok[1],"-")==0){
+						/* Note: tar-file from stdin extends to EOF, nothing left for commands */
+						io_skip_eof(inpfd);
+					}
 					CLOSE(inpfd);
 				}
 				break;
+			case CMD_TARINDEX:
+				if (cmdtoknr>=2){
+					if (strcasecmp(cmdtok[1],"on")==0){
+						tar_idxflag=1;
+					}else if (strcasecmp(cmdtok[1],"off")==0){
+						tar_idxflag=0;
+					}else{
+						fprintf(stderr,"invalid argument\n");
+						goto main_parser_next;
+					}
+				}
+				printf("tar index: %s\n",tar_idxflag?"on":"off");
+				break;
+			case CMD_HASHALL:
+				{
+					int manfd;
+					int shaflag;
+
+					shaflag=0;
+					if (cmdtoknr>=3){
+						if (strcasecmp(cmdtok[2],"sha256")!=0){
+							fprintf(stderr,"invalid argument\n");
+							goto main_parser_next;
+						}
+						shaflag=1;
+					}
+					/* create manifest file */
+					if ((manfd=OPEN(cmdtok[1],O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666))<0){
+						perror("open");
+						goto main_parser_next;
+					}
+					/* Note: data is hashed by par_convnum threads */
+					fflush(NULL);
+					if (par_hashall(par_convnum,shaflag,manfd)<0){
+						fprintf(stderr,"hash error\n");
+						/* Note: no incomplete manifest */
+						CLOSE(manfd);
+						if (unlink(cmdtok[1])==0){
+							printf("manifest removed\n");
+						}
+						goto main_parser_next;
+					}
+					CLOSE(manfd);
+				}
+				break;
+			case CMD_HASHVERIFY:
+				/* Note: only reads disk, OK in read-only mode */
+				fflush(NULL);
+				if (par_hashverify(par_convnum,cmdtok[1])!=0){
+					fprintf(stderr,"verify failed\n");
+				}
+				break;
+			case CMD_TARGZIP:
+				if (cmdtoknr>=2){
+					if (strcasecmp(cmdtok[1],"off")==0){
+						tar_zlevel=0;
+					}else if (strcasecmp(cmdtok[1],"auto")==0){
+						tar_zlevel=-1;
+					}else if ((atoi(cmdtok[1])>=1)&&(atoi(cmdtok[1])<=9)){
+						tar_zlevel=atoi(cmdtok[1]);
+					}else{
+						fprintf(stderr,"invalid gzip level\n");
+						goto main_parser_next;
+					}
+				}
+#ifndef TAR_GZIP
+				if (tar_zlevel!=0){
+					printf("no gzip support\n");
+				}
+#endif
+				if (tar_zlevel>0){
+					printf("tar gzip: level %i\n",tar_zlevel);
+				}else if (tar_zlevel<0){
+					printf("tar gzip: auto (.gz or .tgz for tar c, gzip magic for tar x)\n");
+				}else{
+					printf("tar gzip: off\n");
+				}
+				break;
 			case CMD_MKVOL:
 			case CMD_MKVOL9:
 			case CMD_MKVOL1:
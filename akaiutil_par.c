@@ -0,0 +1,1416 @@
+/*
+* Copyright (C) 2026 akaiutil contributors.
+*
+* Parallel conversion and export, based on akaiutil
+* by Klaus Michael Indlekofer <m.indlekofer@gmx.de>.
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+
+#include "akaiutil_io.h"
+#include "akaiutil.h"
+#include "akaiutil_file.h"
+#include "akaiutil_take.h"
+#include "akaiutil_hash.h"
+#include "akaiutil_par.h"
+
+
+
+u_int par_convnum=0; /* 0: serial */
+u_int par_writenum=1;
+u_int par_memmax=PAR_MEMMAX_DEF;
+
+
+
+/* number of failed jobs so far */
+/* Note: mutex must not be locked */
+static u_int
+par_s2w_errcount(struct par_s2w_s *parp)
+{
+	u_int n;
+
+#ifdef PAR_THREADS
+	if (parp->convnum>0){
+		pthread_mutex_lock(&parp->mutex);
+	}
+#endif
+	n=parp->errcount;
+#ifdef PAR_THREADS
+	if (parp->convnum>0){
+		pthread_mutex_unlock(&parp->mutex);
+	}
+#endif
+
+	return n;
+}
+
+static void
+par_s2w_done(struct par_s2w_s *parp,struct par_job_s *jp)
+{
+
+	/* write stage */
+	if ((jp->ret==0)&&((!parp->stoponerr)||(par_s2w_errcount(parp)==0))){
+		jp->ret=(*parp->writefunc)(jp,parp->writearg);
+	}else if (jp->ret==0){
+		jp->ret=-1; /* not written */
+	}
+	if (jp->wavflag){
+		akai_sample2wav_finish(&jp->s2w);
+	}
+
+#ifdef PAR_THREADS
+	if (parp->convnum>0){
+		pthread_mutex_lock(&parp->mutex);
+	}
+#endif
+	if (jp->ret<0){
+		parp->errcount++;
+	}else{
+		parp->count++;
+	}
+#ifdef PAR_THREADS
+	if (parp->convnum>0){
+		parp->memused-=jp->memsize;
+		pthread_cond_broadcast(&parp->cond);
+		pthread_mutex_unlock(&parp->mutex);
+	}
+#endif
+
+	free(jp);
+}
+
+
+
+#ifdef PAR_THREADS
+static void
+par_s2w_queuedone(struct par_s2w_s *parp,struct par_job_s *jp)
+{
+	struct par_job_s **jpp;
+
+	/* Note: mutex must be locked */
+	if (parp->writenum>0){
+		/* append to write queue */
+		if (parp->writetail!=NULL){
+			parp->writetail->next=jp;
+		}else{
+			parp->writehead=jp;
+		}
+		parp->writetail=jp;
+	}else{
+		/* insert into done list, sorted by seq */
+		for (jpp=&parp->donelist;(*jpp!=NULL)&&((*jpp)->seq<jp->seq);jpp=&(*jpp)->next);
+		jp->next=*jpp;
+		*jpp=jp;
+	}
+	pthread_cond_broadcast(&parp->cond);
+}
+
+static void *
+par_s2w_convthread(void *arg)
+{
+	struct par_s2w_s *parp;
+	struct par_job_s *jp;
+
+	parp=(struct par_s2w_s *)arg;
+
+	pthread_mutex_lock(&parp->mutex);
+	for (;;){
+		while ((parp->convhead==NULL)&&(!parp->convquit)){
+			pthread_cond_wait(&parp->cond,&parp->mutex);
+		}
+		if (parp->convhead==NULL){ /* quit? */
+			break;
+		}
+		/* get job */
+		jp=parp->convhead;
+		parp->convhead=jp->next;
+		if (parp->convhead==NULL){
+			parp->convtail=NULL;
+		}
+		jp->next=NULL;
+		pthread_mutex_unlock(&parp->mutex);
+
+		/* convert stage */
+		if ((jp->ret==0)&&jp->wavflag){
+			jp->ret=akai_sample2wav_conv(&jp->s2w);
+		}
+
+		pthread_mutex_lock(&parp->mutex);
+		par_s2w_queuedone(parp,jp);
+	}
+	pthread_mutex_unlock(&parp->mutex);
+
+	return NULL;
+}
+
+static void *
+par_s2w_writethread(void *arg)
+{
+	struct par_s2w_s *parp;
+	struct par_job_s *jp;
+
+	parp=(struct par_s2w_s *)arg;
+
+	pthread_mutex_lock(&parp->mutex);
+	for (;;){
+		while ((parp->writehead==NULL)&&(!parp->writequit)){
+			pthread_cond_wait(&parp->cond,&parp->mutex);
+		}
+		if (parp->writehead==NULL){ /* quit? */
+			break;
+		}
+		/* get job */
+		jp=parp->writehead;
+		parp->writehead=jp->next;
+		if (parp->writehead==NULL){
+			parp->writetail=NULL;
+		}
+		jp->next=NULL;
+		pthread_mutex_unlock(&parp->mutex);
+
+		par_s2w_done(parp,jp);
+
+		pthread_mutex_lock(&parp->mutex);
+	}
+	pthread_mutex_unlock(&parp->mutex);
+
+	return NULL;
+}
+
+static void
+par_s2w_drain(struct par_s2w_s *parp,int waitall)
+{
+	struct par_job_s *jp;
+
+	/* Note: in-order write by caller's thread, mutex must be locked */
+	for (;;){
+		jp=parp->donelist;
+		if ((jp!=NULL)&&(jp->seq==parp->seqwrite)){
+			parp->donelist=jp->next;
+			jp->next=NULL;
+			parp->seqwrite++;
+			pthread_mutex_unlock(&parp->mutex);
+			par_s2w_done(parp,jp);
+			pthread_mutex_lock(&parp->mutex);
+			continue;
+		}
+		if ((!waitall)||(parp->seqwrite==parp->seqnext)){
+			break;
+		}
+		pthread_cond_wait(&parp->cond,&parp->mutex);
+	}
+}
+#endif
+
+
+
+int
+par_s2w_start(struct par_s2w_s *parp,u_int convnum,u_int writenum,u_int memmax,
+			  int (*writefunc)(struct par_job_s *jp,void *arg),void *writearg,int stoponerr)
+{
+#ifdef PAR_THREADS
+	u_int i;
+#endif
+
+	if ((parp==NULL)||(writefunc==NULL)){
+		return -1;
+	}
+
+	bzero(parp,sizeof(struct par_s2w_s));
+	parp->writefunc=writefunc;
+	parp->writearg=writearg;
+	parp->stoponerr=stoponerr;
+	parp->memmax=memmax;
+
+#ifdef PAR_THREADS
+	if (convnum>PAR_THREADS_MAX){
+		convnum=PAR_THREADS_MAX;
+	}
+	if (writenum>PAR_THREADS_MAX){
+		writenum=PAR_THREADS_MAX;
+	}
+	if (convnum==0){
+		return 0; /* serial */
+	}
+
+	pthread_mutex_init(&parp->mutex,NULL);
+	pthread_cond_init(&parp->cond,NULL);
+
+	/* create threads */
+	for (i=0;i<convnum;i++){
+		if (pthread_create(&parp->convthread[i],NULL,par_s2w_convthread,(void *)parp)!=0){
+			fprintf(stderr,"cannot create thread\n");
+			break;
+		}
+	}
+	parp->convnum=i;
+	if (parp->convnum>0){
+		for (i=0;i<writenum;i++){
+			if (pthread_create(&parp->writethread[i],NULL,par_s2w_writethread,(void *)parp)!=0){
+				fprintf(stderr,"cannot create thread\n");
+				break;
+			}
+		}
+		parp->writenum=i;
+		/* Note: if no writer thread, caller's thread writes in order */
+	}else{
+		/* fall back to serial */
+		pthread_cond_destroy(&parp->cond);
+		pthread_mutex_destroy(&parp->mutex);
+	}
+#else
+	(void)convnum;
+	(void)writenum;
+#endif
+
+	return 0;
+}
+
+/* submit job: sample to WAV (if wavflag) or write stage only */
+/* Note: fp (if not NULL) and arg (if argsize>0) are copied into job */
+/* Note: jobs are passed to write stage in order of submission if no writer threads */
+int
+par_s2w_submitjob(struct par_s2w_s *parp,struct file_s *fp,int wavflag,void *arg,u_int argsize)
+{
+	struct par_job_s *jp;
+	int ret;
+
+	if ((parp==NULL)||(wavflag&&(fp==NULL))||((argsize>0)&&(arg==NULL))){
+		return -1;
+	}
+
+	if ((parp->stoponerr)&&(par_s2w_errcount(parp)>0)){
+		return -1;
+	}
+
+	/* allocate job, job data behind it */
+	jp=(struct par_job_s *)malloc(sizeof(struct par_job_s)+argsize);
+	if (jp==NULL){
+		perror("malloc");
+		return -1;
+	}
+	bzero(jp,sizeof(struct par_job_s));
+	if (fp!=NULL){
+		bcopy(fp,&jp->file,sizeof(struct file_s));
+	}
+	if (argsize>0){
+		jp->arg=(void *)(jp+1);
+		bcopy(arg,jp->arg,argsize);
+	}
+	jp->wavflag=wavflag;
+
+	if (!wavflag){
+		jp->memsize=0;
+	}else if ((ret=akai_sample2wav_check(&jp->s2w,&jp->file))!=0){ /* error or not for WAV? */
+		free(jp);
+		return ret;
+	}else if (jp->file.type==(u_char)AKAI_SAMPLE900_FTYPE){
+		/* memory needed for job */
+		jp->memsize=jp->s2w.samplesize+jp->s2w.wavsamplesize;
+	}else if (parp->writenum==0){
+		/* Note: S1000/S3000 sample will be streamed from disk in write stage by caller's thread */
+		jp->memsize=0;
+	}else{
+		jp->memsize=jp->s2w.wavsamplesize;
+	}
+
+#ifdef PAR_THREADS
+	if (parp->convnum>0){
+		pthread_mutex_lock(&parp->mutex);
+		/* bound memory in flight */
+		/* Note: at least one job in flight, even if larger than memmax */
+		while ((parp->memused>0)&&(parp->memused+jp->memsize>parp->memmax)){
+			if (parp->writenum==0){
+				/* write completed jobs in order, wait for next one */
+				if ((parp->donelist!=NULL)&&(parp->donelist->seq==parp->seqwrite)){
+					par_s2w_drain(parp,0);
+					continue;
+				}
+			}
+			pthread_cond_wait(&parp->cond,&parp->mutex);
+		}
+		parp->memused+=jp->memsize;
+		jp->seq=parp->seqnext++;
+		pthread_mutex_unlock(&parp->mutex);
+
+		/* read stage */
+		if (wavflag
+			&&((jp->file.type==(u_char)AKAI_SAMPLE900_FTYPE)||(parp->writenum>0))){
+			jp->ret=akai_sample2wav_read(&jp->s2w);
+		}
+
+		pthread_mutex_lock(&parp->mutex);
+		if (wavflag){
+			/* append to convert queue */
+			if (parp->convtail!=NULL){
+				parp->convtail->next=jp;
+			}else{
+				parp->convhead=jp;
+			}
+			parp->convtail=jp;
+			pthread_cond_broadcast(&parp->cond);
+		}else{
+			/* nothing to convert */
+			par_s2w_queuedone(parp,jp);
+		}
+		if (parp->writenum==0){
+			/* write completed jobs in order, don't wait */
+			par_s2w_drain(parp,0);
+		}
+		pthread_mutex_unlock(&parp->mutex);
+
+		return 0;
+	}
+#endif
+
+	/* serial */
+	/* Note: S1000/S3000 sample will be streamed from disk by write stage */
+	if (wavflag){
+		jp->ret=akai_sample2wav_load(&jp->s2w);
+	}
+	par_s2w_done(parp,jp);
+
+	return 0;
+}
+
+int
+par_s2w_submit(struct par_s2w_s *parp,struct file_s *fp)
+{
+
+	if (fp==NULL){
+		return -1;
+	}
+
+	return par_s2w_submitjob(parp,fp,1,NULL,0); /* 1: sample to WAV */
+}
+
+int
+par_s2w_end(struct par_s2w_s *parp)
+{
+#ifdef PAR_THREADS
+	u_int i;
+#endif
+
+	if (parp==NULL){
+		return -1;
+	}
+
+#ifdef PAR_THREADS
+	if (parp->convnum>0){
+		/* finish convert stage */
+		pthread_mutex_lock(&parp->mutex);
+		parp->convquit=1;
+		pthread_cond_broadcast(&parp->cond);
+		pthread_mutex_unlock(&parp->mutex);
+		for (i=0;i<parp->convnum;i++){
+			pthread_join(parp->convthread[i],NULL);
+		}
+		/* finish write stage */
+		pthread_mutex_lock(&parp->mutex);
+		if (parp->writenum==0){
+			par_s2w_drain(parp,1);
+		}
+		parp->writequit=1;
+		pthread_cond_broadcast(&parp->cond);
+		pthread_mutex_unlock(&parp->mutex);
+		for (i=0;i<parp->writenum;i++){
+			pthread_join(parp->writethread[i],NULL);
+		}
+		pthread_cond_destroy(&parp->cond);
+		pthread_mutex_destroy(&parp->mutex);
+		parp->convnum=0;
+	}
+#endif
+
+	if (parp->errcount>0){
+		return -1;
+	}
+	return 0;
+}
+
+
+
+int
+par_s2w_writefile(struct par_job_s *jp,void *arg)
+{
+
+	(void)arg;
+
+	if (!jp->wavflag){
+		return 0; /* nothing to write */
+	}
+
+	/* create WAV file */
+	return akai_sample2wav_write(&jp->s2w,-1,NULL);
+}
+
+
+
+/* DD take export */
+
+static int
+par_take_run(struct par_take_s *parp,u_int j)
+{
+	struct hash_xxh64_s h;
+	u_char *buf;
+	int ret;
+
+	if (parp->hashflag){
+		if ((buf=(u_char *)malloc(PAR_TAKE_BUFSIZ))==NULL){
+			perror("malloc");
+			return -1;
+		}
+		hash_xxh64_init(&h,0);
+		ret=akai_take_job_run(&parp->job[j],&h,buf,PAR_TAKE_BUFSIZ);
+		parp->hash[j]=hash_xxh64_final(&h);
+		free(buf);
+	}else{
+		ret=akai_take_job_run(&parp->job[j],NULL,NULL,0);
+	}
+	return ret;
+}
+
+#ifdef PAR_THREADS
+static void *
+par_take_thread(void *arg)
+{
+	struct par_take_s *parp;
+	u_int j;
+	int ret;
+
+	parp=(struct par_take_s *)arg;
+
+	pthread_mutex_lock(&parp->mutex);
+	for (;;){
+		if (parp->jobnext>=parp->jobnum){ /* no more jobs? */
+			break;
+		}
+		/* get job */
+		j=parp->jobnext++;
+		if (parp->serial[j]){
+			continue; /* for caller's thread */
+		}
+		pthread_mutex_unlock(&parp->mutex);
+
+		ret=par_take_run(parp,j);
+
+		pthread_mutex_lock(&parp->mutex);
+		parp->ret[j]=ret;
+		parp->done[j]=1;
+		pthread_cond_broadcast(&parp->cond);
+	}
+	pthread_mutex_unlock(&parp->mutex);
+
+	return NULL;
+}
+#endif
+
+/* export all DD takes in partition to files in current directory */
+/* Note: jobs are prepared in caller's thread, files are written by worker threads, */
+/*       progress and manifest (if manfd>=0) are written in take order by caller's thread */
+int
+par_take_exportall(struct part_s *pp,u_int threadnum,int wavflag,int manfd,u_int *countp)
+{
+	struct par_take_s par;
+	char hstr[HASH_XXH64_STRLEN+1];
+	char lbuf[HASH_XXH64_STRLEN+2+AKAI_NAME_LEN+4+1+1];
+	u_int ti;
+	u_int j;
+	u_int i;
+	int r;
+	int ret;
+
+	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)){
+		return -1;
+	}
+	if (pp->type!=PART_TYPE_DD){
+		return -1;
+	}
+
+	if (countp!=NULL){
+		*countp=0;
+	}
+
+	bzero(&par,sizeof(struct par_take_s));
+	par.hashflag=(manfd>=0);
+
+	/* prepare jobs */
+	/* Note: block cache and FAT access in caller's thread only */
+	ret=0;
+	for (ti=0;ti<AKAI_DDTAKE_MAXNUM;ti++){
+		r=akai_take_job_init(&par.job[par.jobnum],pp,ti,wavflag);
+		if (r<0){
+			fprintf(stderr,"cannot export take %u\n",ti+1);
+			akai_take_job_free(&par.job[par.jobnum]);
+			ret=-1;
+			continue;
+		}
+		if (r>0){ /* empty? */
+			continue;
+		}
+		/* same file name as previous take? */
+		/* Note: must be written in order, last one wins */
+		for (j=0;j<par.jobnum;j++){
+			if (strcmp(par.job[j].fname,par.job[par.jobnum].fname)==0){
+				par.serial[par.jobnum]=1;
+				break;
+			}
+		}
+		par.jobnum++;
+	}
+	if (par.jobnum==0){
+		return ret;
+	}
+	/* make disk consistent for positional reads */
+	if (flush_blk_cache()<0){
+		ret=-1;
+		goto par_take_exportall_exit;
+	}
+
+#ifdef PAR_THREADS
+	if (threadnum>PAR_THREADS_MAX){
+		threadnum=PAR_THREADS_MAX;
+	}
+	if (threadnum>par.jobnum){
+		threadnum=par.jobnum;
+	}
+	if (threadnum>0){
+		pthread_mutex_init(&par.mutex,NULL);
+		pthread_cond_init(&par.cond,NULL);
+		/* create threads */
+		for (i=0;i<threadnum;i++){
+			if (pthread_create(&par.thread[i],NULL,par_take_thread,(void *)&par)!=0){
+				fprintf(stderr,"cannot create thread\n");
+				break;
+			}
+		}
+		par.threadnum=i;
+		if (par.threadnum==0){
+			/* fall back to serial */
+			pthread_cond_destroy(&par.cond);
+			pthread_mutex_destroy(&par.mutex);
+		}
+	}
+#else
+	(void)threadnum;
+#endif
+
+	for (j=0;j<par.jobnum;j++){
+#ifdef PAR_THREADS
+		if ((par.threadnum>0)&&(!par.serial[j])){
+			/* wait for job in order */
+			pthread_mutex_lock(&par.mutex);
+			while (!par.done[j]){
+				pthread_cond_wait(&par.cond,&par.mutex);
+			}
+			pthread_mutex_unlock(&par.mutex);
+		}else
+#endif
+		{
+			/* serial */
+			/* Note: all previous jobs are done */
+			par.ret[j]=par_take_run(&par,j);
+		}
+
+		printf("exporting take %u\n",par.job[j].ti+1);
+		if (par.ret[j]<0){
+			fprintf(stderr,"cannot export take\n");
+			ret=-1;
+			continue;
+		}
+		if (countp!=NULL){
+			(*countp)++;
+		}
+		if (manfd>=0){
+			/* manifest line, compatible with xxh64sum */
+			hash_xxh64_str(par.hash[j],hstr);
+			sprintf(lbuf,"%s  %s\n",hstr,par.job[j].fname);
+			i=(u_int)strlen(lbuf);
+			if (WRITE(manfd,lbuf,i)!=(int)i){
+				perror("write");
+				ret=-1;
+			}
+		}
+	}
+
+#ifdef PAR_THREADS
+	if (par.threadnum>0){
+		for (i=0;i<par.threadnum;i++){
+			pthread_join(par.thread[i],NULL);
+		}
+		pthread_cond_destroy(&par.cond);
+		pthread_mutex_destroy(&par.mutex);
+	}
+#endif
+
+par_take_exportall_exit:
+	for (j=0;j<par.jobnum;j++){
+		akai_take_job_free(&par.job[j]);
+	}
+	return ret;
+}
+
+
+/* checksum manifest */
+
+/* add job, returns pointer to cleared job or NULL if error */
+static struct par_hash_job_s *
+par_hash_newjob(struct par_hash_s *hp,char *name)
+{
+	struct par_hash_job_s *jp;
+	u_int n;
+
+	if (hp->jobnum>=hp->jobmax){
+		n=(hp->jobmax==0)?256:2*hp->jobmax;
+		if ((jp=(struct par_hash_job_s *)realloc(hp->job,n*sizeof(struct par_hash_job_s)))==NULL){
+			perror("realloc");
+			return NULL;
+		}
+		hp->job=jp;
+		hp->jobmax=n;
+	}
+	jp=&hp->job[hp->jobnum++];
+	bzero(jp,sizeof(struct par_hash_job_s));
+	strncpy(jp->name,name,PAR_HASH_NAMELEN);
+	jp->name[PAR_HASH_NAMELEN]='\0';
+	jp->fd=-1;
+	jp->takep=NULL;
+	jp->extp=NULL;
+
+	return jp;
+}
+
+static void
+par_hash_freejobs(struct par_hash_s *hp)
+{
+	u_int j;
+
+	for (j=0;j<hp->jobnum;j++){
+		if (hp->job[j].takep!=NULL){
+			akai_take_job_free(hp->job[j].takep);
+			free(hp->job[j].takep);
+		}
+		if (hp->job[j].extp!=NULL){
+			free(hp->job[j].extp);
+		}
+	}
+	hp->jobnum=0;
+}
+
+/* sampler file */
+static int
+par_hash_addfile(struct par_hash_s *hp,struct file_s *fp,char *name)
+{
+	struct par_hash_job_s *jp;
+	int n;
+
+	if ((jp=par_hash_newjob(hp,name))==NULL){
+		return -1;
+	}
+	jp->fd=fp->volp->partp->fd;
+	jp->size=fp->size;
+	n=akai_file_extents(fp,NULL,0);
+	if (n>0){
+		if ((jp->extp=(struct io_ext_s *)malloc(n*sizeof(struct io_ext_s)))==NULL){
+			perror("malloc");
+			hp->jobnum--; /* drop incomplete job */
+			return -1;
+		}
+		jp->extnum=(u_int)akai_file_extents(fp,jp->extp,(u_int)n);
+	}
+	if (n<0){
+		jp->ret=-1; /* reported in order */
+	}
+
+	return 0;
+}
+
+/* DD take */
+static int
+par_hash_addtake(struct par_hash_s *hp,struct part_s *pp,u_int ti,char *prefix)
+{
+	struct par_hash_job_s *jp;
+	struct take_job_s *tjp;
+	char name[PAR_HASH_NAMELEN+1];
+	int r;
+
+	if ((tjp=(struct take_job_s *)malloc(sizeof(struct take_job_s)))==NULL){
+		perror("malloc");
+		return -1;
+	}
+	r=akai_take_job_init(tjp,pp,ti,0); /* 0: no WAV */
+	if (r>0){ /* empty? */
+		akai_take_job_free(tjp);
+		free(tjp);
+		return 0;
+	}
+	sprintf(name,"%s%s",prefix,(r<0)?"?":tjp->fname);
+	if ((jp=par_hash_newjob(hp,name))==NULL){
+		akai_take_job_free(tjp);
+		free(tjp);
+		return -1;
+	}
+	jp->takep=tjp;
+	jp->fd=tjp->fd;
+	jp->size=tjp->size;
+	if (r<0){
+		jp->ret=-1; /* reported in order */
+	}
+
+	return 0;
+}
+
+/* chunks of partition */
+static int
+par_hash_addchunks(struct par_hash_s *hp,struct part_s *pp,char *prefix)
+{
+	struct par_hash_job_s *jp;
+	char name[PAR_HASH_NAMELEN+1];
+	OFF_T off;
+	u_int pos,size;
+
+	size=pp->bsize*pp->blksize;
+	off=((OFF_T)pp->bstart)*((OFF_T)pp->blksize);
+	for (pos=0;pos<size;pos+=jp->size){
+		sprintf(name,"%s@%08x",prefix,pos);
+		if ((jp=par_hash_newjob(hp,name))==NULL){
+			return -1;
+		}
+		if ((jp->extp=(struct io_ext_s *)malloc(sizeof(struct io_ext_s)))==NULL){
+			perror("malloc");
+			hp->jobnum--; /* drop incomplete job */
+			return -1;
+		}
+		jp->fd=pp->fd;
+		jp->size=size-pos;
+		if (jp->size>PAR_HASH_CHUNKSIZ){
+			jp->size=PAR_HASH_CHUNKSIZ;
+		}
+		jp->extp[0].off=off+(OFF_T)pos;
+		jp->extp[0].size=jp->size;
+		jp->extnum=1;
+	}
+
+	return 0;
+}
+
+/* files in volume */
+static int
+par_hash_addvol(struct par_hash_s *hp,struct vol_s *vp,char *prefix)
+{
+	char name[PAR_HASH_NAMELEN+1];
+	struct file_s tmpfile;
+	u_int fi;
+
+	for (fi=0;fi<vp->fimax;fi++){
+		if (akai_get_file(vp,&tmpfile,fi)<0){
+			continue; /* next */
+		}
+		sprintf(name,"%s%s",prefix,tmpfile.name);
+		if (par_hash_addfile(hp,&tmpfile,name)<0){
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* chunks (if chunkflag), DD takes or files in volumes of partition */
+static int
+par_hash_addpart(struct par_hash_s *hp,struct part_s *pp,char *prefix,int chunkflag)
+{
+	char name[PAR_HASH_NAMELEN+1];
+	struct vol_s tmpvol;
+	u_int cstarts;
+	u_int ti;
+	u_int vi;
+
+	if (chunkflag&&(par_hash_addchunks(hp,pp,prefix)<0)){
+		return -1;
+	}
+
+	if (pp->type==PART_TYPE_DD){
+		/* harddisk DD partition */
+		for (ti=0;ti<AKAI_DDTAKE_MAXNUM;ti++){
+			cstarts=(pp->head.dd.take[ti].cstarts[1]<<8)
+				    +pp->head.dd.take[ti].cstarts[0];
+			if (cstarts==0){ /* empty? */
+				continue; /* next */
+			}
+			if (par_hash_addtake(hp,pp,ti,prefix)<0){
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	/* now, sampler partition */
+	for (vi=0;vi<pp->volnummax;vi++){
+		if (akai_get_vol(pp,&tmpvol,vi)<0){
+			continue; /* next */
+		}
+		if ((tmpvol.type!=AKAI_VOL_TYPE_S900)
+			&&(tmpvol.type!=AKAI_VOL_TYPE_S1000)
+			&&(tmpvol.type!=AKAI_VOL_TYPE_S3000)
+			&&(tmpvol.type!=AKAI_VOL_TYPE_CD3000)){
+			continue; /* next */
+		}
+		sprintf(name,"%s%s/",prefix,tmpvol.name);
+		if (par_hash_addvol(hp,&tmpvol,name)<0){
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* read data of job from disk and hash it */
+/* Note: no global state */
+static int
+par_hash_run(struct par_hash_s *hp,struct par_hash_job_s *jp,u_char *buf)
+{
+	struct hash_xxh64_s h;
+	struct hash_sha256_s sha;
+	struct io_ext_s *extp;
+	u_int extnum;
+	u_int ei;
+	OFF_T off;
+	u_int size,chunk;
+
+	hash_xxh64_init(&h,0);
+	if (hp->shaflag){
+		hash_sha256_init(&sha);
+	}
+	if (jp->takep!=NULL){
+		extp=jp->takep->extp;
+		extnum=jp->takep->extnum;
+		hash_xxh64_update(&h,jp->takep->head,jp->takep->headsize);
+		if (hp->shaflag){
+			hash_sha256_update(&sha,jp->takep->head,jp->takep->headsize);
+		}
+	}else{
+		extp=jp->extp;
+		extnum=jp->extnum;
+	}
+	for (ei=0;ei<extnum;ei++){
+		off=extp[ei].off;
+		for (size=extp[ei].size;size>0;size-=chunk){
+			chunk=(size<PAR_HASH_BUFSIZ)?size:PAR_HASH_BUFSIZ;
+			if (io_pread(jp->fd,buf,chunk,off)<0){
+				perror("read");
+				return -1;
+			}
+			hash_xxh64_update(&h,buf,chunk);
+			if (hp->shaflag){
+				hash_sha256_update(&sha,buf,chunk);
+			}
+			off+=(OFF_T)chunk;
+		}
+	}
+	if ((jp->takep!=NULL)&&(jp->takep->tailsize>0)){
+		hash_xxh64_update(&h,jp->takep->tail,jp->takep->tailsize);
+		if (hp->shaflag){
+			hash_sha256_update(&sha,jp->takep->tail,jp->takep->tailsize);
+		}
+	}
+	jp->hash=hash_xxh64_final(&h);
+	if (hp->shaflag){
+		hash_sha256_final(&sha,jp->md);
+	}
+
+	return 0;
+}
+
+#ifdef PAR_THREADS
+static void *
+par_hash_thread(void *arg)
+{
+	struct par_hash_s *hp;
+	u_char *buf;
+	u_int j;
+	int ret;
+
+	hp=(struct par_hash_s *)arg;
+	buf=(u_char *)malloc(PAR_HASH_BUFSIZ);
+
+	pthread_mutex_lock(&hp->mutex);
+	for (;;){
+		if (hp->jobnext>=hp->jobnum){ /* no more jobs? */
+			break;
+		}
+		/* get job */
+		j=hp->jobnext++;
+		pthread_mutex_unlock(&hp->mutex);
+
+		if (hp->job[j].ret<0){
+			ret=-1; /* already failed */
+		}else if (buf==NULL){
+			perror("malloc");
+			ret=-1;
+		}else{
+			ret=par_hash_run(hp,&hp->job[j],buf);
+		}
+
+		pthread_mutex_lock(&hp->mutex);
+		hp->job[j].ret=ret;
+		hp->job[j].done=1;
+		pthread_cond_broadcast(&hp->cond);
+	}
+	pthread_mutex_unlock(&hp->mutex);
+
+	if (buf!=NULL){
+		free(buf);
+	}
+	return NULL;
+}
+#endif
+
+/* run batch of jobs, call func in order, free jobs */
+static int
+par_hash_batch(struct par_hash_s *hp,u_int threadnum)
+{
+	u_char *buf;
+	u_int j;
+#ifdef PAR_THREADS
+	u_int i;
+#endif
+	int ret;
+
+	if (hp->jobnum==0){
+		return 0;
+	}
+	/* make disk consistent for positional reads */
+	if (flush_blk_cache()<0){
+		par_hash_freejobs(hp);
+		return -1;
+	}
+	if ((buf=(u_char *)malloc(PAR_HASH_BUFSIZ))==NULL){
+		perror("malloc");
+		par_hash_freejobs(hp);
+		return -1;
+	}
+
+#ifdef PAR_THREADS
+	if (threadnum>PAR_THREADS_MAX){
+		threadnum=PAR_THREADS_MAX;
+	}
+	if (threadnum>hp->jobnum){
+		threadnum=hp->jobnum;
+	}
+	hp->threadnum=0;
+	hp->jobnext=0;
+	if (threadnum>0){
+		pthread_mutex_init(&hp->mutex,NULL);
+		pthread_cond_init(&hp->cond,NULL);
+		/* create threads */
+		for (i=0;i<threadnum;i++){
+			if (pthread_create(&hp->thread[i],NULL,par_hash_thread,(void *)hp)!=0){
+				fprintf(stderr,"cannot create thread\n");
+				break;
+			}
+		}
+		hp->threadnum=i;
+		if (hp->threadnum==0){
+			/* fall back to serial */
+			pthread_cond_destroy(&hp->cond);
+			pthread_mutex_destroy(&hp->mutex);
+		}
+	}
+#else
+	(void)threadnum;
+#endif
+
+	ret=0;
+	for (j=0;j<hp->jobnum;j++){
+#ifdef PAR_THREADS
+		if (hp->threadnum>0){
+			/* wait for job in order */
+			pthread_mutex_lock(&hp->mutex);
+			while (!hp->job[j].done){
+				pthread_cond_wait(&hp->cond,&hp->mutex);
+			}
+			pthread_mutex_unlock(&hp->mutex);
+		}else
+#endif
+		if (hp->job[j].ret==0){
+			/* serial */
+			hp->job[j].ret=par_hash_run(hp,&hp->job[j],buf);
+		}
+
+		if (hp->job[j].ret<0){
+			fprintf(stderr,"cannot read %s\n",hp->job[j].name);
+			hp->errcount++;
+			continue;
+		}
+		if ((*hp->func)(&hp->job[j],hp->arg)<0){
+			ret=-1;
+		}
+	}
+
+#ifdef PAR_THREADS
+	if (hp->threadnum>0){
+		for (i=0;i<hp->threadnum;i++){
+			pthread_join(hp->thread[i],NULL);
+		}
+		pthread_cond_destroy(&hp->cond);
+		pthread_mutex_destroy(&hp->mutex);
+	}
+#endif
+
+	free(buf);
+	par_hash_freejobs(hp);
+	return ret;
+}
+
+/* hash all files, DD takes and partition chunks in current directory, call func for each in order */
+int
+par_hash_curdir(u_int threadnum,int shaflag,int (*func)(struct par_hash_job_s *jp,void *arg),void *arg)
+{
+	struct par_hash_s hash;
+	char prefix[PAR_HASH_NAMELEN+1];
+	struct part_s *pp;
+	u_int pi;
+	int ret;
+
+	if (curdiskp==NULL){ /* no disk? */
+		printf("must be on disk\n");
+		return -1;
+	}
+
+	bzero(&hash,sizeof(struct par_hash_s));
+	hash.shaflag=shaflag;
+	hash.job=NULL;
+	hash.func=func;
+	hash.arg=arg;
+
+	ret=0;
+	if (curvolp!=NULL){
+		/* in sampler volume */
+		/* Note: no batch if jobs incomplete */
+		if (par_hash_addvol(&hash,curvolp,"")<0){
+			ret=-1;
+		}else if (par_hash_batch(&hash,threadnum)<0){
+			ret=-1;
+		}
+	}else if (curpartp!=NULL){
+		/* in partition (sampler or DD) */
+		if (par_hash_addpart(&hash,curpartp,"",1)<0){ /* 1: chunks */
+			ret=-1;
+		}else if (par_hash_batch(&hash,threadnum)<0){
+			ret=-1;
+		}
+	}else{
+		/* on disk: one batch per partition */
+		for (pi=0;pi<part_num;pi++){
+			pp=&part[pi];
+			if ((pp->diskp!=curdiskp)||(!pp->valid)||(pp->fd<0)){
+				continue; /* next partition */
+			}
+			/* Note: as in tar-file */
+			if (pp->type==PART_TYPE_DD){
+				if (pp->letter==0){
+					sprintf(prefix,"DD/");
+				}else{
+					sprintf(prefix,"DD%u/",(u_int)pp->letter);
+				}
+			}else{
+				sprintf(prefix,"%c/",pp->letter);
+			}
+			if (par_hash_addpart(&hash,pp,prefix,1)<0){ /* 1: chunks */
+				ret=-1;
+				break; /* stop */
+			}
+			if (par_hash_batch(&hash,threadnum)<0){
+				ret=-1;
+			}
+		}
+	}
+	par_hash_freejobs(&hash);
+	if (hash.job!=NULL){
+		free(hash.job);
+	}
+
+	if (hash.errcount>0){
+		ret=-1;
+	}
+	return ret;
+}
+
+/* manifest line of job */
+static void
+par_hash_line(struct par_hash_job_s *jp,int shaflag,char *lbuf)
+{
+	char hstr[HASH_XXH64_STRLEN+1];
+	char sstr[HASH_SHA256_STRLEN+1];
+
+	hash_xxh64_str(jp->hash,hstr);
+	if (shaflag){
+		hash_sha256_str(jp->md,sstr);
+	}else{
+		strcpy(sstr,"-");
+	}
+	sprintf(lbuf,"%s %s %u %s\n",hstr,sstr,jp->size,jp->name);
+}
+
+struct par_hashall_s{
+	int manfd;
+	int shaflag;
+	u_int count;
+	U_INT64 bytes;
+};
+
+static int
+par_hashall_func(struct par_hash_job_s *jp,void *arg)
+{
+	struct par_hashall_s *ap;
+	char lbuf[PAR_HASH_LINELEN];
+	u_int l;
+
+	ap=(struct par_hashall_s *)arg;
+	par_hash_line(jp,ap->shaflag,lbuf);
+	l=(u_int)strlen(lbuf);
+	if (WRITE(ap->manfd,lbuf,l)!=(int)l){
+		perror("write");
+		return -1;
+	}
+	ap->count++;
+	ap->bytes+=(U_INT64)jp->size;
+
+	return 0;
+}
+
+/* write manifest of current directory to manfd */
+int
+par_hashall(u_int threadnum,int shaflag,int manfd)
+{
+	struct par_hashall_s a;
+	char *hline;
+	int ret;
+
+	hline="# xxh64 sha256 size name\n";
+	if (WRITE(manfd,hline,strlen(hline))!=(int)strlen(hline)){
+		perror("write");
+		return -1;
+	}
+
+	a.manfd=manfd;
+	a.shaflag=shaflag;
+	a.count=0;
+	a.bytes=0;
+	ret=par_hash_curdir(threadnum,shaflag,par_hashall_func,(void *)&a);
+	printf("hashed %u item(s), %.1lf MB\n",a.count,((double)a.bytes)/(1024.0*1024.0));
+
+	return ret;
+}
+
+/* manifest entry for verification */
+struct par_hashver_ent_s{
+	U_INT64 hash;
+	u_char md[HASH_SHA256_SIZE];
+	int shaflag; /* md valid */
+	u_int size;
+	int seen;
+	char name[PAR_HASH_NAMELEN+1]; /* +1 for '\0' */
+};
+
+struct par_hashver_s{
+	struct par_hashver_ent_s *entp; /* sorted by name */
+	u_int entnum;
+	u_int okcount;
+	u_int badcount;
+	u_int newcount;
+};
+
+static int
+par_hashver_cmp(const void *a,const void *b)
+{
+
+	return strcmp(((struct par_hashver_ent_s *)a)->name,((struct par_hashver_ent_s *)b)->name);
+}
+
+static int
+par_hashver_func(struct par_hash_job_s *jp,void *arg)
+{
+	struct par_hashver_s *vp;
+	struct par_hashver_ent_s key;
+	struct par_hashver_ent_s *ep;
+
+	vp=(struct par_hashver_s *)arg;
+	strcpy(key.name,jp->name);
+	ep=(struct par_hashver_ent_s *)bsearch(&key,vp->entp,vp->entnum,sizeof(struct par_hashver_ent_s),par_hashver_cmp);
+	if (ep==NULL){
+		printf("new: %s\n",jp->name);
+		vp->newcount++;
+		return 0;
+	}
+	ep->seen=1;
+	if ((ep->size!=jp->size)||(ep->hash!=jp->hash)
+		||(ep->shaflag&&(memcmp(ep->md,jp->md,HASH_SHA256_SIZE)!=0))){
+		printf("MISMATCH: %s\n",jp->name);
+		vp->badcount++;
+		return 0;
+	}
+	vp->okcount++;
+
+	return 0;
+}
+
+/* parse hex string of n bytes */
+static int
+par_hashver_hex(char *s,u_char *p,u_int n)
+{
+	u_int i;
+	u_int v;
+
+	for (i=0;i<n;i++){
+		if ((!isxdigit((int)(u_char)s[2*i]))||(!isxdigit((int)(u_char)s[2*i+1]))
+			||(sscanf(s+2*i,"%2x",&v)!=1)){
+			return -1;
+		}
+		p[i]=(u_char)v;
+	}
+
+	return 0;
+}
+
+/* verify current directory against manifest file manname */
+/* Note: returns 1 if differences found */
+int
+par_hashverify(u_int threadnum,char *manname)
+{
+	struct par_hashver_s ver;
+	struct par_hashver_ent_s *ep;
+	u_char hbuf[HASH_XXH64_SIZE];
+	char *buf,*p,*q,*r;
+	OFF_T fsize;
+	u_int missing;
+	u_int lnum;
+	u_int i;
+	int shaflag;
+	int fd;
+	int ret;
+
+	/* read manifest */
+	if ((fd=OPEN(manname,O_RDONLY|O_BINARY,0))<0){
+		perror("open");
+		return -1;
+	}
+	if (((fsize=LSEEK(fd,0,SEEK_END))<0)||(LSEEK(fd,0,SEEK_SET)<0)){
+		perror("lseek");
+		CLOSE(fd);
+		return -1;
+	}
+	if ((buf=(char *)malloc((size_t)fsize+1))==NULL){
+		perror("malloc");
+		CLOSE(fd);
+		return -1;
+	}
+	if (READ(fd,buf,(u_int)fsize)!=(int)fsize){
+		perror("read");
+		free(buf);
+		CLOSE(fd);
+		return -1;
+	}
+	buf[fsize]='\0';
+	CLOSE(fd);
+
+	/* parse lines */
+	for (lnum=0,p=buf;*p!='\0';p++){
+		if (*p=='\n'){
+			lnum++;
+		}
+	}
+	bzero(&ver,sizeof(struct par_hashver_s));
+	if ((ver.entp=(struct par_hashver_ent_s *)malloc((lnum+1)*sizeof(struct par_hashver_ent_s)))==NULL){
+		perror("malloc");
+		free(buf);
+		return -1;
+	}
+	shaflag=0;
+	ret=0;
+	for (p=buf;*p!='\0';p=q){
+		for (q=p;(*q!='\0')&&(*q!='\n');q++);
+		if (*q=='\n'){
+			*q++='\0';
+		}
+		if ((r=strchr(p,'\r'))!=NULL){
+			*r='\0';
+		}
+		if ((*p=='#')||(*p=='\0')){
+			continue; /* comment or empty line */
+		}
+		ep=&ver.entp[ver.entnum];
+		bzero(ep,sizeof(struct par_hashver_ent_s));
+		/* <xxh64> <sha256> <size> <name> */
+		if ((strlen(p)<HASH_XXH64_STRLEN+1)||(p[HASH_XXH64_STRLEN]!=' ')
+			||(par_hashver_hex(p,hbuf,HASH_XXH64_SIZE)<0)){
+			ret=-1;
+			break;
+		}
+		for (i=0;i<HASH_XXH64_SIZE;i++){
+			ep->hash=(ep->hash<<8)|(U_INT64)hbuf[i];
+		}
+		p+=HASH_XXH64_STRLEN+1;
+		if ((p[0]=='-')&&(p[1]==' ')){
+			p+=2;
+		}else if ((strlen(p)>=HASH_SHA256_STRLEN+1)&&(p[HASH_SHA256_STRLEN]==' ')
+				  &&(par_hashver_hex(p,ep->md,HASH_SHA256_SIZE)==0)){
+			ep->shaflag=1;
+			shaflag=1;
+			p+=HASH_SHA256_STRLEN+1;
+		}else{
+			ret=-1;
+			break;
+		}
+		if ((sscanf(p,"%u",&ep->size)!=1)||((r=strchr(p,' '))==NULL)
+			||(strlen(r+1)==0)||(strlen(r+1)>PAR_HASH_NAMELEN)){
+			ret=-1;
+			break;
+		}
+		strcpy(ep->name,r+1);
+		ver.entnum++;
+	}
+	free(buf);
+	if (ret<0){
+		fprintf(stderr,"invalid manifest\n");
+		free(ver.entp);
+		return -1;
+	}
+	qsort(ver.entp,ver.entnum,sizeof(struct par_hashver_ent_s),par_hashver_cmp);
+
+	/* hash current directory, SHA-256 if in manifest */
+	ret=par_hash_curdir(threadnum,shaflag,par_hashver_func,(void *)&ver);
+
+	missing=0;
+	for (i=0;i<ver.entnum;i++){
+		if (!ver.entp[i].seen){
+			printf("missing: %s\n",ver.entp[i].name);
+			missing++;
+		}
+	}
+	printf("verify: %u ok, %u mismatch, %u missing, %u new\n",ver.okcount,ver.badcount,missing,ver.newcount);
+	if ((ret==0)&&((ver.badcount>0)||(missing>0)||(ver.newcount>0))){
+		ret=1;
+	}
+	free(ver.entp);
+
+	return ret;
+}
+
+
+
+/* EOF */
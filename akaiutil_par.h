@@ -0,0 +1,178 @@
+#ifndef __AKAIUTIL_PAR_H
+#define __AKAIUTIL_PAR_H
+/*
+* Copyright (C) 2026 akaiutil contributors.
+*
+* Parallel conversion and export, based on akaiutil
+* by Klaus Michael Indlekofer <m.indlekofer@gmx.de>.
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+
+#include "akaiutil_io.h"
+#include "akaiutil.h"
+#include "akaiutil_file.h"
+#include "akaiutil_take.h"
+
+#if !defined(WIN32)&&!defined(PAR_THREADS_DISABLE)
+#define PAR_THREADS
+#include <pthread.h>
+#endif
+
+
+
+/* parallel export pipeline */
+
+/* Note: reader stage (disk I/O) always runs in caller's thread, */
+/*       since block cache and FAT access are not thread-safe */
+/* Note: jobs w/o sample to WAV conversion only pass through write stage, */
+/*       in order with the other jobs if no writer threads */
+
+#define PAR_THREADS_MAX		64 /* max. number of converter or writer threads */
+#define PAR_MEMMAX_DEF		(64*1024*1024) /* default max. memory in flight in bytes */
+
+/* pipeline job */
+struct par_job_s{
+	struct par_job_s *next;
+	u_int seq; /* sequence number */
+	u_int memsize; /* memory in flight in bytes */
+	int ret;
+	int wavflag; /* sample to WAV, else: write stage only */
+	struct file_s file; /* copy of file, cp->fp points to it */
+	struct sample2wav_s s2w;
+	void *arg; /* copy of caller's job data, NULL if none */
+};
+
+/* sample to WAV export pipeline */
+struct par_s2w_s{
+	u_int convnum; /* number of converter threads, 0: serial */
+	u_int writenum; /* number of writer threads, 0: in order by caller's thread */
+	u_int memmax; /* max. memory in flight in bytes */
+	int (*writefunc)(struct par_job_s *jp,void *arg);
+	void *writearg;
+	int stoponerr; /* don't write any more jobs after error */
+	u_int count; /* number of jobs written */
+	u_int errcount; /* number of failed jobs */
+#ifdef PAR_THREADS
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; /* any state change */
+	pthread_t convthread[PAR_THREADS_MAX];
+	pthread_t writethread[PAR_THREADS_MAX];
+	struct par_job_s *convhead,*convtail; /* jobs to convert */
+	struct par_job_s *writehead,*writetail; /* jobs to write */
+	struct par_job_s *donelist; /* converted jobs for in-order write, sorted by seq */
+	u_int memused; /* memory in flight in bytes */
+	u_int seqnext; /* next sequence number */
+	u_int seqwrite; /* next sequence number to write in order */
+	int convquit;
+	int writequit;
+#endif
+};
+
+
+/* DD take export */
+
+#define PAR_TAKE_BUFSIZ		(1024*1024) /* buffer per job if hashing */
+
+struct par_take_s{
+	u_int jobnum;
+	struct take_job_s job[AKAI_DDTAKE_MAXNUM];
+	int ret[AKAI_DDTAKE_MAXNUM];
+	int serial[AKAI_DDTAKE_MAXNUM]; /* job must run in caller's thread */
+	int hashflag;
+	U_INT64 hash[AKAI_DDTAKE_MAXNUM];
+#ifdef PAR_THREADS
+	u_int threadnum; /* 0: serial */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; /* job done */
+	pthread_t thread[PAR_THREADS_MAX];
+	u_int jobnext; /* next job to start */
+	int done[AKAI_DDTAKE_MAXNUM];
+#endif
+};
+
+
+/* checksum manifest */
+/* Note: jobs (files, DD takes, chunks of partitions) are prepared in caller's thread, */
+/*       data read from extents on disk and hashed by worker threads, */
+/*       results handled in order by caller's thread, one batch per partition */
+/* Note: manifest is a text file, one line per job: */
+/*       <xxh64> <sha256> <size> <name> */
+/*       sha256: "-" if none, name of chunk of partition: <part>/@<offset in hex> */
+
+#define PAR_HASH_CHUNKSIZ	(16*1024*1024) /* size of partition chunk in bytes */
+#define PAR_HASH_BUFSIZ		(1024*1024) /* buffer per thread */
+#define PAR_HASH_NAMELEN	64 /* max. length of name */
+#define PAR_HASH_LINELEN	(HASH_XXH64_STRLEN+1+HASH_SHA256_STRLEN+1+10+1+PAR_HASH_NAMELEN+1+1)
+
+struct par_hash_job_s{
+	char name[PAR_HASH_NAMELEN+1]; /* +1 for '\0' */
+	int fd; /* disk file descriptor */
+	struct take_job_s *takep; /* DD take (header, extents, tail), NULL if none */
+	struct io_ext_s *extp; /* data extents on disk if not DD take */
+	u_int extnum;
+	u_int size; /* in bytes */
+	int ret;
+	U_INT64 hash; /* XXH64 */
+	u_char md[HASH_SHA256_SIZE]; /* SHA-256 if shaflag */
+#ifdef PAR_THREADS
+	int done;
+#endif
+};
+
+struct par_hash_s{
+	int shaflag; /* also SHA-256 */
+	struct par_hash_job_s *job;
+	u_int jobnum;
+	u_int jobmax;
+	u_int errcount;
+	int (*func)(struct par_hash_job_s *jp,void *arg); /* called in order */
+	void *arg;
+#ifdef PAR_THREADS
+	u_int threadnum; /* 0: serial */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; /* job done */
+	pthread_t thread[PAR_THREADS_MAX];
+	u_int jobnext; /* next job to start */
+#endif
+};
+
+
+
+/* Declarations */
+
+extern u_int par_convnum; /* default number of converter threads */
+extern u_int par_writenum; /* default number of writer threads */
+extern u_int par_memmax; /* default max. memory in flight */
+
+extern int par_s2w_start(struct par_s2w_s *parp,u_int convnum,u_int writenum,u_int memmax,
+						 int (*writefunc)(struct par_job_s *jp,void *arg),void *writearg,int stoponerr);
+extern int par_s2w_submitjob(struct par_s2w_s *parp,struct file_s *fp,int wavflag,void *arg,u_int argsize);
+extern int par_s2w_submit(struct par_s2w_s *parp,struct file_s *fp);
+extern int par_s2w_end(struct par_s2w_s *parp);
+
+extern int par_s2w_writefile(struct par_job_s *jp,void *arg);
+
+extern int par_take_exportall(struct part_s *pp,u_int threadnum,int wavflag,int manfd,u_int *countp);
+
+extern int par_hash_curdir(u_int threadnum,int shaflag,int (*func)(struct par_hash_job_s *jp,void *arg),void *arg);
+extern int par_hashall(u_int threadnum,int shaflag,int manfd);
+extern int par_hashverify(u_int threadnum,char *manname);
+
+
+
+#endif /* !__AKAIUTIL_PAR_H */
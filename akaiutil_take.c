@@ -24,6 +24,17 @@
 #include "akaiutil.h"
 #include "akaiutil_take.h"
 #include "akaiutil_wav.h"
+#include "akaiutil_hash.h"
+
+#ifndef TAKE_SIMD_DISABLE
+#if defined(__SSE2__)||defined(_M_X64)||(defined(_M_IX86_FP)&&(_M_IX86_FP>=2))
+#define TAKE_SIMD_SSE2
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON)||defined(__ARM_NEON__))&&!defined(__ARM_BIG_ENDIAN)
+#define TAKE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
 
 
 
@@ -190,6 +201,47 @@ akai_ddtake_info(struct part_s *pp,u_int ti,int verbose)
 
 
 
+/* import sample of DD take from file and calculate envelope on the fly */
+/* Note: sbuf: buffer of caller for 1 cluster (AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE bytes) */
+static int
+akai_take_importsample(struct part_s *pp,u_int cstarts,u_int samplesize,int inpfd,struct wav_conv_s *convp,u_char *envbuf,u_int envsiz,u_char *sbuf)
+{
+	struct take_env_s env;
+	u_int ba,bchunk;
+
+	akai_take_envinit(&env,envbuf,envsiz);
+
+	for (ba=0;ba<samplesize;ba+=bchunk){
+		/* cluster */
+		bchunk=AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE;
+		if (bchunk>samplesize-ba){
+			bchunk=samplesize-ba;
+		}
+
+		if (convp!=NULL){
+			/* read and convert to 16bit */
+			if (wav_read16(convp,inpfd,sbuf,bchunk/2)<0){ /* /2 for 16bit per sample word */
+				perror("read");
+				return -1;
+			}
+		}else if (READ(inpfd,sbuf,bchunk)!=(int)bchunk){
+			perror("read");
+			return -1;
+		}
+
+		/* envelope */
+		akai_take_envupdate(&env,sbuf,bchunk);
+
+		/* write cluster to take */
+		if (akai_import_ddfatchain(pp,cstarts,ba,bchunk,-1,sbuf)<0){
+			return -1;
+		}
+	}
+	akai_take_envfinish(&env);
+
+	return 0;
+}
+
 int
 akai_import_take(int inpfd,struct part_s *pp,struct akai_ddtake_s *tp,u_int ti,u_int csizes,u_int csizee)
 {
@@ -197,6 +249,7 @@ akai_import_take(int inpfd,struct part_s *pp,struct akai_ddtake_s *tp,u_int ti,u
 	u_int samplesize;
 	u_int envsiz;
 	u_char *envbuf;
+	u_char *cbuf;
 	u_int bsize;
 	int ret;
 
@@ -224,6 +277,7 @@ akai_import_take(int inpfd,struct part_s *pp,struct akai_ddtake_s *tp,u_int ti,u
 	ret=-1; /* no success so far */
 	envsiz=0;
 	envbuf=NULL; /* not allocated yet */
+	cbuf=NULL; /* not allocated yet */
 
 	/* total number of bytes for sample */
 	samplesize=csizes*AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE;
@@ -285,30 +339,33 @@ akai_import_take(int inpfd,struct part_s *pp,struct akai_ddtake_s *tp,u_int ti,u
 		goto akai_import_take_exit;
 	}
 
-	if (csizes>0){
+	if (envbuf!=NULL){ /* no envelope in file? (see above) */
+		/* sample, calculate envelope from sample on the fly */
+		/* Note: csizes>0 (see above) */
+		if ((cbuf=(u_char *)malloc(AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE))==NULL){
+			perror("malloc");
+			ret=-1;
+			goto akai_import_take_exit;
+		}
+		if (akai_take_importsample(pp,cstarts,samplesize,inpfd,NULL,envbuf,envsiz,cbuf)<0){
+			fprintf(stderr,"cannot import DD take\n");
+			ret=-1;
+			goto akai_import_take_exit;
+		}
+		/* write envelope to DD take */
+		if (akai_import_ddfatchain(pp,cstarte,0,envsiz,-1,envbuf)<0){
+			fprintf(stderr,"cannot save envelope\n");
+			ret=-1;
+			goto akai_import_take_exit;
+		}
+	}else{
 		/* sample */
 		if (akai_import_ddfatchain(pp,cstarts,0,samplesize,inpfd,NULL)<0){
 			fprintf(stderr,"cannot import DD take\n");
 			ret=-1;
 			goto akai_import_take_exit;
 		}
-	}
-
-	if (csizee>0){
-		/* envelope */
-		if (envbuf!=NULL){ /* no envelope in file? (see above) */
-			/* calculate envelope from sample */
-			if (akai_take_setenv(pp,cstarts,samplesize,envbuf,envsiz)<0){
-				ret=-1;
-				goto akai_import_take_exit;
-			}
-			/* write envelope to DD take */
-			if (akai_import_ddfatchain(pp,cstarte,0,envsiz,-1,envbuf)<0){
-				fprintf(stderr,"cannot save envelope\n");
-				ret=-1;
-				goto akai_import_take_exit;
-			}
-		}else{
+		if (csizee>0){
 			/* import envelope from file */
 			bsize=csizee*AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE;
 			if (akai_import_ddfatchain(pp,cstarte,0,bsize,inpfd,NULL)<0){
@@ -322,6 +379,9 @@ akai_import_take(int inpfd,struct part_s *pp,struct akai_ddtake_s *tp,u_int ti,u
 	ret=0; /* success */
 
 akai_import_take_exit:
+	if (cbuf!=NULL){
+		free(cbuf);
+	}
 	if (envbuf!=NULL){
 		free(envbuf);
 	}
@@ -374,17 +434,21 @@ akai_export_take(int outfd,struct part_s *pp,struct akai_ddtake_s *tp,u_int csiz
 
 
 int
-akai_take2wav(struct part_s *pp,u_int ti,int wavfd,u_int *sizep,char **wavnamep,int what)
+akai_take2wav_check(struct take2wav_s *cp,struct part_s *pp,u_int ti)
 {
-	/* Note: static for multiple calls with different what */
-	static u_int cstarts;
-	static u_int samplestart;
-	static u_int samplesize;
-	static u_int samplerate;
-	static u_int samplechnr;
-	static int ret;
-	static char wavname[AKAI_NAME_LEN+4+1]; /* name (ASCII), +4 for ".<type>", +1 for '\0' */
-	static int nlen;
+	int nlen;
+
+	if (cp==NULL){
+		return -1;
+	}
+
+	/* initialize context */
+	cp->pp=pp;
+	cp->ti=ti;
+	cp->wavfd=-1; /* no WAV file created so far */
+	cp->wavsize=0;
+	cp->wavname[0]='\0';
+	cp->rangeflag=0; /* whole take */
 
 	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)){
 		return -1;
@@ -397,177 +461,527 @@ akai_take2wav(struct part_s *pp,u_int ti,int wavfd,u_int *sizep,char **wavnamep,
 		return -1;
 	}
 
-	if (what&TAKE2WAV_CHECK){
-
-		cstarts=(pp->head.dd.take[ti].cstarts[1]<<8)
-			    +pp->head.dd.take[ti].cstarts[0];
-		if (cstarts==0){ /* empty? */
-			return -1;
-		}
-
-		ret=-1; /* no success so far */
+	cp->cstarts=(pp->head.dd.take[ti].cstarts[1]<<8)
+		+pp->head.dd.take[ti].cstarts[0];
+	if (cp->cstarts==0){ /* empty? */
+		return -1;
+	}
 
-		/* take parameters */
+	/* take parameters */
 #if 1
-		/* Note: words are 16bit */
-		/* start word */
-		samplestart=(pp->head.dd.take[ti].wstart[3]<<24)
-				   +(pp->head.dd.take[ti].wstart[2]<<16)
-				   +(pp->head.dd.take[ti].wstart[1]<<8)
-				   +pp->head.dd.take[ti].wstart[0];
-		/* end word */
-		samplesize=(pp->head.dd.take[ti].wend[3]<<24)
-				   +(pp->head.dd.take[ti].wend[2]<<16)
-				   +(pp->head.dd.take[ti].wend[1]<<8)
-				   +pp->head.dd.take[ti].wend[0];
-		if (samplesize<samplestart){ /* end<start? */
-			return -1;
-		}
-		samplesize-=samplestart; /* size in words */
-		samplestart*=2; /* *2 for 16bit per sample word */
-		samplesize*=2; /* *2 for 16bit per sample word */
-		/* XXX check samplestart and samplesize */
+	/* Note: words are 16bit */
+	/* start word */
+	cp->samplestart=(pp->head.dd.take[ti].wstart[3]<<24)
+		+(pp->head.dd.take[ti].wstart[2]<<16)
+		+(pp->head.dd.take[ti].wstart[1]<<8)
+		+pp->head.dd.take[ti].wstart[0];
+	/* end word */
+	cp->samplesize=(pp->head.dd.take[ti].wend[3]<<24)
+		+(pp->head.dd.take[ti].wend[2]<<16)
+		+(pp->head.dd.take[ti].wend[1]<<8)
+		+pp->head.dd.take[ti].wend[0];
+	if (cp->samplesize<cp->samplestart){ /* end<start? */
+		return -1;
+	}
+	cp->samplesize-=cp->samplestart; /* size in words */
+	cp->samplestart*=2; /* *2 for 16bit per sample word */
+	cp->samplesize*=2; /* *2 for 16bit per sample word */
+	/* XXX check samplestart and samplesize */
 #else
-		/* all clusters */
-		samplestart=0;
-		samplesize=akai_count_ddfatchain(pp,cstarts)*AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE; /* in bytes */
+	/* all clusters */
+	cp->samplestart=0;
+	cp->samplesize=akai_count_ddfatchain(pp,cp->cstarts)*AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE; /* in bytes */
 #endif
-		samplerate=(pp->head.dd.take[ti].srate[1]<<8)
-				   +pp->head.dd.take[ti].srate[0];
-		samplechnr=pp->head.dd.take[ti].stype?2:1;
+	cp->samplerate=(pp->head.dd.take[ti].srate[1]<<8)
+		+pp->head.dd.take[ti].srate[0];
+	cp->samplechnr=pp->head.dd.take[ti].stype?2:1;
 
 #ifdef DEBUG
-		printf("samplestart: %15u bytes\n",samplestart);
-		printf("samplesize:  %15u bytes\n",samplesize);
-		printf("samplerate:  %15u Hz\n",samplerate);
-		printf("samplechnr:  %15u\n",samplechnr);
+	printf("samplestart: %15u bytes\n",cp->samplestart);
+	printf("samplesize:  %15u bytes\n",cp->samplesize);
+	printf("samplerate:  %15u Hz\n",cp->samplerate);
+	printf("samplechnr:  %15u\n",cp->samplechnr);
 #endif
 
-		if (sizep!=NULL){
-			/* WAV file size */
-			*sizep=WAV_HEAD_SIZE+samplesize;
+	/* WAV file size */
+	cp->wavsize=WAV_HEAD_SIZE+cp->samplesize;
 #ifndef WAV_AKAIHEAD_DISABLE
-			*sizep+=sizeof(struct wav_chunkhead_s)+sizeof(struct akai_ddtake_s); /* DD take header chunk (see below) */
+	cp->wavsize+=sizeof(struct wav_chunkhead_s)+sizeof(struct akai_ddtake_s); /* DD take header chunk (see below) */
 #endif
-		}
 
-		/* create WAV name */
-		akai2ascii_name(pp->head.dd.take[ti].name,wavname,0); /* 0: not S900 */
-		nlen=(int)strlen(wavname);
-		bcopy(".wav",wavname+nlen,5);
+	/* create WAV name */
+	akai2ascii_name(pp->head.dd.take[ti].name,cp->wavname,0); /* 0: not S900 */
+	nlen=(int)strlen(cp->wavname);
+	bcopy(".wav",cp->wavname+nlen,5);
 
-		if (wavnamep!=NULL){
-			/* pointer to name (wavname must be static!) */
-			*wavnamep=wavname;
-		}
+	return 0;
+}
+
+/* restrict export to range of sample frames, relative to start of take window (wstart), not to sample 0 */
+/* Note: after akai_take2wav_check(), fend is exclusive and will be clipped to end of take window (wend) */
+/* Note: only clusters within range will be read by akai_take2wav_export() */
+int
+akai_take2wav_setrange(struct take2wav_s *cp,u_int fstart,u_int fend)
+{
+	u_int fsize;
+	u_int fnum;
+
+	if ((cp==NULL)||(cp->pp==NULL)||(cp->samplechnr==0)){
+		return -1;
 	}
 
-	if (what&TAKE2WAV_EXPORT){
+	fsize=2*cp->samplechnr; /* frame size in bytes, 2 for 16bit per sample word */
+	fnum=cp->samplesize/fsize; /* number of frames */
+	if (fend>fnum){
+		fend=fnum;
+	}
+	if (fstart>=fend){
+		fprintf(stderr,"invalid range\n");
+		return -1;
+	}
 
-		if (what&TAKE2WAV_CREATE){
-			/* create WAV file */
-			if ((wavfd=OPEN(wavname,O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666))<0){
-				perror("create WAV");
-				goto akai_take2wav_exit;
-			}
-		}
+	cp->samplestart+=fstart*fsize;
+	cp->samplesize=(fend-fstart)*fsize;
+	cp->rangeflag=1;
+
+#ifdef DEBUG
+	printf("samplestart: %15u bytes\n",cp->samplestart);
+	printf("samplesize:  %15u bytes\n",cp->samplesize);
+#endif
 
-		/* write WAV header */
-		if (wav_write_head(wavfd,
-						   samplesize,samplechnr,samplerate,16, /* 16: 16bit */
+	/* WAV file size */
+	cp->wavsize=WAV_HEAD_SIZE+cp->samplesize;
 #ifndef WAV_AKAIHEAD_DISABLE
-						   sizeof(struct wav_chunkhead_s)+sizeof(struct akai_ddtake_s) /* DD take header chunk (see below) */
+	cp->wavsize+=sizeof(struct wav_chunkhead_s)+sizeof(struct akai_ddtake_s); /* DD take header chunk */
+#endif
+
+	return 0;
+}
+
+/* same as akai_take2wav_setrange(), range in ms */
+int
+akai_take2wav_setrange_ms(struct take2wav_s *cp,u_int msstart,u_int msend)
+{
+
+	if (cp==NULL){
+		return -1;
+	}
+
+	/* Note: U_INT64 to avoid overflow for long takes */
+	return akai_take2wav_setrange(cp,
+								  (u_int)((((U_INT64)msstart)*cp->samplerate)/1000),
+								  (u_int)((((U_INT64)msend)*cp->samplerate)/1000));
+}
+
+/* set DD take header chunk in buf (to be appended after WAV samples), returns size in bytes */
+/* Note: buf must have space for TAKE2WAV_TAILSIZMAX bytes */
+u_int
+akai_take2wav_settail(struct take2wav_s *cp,u_char *buf)
+{
+#ifndef WAV_AKAIHEAD_DISABLE
+	struct wav_chunkhead_s wavchunkhead;
+	struct akai_ddtake_s t;
+	u_int hdrsize;
+	u_int csizes;
+
+	if ((cp==NULL)||(cp->pp==NULL)||(buf==NULL)){
+		return 0;
+	}
+
+	/* create DD take header chunk */
+	bcopy(WAV_CHUNKHEAD_AKAIDDTAKEHEADSTR,wavchunkhead.typestr,4);
+	hdrsize=sizeof(struct akai_ddtake_s);
+	wavchunkhead.csize[0]=0xff&hdrsize;
+	wavchunkhead.csize[1]=0xff&(hdrsize>>8);
+	wavchunkhead.csize[2]=0xff&(hdrsize>>16);
+	wavchunkhead.csize[3]=0xff&(hdrsize>>24);
+	bcopy((u_char *)&wavchunkhead,buf,sizeof(struct wav_chunkhead_s));
+	/* get DD take header from directory entry */
+	bcopy((u_char *)&cp->pp->head.dd.take[cp->ti],&t,hdrsize);
+	if (cp->rangeflag){
+		u_int wstart,wend;
+		u_int wm;
+
+		/* range: sample starts at word 0 in WAV, move edit markers into range */
+		wstart=cp->samplestart/2; /* /2 for 16bit per sample word */
+		wend=cp->samplesize/2; /* /2 for 16bit per sample word */
+		bzero(t.wstart,4);
+		t.wend[3]=0xff&(wend>>24);
+		t.wend[2]=0xff&(wend>>16);
+		t.wend[1]=0xff&(wend>>8);
+		t.wend[0]=0xff&wend;
+		wm=(t.wstartm[3]<<24)+(t.wstartm[2]<<16)+(t.wstartm[1]<<8)+t.wstartm[0];
+		wm=(wm>wstart)?(wm-wstart):0;
+		wm=(wm<wend)?wm:wend;
+		t.wstartm[3]=0xff&(wm>>24);
+		t.wstartm[2]=0xff&(wm>>16);
+		t.wstartm[1]=0xff&(wm>>8);
+		t.wstartm[0]=0xff&wm;
+		wm=(t.wendm[3]<<24)+(t.wendm[2]<<16)+(t.wendm[1]<<8)+t.wendm[0];
+		wm=(wm>wstart)?(wm-wstart):0;
+		wm=(wm<wend)?wm:wend;
+		t.wendm[3]=0xff&(wm>>24);
+		t.wendm[2]=0xff&(wm>>16);
+		t.wendm[1]=0xff&(wm>>8);
+		t.wendm[0]=0xff&wm;
+		/* clusters needed for range */
+		csizes=(cp->samplesize+AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE-1)/(AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE);
+	}else{
+		/* determine csizes (sample clusters) and csizee (envelope clusters) */
+		csizes=akai_count_ddfatchain(cp->pp,cp->cstarts);
+	}
+	/* Note: no envelope in WAV file -> csizee=0 */
+	/* XXX use cstarts/cstarte fields in DD take header for csizes/csizee */
+	t.cstarts[1]=0xff&(csizes>>8);
+	t.cstarts[0]=0xff&csizes;
+	t.cstarte[1]=0x00;
+	t.cstarte[0]=0x00;
+	bcopy((u_char *)&t,buf+sizeof(struct wav_chunkhead_s),hdrsize);
+
+	return sizeof(struct wav_chunkhead_s)+hdrsize;
 #else
-						   0
+	(void)cp;
+	(void)buf;
+	return 0;
 #endif
-						   )<0){
-			fprintf(stderr,"cannot write WAV header\n");
-			goto akai_take2wav_exit;
-		}
+}
 
-		/* export sample */
-		/* Note: no sample format conversion necessary for S1100 and S3000 */
-		if (akai_export_ddfatchain(pp,cstarts,samplestart,samplesize,wavfd,NULL)<0){
-			perror("write WAV samples");
-			goto akai_take2wav_exit;
+int
+akai_take2wav_export(struct take2wav_s *cp,int wavfd)
+{
+	struct part_s *pp;
+
+	if ((cp==NULL)||(cp->pp==NULL)){
+		return -1;
+	}
+	pp=cp->pp;
+
+	if (wavfd<0){
+		/* create WAV file */
+		if ((cp->wavfd=OPEN(cp->wavname,O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666))<0){
+			perror("create WAV");
+			return -1;
 		}
+		/* Note: akai_take2wav_finish() will close WAV file */
+		wavfd=cp->wavfd;
+	}
 
+	/* write WAV header */
+	if (wav_write_head(wavfd,
+					   cp->samplesize,cp->samplechnr,cp->samplerate,16, /* 16: 16bit */
 #ifndef WAV_AKAIHEAD_DISABLE
-		{
-			struct wav_chunkhead_s wavchunkhead;
-			struct akai_ddtake_s t;
-			u_int hdrsize;
-			u_int csizes;
-
-			/* create DD take header chunk */
-			bcopy(WAV_CHUNKHEAD_AKAIDDTAKEHEADSTR,wavchunkhead.typestr,4);
-			hdrsize=sizeof(struct akai_ddtake_s);
-			wavchunkhead.csize[0]=0xff&hdrsize;
-			wavchunkhead.csize[1]=0xff&(hdrsize>>8);
-			wavchunkhead.csize[2]=0xff&(hdrsize>>16);
-			wavchunkhead.csize[3]=0xff&(hdrsize>>24);
-			/* write WAV chunk header */
-			if (WRITE(wavfd,(u_char *)&wavchunkhead,sizeof(struct wav_chunkhead_s))!=(int)sizeof(struct wav_chunkhead_s)){
-				perror("write WAV chunk");
-				goto akai_take2wav_exit;
-			}
-			/* get DD take header from directory entry */
-			bcopy((u_char *)&pp->head.dd.take[ti],&t,hdrsize);
-			/* determine csizes (sample clusters) and csizee (envelope clusters) */
-			csizes=akai_count_ddfatchain(pp,cstarts);
-			/* Note: no envelope in WAV file -> csizee=0 */
-			/* XXX use cstarts/cstarte fields in DD take header for csizes/csizee */
-			t.cstarts[1]=0xff&(csizes>>8);
-			t.cstarts[0]=0xff&csizes;
-			t.cstarte[1]=0x00;
-			t.cstarte[0]=0x00;
-			/* write DD take header */
-			if (WRITE(wavfd,(u_char *)&t,hdrsize)!=(int)hdrsize){
-				perror("write WAV chunk");
-				goto akai_take2wav_exit;
-			}
-		}
+					   sizeof(struct wav_chunkhead_s)+sizeof(struct akai_ddtake_s) /* DD take header chunk (see below) */
+#else
+					   0
 #endif
+					   )<0){
+		fprintf(stderr,"cannot write WAV header\n");
+		return -1;
+	}
+
+	/* export sample */
+	/* Note: no sample format conversion necessary for S1100 and S3000 */
+	if (akai_export_ddfatchain(pp,cp->cstarts,cp->samplestart,cp->samplesize,wavfd,NULL)<0){
+		perror("write WAV samples");
+		return -1;
+	}
+
+	/* DD take header chunk */
+	{
+		u_char tailbuf[TAKE2WAV_TAILSIZMAX];
+		u_int tailsize;
+
+		tailsize=akai_take2wav_settail(cp,tailbuf);
+		if ((tailsize>0)&&(WRITE(wavfd,tailbuf,tailsize)!=(int)tailsize)){
+			perror("write WAV chunk");
+			return -1;
+		}
+	}
 #if 1
-		printf("DD take exported to WAV\n");
+	printf("DD take exported to WAV\n");
 #endif
+
+	return 0;
+}
+
+void
+akai_take2wav_finish(struct take2wav_s *cp)
+{
+
+	if (cp==NULL){
+		return;
+	}
+
+	if (cp->wavfd>=0){
+		CLOSE(cp->wavfd);
+		cp->wavfd=-1;
+	}
+}
+
+int
+akai_take2wav(struct part_s *pp,u_int ti,int wavfd,u_int *sizep,char **wavnamep,int what)
+{
+	/* Note: static for multiple calls with different what */
+	/* Note: not reentrant, use akai_take2wav_check()/_export()/_finish() with own context instead */
+	static struct take2wav_s ctx;
+	int ret;
+
+	if (what&TAKE2WAV_CHECK){
+		ret=akai_take2wav_check(&ctx,pp,ti);
+		if (ret!=0){
+			return ret;
+		}
+		if (sizep!=NULL){
+			/* WAV file size */
+			*sizep=ctx.wavsize;
+		}
+		if (wavnamep!=NULL){
+			/* pointer to name (ctx must be static!) */
+			*wavnamep=ctx.wavname;
+		}
 	}
 
 	ret=0; /* success */
 
-akai_take2wav_exit:
-	if (what&TAKE2WAV_CREATE){
-		if (wavfd>=0){
-			CLOSE(wavfd);
+	if (what&TAKE2WAV_EXPORT){
+		ctx.pp=pp;
+		ctx.ti=ti;
+		ret=akai_take2wav_export(&ctx,(what&TAKE2WAV_CREATE)?-1:wavfd);
+		akai_take2wav_finish(&ctx);
+	}
+
+	return ret;
+}
+
+
+
+/* DD take export job */
+/* Note: prepared by caller's thread, akai_take_job_run() can run in any thread */
+
+int
+akai_take_job_init(struct take_job_s *jp,struct part_s *pp,u_int ti,int wavflag)
+{
+	struct akai_ddtake_s t;
+	u_int cstarts,cstarte;
+	u_int csizes,csizee;
+	u_int bstarts,bsizes,bsizee;
+	int extnums,extnume;
+
+	if (jp==NULL){
+		return -1;
+	}
+
+	bzero(jp,sizeof(struct take_job_s));
+	jp->ti=ti;
+	jp->extp=NULL;
+
+	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)){
+		return -1;
+	}
+	if (pp->type!=PART_TYPE_DD){
+		return -1;
+	}
+	if (ti>=AKAI_DDTAKE_MAXNUM){
+		return -1;
+	}
+	jp->fd=pp->fd;
+
+	cstarts=(pp->head.dd.take[ti].cstarts[1]<<8)
+		+pp->head.dd.take[ti].cstarts[0];
+	if (cstarts==0){ /* empty? */
+		return 1; /* no error */
+	}
+	cstarte=(pp->head.dd.take[ti].cstarte[1]<<8)
+		+pp->head.dd.take[ti].cstarte[0];
+
+	if (wavflag){
+		struct take2wav_s t2w;
+
+		if (akai_take2wav_check(&t2w,pp,ti)<0){
+			return -1;
 		}
+		strcpy(jp->fname,t2w.wavname);
+		/* WAV header */
+		jp->tailsize=akai_take2wav_settail(&t2w,jp->tail);
+		wav_set_head(jp->head,t2w.samplesize,t2w.samplechnr,t2w.samplerate,16, /* 16: 16bit */
+					 jp->tailsize);
+		jp->headsize=WAV_HEAD_SIZE;
+		/* sample */
+		bstarts=t2w.samplestart;
+		bsizes=t2w.samplesize;
+		bsizee=0;
+		extnums=akai_ddfatchain_extents(pp,cstarts,bstarts,bsizes,NULL,0);
+		extnume=0;
+	}else{
+		/* name */
+		akai2ascii_name(pp->head.dd.take[ti].name,jp->fname,0); /* 0: not S900 */
+		strcpy(jp->fname+strlen(jp->fname),AKAI_DDTAKE_FNAMEEND);
+		/* get DD take header from directory entry */
+		bcopy(&pp->head.dd.take[ti],&t,sizeof(struct akai_ddtake_s));
+		/* determine csizes (sample clusters) and csizee (envelope clusters) */
+		csizes=akai_count_ddfatchain(pp,cstarts);
+		csizee=akai_count_ddfatchain(pp,cstarte);
+		/* XXX use cstarts/cstarte fields in DD take header for csizes/csizee */
+		t.cstarts[1]=0xff&(csizes>>8);
+		t.cstarts[0]=0xff&csizes;
+		t.cstarte[1]=0xff&(csizee>>8);
+		t.cstarte[0]=0xff&csizee;
+		bcopy(&t,jp->head,sizeof(struct akai_ddtake_s));
+		jp->headsize=sizeof(struct akai_ddtake_s);
+		/* sample and envelope */
+		bstarts=0;
+		bsizes=csizes*AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE; /* in bytes */
+		bsizee=csizee*AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE; /* in bytes */
+		extnums=akai_ddfatchain_extents(pp,cstarts,0,bsizes,NULL,0);
+		extnume=(csizee>0)?akai_ddfatchain_extents(pp,cstarte,0,bsizee,NULL,0):0;
 	}
+	if ((extnums<0)||(extnume<0)){
+		fprintf(stderr,"invalid cluster chain in take %u\n",ti+1);
+		return -1;
+	}
+
+	/* resolve extents on disk */
+	jp->extnum=(u_int)(extnums+extnume);
+	if (jp->extnum>0){
+		if ((jp->extp=(struct io_ext_s *)malloc(jp->extnum*sizeof(struct io_ext_s)))==NULL){
+			perror("malloc");
+			return -1;
+		}
+		if (wavflag){
+			akai_ddfatchain_extents(pp,cstarts,bstarts,bsizes,jp->extp,(u_int)extnums);
+		}else{
+			akai_ddfatchain_extents(pp,cstarts,0,bsizes,jp->extp,(u_int)extnums);
+			if (extnume>0){
+				akai_ddfatchain_extents(pp,cstarte,0,bsizee,jp->extp+extnums,(u_int)extnume);
+			}
+		}
+	}
+
+	/* file size */
+	jp->size=jp->headsize+jp->tailsize;
+	for (extnums=0;extnums<(int)jp->extnum;extnums++){
+		jp->size+=jp->extp[extnums].size;
+	}
+
+	return 0;
+}
+
+void
+akai_take_job_free(struct take_job_s *jp)
+{
+
+	if (jp==NULL){
+		return;
+	}
+
+	if (jp->extp!=NULL){
+		free(jp->extp);
+		jp->extp=NULL;
+	}
+	jp->extnum=0;
+}
+
+/* create file and copy take data, update hash if hp!=NULL */
+/* Note: no global state, block cache must have been flushed by caller */
+/* Note: buf (of bufsiz bytes) is required if hp!=NULL */
+int
+akai_take_job_run(struct take_job_s *jp,struct hash_xxh64_s *hp,u_char *buf,u_int bufsiz)
+{
+	int outfd;
+	u_int ei;
+	OFF_T off;
+	u_int size,chunk;
+	int ret;
+
+	if (jp==NULL){
+		return -1;
+	}
+	if ((hp!=NULL)&&((buf==NULL)||(bufsiz==0))){
+		return -1;
+	}
+
+	if ((outfd=OPEN(jp->fname,O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666))<0){
+		perror("create");
+		return -1;
+	}
+
+	ret=-1;
+
+	/* header */
+	if (WRITE(outfd,jp->head,jp->headsize)!=(int)jp->headsize){
+		perror("write");
+		goto akai_take_job_run_exit;
+	}
+	if (hp!=NULL){
+		hash_xxh64_update(hp,jp->head,jp->headsize);
+	}
+
+	/* data */
+	for (ei=0;ei<jp->extnum;ei++){
+		if (hp==NULL){
+			/* zero-copy if possible */
+			if (io_copy_range(jp->fd,jp->extp[ei].off,jp->extp[ei].size,outfd)<0){
+				goto akai_take_job_run_exit;
+			}
+			continue;
+		}
+		/* via buffer for hash */
+		off=jp->extp[ei].off;
+		for (size=jp->extp[ei].size;size>0;size-=chunk){
+			chunk=(size<bufsiz)?size:bufsiz;
+			if (io_pread(jp->fd,buf,chunk,off)<0){
+				perror("read");
+				goto akai_take_job_run_exit;
+			}
+			hash_xxh64_update(hp,buf,chunk);
+			if (WRITE(outfd,buf,chunk)!=(int)chunk){
+				perror("write");
+				goto akai_take_job_run_exit;
+			}
+			off+=(OFF_T)chunk;
+		}
+	}
+
+	/* tail */
+	if (jp->tailsize>0){
+		if (WRITE(outfd,jp->tail,jp->tailsize)!=(int)jp->tailsize){
+			perror("write");
+			goto akai_take_job_run_exit;
+		}
+		if (hp!=NULL){
+			hash_xxh64_update(hp,jp->tail,jp->tailsize);
+		}
+	}
+
+	ret=0; /* success */
+
+akai_take_job_run_exit:
+	CLOSE(outfd);
 	return ret;
 }
 
 
 
 int
-akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,int what)
+akai_wav2take_check(struct wav2take_s *cp,int wavfd,char *wavname,struct part_s *pp,u_int ti)
 {
-	/* Note: static for multiple calls with different what */
-	static struct akai_ddtake_s t;
-	static u_int chnr;
-	static u_int samplerate;
-	static u_int bitnr;
-	static u_int samplesize;
-	static char *errstrp;
-	static int nlen;
-	static char name[AKAI_NAME_LEN+1]; /* name (ASCII), +1 for '\0' */
-	static u_int cstarts,cstarte;
-	static u_int csizes,csizee;
-	static u_int envsiz;
-	static u_char *envbuf;
-	static int ret;
-	static u_int bcount;
-#ifndef WAV_AKAIHEAD_DISABLE
-	static u_int extrasize;
-	static int wavakaiheadfound;
-#endif
+	char *errstrp;
+
+	if (cp==NULL){
+		return -1;
+	}
+
+	/* initialize context */
+	cp->wavname=wavname;
+	cp->pp=pp;
+	cp->ti=ti;
+	cp->wavfd=wavfd;
+	cp->openflag=0; /* not opened by context so far */
+	cp->envbuf=NULL; /* not allocated yet */
+	cp->cbuf=NULL;
+	cp->bcount=0; /* no bytes read yet */
+	cp->extrasize=0;
+	wav_conv_init(&cp->conv,WAV_HEAD_FTAG,16); /* no conversion so far */
 
 	if (wavname==NULL){
 		return -1;
@@ -586,32 +1000,29 @@ akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,
 
 	/* Note: don't check if name already used, create new DD take */
 
-	ret=-1; /* no success so far */
-	bcount=0; /* no bytes read yet */
-	envbuf=NULL; /* not allocated yet */
-
 	/* check WAV name */
-	nlen=(int)strlen(wavname);
-	if ((nlen<4)||(strncasecmp(wavname+nlen-4,".wav",4)!=0)){
+	cp->nlen=(int)strlen(wavname);
+	if ((cp->nlen<4)||(strncasecmp(wavname+cp->nlen-4,".wav",4)!=0)){
 		/* unknown or unsupported */
-		ret=1; /* no error */
-		goto akai_wav2take_exit;
+		return 1; /* no error */
 	}
-	nlen-=4; /* remove suffix */
+	cp->nlen-=4; /* remove suffix */
 
-	if (what&WAV2TAKE_OPEN){
+	if (wavfd<0){
 		/* open external WAV file */
-		if ((wavfd=OPEN(wavname,O_RDONLY|O_BINARY,0))<0){
+		if ((cp->wavfd=OPEN(wavname,O_RDONLY|O_BINARY,0))<0){
 			perror("open WAV");
-			goto akai_wav2take_exit;
+			return -1;
 		}
+		/* Note: akai_wav2take_finish() will close WAV file */
+		cp->openflag=1;
 	}
 
 	/* read and parse WAV header */
-	if (wav_read_head(wavfd,&bcount,
-					  &samplesize,&chnr,&samplerate,&bitnr,
+	if (wav_read_head(cp->wavfd,&cp->bcount,
+					  &cp->wavdatasize,&cp->chnr,&cp->samplerate,&cp->bitnr,&cp->ftag,
 #ifndef WAV_AKAIHEAD_DISABLE
-					  &extrasize,
+					  &cp->extrasize,
 #else
 					  NULL,
 #endif
@@ -620,38 +1031,84 @@ akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,
 			fprintf(stderr,"%s\n",errstrp);
 		}
 		/* error, don't know how many bytes read */
-		goto akai_wav2take_exit;
+		return -1;
 	}
 
 	/* check parameters */
-	if ((chnr!=1)&&(chnr!=2)){
+	if ((cp->chnr!=1)&&(cp->chnr!=2)){
 		fprintf(stderr,"WAV must be mono or stereo\n");
 		/* unknown or unsupported */
-		ret=1; /* no error */
-		goto akai_wav2take_exit;
+		return 1; /* no error */
 	}
-	if (bitnr!=16){
-		fprintf(stderr,"WAV must be 16bit\n");
+	/* conversion to 16bit */
+	if (wav_conv_init(&cp->conv,cp->ftag,cp->bitnr)<0){
+		fprintf(stderr,"WAV must be 8/16/24/32bit or 32bit float\n");
 		/* unknown or unsupported */
-		ret=1; /* no error */
-		goto akai_wav2take_exit;
+		return 1; /* no error */
 	}
-	if (samplesize==0){
+	if (cp->conv.bytenr==2){
+		cp->samplesize=cp->wavdatasize;
+	}else{
+		cp->samplesize=(cp->wavdatasize/(cp->chnr*cp->conv.bytenr))*cp->chnr*2; /* *2 for 16bit per sample word */
+	}
+	if (cp->samplesize==0){
 		fprintf(stderr,"WAV is empty\n");
-		ret=1; /* no error */
-		goto akai_wav2take_exit;
+		return 1; /* no error */
+	}
+
+	/* resampling */
+	if ((wav_rsrate!=0)&&(wav_rsrate!=cp->samplerate)){
+		u_int framenr;
+		int r;
+
+		r=wav_conv_resample(&cp->conv,cp->chnr,cp->samplerate,wav_rsrate,
+							cp->wavdatasize/(cp->chnr*cp->conv.bytenr),&framenr);
+		if (r!=0){
+			return r;
+		}
+		printf("resampling from %u Hz to %u Hz\n",cp->samplerate,wav_rsrate);
+		cp->samplerate=wav_rsrate;
+		cp->samplesize=framenr*cp->chnr*2; /* *2 for 16bit per sample word */
 	}
 
+	return 0;
+}
+
+int
+akai_wav2take_import(struct wav2take_s *cp)
+{
+	struct part_s *pp;
+	struct akai_ddtake_s t;
+	char name[AKAI_NAME_LEN+1]; /* name (ASCII), +1 for '\0' */
+	int nlen;
+	u_int samplesize;
+	u_int cstarts,cstarte;
+	u_int csizes,csizee;
+#ifndef WAV_AKAIHEAD_DISABLE
+	int wavakaiheadfound;
+#endif
+
+	if ((cp==NULL)||(cp->pp==NULL)||(cp->wavfd<0)){
+		return -1;
+	}
+	pp=cp->pp;
+	samplesize=cp->samplesize;
+	nlen=cp->nlen;
+
 	/* determine csizes (sample clusters) and csizee (envelope clusters) */
 	csizes=(samplesize+AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE-1)/(AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE); /* in clusters, round up */
-	envsiz=((samplesize/2)+AKAI_DDTAKE_ENVBLKSIZW-1)/AKAI_DDTAKE_ENVBLKSIZW; /* number of bytes for envelope, round up (Note: /2 for 16bit per sample word) */
-	csizee=(envsiz+AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE-1)/(AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE); /* in clusters, round up */
+	cp->envsiz=((samplesize/2)+AKAI_DDTAKE_ENVBLKSIZW-1)/AKAI_DDTAKE_ENVBLKSIZW; /* number of bytes for envelope, round up (Note: /2 for 16bit per sample word) */
+	csizee=(cp->envsiz+AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE-1)/(AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE); /* in clusters, round up */
 
 	/* allocate envelope buffer */
-	if ((envbuf=malloc(envsiz))==NULL){
+	if ((cp->envbuf=malloc(cp->envsiz))==NULL){
 		fprintf(stderr,"cannot allocate envelope buffer\n");
-		ret=-1;
-		goto akai_wav2take_exit;
+		return -1;
+	}
+	/* allocate cluster buffer */
+	if ((cp->cbuf=(u_char *)malloc(AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE))==NULL){
+		perror("malloc");
+		return -1;
 	}
 
 	/* allocate space for take */
@@ -661,8 +1118,7 @@ akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,
 	if (akai_allocate_ddfatchain(pp,csizes,&cstarts,csizes)<0){ /* contiguous */
 #endif
 		fprintf(stderr,"cannot allocate FAT chain for sample\n");
-		ret=-1;
-		goto akai_wav2take_exit;
+		return -1;
 	}
 #if 1
 	if (akai_allocate_ddfatchain(pp,csizee,&cstarte,1)<0){ /* 1: not necessarily contiguous */
@@ -672,33 +1128,46 @@ akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,
 		fprintf(stderr,"cannot allocate FAT chain for envelope\n");
 		/* free FAT at cstarts */
 		akai_free_ddfatchain(pp,cstarts,1); /* XXX ignore error */
-		ret=-1;
-		goto akai_wav2take_exit;
+		return -1;
 	}
 
 	if (csizes>0){
 		/* read WAV sample and write sample to DD take */
 		/* Note: no sample format conversion necessary for S1100 and S3000 */
-		if (akai_import_ddfatchain(pp,cstarts,0,samplesize,wavfd,NULL)<0){
+		/* Note: no envelope in WAV file, calculate envelope from sample on the fly */
+		if (akai_take_importsample(pp,cstarts,samplesize,cp->wavfd,
+								   ((cp->conv.bytenr!=2)||(cp->conv.rsp!=NULL))?&cp->conv:NULL,
+								   cp->envbuf,cp->envsiz,cp->cbuf)<0){
 			fprintf(stderr,"cannot import DD take\n");
-			ret=-1;
-			goto akai_wav2take_exit;
+			goto akai_wav2take_import_free;
+		}
+		if ((cp->conv.bytenr!=2)||(cp->conv.rsp!=NULL)){
+			u_int n;
+
+			cp->bcount+=cp->conv.bcount;
+			/* skip unused rest of WAV sample */
+			n=cp->wavdatasize-cp->conv.bcount;
+			if (n>0){
+				u_char rbuf[8]; /* Note: less than one frame */
+
+				if (READ(cp->wavfd,rbuf,n)!=(int)n){
+					fprintf(stderr,"cannot read sample\n");
+					goto akai_wav2take_import_free;
+				}
+				cp->bcount+=n;
+			}
+		}else{
+			cp->bcount+=samplesize;
 		}
-		bcount+=samplesize;
+	}else{
+		bzero(cp->envbuf,cp->envsiz);
 	}
 
 	if (csizee>0){
-		/* Note: no envelope in WAV file */
-		/* calculate envelope from sample */
-		if (akai_take_setenv(pp,cstarts,samplesize,envbuf,envsiz)<0){
-			ret=-1;
-			goto akai_wav2take_exit;
-		}
 		/* write envelope to DD take */
-		if (akai_import_ddfatchain(pp,cstarte,0,envsiz,-1,envbuf)<0){
+		if (akai_import_ddfatchain(pp,cstarte,0,cp->envsiz,-1,cp->envbuf)<0){
 			fprintf(stderr,"cannot save envelope\n");
-			ret=-1;
-			goto akai_wav2take_exit;
+			goto akai_wav2take_import_free;
 		}
 	}
 
@@ -709,15 +1178,20 @@ akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,
 		u_int wavakaiheadsize;
 		u_int bc;
 
-		wavakaiheadtype=wav_find_akaihead(wavfd,&bc,&wavakaiheadsize,extrasize,WAV_AKAIHEADTYPE_DDTAKE);
+		wavakaiheadtype=wav_find_akaihead(cp->wavfd,&bc,&wavakaiheadsize,cp->extrasize,WAV_AKAIHEADTYPE_DDTAKE);
 		if (wavakaiheadtype<0){
-			goto akai_wav2take_exit;
+			goto akai_wav2take_import_free;
 		}
-		bcount+=bc;
+		cp->bcount+=bc;
 
 		if ((wavakaiheadtype==(int)WAV_AKAIHEADTYPE_DDTAKE)&&(wavakaiheadsize==sizeof(struct akai_ddtake_s))){
 			/* found matching DD take header chunk */
 			wavakaiheadfound=1;
+			if (cp->conv.rsp!=NULL){
+				/* Note: sample positions in header would not match */
+				printf("DD take header in WAV ignored due to resampling\n");
+				wavakaiheadfound=0;
+			}
 		}else{
 			wavakaiheadfound=0;
 		}
@@ -725,11 +1199,11 @@ akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,
 
 	if (wavakaiheadfound){
 		/* read DD take header */
-		if (READ(wavfd,(u_char *)&t,sizeof(struct akai_ddtake_s))!=(int)sizeof(struct akai_ddtake_s)){
+		if (READ(cp->wavfd,(u_char *)&t,sizeof(struct akai_ddtake_s))!=(int)sizeof(struct akai_ddtake_s)){
 			fprintf(stderr,"cannot read DD take header\n");
-			goto akai_wav2take_exit;
+			goto akai_wav2take_import_free;
 		}
-		bcount+=sizeof(struct akai_ddtake_s);
+		cp->bcount+=sizeof(struct akai_ddtake_s);
 #if 1
 		printf("DD take header imported from WAV\n");
 #endif
@@ -783,7 +1257,7 @@ akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,
 		if (nlen>AKAI_NAME_LEN){
 			nlen=AKAI_NAME_LEN;
 		}
-		bcopy(wavname,name,nlen);
+		bcopy(cp->wavname,name,nlen);
 		name[nlen]='\0';
 		ascii2akai_name(name,t.name,0); /* 0: not S900 */
 	}
@@ -792,72 +1266,298 @@ akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,
 	t.cstarts[0]=0xff&cstarts;
 	t.cstarte[1]=0xff&(cstarte>>8);
 	t.cstarte[0]=0xff&cstarte;
-	t.stype=(chnr==2)?0x01:0x00;
-	t.srate[1]=0xff&(samplerate>>8);
-	t.srate[0]=0xff&samplerate;
+	t.stype=(cp->chnr==2)?0x01:0x00;
+	t.srate[1]=0xff&(cp->samplerate>>8);
+	t.srate[0]=0xff&cp->samplerate;
 
 	/* copy DD take header into directory entry */
-	bcopy(&t,&pp->head.dd.take[ti],sizeof(struct akai_ddtake_s));
+	bcopy(&t,&pp->head.dd.take[cp->ti],sizeof(struct akai_ddtake_s));
 	/* write partition header */
 	if (akai_io_blks(pp,(u_char *)&pp->head.dd,
 					 0,
 					 AKAI_DDPARTHEAD_BLKS,
 					 1,IO_BLKS_WRITE)<0){ /* 1: allocate cache if possible */
 		fprintf(stderr,"cannot write partition header\n");
-		ret=-1;
-		goto akai_wav2take_exit;
+		return -1;
 	}
 
 #if 1
 	printf("DD take imported from WAV\n");
 #endif
 
-	ret=0; /* success */
+	return 0;
+
+akai_wav2take_import_free:
+	/* Note: no partly imported DD take left in partition */
+	if (csizee>0){
+		akai_free_ddfatchain(pp,cstarte,1); /* XXX ignore error */
+	}
+	if (csizes>0){
+		akai_free_ddfatchain(pp,cstarts,1); /* XXX ignore error */
+	}
+	return -1;
+}
 
-akai_wav2take_exit:
-	if (what&WAV2TAKE_OPEN){
-		if (wavfd>=0){
-			CLOSE(wavfd);
+void
+akai_wav2take_finish(struct wav2take_s *cp)
+{
+
+	if (cp==NULL){
+		return;
+	}
+
+	if (cp->envbuf!=NULL){
+		free(cp->envbuf);
+		cp->envbuf=NULL;
+	}
+	if (cp->cbuf!=NULL){
+		free(cp->cbuf);
+		cp->cbuf=NULL;
+	}
+	wav_conv_free(&cp->conv);
+	if (cp->openflag){
+		if (cp->wavfd>=0){
+			CLOSE(cp->wavfd);
 		}
+		cp->wavfd=-1;
+		cp->openflag=0;
 	}
-	if (bcountp!=NULL){
-		*bcountp=bcount;
+}
+
+int
+akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,int what)
+{
+	struct wav2take_s ctx;
+	int ret;
+
+	ret=akai_wav2take_check(&ctx,(what&WAV2TAKE_OPEN)?-1:wavfd,wavname,pp,ti);
+	if (ret==0){
+		ret=akai_wav2take_import(&ctx);
 	}
-	if (envbuf!=NULL){
-		free(envbuf);
+	akai_wav2take_finish(&ctx);
+
+	if (bcountp!=NULL){
+		*bcountp=ctx.bcount;
 	}
 	return ret;
 }
 
 
 
-/* set envelope for take */
-int
-akai_take_setenv(struct part_s *pp,u_int cstarts,u_int samplesize,u_char *envbuf,u_int envsiz)
+/* DD take envelope */
+
+static u_char akai_take_logabstab[0x80+1]; /* envelope value for peak of |MSB| */
+static u_char akai_take_absmsbtab[0x100]; /* |MSB| */
+static int akai_take_logabstabready=0;
+
+static void
+akai_take_initlogabstab(void)
 {
-	static u_char logabstab[0x100]; /* must be static */
-	static int logabstabready=0; /* must be static */
-	u_char l,lmax;
-	u_int i,j;
-	u_int ba,bremain,bchunk,la,lchunk;
-	static u_char sbuf[AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE]; /* 1 cluster */
+	double lconst;
+	u_int i;
+
+	if (akai_take_logabstabready){ /* already initialized? */
+		return;
+	}
+
+	lconst=((double)(AKAI_DDTAKE_ENVMAXVAL-1))/log((double)0x80);
+	akai_take_logabstab[0x00]=0;
+	for (i=0x01;i<=0x7f;i++){
+		akai_take_logabstab[i]=((u_char)(lconst*log((double)i)))+1;
+	}
+	akai_take_logabstab[0x80]=AKAI_DDTAKE_ENVMAXVAL;
+	for (i=0x00;i<=0xff;i++){
+		akai_take_absmsbtab[i]=(i<=0x80)?i:(0x100-i);
+	}
+
+	akai_take_logabstabready=1;
+}
+
+/* peak of |MSB| of 16bit sample words in buf, size in bytes (odd last byte ignored) */
+/* Note: MSB is signed, |MSB| in 0x00..0x80 */
+/* Note: logabstab is monotonic in |MSB|, therefore lookup of peak is */
+/*       equivalent to peak of lookups */
+/* Note: MSB of word is monotonic in word, therefore peak of |MSB| */
+/*       can be derived from min. and max. of words */
+/* Note: SIMD code assumes little endian host */
+static u_int
+akai_take_envpeak(u_char *buf,u_int size)
+{
+	int wmin,wmax; /* min. and max. MSB */
+	int m0,m1;
+	u_int count;
+	u_int i;
+
+	count=size>>1; /* number of 16bit words */
+	wmin=0;
+	wmax=0;
+	i=0;
+#if defined(TAKE_SIMD_SSE2)
+	if (count>=8){
+		__m128i vmin,vmax,v;
+		short tmp[8];
+		u_int k;
+
+		/* Note: no alignment required */
+		vmin=_mm_setzero_si128();
+		vmax=_mm_setzero_si128();
+		for (;i+8<=count;i+=8){
+			v=_mm_loadu_si128((__m128i *)(buf+2*i));
+			vmin=_mm_min_epi16(vmin,v);
+			vmax=_mm_max_epi16(vmax,v);
+		}
+		/* MSB, Note: arithmetic shift rounds towards -infinity like MSB */
+		vmin=_mm_srai_epi16(vmin,8);
+		vmax=_mm_srai_epi16(vmax,8);
+		_mm_storeu_si128((__m128i *)tmp,vmin);
+		for (k=0;k<8;k++){
+			if (tmp[k]<wmin){
+				wmin=tmp[k];
+			}
+		}
+		_mm_storeu_si128((__m128i *)tmp,vmax);
+		for (k=0;k<8;k++){
+			if (tmp[k]>wmax){
+				wmax=tmp[k];
+			}
+		}
+	}
+#elif defined(TAKE_SIMD_NEON)
+	if (count>=8){
+		int16x8_t vmin,vmax,v;
+		short tmp[8];
+		u_int k;
+
+		vmin=vdupq_n_s16(0);
+		vmax=vdupq_n_s16(0);
+		for (;i+8<=count;i+=8){
+			v=vreinterpretq_s16_u8(vld1q_u8(buf+2*i));
+			vmin=vminq_s16(vmin,v);
+			vmax=vmaxq_s16(vmax,v);
+		}
+		/* MSB */
+		vmin=vshrq_n_s16(vmin,8);
+		vmax=vshrq_n_s16(vmax,8);
+		vst1q_s16(tmp,vmin);
+		for (k=0;k<8;k++){
+			if (tmp[k]<wmin){
+				wmin=tmp[k];
+			}
+		}
+		vst1q_s16(tmp,vmax);
+		for (k=0;k<8;k++){
+			if (tmp[k]>wmax){
+				wmax=tmp[k];
+			}
+		}
+	}
+#endif
+	/* rest */
+	/* Note: from here, wmax and -wmin are two accumulators for peak of |MSB| */
+	wmin=-wmin;
+	for (;i+2<=count;i+=2){
+		m0=akai_take_absmsbtab[buf[2*i+1]]; /* |MSB| */
+		m1=akai_take_absmsbtab[buf[2*i+3]];
+		wmin=(m0>wmin)?m0:wmin;
+		wmax=(m1>wmax)?m1:wmax;
+	}
+	if (i<count){
+		m0=akai_take_absmsbtab[buf[2*i+1]];
+		wmin=(m0>wmin)?m0:wmin;
+	}
+
+	return (u_int)((wmin>wmax)?wmin:wmax);
+}
 
-	if (!logabstabready){ /* logabstab not initialized yet? */
-		double lconst;
+void
+akai_take_envinit(struct take_env_s *ep,u_char *envbuf,u_int envsiz)
+{
+
+	if (ep==NULL){
+		return;
+	}
+
+	akai_take_initlogabstab();
+
+	ep->envbuf=envbuf;
+	ep->envsiz=(envbuf!=NULL)?envsiz:0;
+	ep->envi=0;
+	ep->bcount=0;
+	ep->peak=0;
+
+	/* zero envbuf */
+	if (ep->envsiz>0){
+		bzero(envbuf,envsiz);
+	}
+}
+
+/* process next sample bytes in order */
+/* Note: size may be arbitrary, even split within a 16bit word */
+void
+akai_take_envupdate(struct take_env_s *ep,u_char *buf,u_int size)
+{
+	u_int bsiz;
+	u_int n,p;
+
+	if ((ep==NULL)||(buf==NULL)){
+		return;
+	}
 
-		/* initialize logabstab */
-		lconst=((double)(AKAI_DDTAKE_ENVMAXVAL-1))/log((double)0x80);
-		logabstab[0x00]=0;
-		for (i=0x01;i<=0x7f;i++){
-			logabstab[i]=((u_char)(lconst*log((double)i)))+1;
+	bsiz=AKAI_DDTAKE_ENVBLKSIZW<<1; /* envelope block size in bytes, *2 for 16bit per sample word */
+	while ((size>0)&&(ep->envi<ep->envsiz)){
+		n=bsiz-ep->bcount; /* remaining bytes in envelope block */
+		if (n>size){
+			n=size;
 		}
-		logabstab[0x80]=AKAI_DDTAKE_ENVMAXVAL;
-		for (i=0x81;i<=0xff;i++){
-			logabstab[i]=logabstab[0x100-i];
+		if (ep->bcount&1){
+			/* MSB of split 16bit word first */
+			p=akai_take_absmsbtab[buf[0]];
+			if (p>ep->peak){
+				ep->peak=p;
+			}
+			p=akai_take_envpeak(buf+1,n-1);
+		}else{
+			p=akai_take_envpeak(buf,n);
+		}
+		if (p>ep->peak){
+			ep->peak=p;
+		}
+		ep->bcount+=n;
+		buf+=n;
+		size-=n;
+		if (ep->bcount==bsiz){ /* envelope block complete? */
+			ep->envbuf[ep->envi++]=akai_take_logabstab[ep->peak];
+			ep->bcount=0;
+			ep->peak=0;
 		}
+	}
+}
 
-		logabstabready=1; /* logabstab is initialized */
+/* flush incomplete last envelope block */
+void
+akai_take_envfinish(struct take_env_s *ep)
+{
+
+	if (ep==NULL){
+		return;
+	}
+
+	if ((ep->bcount>=2)&&(ep->envi<ep->envsiz)){ /* at least one 16bit word? */
+		ep->envbuf[ep->envi++]=akai_take_logabstab[ep->peak];
 	}
+	ep->bcount=0;
+	ep->peak=0;
+}
+
+
+
+/* set envelope for take */
+int
+akai_take_setenv(struct part_s *pp,u_int cstarts,u_int samplesize,u_char *envbuf,u_int envsiz)
+{
+	struct take_env_s env;
+	u_int ba,bremain,bchunk;
+	static u_char sbuf[AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE]; /* 1 cluster */
 
 	if ((pp==NULL)||(!pp->valid)||(pp->fd<0)||(pp->fat==NULL)){
 		return -1;
@@ -870,8 +1570,7 @@ akai_take_setenv(struct part_s *pp,u_int cstarts,u_int samplesize,u_char *envbuf
 		return -1;
 	}
 
-	/* zero envbuf */
-	bzero(envbuf,envsiz);
+	akai_take_envinit(&env,envbuf,envsiz);
 
 	if (samplesize==0){
 		return 0;
@@ -880,8 +1579,7 @@ akai_take_setenv(struct part_s *pp,u_int cstarts,u_int samplesize,u_char *envbuf
 	/* calculate envelope of samples */
 	ba=0;
 	bremain=samplesize;
-	i=0;
-	while ((bremain>0)&&(i<envsiz)){
+	while ((bremain>0)&&(env.envi<env.envsiz)){
 		/* cluster */
 		bchunk=AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE;
 		if (bchunk>bremain){
@@ -898,30 +1596,12 @@ akai_take_setenv(struct part_s *pp,u_int cstarts,u_int samplesize,u_char *envbuf
 #endif
 		}
 
-		la=0;
-		while ((bchunk>0)&&(i<envsiz)){
-			/* envelope block */
-			lchunk=AKAI_DDTAKE_ENVBLKSIZW<<1; /* *2 for 16bit per sample word */
-			if (lchunk>bchunk){
-				lchunk=bchunk;
-			}
-			/* determine peak level within envelope block */
-			lmax=0;
-			for (j=0;j<lchunk;j+=2){ /* 2 for 16bit per sample word */
-				l=logabstab[sbuf[la+j+1]]; /* logabs of MSB */
-				if (l>lmax){
-					lmax=l;
-				}
-			}
-			envbuf[i]=lmax;
+		akai_take_envupdate(&env,sbuf,bchunk);
 
-			ba+=lchunk;
-			bremain-=lchunk;
-			la+=lchunk;
-			bchunk-=lchunk;
-			i++;
-		}
+		ba+=bchunk;
+		bremain-=bchunk;
 	}
+	akai_take_envfinish(&env);
 
 	return 0;
 }
@@ -24,6 +24,8 @@
 
 #include "akaiutil_io.h"
 #include "akaiutil.h"
+#include "akaiutil_wav.h"
+#include "akaiutil_hash.h"
 
 
 
@@ -44,6 +46,78 @@ struct akai_ddtake_s;
 
 
 
+/* converter contexts */
+
+/* DD take to WAV */
+struct take2wav_s{
+	struct part_s *pp;
+	u_int ti;
+	u_int cstarts;
+	u_int samplestart; /* in bytes */
+	u_int samplesize; /* in bytes */
+	u_int samplerate;
+	u_int samplechnr;
+	u_int wavsize; /* WAV file size */
+	char wavname[AKAI_NAME_LEN+4+1]; /* name (ASCII), +4 for ".<type>", +1 for '\0' */
+	int wavfd; /* WAV file created by context, -1 if none */
+	int rangeflag; /* range of take only */
+};
+
+/* WAV to DD take */
+struct wav2take_s{
+	char *wavname;
+	struct part_s *pp;
+	u_int ti;
+	int wavfd;
+	int openflag; /* WAV file opened by context */
+	int nlen;
+	u_int chnr;
+	u_int samplerate;
+	u_int bitnr;
+	u_int ftag;
+	u_int samplesize; /* in bytes after conversion to 16bit */
+	u_int wavdatasize; /* in bytes in WAV file */
+	struct wav_conv_s conv;
+	u_int extrasize;
+	u_int bcount; /* number of bytes read from WAV file */
+	u_char *envbuf;
+	u_int envsiz;
+	u_char *cbuf; /* 1 cluster */
+};
+
+
+
+/* max. size of AKAI tail in exported WAV file */
+#define TAKE2WAV_TAILSIZMAX	0x80
+
+/* export job for DD take */
+/* Note: all disk positions resolved in advance, no access to block cache or FAT */
+struct take_job_s{
+	u_int ti;
+	int fd; /* disk file descriptor */
+	char fname[AKAI_NAME_LEN+4+1]; /* name (ASCII), +4 for ".<type>", +1 for '\0' */
+	u_char head[WAV_HEAD_SIZE+sizeof(struct akai_ddtake_s)]; /* file header */
+	u_int headsize;
+	u_char tail[TAKE2WAV_TAILSIZMAX]; /* file tail */
+	u_int tailsize;
+	struct io_ext_s *extp; /* data extents on disk */
+	u_int extnum;
+	u_int size; /* file size */
+};
+
+
+
+/* envelope calculation context */
+struct take_env_s{
+	u_char *envbuf;
+	u_int envsiz; /* in bytes */
+	u_int envi; /* index of current envelope block */
+	u_int bcount; /* number of sample bytes in current envelope block */
+	u_int peak; /* peak of |MSB| in current envelope block */
+};
+
+
+
 /* Declarations */
 
 extern int akai_ddtake_info(struct part_s *pp,u_int ti,int verbose);
@@ -56,11 +130,27 @@ extern int akai_export_take(int outfd,struct part_s *pp,struct akai_ddtake_s *tp
 #define TAKE2WAV_EXPORT		2
 #define TAKE2WAV_CREATE		4
 #define TAKE2WAV_ALL		0xff
+extern int akai_take2wav_check(struct take2wav_s *cp,struct part_s *pp,u_int ti);
+extern int akai_take2wav_export(struct take2wav_s *cp,int wavfd);
+extern void akai_take2wav_finish(struct take2wav_s *cp);
 extern int akai_take2wav(struct part_s *pp,u_int ti,int wavfd,u_int *sizep,char **wavnamep,int what);
+extern int akai_take2wav_setrange(struct take2wav_s *cp,u_int fstart,u_int fend);
+extern int akai_take2wav_setrange_ms(struct take2wav_s *cp,u_int msstart,u_int msend);
+extern u_int akai_take2wav_settail(struct take2wav_s *cp,u_char *buf);
+
+extern int akai_take_job_init(struct take_job_s *jp,struct part_s *pp,u_int ti,int wavflag);
+extern void akai_take_job_free(struct take_job_s *jp);
+extern int akai_take_job_run(struct take_job_s *jp,struct hash_xxh64_s *hp,u_char *buf,u_int bufsiz);
 
 #define WAV2TAKE_OPEN		1
+extern int akai_wav2take_check(struct wav2take_s *cp,int wavfd,char *wavname,struct part_s *pp,u_int ti);
+extern int akai_wav2take_import(struct wav2take_s *cp);
+extern void akai_wav2take_finish(struct wav2take_s *cp);
 extern int akai_wav2take(int wavfd,char *wavname,struct part_s *pp,u_int ti,u_int *bcountp,int what);
 
+extern void akai_take_envinit(struct take_env_s *ep,u_char *envbuf,u_int envsiz);
+extern void akai_take_envupdate(struct take_env_s *ep,u_char *buf,u_int size);
+extern void akai_take_envfinish(struct take_env_s *ep);
 extern int akai_take_setenv(struct part_s *pp,u_int cstarts,u_int samplesize,u_char *envbuf,u_int envsiz);
 
 
@@ -24,71 +24,1417 @@
 #include "akaiutil.h"
 #include "akaiutil_file.h"
 #include "akaiutil_take.h"
+#include "akaiutil_par.h"
 #include "akaiutil_tar.h"
 
+#ifdef TAR_GZIP
+#include <errno.h>
+#include <signal.h>
+#include <zlib.h>
+#endif
+
+
+
+u_int
+tar_checksum(u_char *hp)
+{
+	u_int sum;
+	u_int i;
+	int zeroflag;
+
+	if (hp==NULL){
+		return 0;
+	}
+
+	sum=0;
+	zeroflag=1; /* still all zeroes */
+	for (i=0;i<sizeof(struct tar_head_s);i++){
+		if (hp[i]!=0){
+			zeroflag=0;
+		}
+		if ((i>=148)&&(i<156)){	/* treat chksum field */
+			sum+=(u_int)' '; /* space */
+		}else{
+			sum+=(u_int)hp[i];
+		}
+	}
+	/* Note: sum is always >0 !!! */
+
+	if (zeroflag){
+		sum=0; /* unique value, see comment above */
+	}
+	return sum;
+}
+
+
+
+/* AKAI metadata of member */
+
+/* metadata from legacy encoding in tar header, if not set by PAX extended header */
+static void
+tar_meta_legacy(struct tar_head_s *hp,struct tar_meta_s *mp)
+{
+	u_int v;
+
+	if (hp->type==TAR_TYPE_DIR){
+		/* XXX devmajor field for volume type */
+		if ((!(mp->flags&TAR_META_VTYPE))&&(sscanf(hp->devmajor,"%o",&v)==1)){
+			mp->vtype=v;
+			mp->flags|=TAR_META_VTYPE;
+		}
+		/* XXX devminor field for load number */
+		if ((!(mp->flags&TAR_META_LNUM))&&(hp->devminor[0]!=0x00)&&(sscanf(hp->devminor,"%o",&v)==1)){
+			mp->lnum=v;
+			mp->flags|=TAR_META_LNUM;
+		}
+		/* XXX linkname for volume parameters */
+		if ((!(mp->flags&TAR_META_VOLPARAM))&&(hp->linkname[0]=='\0')&&(hp->linkname[1]=='P')){ /* XXX correct magic? */
+			bcopy(&hp->linkname[2],&mp->param,sizeof(struct akai_volparam_s)); /* XXX +2: linkname starts with magic */
+			mp->flags|=TAR_META_VOLPARAM;
+		}
+	}else{
+		/* XXX devmajor field for osver */
+		if ((!(mp->flags&TAR_META_OSVER))&&(sscanf(hp->devmajor,"%o",&v)==1)){
+			mp->osver=v;
+			mp->flags|=TAR_META_OSVER;
+		}
+		/* XXX linkname for file tags */
+		if ((!(mp->flags&TAR_META_TAGS))&&(hp->linkname[0]=='\0')&&(hp->linkname[1]=='T')){ /* XXX correct magic? */
+			bcopy(&hp->linkname[2],mp->tag,AKAI_FILE_TAGNUM); /* XXX +2: linkname starts with magic */
+			mp->flags|=TAR_META_TAGS;
+		}
+	}
+}
+
+/* legacy encoding of metadata in tar header */
+/* Note: also used for metadata hash of incremental export */
+static void
+tar_meta_tolegacy(struct tar_meta_s *mp,struct tar_head_s *hp)
+{
+
+	if (mp->flags&TAR_META_VTYPE){
+		sprintf(hp->devmajor,"%07o",mp->vtype);
+	}
+	if (mp->flags&TAR_META_OSVER){
+		sprintf(hp->devmajor,"%07o",mp->osver);
+	}
+	if (mp->flags&TAR_META_LNUM){
+		sprintf(hp->devminor,"%07o",mp->lnum);
+	}
+	if (mp->flags&TAR_META_VOLPARAM){
+		hp->linkname[0]='\0'; /* XXX magic, also empty linkname string */
+		hp->linkname[1]='P'; /* XXX magic */
+		bcopy(&mp->param,&hp->linkname[2],sizeof(struct akai_volparam_s)); /* XXX should fit */
+	}else if (mp->flags&TAR_META_TAGS){
+		hp->linkname[0]='\0'; /* XXX magic, also empty linkname string */
+		hp->linkname[1]='T'; /* XXX magic */
+		bcopy(mp->tag,&hp->linkname[2],AKAI_FILE_TAGNUM); /* XXX should fit */
+	}
+}
+
+/* bytes to hex string */
+static void
+tar_pax_hex(char *s,u_char *p,u_int n)
+{
+	u_int i;
+
+	for (i=0;i<n;i++){
+		sprintf(s+2*i,"%02x",p[i]);
+	}
+	s[2*n]='\0';
+}
+
+/* hex string to n bytes, returns -1 if invalid */
+static int
+tar_pax_unhex(char *s,u_char *p,u_int n)
+{
+	u_int i,v;
+
+	if (strlen(s)!=2*n){
+		return -1;
+	}
+	for (i=0;i<n;i++){
+		if ((!isxdigit((u_char)s[2*i]))||(!isxdigit((u_char)s[2*i+1]))
+			||(sscanf(s+2*i,"%2x",&v)!=1)){
+			return -1;
+		}
+		p[i]=(u_char)v;
+	}
+	return 0;
+}
+
+#ifndef TAR_PAX_DISABLE
+/* append PAX record "<len> <key>=<val>\n" to buf at *countp */
+static void
+tar_pax_record(char *buf,u_int *countp,char *key,char *val)
+{
+	char nstr[12];
+	u_int n,l;
+
+	/* Note: len includes its own digits */
+	n=(u_int)(strlen(key)+strlen(val)+3); /* +3: ' ', '=', '\n' */
+	sprintf(nstr,"%u",n);
+	l=n+(u_int)strlen(nstr);
+	sprintf(nstr,"%u",l);
+	if (n+(u_int)strlen(nstr)!=l){
+		l++;
+	}
+	sprintf(buf+(*countp),"%u %s=%s\n",l,key,val);
+	*countp+=l;
+}
+
+/* PAX records of metadata into buf (TAR_PAX_BUFSIZ bytes), returns size */
+static u_int
+tar_pax_records(struct tar_meta_s *mp,char *buf)
+{
+	char val[2*sizeof(struct akai_volparam_s)+1];
+	u_int count;
+
+	count=0;
+	if (mp->flags&TAR_META_VTYPE){
+		sprintf(val,"%u",mp->vtype);
+		tar_pax_record(buf,&count,TAR_PAX_VTYPE,val);
+	}
+	if (mp->flags&TAR_META_LNUM){
+		sprintf(val,"%u",mp->lnum);
+		tar_pax_record(buf,&count,TAR_PAX_LNUM,val);
+	}
+	if (mp->flags&TAR_META_VOLPARAM){
+		tar_pax_hex(val,(u_char *)&mp->param,sizeof(struct akai_volparam_s));
+		tar_pax_record(buf,&count,TAR_PAX_VOLPARAM,val);
+	}
+	if (mp->flags&TAR_META_OSVER){
+		sprintf(val,"%u",mp->osver);
+		tar_pax_record(buf,&count,TAR_PAX_OSVER,val);
+	}
+	if (mp->flags&TAR_META_TAGS){
+		tar_pax_hex(val,mp->tag,AKAI_FILE_TAGNUM);
+		tar_pax_record(buf,&count,TAR_PAX_TAGS,val);
+	}
+	return count;
+}
+#endif
+
+/* parse PAX records in buf (size bytes, buf[size]=='\0'), AKAI keys into *mp */
+/* Note: other keys are ignored */
+static int
+tar_pax_parse(char *buf,u_int size,struct tar_meta_s *mp)
+{
+	char *p,*key,*val,*end;
+	u_int l,v;
+
+	for (p=buf;p<buf+size;p+=l){
+		if ((sscanf(p,"%u",&l)!=1)||(l==0)||(l>(u_int)(buf+size-p))||(p[l-1]!='\n')){
+			fprintf(stderr,"invalid PAX extended header\n");
+			return -1;
+		}
+		p[l-1]='\0'; /* terminate value */
+		end=p+l;
+		if (((key=strchr(p,' '))==NULL)||(key>=end)||((val=strchr(key,'='))==NULL)){
+			fprintf(stderr,"invalid PAX extended header\n");
+			return -1;
+		}
+		key++;
+		*val++='\0';
+		if (strncmp(key,"AKAI.",5)!=0){
+			continue; /* not for us */
+		}
+		if (strcmp(key,TAR_PAX_VTYPE)==0){
+			if (sscanf(val,"%u",&v)==1){
+				mp->vtype=v;
+				mp->flags|=TAR_META_VTYPE;
+			}
+		}else if (strcmp(key,TAR_PAX_LNUM)==0){
+			if (sscanf(val,"%u",&v)==1){
+				mp->lnum=v;
+				mp->flags|=TAR_META_LNUM;
+			}
+		}else if (strcmp(key,TAR_PAX_VOLPARAM)==0){
+			if (tar_pax_unhex(val,(u_char *)&mp->param,sizeof(struct akai_volparam_s))==0){
+				mp->flags|=TAR_META_VOLPARAM;
+			}
+		}else if (strcmp(key,TAR_PAX_OSVER)==0){
+			if (sscanf(val,"%u",&v)==1){
+				mp->osver=v;
+				mp->flags|=TAR_META_OSVER;
+			}
+		}else if (strcmp(key,TAR_PAX_TAGS)==0){
+			if (tar_pax_unhex(val,mp->tag,AKAI_FILE_TAGNUM)==0){
+				mp->flags|=TAR_META_TAGS;
+			}
+		}
+	}
+	return 0;
+}
+
+/* read next tar header into *hp and its metadata into *mp */
+/* Note: PAX extended headers before member are consumed (*extp: their size in bytes if extp!=NULL), */
+/*       returns as READ(): sizeof(struct tar_head_s) if OK, 0 if EOF */
+static int
+tar_read_head(int fd,struct tar_head_s *hp,struct tar_meta_s *mp,u_int *extp)
+{
+	char *buf;
+	u_int chksum,size,skip;
+	int n;
+
+	bzero(mp,sizeof(struct tar_meta_s));
+	if (extp!=NULL){
+		*extp=0;
+	}
+	for (;;){
+		n=READ(fd,(void *)hp,sizeof(struct tar_head_s));
+		if (n!=sizeof(struct tar_head_s)){
+			return n;
+		}
+		chksum=0;
+		if ((hp->type!=TAR_TYPE_PAX)
+			||(sscanf(hp->chksum,"%o",&chksum)!=1)||(chksum!=tar_checksum((u_char *)hp))){ /* not PAX or checksum error? (reported by caller) */
+			break;
+		}
+		/* PAX extended header */
+		size=0;
+		sscanf(hp->size,"%o",&size);
+		if (size>TAR_PAX_SIZEMAX){
+			fprintf(stderr,"PAX extended header too large\n");
+			return -1;
+		}
+		if ((buf=(char *)malloc(size+1))==NULL){
+			perror("malloc");
+			return -1;
+		}
+		if (READ(fd,(void *)buf,size)!=(int)size){
+			free(buf);
+			return -1;
+		}
+		buf[size]='\0';
+		n=tar_pax_parse(buf,size,mp);
+		free(buf);
+		if (n<0){
+			return -1;
+		}
+		skip=(TAR_BLOCKSIZE-(size%TAR_BLOCKSIZE))%TAR_BLOCKSIZE;
+		if ((skip>0)&&(io_skip(fd,(OFF_T)skip)<0)){
+			return -1;
+		}
+		if (extp!=NULL){
+			*extp+=TAR_BLOCKSIZE+size+skip;
+		}
+	}
+	tar_meta_legacy(hp,mp);
+
+	return n;
+}
+
+
+
+/* sidecar index of tar-file */
+
+int tar_idxflag=0; /* create index for tar c */
+
+/* index line for tar header with metadata *mp at offset off */
+/* Note: devmajor column: volume type or osver, devminor column: load number */
+static void
+tar_idx_line(char *buf,OFF_T off,struct tar_head_s *hp,struct tar_meta_s *mp)
+{
+	u_int size,major,minor;
+	char tstr[2*AKAI_FILE_TAGNUM+1];
+	char name[TAR_NAMELEN+1];
+
+	size=0;
+	sscanf(hp->size,"%o",&size);
+	major=0;
+	if (mp->flags&TAR_META_VTYPE){
+		major=mp->vtype;
+	}else if (mp->flags&TAR_META_OSVER){
+		major=mp->osver;
+	}
+	minor=(mp->flags&TAR_META_LNUM)?mp->lnum:0;
+	if (mp->flags&TAR_META_TAGS){
+		tar_pax_hex(tstr,mp->tag,AKAI_FILE_TAGNUM);
+	}else{
+		strcpy(tstr,"-");
+	}
+	bcopy(hp->name,name,TAR_NAMELEN);
+	name[TAR_NAMELEN]='\0';
+
+	sprintf(buf,"%llu %u %c %u %u %s %s\n",
+			(unsigned long long)off,size,(hp->type=='\0')?TAR_TYPE_REG:hp->type,major,minor,tstr,name);
+}
+
+/* create index file for tar-file */
+int
+tar_idx_open(char *tarname)
+{
+	char *fname;
+	char *hstr;
+	char sbuf[64];
+	int fd;
+
+	if ((fname=(char *)malloc(strlen(tarname)+strlen(TAR_IDX_FNAMEEND)+1))==NULL){
+		perror("malloc");
+		return -1;
+	}
+	sprintf(fname,"%s%s",tarname,TAR_IDX_FNAMEEND);
+	fd=OPEN(fname,O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666);
+	free(fname);
+	if (fd<0){
+		perror("create index");
+		return -1;
+	}
+
+	/* Note: stamp of empty tar-file until tar_idx_close() */
+	sprintf(sbuf,TAR_IDX_STAMPFMT,0ULL,0ULL);
+	hstr="# offset size type devmajor devminor tags name\n";
+	if ((WRITE(fd,sbuf,strlen(sbuf))!=(int)strlen(sbuf))
+		||(WRITE(fd,hstr,strlen(hstr))!=(int)strlen(hstr))){
+		perror("write");
+		CLOSE(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* close index file, stamp it with size and mtime of tar-file tarfd */
+/* Note: call after last write to tar-file */
+int
+tar_idx_close(int idxfd,int tarfd)
+{
+	struct stat st;
+	char sbuf[64];
+	int ret;
+
+	ret=0;
+	if (fstat(tarfd,&st)<0){
+		perror("stat");
+		ret=-1;
+	}else{
+		sprintf(sbuf,TAR_IDX_STAMPFMT,(unsigned long long)st.st_size,(unsigned long long)st.st_mtime);
+		if (LSEEK(idxfd,0,SEEK_SET)<0){
+			perror("lseek");
+			ret=-1;
+		}else if (WRITE(idxfd,sbuf,strlen(sbuf))!=(int)strlen(sbuf)){
+			perror("write");
+			ret=-1;
+		}
+	}
+	CLOSE(idxfd);
+
+	return ret;
+}
+
+/* read index file of tar-file fd into *bufp, returns 1 if no index or index out of date */
+/* Note: *bufp must be freed by caller */
+static int
+tar_idx_read(int fd,char *tarname,char **bufp)
+{
+	char *fname;
+	char *buf;
+	struct stat st;
+	unsigned long long size,mtime;
+	int ifd;
+
+	*bufp=NULL;
+
+	if ((fname=(char *)malloc(strlen(tarname)+strlen(TAR_IDX_FNAMEEND)+1))==NULL){
+		perror("malloc");
+		return -1;
+	}
+	sprintf(fname,"%s%s",tarname,TAR_IDX_FNAMEEND);
+	ifd=OPEN(fname,O_RDONLY|O_BINARY,0);
+	free(fname);
+	if (ifd<0){
+		return 1; /* no index */
+	}
+	if ((fstat(ifd,&st)<0)||(st.st_size<0)){
+		perror("stat");
+		CLOSE(ifd);
+		return -1;
+	}
+	if ((buf=(char *)malloc((size_t)st.st_size+1))==NULL){
+		perror("malloc");
+		CLOSE(ifd);
+		return -1;
+	}
+	if (READ(ifd,buf,(u_int)st.st_size)!=(int)st.st_size){
+		perror("read");
+		free(buf);
+		CLOSE(ifd);
+		return -1;
+	}
+	CLOSE(ifd);
+	buf[st.st_size]='\0';
+
+	/* compare stamp with tar-file */
+	if (fstat(fd,&st)<0){
+		perror("stat");
+		free(buf);
+		return -1;
+	}
+	if ((sscanf(buf,"# tar %llu %llu",&size,&mtime)!=2)
+		||(size!=(unsigned long long)st.st_size)||(mtime!=(unsigned long long)st.st_mtime)){
+		printf("index out of date, ignored\n");
+		free(buf);
+		return 1;
+	}
+
+	*bufp=buf;
+	return 0;
+}
+
+/* load index of tar-file fd, returns 1 if no index or index out of date */
+/* Note: *idxpp must be freed by caller */
+int
+tar_idx_load(int fd,char *tarname,struct tar_idx_s **idxpp,u_int *nump)
+{
+	char *buf,*p,*q;
+	struct tar_idx_s *idxp;
+	unsigned long long off;
+	u_int size,major,minor;
+	char type;
+	char tstr[2*AKAI_FILE_TAGNUM+1+1]; /* +1 to detect overlong field */
+	char fmt[64];
+	u_int num,max;
+	int n;
+
+	*idxpp=NULL;
+	*nump=0;
+
+	if ((n=tar_idx_read(fd,tarname,&buf))!=0){
+		return n; /* no index or error */
+	}
+
+	/* count lines */
+	max=1;
+	for (p=buf;*p!='\0';p++){
+		if (*p=='\n'){
+			max++;
+		}
+	}
+	if ((idxp=(struct tar_idx_s *)malloc(max*sizeof(struct tar_idx_s)))==NULL){
+		perror("malloc");
+		free(buf);
+		return -1;
+	}
+
+	/* parse lines */
+	/* Note: width of tags field from AKAI_FILE_TAGNUM as in TAR_IDX_LINELEN */
+	sprintf(fmt,"%%llu %%u %%c %%u %%u %%%us %%n",(u_int)(sizeof(tstr)-1));
+	num=0;
+	for (p=buf;*p!='\0';p=q){
+		for (q=p;(*q!='\0')&&(*q!='\n');q++);
+		if (*q=='\n'){
+			*q++='\0';
+		}
+		if ((p[0]=='#')||(p[0]=='\0')){ /* comment or empty line? */
+			continue;
+		}
+		if ((sscanf(p,fmt,&off,&size,&type,&major,&minor,tstr,&n)<6)
+			||(strlen(tstr)>2*AKAI_FILE_TAGNUM)||(strlen(p+n)>TAR_NAMELEN)){
+			fprintf(stderr,"invalid index line\n");
+			free(idxp);
+			free(buf);
+			return -1;
+		}
+		idxp[num].off=(OFF_T)off;
+		idxp[num].type=type;
+		strcpy(idxp[num].name,p+n);
+		num++;
+	}
+	free(buf);
+
+	*idxpp=idxp;
+	*nump=num;
+	return 0;
+}
+
+/* check if tar member is selected: within sel or parent directory of sel */
+static int
+tar_sel_match(char *sel,char *name)
+{
+	size_t l,n;
+
+	l=strlen(sel);
+	while ((l>0)&&(sel[l-1]=='/')){
+		l--;
+	}
+	if ((strncmp(name,sel,l)==0)&&((name[l]=='\0')||(name[l]=='/'))){
+		return 1; /* within selection */
+	}
+	n=strlen(name);
+	if ((n>0)&&(name[n-1]=='/')&&(n<=l)&&(strncmp(sel,name,n)==0)){
+		return 1; /* parent directory */
+	}
+	return 0;
+}
+
+/* list tar-file from index, or from tar headers if no index */
+int
+tar_list(int fd,char *tarname)
+{
+	struct tar_head_s tarhd;
+	struct tar_meta_s meta;
+	char lbuf[TAR_IDX_LINELEN];
+	char *buf;
+	OFF_T off;
+	u_int size,ext;
+	int n;
+
+	if (tarname!=NULL){
+		/* from index */
+		if ((n=tar_idx_read(fd,tarname,&buf))<0){
+			return -1;
+		}
+		if (n==0){
+			printf("%s",buf);
+			free(buf);
+			return 0;
+		}
+	}
+
+	/* from tar headers */
+	printf("# offset size type devmajor devminor tags name\n");
+	for (off=0;;){
+		n=tar_read_head(fd,&tarhd,&meta,&ext);
+		if (n==0){ /* end of file? */
+			break;
+		}
+		if (n!=sizeof(struct tar_head_s)){
+			perror("read");
+			return -1;
+		}
+		if (tar_checksum((u_char *)&tarhd)==0){ /* all zero block? */
+			off+=(OFF_T)(ext+TAR_BLOCKSIZE);
+			continue;
+		}
+		/* Note: offset of PAX extended header if any */
+		tar_idx_line(lbuf,off,&tarhd,&meta);
+		printf("%s",lbuf);
+		size=0;
+		sscanf(tarhd.size,"%o",&size);
+		size=(size+TAR_BLOCKSIZE-1)/TAR_BLOCKSIZE*TAR_BLOCKSIZE; /* round up */
+		if (io_skip(fd,(OFF_T)size)<0){
+			perror("lseek");
+			return -1;
+		}
+		off+=(OFF_T)(ext+TAR_BLOCKSIZE+size);
+	}
+
+	return 0;
+}
+
+
+
+/* tar output stream */
+
+int
+tar_out_init(struct tar_out_s *op,int fd)
+{
+
+	if (op==NULL){
+		return -1;
+	}
+
+	op->fd=fd;
+	op->bufsiz=TAR_OUT_BUFSIZ;
+	op->count=0;
+	op->off=0;
+	op->idxfd=-1; /* no index */
+	op->incp=NULL; /* not incremental */
+	op->dedupp=NULL; /* not deduplicating */
+	if ((op->buf=(u_char *)malloc(op->bufsiz))==NULL){
+		perror("malloc");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* write n bytes from start of buffer, keep rest */
+static int
+tar_out_writebuf(struct tar_out_s *op,u_int n)
+{
+
+	if (n==0){
+		return 0;
+	}
+	if (WRITE(op->fd,op->buf,n)!=(int)n){
+		perror("write");
+		return -1;
+	}
+	op->off+=(OFF_T)n;
+	op->count-=n;
+	if (op->count>0){
+		memmove(op->buf,op->buf+n,op->count);
+	}
+
+	return 0;
+}
+
+/* write all full parts of buffer up to next multiple of bufsiz in output */
+static int
+tar_out_drain(struct tar_out_s *op)
+{
+	u_int limit;
+
+	for (;;){
+		limit=op->bufsiz-(u_int)(op->off%(OFF_T)op->bufsiz);
+		if (op->count<limit){
+			return 0;
+		}
+		if (tar_out_writebuf(op,limit)<0){
+			return -1;
+		}
+	}
+}
+
+/* write all of buffer */
+/* Note: required before direct writes to op->fd */
+int
+tar_out_flush(struct tar_out_s *op)
+{
+
+	if ((op==NULL)||(op->buf==NULL)){
+		return -1;
+	}
+
+	return tar_out_writebuf(op,op->count);
+}
+
+int
+tar_out_write(struct tar_out_s *op,u_char *data,u_int size)
+{
+	u_int n;
+
+	if ((op==NULL)||(op->buf==NULL)){
+		return -1;
+	}
+
+	for (;size>0;size-=n){
+		n=op->bufsiz-op->count;
+		if (n>size){
+			n=size;
+		}
+		if (data!=NULL){
+			bcopy(data,op->buf+op->count,n);
+			data+=n;
+		}else{
+			/* zeros */
+			bzero(op->buf+op->count,n);
+		}
+		op->count+=n;
+		if (tar_out_drain(op)<0){
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* get space for size bytes in buffer, NULL if too large */
+/* Note: call tar_out_commit() after data has been put there */
+u_char *
+tar_out_reserve(struct tar_out_s *op,u_int size)
+{
+
+	if ((op==NULL)||(op->buf==NULL)||(size>op->bufsiz)){
+		return NULL;
+	}
+
+	if (op->count+size>op->bufsiz){
+		if (tar_out_flush(op)<0){
+			return NULL;
+		}
+	}
+
+	return op->buf+op->count;
+}
+
+int
+tar_out_commit(struct tar_out_s *op,u_int size)
+{
+
+	if ((op==NULL)||(op->buf==NULL)||(op->count+size>op->bufsiz)){
+		return -1;
+	}
+
+	op->count+=size;
+
+	return tar_out_drain(op);
+}
+
+/* flush and free buffer */
+int
+tar_out_end(struct tar_out_s *op)
+{
+	int ret;
+
+	if ((op==NULL)||(op->buf==NULL)){
+		return -1;
+	}
+
+	ret=tar_out_flush(op);
+	free(op->buf);
+	op->buf=NULL;
+
+	return ret;
+}
+
+/* incremental export */
+
+static int
+tar_inc_cmp(const void *a,const void *b)
+{
+
+	return strcmp(((struct tar_inc_ent_s *)a)->name,((struct tar_inc_ent_s *)b)->name);
+}
+
+/* parse 16 hex digits */
+static int
+tar_inc_hex(char *s,U_INT64 *vp)
+{
+	U_INT64 v;
+	u_int i;
+	int c;
+
+	v=0;
+	for (i=0;i<HASH_XXH64_STRLEN;i++){
+		c=s[i];
+		if ((c>='0')&&(c<='9')){
+			c-='0';
+		}else if ((c>='a')&&(c<='f')){
+			c-='a'-10;
+		}else if ((c>='A')&&(c<='F')){
+			c-='A'-10;
+		}else{
+			return -1;
+		}
+		v=(v<<4)|(U_INT64)c;
+	}
+	if (s[i]!=' '){
+		return -1;
+	}
+	*vp=v;
+	return 0;
+}
+
+/* start incremental export, load previous manifest mname if present */
+int
+tar_inc_start(struct tar_inc_s *ip,char *mname,int quick)
+{
+	struct stat st;
+	char *buf,*p,*q;
+	u_int max;
+	int fd;
+	int n;
+
+	bzero(ip,sizeof(struct tar_inc_s));
+	ip->mname=mname;
+	ip->quick=quick;
+	if ((ip->buf=(u_char *)malloc(TAR_INC_BUFSIZ))==NULL){
+		perror("malloc");
+		return -1;
+	}
+
+	if ((fd=OPEN(mname,O_RDONLY|O_BINARY,0))<0){
+		printf("no manifest, full export\n");
+		return 0;
+	}
+	if ((fstat(fd,&st)<0)||(st.st_size<0)){
+		perror("stat");
+		CLOSE(fd);
+		tar_inc_free(ip);
+		return -1;
+	}
+	if ((buf=(char *)malloc((size_t)st.st_size+1))==NULL){
+		perror("malloc");
+		CLOSE(fd);
+		tar_inc_free(ip);
+		return -1;
+	}
+	if (READ(fd,buf,(u_int)st.st_size)!=(int)st.st_size){
+		perror("read");
+		free(buf);
+		CLOSE(fd);
+		tar_inc_free(ip);
+		return -1;
+	}
+	CLOSE(fd);
+	buf[st.st_size]='\0';
+
+	/* count lines */
+	max=1;
+	for (p=buf;*p!='\0';p++){
+		if (*p=='\n'){
+			max++;
+		}
+	}
+	if ((ip->oldp=(struct tar_inc_ent_s *)malloc(max*sizeof(struct tar_inc_ent_s)))==NULL){
+		perror("malloc");
+		free(buf);
+		tar_inc_free(ip);
+		return -1;
+	}
+
+	/* parse lines */
+	for (p=buf;*p!='\0';p=q){
+		for (q=p;(*q!='\0')&&(*q!='\n');q++);
+		if (*q=='\n'){
+			*q++='\0';
+		}
+		if ((p[0]=='#')||(p[0]=='\0')){ /* comment or empty line? */
+			continue;
+		}
+		n=0;
+		if ((strlen(p)<3*(HASH_XXH64_STRLEN+1))
+			||(tar_inc_hex(p,&ip->oldp[ip->oldnum].hash)<0)
+			||(tar_inc_hex(p+HASH_XXH64_STRLEN+1,&ip->oldp[ip->oldnum].mhash)<0)
+			||(tar_inc_hex(p+2*(HASH_XXH64_STRLEN+1),&ip->oldp[ip->oldnum].ehash)<0)
+			||(sscanf(p+3*(HASH_XXH64_STRLEN+1),"%u %n",&ip->oldp[ip->oldnum].size,&n)<1)
+			||(n==0)
+			||(strlen(p+3*(HASH_XXH64_STRLEN+1)+n)>TAR_NAMELEN)){
+			fprintf(stderr,"invalid manifest line\n");
+			free(buf);
+			tar_inc_free(ip);
+			return -1;
+		}
+		strcpy(ip->oldp[ip->oldnum].name,p+3*(HASH_XXH64_STRLEN+1)+n);
+		ip->oldp[ip->oldnum].seen=0;
+		ip->oldnum++;
+	}
+	free(buf);
+
+	/* sort for lookup */
+	qsort(ip->oldp,ip->oldnum,sizeof(struct tar_inc_ent_s),tar_inc_cmp);
+
+	return 0;
+}
+
+void
+tar_inc_free(struct tar_inc_s *ip)
+{
+
+	if (ip->oldp!=NULL){
+		free(ip->oldp);
+		ip->oldp=NULL;
+	}
+	if (ip->newp!=NULL){
+		free(ip->newp);
+		ip->newp=NULL;
+	}
+	if (ip->buf!=NULL){
+		free(ip->buf);
+		ip->buf=NULL;
+	}
+	if (ip->delbuf!=NULL){
+		free(ip->delbuf);
+		ip->delbuf=NULL;
+	}
+}
+
+/* find entry of previous manifest not seen so far */
+static struct tar_inc_ent_s *
+tar_inc_find(struct tar_inc_s *ip,char *name)
+{
+	struct tar_inc_ent_s key;
+	struct tar_inc_ent_s *ep;
+
+	if (ip->oldnum==0){
+		return NULL;
+	}
+	strcpy(key.name,name);
+	if ((ep=(struct tar_inc_ent_s *)bsearch(&key,ip->oldp,ip->oldnum,sizeof(struct tar_inc_ent_s),tar_inc_cmp))==NULL){
+		return NULL;
+	}
+	/* Note: same name possible (e.g. DD takes) */
+	while ((ep>ip->oldp)&&(strcmp((ep-1)->name,name)==0)){
+		ep--;
+	}
+	for (;(ep<ip->oldp+ip->oldnum)&&(strcmp(ep->name,name)==0);ep++){
+		if (!ep->seen){
+			return ep;
+		}
+	}
+	return NULL;
+}
+
+/* XXH64 of little-endian value */
+static void
+tar_inc_hashval(struct hash_xxh64_s *hp,U_INT64 v,u_int size)
+{
+	u_char b[8];
+	u_int i;
+
+	for (i=0;i<size;i++){
+		b[i]=(u_char)(0xff&(v>>(8*i)));
+	}
+	hash_xxh64_update(hp,b,size);
+}
+
+/* check member with header *hp and metadata *mp in incremental export, add to new manifest */
+/* Note: data from fp, jp or data (of size bytes) */
+/* returns 1 if unchanged, 0 if changed or new, -1 on error */
+static int
+tar_inc_check(struct tar_inc_s *ip,struct tar_head_s *hp,struct tar_meta_s *mp,u_int size,struct file_s *fp,struct take_job_s *jp,u_char *data)
+{
+	struct tar_head_s mhd;
+	struct tar_inc_ent_s ent;
+	struct tar_inc_ent_s *oep;
+	struct hash_xxh64_s h;
+	struct part_s *pp;
+	u_int blk,bnum;
+	u_int ei;
+	OFF_T off;
+	u_int pos,n;
+	int same;
+
+	bzero(&ent,sizeof(struct tar_inc_ent_s));
+	strncpy(ent.name,hp->name,TAR_NAMELEN);
+	ent.name[TAR_NAMELEN]='\0';
+	ent.size=size;
+
+	/* metadata */
+	/* Note: of legacy encoding, independent of PAX */
+	bzero(&mhd,sizeof(struct tar_head_s));
+	tar_meta_tolegacy(mp,&mhd);
+	hash_xxh64_init(&h,0);
+	hash_xxh64_update(&h,(u_char *)mhd.devmajor,sizeof(mhd.devmajor));
+	hash_xxh64_update(&h,(u_char *)mhd.devminor,sizeof(mhd.devminor));
+	hash_xxh64_update(&h,(u_char *)mhd.linkname,sizeof(mhd.linkname));
+	ent.mhash=hash_xxh64_final(&h);
+
+	/* FAT extents */
+	hash_xxh64_init(&h,0);
+	if (fp!=NULL){
+		pp=fp->volp->partp;
+		blk=fp->bstart;
+		for (bnum=(fp->size+pp->blksize-1)/pp->blksize;bnum>0;bnum--){
+			if (akai_check_fatblk(blk,pp->bsize,pp->bsyssize)<0){
+				break;
+			}
+			tar_inc_hashval(&h,(U_INT64)blk,2);
+			blk=(pp->fat[blk][1]<<8)+pp->fat[blk][0];
+		}
+	}
+	if (jp!=NULL){
+		for (ei=0;ei<jp->extnum;ei++){
+			tar_inc_hashval(&h,(U_INT64)jp->extp[ei].off,8);
+			tar_inc_hashval(&h,(U_INT64)jp->extp[ei].size,4);
+		}
+	}
+	ent.ehash=hash_xxh64_final(&h);
+
+	oep=tar_inc_find(ip,ent.name);
+	if (oep!=NULL){
+		oep->seen=1;
+	}
+
+	if (ip->quick&&(oep!=NULL)
+		&&(oep->size==ent.size)&&(oep->mhash==ent.mhash)&&(oep->ehash==ent.ehash)){
+		/* same extents: assume same data */
+		ent.hash=oep->hash;
+	}else{
+		/* data */
+		hash_xxh64_init(&h,0);
+		if (fp!=NULL){
+			for (pos=0;pos<fp->size;pos+=n){
+				n=fp->size-pos;
+				if (n>TAR_INC_BUFSIZ){
+					n=TAR_INC_BUFSIZ;
+				}
+				if (akai_read_file(-1,ip->buf,fp,pos,pos+n)<0){
+					return -1;
+				}
+				hash_xxh64_update(&h,ip->buf,n);
+			}
+		}
+		if (jp!=NULL){
+			hash_xxh64_update(&h,jp->head,jp->headsize);
+			if (jp->extnum>0){
+				/* make sure that disk contains current data */
+				if (flush_blk_cache()<0){
+					return -1;
+				}
+			}
+			for (ei=0;ei<jp->extnum;ei++){
+				off=jp->extp[ei].off;
+				for (pos=0;pos<jp->extp[ei].size;pos+=n){
+					n=jp->extp[ei].size-pos;
+					if (n>TAR_INC_BUFSIZ){
+						n=TAR_INC_BUFSIZ;
+					}
+					if (io_pread(jp->fd,ip->buf,n,off+(OFF_T)pos)<0){
+						perror("read");
+						return -1;
+					}
+					hash_xxh64_update(&h,ip->buf,n);
+				}
+			}
+			hash_xxh64_update(&h,jp->tail,jp->tailsize);
+		}
+		if (data!=NULL){
+			hash_xxh64_update(&h,data,size);
+		}
+		ent.hash=hash_xxh64_final(&h);
+	}
+
+	same=(oep!=NULL)&&(oep->size==ent.size)&&(oep->mhash==ent.mhash)&&(oep->hash==ent.hash);
+
+	/* add to new manifest */
+	if (ip->newnum==ip->newmax){
+		struct tar_inc_ent_s *p;
+
+		n=(ip->newmax==0)?1024:2*ip->newmax;
+		if ((p=(struct tar_inc_ent_s *)realloc(ip->newp,n*sizeof(struct tar_inc_ent_s)))==NULL){
+			perror("realloc");
+			return -1;
+		}
+		ip->newp=p;
+		ip->newmax=n;
+	}
+	ip->newp[ip->newnum++]=ent;
+
+	if (same){
+		ip->samenum++;
+		return 1;
+	}
+	ip->chgnum++;
+	return 0;
+}
+
+/* size of sample header of file, 0 if not a sample file */
+static u_int
+tar_dedup_headsize(struct file_s *fp)
+{
+
+	switch (fp->type){
+	case AKAI_SAMPLE900_FTYPE:
+		return sizeof(struct akai_sample900_s);
+	case AKAI_SAMPLE1000_FTYPE:
+		return sizeof(struct akai_sample1000_s);
+	case AKAI_SAMPLE3000_FTYPE:
+		return sizeof(struct akai_sample3000_s);
+	default:
+		return 0; /* whole file */
+	}
+}
+
+int
+tar_dedup_start(struct tar_dedup_s *dp)
+{
+	u_int i;
+
+	if (dp==NULL){
+		return -1;
+	}
+
+	bzero(dp,sizeof(struct tar_dedup_s));
+	dp->entp=NULL;
+	dp->buf=NULL;
+	for (i=0;i<TAR_DEDUP_HASHNUM;i++){
+		dp->bucket[i]=TAR_DEDUP_NONE;
+	}
+
+	return 0;
+}
+
+void
+tar_dedup_end(struct tar_dedup_s *dp)
+{
+
+	if (dp==NULL){
+		return;
+	}
+
+	if (dp->entp!=NULL){
+		free(dp->entp);
+		dp->entp=NULL;
+	}
+	if (dp->buf!=NULL){
+		free(dp->buf);
+		dp->buf=NULL;
+	}
+}
+
+void
+tar_dedup_print(struct tar_dedup_s *dp)
+{
+
+	if (dp==NULL){
+		return;
+	}
+
+	printf("dedup: %u files, %u unique, %u references\n",dp->filenum,dp->filenum-dp->refnum,dp->refnum);
+	printf("dedup: %.1lf MB in files, %.1lf MB in tar-file",
+		   ((double)dp->insize)/(1024.0*1024.0),((double)dp->outsize)/(1024.0*1024.0));
+	if (dp->outsize>0){
+		printf(", ratio %.2lf",((double)dp->insize)/((double)dp->outsize));
+	}
+	printf("\n");
+}
+
+/* read sampler file into dp->buf, check if sample data has been exported before */
+/* Note: sets dp->refflag, dp->ref and dp->hsize, and *sizep to size of member */
+static int
+tar_dedup_check(struct tar_dedup_s *dp,struct tar_head_s *hp,struct file_s *fp,u_int *sizep)
+{
+	struct hash_sha256_s sha;
+	struct tar_dedup_ent_s *ep;
+	u_char md[HASH_SHA256_SIZE];
+	u_int hsize,psize;
+	u_int bi,ei;
+	u_char *p;
+	u_int n;
+
+	dp->refflag=0;
+	dp->filenum++;
+	dp->insize+=(U_INT64)fp->size;
+
+	/* read file */
+	if (fp->size>dp->bufsiz){
+		if ((p=(u_char *)realloc(dp->buf,fp->size))==NULL){
+			perror("realloc");
+			return -1;
+		}
+		dp->buf=p;
+		dp->bufsiz=fp->size;
+	}
+	if ((fp->size>0)&&(akai_read_file(-1,dp->buf,fp,0,fp->size)<0)){
+		return -1;
+	}
+
+	hsize=tar_dedup_headsize(fp);
+	if (hsize>fp->size){
+		hsize=fp->size;
+	}
+	psize=fp->size-hsize;
+	if (psize<TAR_BLOCKSIZE){
+		/* Note: reference would not save space */
+		dp->outsize+=(U_INT64)fp->size;
+		return 0;
+	}
+
+	hash_sha256_init(&sha);
+	hash_sha256_update(&sha,dp->buf+hsize,psize);
+	hash_sha256_final(&sha,md);
+
+	/* lookup */
+	bi=((((u_int)md[0])<<8)|((u_int)md[1]))&(TAR_DEDUP_HASHNUM-1);
+	for (ei=dp->bucket[bi];ei!=TAR_DEDUP_NONE;ei=dp->entp[ei].next){
+		ep=&dp->entp[ei];
+		if ((ep->psize==psize)&&(memcmp(ep->md,md,HASH_SHA256_SIZE)==0)){
+			/* reference to earlier member */
+			bzero(&dp->ref,sizeof(struct tar_dedupref_s));
+			strcpy(dp->ref.name,ep->name);
+			sprintf(dp->ref.psize,"%011o",psize);
+			bcopy(md,dp->ref.md,HASH_SHA256_SIZE);
+			dp->refflag=1;
+			dp->hsize=hsize;
+			dp->refnum++;
+			*sizep=sizeof(struct tar_dedupref_s)+hsize;
+			dp->outsize+=(U_INT64)(*sizep);
+			return 0;
+		}
+	}
+
+	/* new sample data */
+	if (dp->entnum>=dp->entmax){
+		n=(dp->entmax==0)?256:2*dp->entmax;
+		if ((ep=(struct tar_dedup_ent_s *)realloc(dp->entp,n*sizeof(struct tar_dedup_ent_s)))==NULL){
+			perror("realloc");
+			return -1;
+		}
+		dp->entp=ep;
+		dp->entmax=n;
+	}
+	ep=&dp->entp[dp->entnum];
+	bcopy(md,ep->md,HASH_SHA256_SIZE);
+	ep->psize=psize;
+	strncpy(ep->name,hp->name,TAR_NAMELEN);
+	ep->name[TAR_NAMELEN-1]='\0';
+	ep->next=dp->bucket[bi];
+	dp->bucket[bi]=dp->entnum;
+	dp->entnum++;
+	dp->outsize+=(U_INT64)fp->size;
+
+	return 0;
+}
 
+/* export take data of job */
+static int
+tar_export_takejob(struct tar_out_s *op,struct take_job_s *jp)
+{
+	u_int ei;
 
-u_int
-tar_checksum(u_char *hp)
+	if (tar_out_write(op,jp->head,jp->headsize)<0){
+		return -1;
+	}
+	if (jp->extnum>0){
+		/* make sure that disk contains current data */
+		if (flush_blk_cache()<0){
+			return -1;
+		}
+		/* data directly from disk (zero-copy if possible) */
+		if (tar_out_flush(op)<0){
+			return -1;
+		}
+		for (ei=0;ei<jp->extnum;ei++){
+			if (io_copy_range(jp->fd,jp->extp[ei].off,jp->extp[ei].size,op->fd)<0){
+				fprintf(stderr,"cannot export take\n");
+				return -1;
+			}
+			op->off+=(OFF_T)jp->extp[ei].size;
+		}
+	}
+	if (jp->tailsize>0){
+		if (tar_out_write(op,jp->tail,jp->tailsize)<0){
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* export sampler file, read directly into output buffer */
+static int
+tar_export_file(struct tar_out_s *op,struct file_s *fp)
 {
-	u_int sum;
-	u_int i;
-	int zeroflag;
+	u_char *p;
+	u_int blksize;
+	u_int pos,n;
 
-	if (hp==NULL){
-		return 0;
+	if ((fp==NULL)||(fp->volp==NULL)||(fp->volp->partp==NULL)){
+		return -1;
+	}
+	blksize=fp->volp->partp->blksize;
+	if (blksize==0){
+		return -1;
 	}
 
-	sum=0;
-	zeroflag=1; /* still all zeroes */
-	for (i=0;i<sizeof(struct tar_head_s);i++){
-		if (hp[i]!=0){
-			zeroflag=0;
+	for (pos=0;pos<fp->size;pos+=n){
+		n=fp->size-pos;
+		if (n>op->bufsiz-op->count){
+			n=op->bufsiz-op->count;
+			/* end at block boundary in file if possible */
+			if (n>=blksize){
+				n-=n%blksize;
+			}
 		}
-		if ((i>=148)&&(i<156)){	/* treat chksum field */
-			sum+=(u_int)' '; /* space */
-		}else{
-			sum+=(u_int)hp[i];
+		if ((p=tar_out_reserve(op,n))==NULL){
+			return -1;
+		}
+		if (akai_read_file(-1,p,fp,pos,pos+n)<0){
+			return -1;
+		}
+		if (tar_out_commit(op,n)<0){
+			return -1;
 		}
 	}
-	/* Note: sum is always >0 !!! */
 
-	if (zeroflag){
-		sum=0; /* unique value, see comment above */
+	return 0;
+}
+
+/* export sample as WAV, sample must have been loaded */
+static int
+tar_export_wav(struct tar_out_s *op,struct sample2wav_s *cp)
+{
+	u_char *p;
+
+	if ((p=tar_out_reserve(op,cp->wavsize))!=NULL){
+		/* WAV directly into output buffer */
+		if (akai_sample2wav_write(cp,-1,p)<0){
+			return -1;
+		}
+		return tar_out_commit(op,cp->wavsize);
 	}
-	return sum;
+
+	/* too large for buffer */
+	if (tar_out_flush(op)<0){
+		return -1;
+	}
+	if (akai_sample2wav_write(cp,op->fd,NULL)<0){
+		return -1;
+	}
+	op->off+=(OFF_T)cp->wavsize;
+
+	return 0;
 }
 
-int
-tar_export(int fd,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,u_int flags,int verbose,u_char *filtertagp)
+#ifndef TAR_PAX_DISABLE
+/* export PAX extended header with metadata *mp for member with tar header *hp */
+static int
+tar_export_pax(struct tar_out_s *op,struct tar_head_s *hp,struct tar_meta_s *mp)
+{
+	struct tar_head_s paxhd;
+	char buf[TAR_PAX_BUFSIZ];
+	u_int size;
+	u_int l;
+
+	size=tar_pax_records(mp,buf);
+
+	bzero(&paxhd,sizeof(struct tar_head_s));
+	/* name */
+	strcpy(paxhd.name,TAR_PAX_NAMEPREFIX);
+	l=(u_int)strlen(hp->name);
+	if ((l>0)&&(hp->name[l-1]=='/')){
+		l--; /* without trailing '/' of directory */
+	}
+	if (l>TAR_NAMELEN-1-strlen(TAR_PAX_NAMEPREFIX)){
+		l=TAR_NAMELEN-1-strlen(TAR_PAX_NAMEPREFIX); /* XXX truncate */
+	}
+	bcopy(hp->name,paxhd.name+strlen(TAR_PAX_NAMEPREFIX),l);
+	/* as member */
+	bcopy(hp->mode,paxhd.mode,sizeof(paxhd.mode));
+	bcopy(hp->uid,paxhd.uid,sizeof(paxhd.uid));
+	bcopy(hp->gid,paxhd.gid,sizeof(paxhd.gid));
+	bcopy(hp->mtime,paxhd.mtime,sizeof(paxhd.mtime));
+	bcopy(hp->ustar,paxhd.ustar,sizeof(paxhd.ustar));
+	bcopy(hp->uname,paxhd.uname,sizeof(paxhd.uname));
+	bcopy(hp->gname,paxhd.gname,sizeof(paxhd.gname));
+	sprintf(paxhd.size,"%011o",size);
+	paxhd.space=' ';
+	paxhd.type=TAR_TYPE_PAX;
+	sprintf(paxhd.chksum,"%06o",tar_checksum((u_char *)&paxhd));
+
+	if (tar_out_write(op,(u_char *)&paxhd,sizeof(struct tar_head_s))<0){
+		return -1;
+	}
+	if (tar_out_write(op,(u_char *)buf,size)<0){
+		return -1;
+	}
+	/* fill rest of TAR_BLOCKSIZE bytes */
+	/* Note: size<TAR_BLOCKSIZE */
+	return tar_out_write(op,NULL,TAR_BLOCKSIZE-size); /* NULL: zeros */
+}
+#endif
+
+static int
+tar_export_ctx(struct tar_out_s *op,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,u_int flags,int verbose,u_char *filtertagp,
+			   struct sample2wav_s *s2wp)
 {
 	struct tar_head_s tarhd;
+	struct tar_meta_s meta;
+	OFF_T hoff;
 	u_int chksum;
 	u_int size;
 	u_int n;
-	u_char buf[TAR_BLOCKSIZE];
 	int wavret;
-	char *wavname;
+	struct sample2wav_s s2w;
+	struct take_job_s job; /* DD take */
+	int dedupflag;
 
-	/* DD take */
-	u_int ddcstarts,ddcstarte;
-	u_int ddcsizes,ddcsizee;
-	struct akai_ddtake_s ddt;
-
-	if (fd<0){
+	if ((op==NULL)||(op->buf==NULL)){
 		return -1;
 	}
+	/* deduplicating export of sampler file? */
+	dedupflag=((op->dedupp!=NULL)&&(flags&TAR_EXPORT_FILE)&&(!(flags&TAR_EXPORT_WAV)));
 	if ((flags&(TAR_EXPORT_PART|TAR_EXPORT_VOL|TAR_EXPORT_ANYFILE))==0){
 		return -1;
 	}
 
-	ddcstarts=0;
-	ddcstarte=0;
-	ddcsizes=0;
-	ddcsizee=0;
-
 	/* create tar header */
 	bzero(&tarhd,sizeof(struct tar_head_s));
+	bzero(&meta,sizeof(struct tar_meta_s));
 	
 	/* name */
 	/* XXX should always fit */
@@ -118,72 +1464,28 @@ tar_export(int fd,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,
 		sprintf(tarhd.name+strlen(tarhd.name),"%s/",vp->name);
 		size=0;
 		if ((flags&TAR_EXPORT_ANYFILE)==0){ /* not a file? */
-			/* XXX use devmajor field for type */
-			sprintf(tarhd.devmajor,"%07o",vp->type);
-			/* XXX use devminor field for load number */
-			sprintf(tarhd.devminor,"%07o",vp->lnum);
+			/* metadata: type, load number and volume parameters */
+			meta.vtype=vp->type;
+			meta.lnum=vp->lnum;
+			meta.flags=TAR_META_VTYPE|TAR_META_LNUM;
 #ifndef TAR_NOVOLPARAMTARHD
 			if (vp->param!=NULL){
-				/* XXX use linkname for volume parameters */
-				tarhd.linkname[0]='\0'; /* XXX magic, also empty linkname string */
-				tarhd.linkname[1]='P'; /* XXX magic */
-				bcopy(vp->param,
-					&tarhd.linkname[0]+2, /* XXX +2: linkname starts with magic */
-					sizeof(struct akai_volparam_s)); /* XXX should fit */
+				bcopy(vp->param,&meta.param,sizeof(struct akai_volparam_s));
+				meta.flags|=TAR_META_VOLPARAM;
 			}
 #endif
 		}
 	}
 	if (flags&TAR_EXPORT_DDFILE){
-		if (flags&TAR_EXPORT_WAV){
-			wavret=akai_take2wav(pp,ti,fd,&size,&wavname,TAKE2WAV_CHECK);
-			if (wavret<0){ /* error? */
-#if 1
-				return 0; /* skip this file w/o error */
-#else
-				return -1;
-#endif
-			}
-			if (wavret>0){ /* not for WAV? */
-				return 0; /* skip this file w/o error */
-			}
-			strcpy(tarhd.name+strlen(tarhd.name),wavname);
-		}else{
-			char fnamebuf[AKAI_NAME_LEN+4+1]; /* name (ASCII), +4 for ".<type>", +1 for '\0' */
-
-			/* index */
-			if (ti>=AKAI_DDTAKE_MAXNUM){
-				return 0; /* skip this file w/o error */
-			}
-
-			/* get directory entry */
-			bcopy(&pp->head.dd.take[ti],&ddt,sizeof(struct akai_ddtake_s));
-
-			/* name */
-			akai2ascii_name(ddt.name,fnamebuf,0); /* 0: not S900 */
-			strcpy(fnamebuf+strlen(fnamebuf),AKAI_DDTAKE_FNAMEEND);
-			strcpy(tarhd.name+strlen(tarhd.name),fnamebuf);
-
-			/* clusters */
-			ddcstarts=(ddt.cstarts[1]<<8)
-					  +ddt.cstarts[0];
-			if (ddcstarts==0){ /* empty? */
-				return 0; /* skip this file w/o error */
-			}
-			ddcstarte=(ddt.cstarte[1]<<8)
-					  +ddt.cstarte[0];
-
-			/* determine csizes (sample clusters) and csizee (envelope clusters) */
-			ddcsizes=akai_count_ddfatchain(pp,ddcstarts);
-			ddcsizee=akai_count_ddfatchain(pp,ddcstarte);
-			/* XXX use cstarts/cstarte fields in DD take header for csizes/csizee */
-			ddt.cstarts[1]=0xff&(ddcsizes>>8);
-			ddt.cstarts[0]=0xff&ddcsizes;
-			ddt.cstarte[1]=0xff&(ddcsizee>>8);
-			ddt.cstarte[0]=0xff&ddcsizee;
-			/* size in bytes */
-			size=sizeof(struct akai_ddtake_s)+(ddcsizes+ddcsizee)*AKAI_DDPART_CBLKS*AKAI_HD_BLOCKSIZE;
+		/* DD take */
+		/* Note: all disk positions resolved in advance */
+		wavret=akai_take_job_init(&job,pp,ti,(flags&TAR_EXPORT_WAV)?1:0);
+		if (wavret!=0){ /* error or empty? */
+			akai_take_job_free(&job);
+			return 0; /* skip this file w/o error */
 		}
+		size=job.size;
+		strcpy(tarhd.name+strlen(tarhd.name),job.fname);
 	}
 	if (flags&TAR_EXPORT_FILE){
 		/* sampler file */
@@ -195,36 +1497,38 @@ tar_export(int fd,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,
 			return 0; /* skip this file w/o error */
 		}
 		if (flags&TAR_EXPORT_WAV){
-			wavret=akai_sample2wav(fp,fd,&size,&wavname,SAMPLE2WAV_CHECK);
-			if (wavret<0){ /* error? */
+			if (s2wp==NULL){
+				s2wp=&s2w;
+				wavret=akai_sample2wav_check(s2wp,fp);
+				if (wavret<0){ /* error? */
 #if 1
-				return 0; /* skip this file w/o error */
+					return 0; /* skip this file w/o error */
 #else
-				return -1;
+					return -1;
 #endif
+				}
+				if (wavret>0){ /* not for WAV? */
+					return 0; /* skip this file w/o error */
+				}
 			}
-			if (wavret>0){ /* not for WAV? */
-				return 0; /* skip this file w/o error */
-			}
-			strcpy(tarhd.name+strlen(tarhd.name),wavname);
+			/* Note: else, s2wp already checked, read and converted by caller */
+			size=s2wp->wavsize;
+			strcpy(tarhd.name+strlen(tarhd.name),s2wp->wavname);
 		}else{
 			strcpy(tarhd.name+strlen(tarhd.name),fp->name);
 			size=fp->size;
 		}
-		/* XXX use devmajor field for osver */
+		/* metadata: osver and tags */
 		if ((flags&TAR_EXPORT_WAV)&&(fp->type==AKAI_SAMPLE900_FTYPE)){
-			sprintf(tarhd.devmajor,"%07o",AKAI_OSVER_S900VOL); /* XXX */
+			meta.osver=AKAI_OSVER_S900VOL; /* XXX */
 		}else{
-			sprintf(tarhd.devmajor,"%07o",fp->osver); /* XXX */
+			meta.osver=fp->osver;
 		}
+		meta.flags=TAR_META_OSVER;
 		if ((fp->volp!=NULL)
 			&&((fp->volp->type==AKAI_VOL_TYPE_S3000)||(fp->volp->type==AKAI_VOL_TYPE_CD3000))){
-			/* XXX use linkname for file tags */
-			tarhd.linkname[0]='\0'; /* XXX magic, also empty linkname string */
-			tarhd.linkname[1]='T'; /* XXX magic */
-			bcopy(fp->tag,
-				&tarhd.linkname[0]+2, /* XXX +2: linkname starts with magic */
-				AKAI_FILE_TAGNUM); /* XXX should fit */
+			bcopy(fp->tag,meta.tag,AKAI_FILE_TAGNUM);
+			meta.flags|=TAR_META_TAGS;
 		}
 	}
 #ifndef TAR_NOTAGSFILE
@@ -264,6 +1568,44 @@ tar_export(int fd,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,
 		size=sizeof(struct akai_volparam_s);
 	}
 #endif
+	if (flags&TAR_EXPORT_DELFILE){
+		/* deletion list of incremental export */
+		if ((op->incp==NULL)||(op->incp->delbuf==NULL)||(flags&TAR_EXPORT_WAV)){
+			return -1;
+		}
+		strcpy(tarhd.name,TAR_INC_DELFILENAME);
+		size=op->incp->delsize;
+	}
+
+	/* incremental export: skip unchanged member */
+	if ((op->incp!=NULL)&&(!(flags&TAR_EXPORT_DELFILE))){
+		if (flags&TAR_EXPORT_WAV){
+			wavret=-1; /* XXX not supported */
+		}else if (flags&TAR_EXPORT_DDFILE){
+			wavret=tar_inc_check(op->incp,&tarhd,&meta,size,NULL,&job,NULL);
+		}else if (flags&TAR_EXPORT_FILE){
+			wavret=tar_inc_check(op->incp,&tarhd,&meta,size,fp,NULL,NULL);
+		}else if (flags&TAR_EXPORT_TAGSFILE){
+			wavret=tar_inc_check(op->incp,&tarhd,&meta,size,NULL,NULL,(u_char *)pp->head.hd.tagsmagic);
+		}else if (flags&TAR_EXPORT_VOLPARAMFILE){
+			wavret=tar_inc_check(op->incp,&tarhd,&meta,size,NULL,NULL,(u_char *)vp->param);
+		}else{
+			wavret=tar_inc_check(op->incp,&tarhd,&meta,size,NULL,NULL,NULL);
+		}
+		if (wavret!=0){ /* error or unchanged? */
+			if (flags&TAR_EXPORT_DDFILE){
+				akai_take_job_free(&job);
+			}
+			return (wavret<0)?-1:0;
+		}
+	}
+
+	/* deduplicating export: reference to earlier member with same sample data? */
+	if (dedupflag){
+		if (tar_dedup_check(op->dedupp,&tarhd,fp,&size)<0){
+			return -1;
+		}
+	}
 
 	if (verbose){
 		printf("%s\n",tarhd.name);
@@ -285,7 +1627,9 @@ tar_export(int fd,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,
 	tarhd.space=' ';
 
 	/* type */
-	if (flags&TAR_EXPORT_ANYFILE){ /* file? */
+	if (dedupflag&&op->dedupp->refflag){
+		tarhd.type=TAR_TYPE_DEDUPREF;
+	}else if (flags&TAR_EXPORT_ANYFILE){ /* file? */
 		tarhd.type=TAR_TYPE_REG;
 	}else{
 		/* directory */
@@ -295,6 +1639,11 @@ tar_export(int fd,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,
 	/* magic */
 	bcopy(TAR_USTAR,tarhd.ustar,8);
 
+#ifdef TAR_PAX_DISABLE
+	/* metadata in legacy encoding */
+	tar_meta_tolegacy(&meta,&tarhd);
+#endif
+
 	/* user name */
 #ifndef TAR_UNAME
 #define TAR_UNAME	"AKAI"
@@ -310,9 +1659,37 @@ tar_export(int fd,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,
 	chksum=tar_checksum((u_char *)&tarhd);
 	sprintf(tarhd.chksum,"%06o",chksum);
 	
+	/* index entry */
+	/* Note: offset of PAX extended header if any */
+	hoff=op->off+(OFF_T)op->count;
+	if (op->idxfd>=0){
+		char lbuf[TAR_IDX_LINELEN];
+
+		tar_idx_line(lbuf,hoff,&tarhd,&meta);
+		if (WRITE(op->idxfd,lbuf,strlen(lbuf))!=(int)strlen(lbuf)){
+			perror("write index");
+			if (flags&TAR_EXPORT_DDFILE){
+				akai_take_job_free(&job);
+			}
+			return -1;
+		}
+	}
+
+#ifndef TAR_PAX_DISABLE
+	/* write PAX extended header with metadata */
+	if ((meta.flags!=0)&&(tar_export_pax(op,&tarhd,&meta)<0)){
+		if (flags&TAR_EXPORT_DDFILE){
+			akai_take_job_free(&job);
+		}
+		return -1;
+	}
+#endif
+
 	/* write tar header */
-	if (WRITE(fd,(void *)&tarhd,sizeof(struct tar_head_s))!=sizeof(struct tar_head_s)){
-		perror("write");
+	if (tar_out_write(op,(u_char *)&tarhd,sizeof(struct tar_head_s))<0){
+		if (flags&TAR_EXPORT_DDFILE){
+			akai_take_job_free(&job);
+		}
 		return -1;
 	}
 
@@ -321,26 +1698,42 @@ tar_export(int fd,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,
 	}
 
 	if (flags&TAR_EXPORT_DDFILE){
-		if (flags&TAR_EXPORT_WAV){
-			if (akai_take2wav(pp,ti,fd,NULL,NULL,SAMPLE2WAV_EXPORT)<0){
-				return -1;
-			}
-		}else{
-			if (akai_export_take(fd,pp,&ddt,ddcsizes,ddcsizee,ddcstarts,ddcstarte)<0){
-				fprintf(stderr,"cannot export take\n");
-				return -1;
-			}
+		wavret=tar_export_takejob(op,&job);
+		akai_take_job_free(&job);
+		if (wavret<0){
+			return -1;
 		}
 	}
 
 	if (flags&TAR_EXPORT_FILE){
 		/* export sampler file */
 		if (flags&TAR_EXPORT_WAV){
-			if (akai_sample2wav(fp,fd,NULL,NULL,SAMPLE2WAV_EXPORT)<0){
+			if (s2wp==&s2w){
+				/* read and convert sample if necessary */
+				wavret=akai_sample2wav_load(&s2w);
+				if (wavret==0){
+					wavret=tar_export_wav(op,&s2w);
+				}
+				akai_sample2wav_finish(&s2w);
+			}else{
+				/* Note: caller will call akai_sample2wav_finish() */
+				wavret=tar_export_wav(op,s2wp);
+			}
+			if (wavret<0){
+				return -1;
+			}
+		}else if (dedupflag){
+			/* file already read */
+			if (op->dedupp->refflag){
+				if (tar_out_write(op,(u_char *)&op->dedupp->ref,sizeof(struct tar_dedupref_s))<0){
+					return -1;
+				}
+			}
+			if (tar_out_write(op,op->dedupp->buf,op->dedupp->refflag?op->dedupp->hsize:size)<0){
 				return -1;
 			}
 		}else{
-			if (akai_read_file(fd,NULL,fp,0,fp->size)<0){
+			if (tar_export_file(op,fp)<0){
 				return -1;
 			}
 		}
@@ -349,44 +1742,300 @@ tar_export(int fd,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,
 #ifndef TAR_NOTAGSFILE
 	if (flags&TAR_EXPORT_TAGSFILE){
 		/* export tags-file */
-		if (WRITE(fd,(void *)pp->head.hd.tagsmagic,size)!=(int)size){
+		if (tar_out_write(op,(u_char *)pp->head.hd.tagsmagic,size)<0){
+			return -1;
+		}
+	}
+#endif
+#ifndef TAR_NOVOLPARAMFILE
+	if (flags&TAR_EXPORT_VOLPARAMFILE){
+		/* export volparam-file */
+		if (tar_out_write(op,(u_char *)vp->param,size)<0){
+			return -1;
+		}
+	}
+#endif
+	if (flags&TAR_EXPORT_DELFILE){
+		/* export deletion list */
+		if (tar_out_write(op,(u_char *)op->incp->delbuf,size)<0){
+			return -1;
+		}
+	}
+
+	/* fill rest of TAR_BLOCKSIZE bytes */
+	n=size%TAR_BLOCKSIZE;
+	n=(TAR_BLOCKSIZE-n)%TAR_BLOCKSIZE;
+	if (n>0){
+		if (tar_out_write(op,NULL,n)<0){ /* NULL: zeros */
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int
+tar_export(struct tar_out_s *op,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,u_int flags,int verbose,u_char *filtertagp)
+{
+
+	return tar_export_ctx(op,pp,vp,fp,ti,flags,verbose,filtertagp,NULL);
+}
+
+/* end incremental export: export deletion list */
+int
+tar_inc_end(struct tar_inc_s *ip,struct tar_out_s *op,int verbose)
+{
+	u_int delnum;
+	u_int i,j,l;
+
+	/* deletion list */
+	delnum=0;
+	ip->delsize=0;
+	for (i=0;i<ip->oldnum;i++){
+		if (!ip->oldp[i].seen){
+			l=(u_int)strlen(ip->oldp[i].name);
+			if ((l>0)&&(ip->oldp[i].name[l-1]=='/')){
+				/* Note: members of deleted directory are covered by directory (list is sorted) */
+				for (j=i+1;(j<ip->oldnum)&&(strncmp(ip->oldp[j].name,ip->oldp[i].name,l)==0);j++){
+					ip->oldp[j].seen=1;
+				}
+			}
+			delnum++;
+			ip->delsize+=(u_int)strlen(ip->oldp[i].name)+1;
+		}
+	}
+	if (delnum>0){
+		if ((ip->delbuf=(char *)malloc(ip->delsize+1))==NULL){
+			perror("malloc");
+			return -1;
+		}
+		ip->delbuf[0]='\0';
+		ip->delsize=0;
+		for (i=0;i<ip->oldnum;i++){
+			if (!ip->oldp[i].seen){
+				sprintf(ip->delbuf+ip->delsize,"%s\n",ip->oldp[i].name);
+				ip->delsize+=(u_int)strlen(ip->oldp[i].name)+1;
+			}
+		}
+		op->incp=ip;
+		if (tar_export_ctx(op,NULL,NULL,NULL,0,TAR_EXPORT_DELFILE,verbose,NULL,NULL)<0){
+			return -1;
+		}
+	}
+
+	printf("incremental: %u changed or new, %u unchanged, %u deleted\n",ip->chgnum,ip->samenum,delnum);
+
+	return 0;
+}
+
+/* write new manifest of incremental export */
+int
+tar_inc_save(struct tar_inc_s *ip)
+{
+	char hstr[3][HASH_XXH64_STRLEN+1];
+	char *lbuf;
+	u_int i;
+	int fd;
+	int ret;
+
+	/* write new manifest */
+	if ((fd=OPEN(ip->mname,O_RDWR|O_CREAT|O_TRUNC|O_BINARY,0666))<0){
+		perror("create manifest");
+		return -1;
+	}
+	if ((lbuf=(char *)malloc(3*(HASH_XXH64_STRLEN+1)+10+1+TAR_NAMELEN+1+1))==NULL){
+		perror("malloc");
+		CLOSE(fd);
+		return -1;
+	}
+	ret=0;
+	strcpy(lbuf,"# hash metahash exthash size name\n");
+	if (WRITE(fd,lbuf,strlen(lbuf))!=(int)strlen(lbuf)){
+		perror("write");
+		ret=-1;
+	}
+	for (i=0;(ret==0)&&(i<ip->newnum);i++){
+		hash_xxh64_str(ip->newp[i].hash,hstr[0]);
+		hash_xxh64_str(ip->newp[i].mhash,hstr[1]);
+		hash_xxh64_str(ip->newp[i].ehash,hstr[2]);
+		sprintf(lbuf,"%s %s %s %u %s\n",hstr[0],hstr[1],hstr[2],ip->newp[i].size,ip->newp[i].name);
+		if (WRITE(fd,lbuf,strlen(lbuf))!=(int)strlen(lbuf)){
 			perror("write");
+			ret=-1;
+		}
+	}
+	free(lbuf);
+	CLOSE(fd);
+
+	return ret;
+}
+
+/* parallel tar export */
+/* Note: tar members are submitted to pipeline in same order as in serial export, */
+/*       WAV conversion by converter threads, whole member written in order by caller's thread */
+
+/* volume for jobs in pipeline */
+struct tar_par_vol_s{
+	struct tar_par_vol_s *next;
+	u_int refcount; /* number of references by submitter and jobs */
+	struct vol_s vol;
+};
+
+/* pipeline context */
+struct tar_par_s{
+	struct par_s2w_s par;
+	struct tar_out_s *op;
+	int verbose;
+	struct tar_par_vol_s *vollist; /* allocated volumes */
+};
+
+/* job data */
+struct tar_par_job_s{
+	struct part_s *pp;
+	struct vol_s *vp;
+	struct tar_par_vol_s *volcp; /* volume allocated for pipeline, NULL if none */
+	u_int ti;
+	u_int flags;
+};
+
+static struct tar_par_vol_s *
+tar_par_volalloc(struct tar_par_s *tp)
+{
+	struct tar_par_vol_s *volcp;
+
+	volcp=(struct tar_par_vol_s *)malloc(sizeof(struct tar_par_vol_s));
+	if (volcp==NULL){
+		perror("malloc");
+		return NULL;
+	}
+	volcp->refcount=1; /* submitter */
+	volcp->next=tp->vollist;
+	tp->vollist=volcp;
+
+	return volcp;
+}
+
+static void
+tar_par_volrelease(struct tar_par_s *tp,struct tar_par_vol_s *volcp)
+{
+	struct tar_par_vol_s **vpp;
+
+	/* Note: only in caller's thread */
+	if (volcp==NULL){
+		return;
+	}
+	if (volcp->refcount>1){
+		volcp->refcount--;
+		return;
+	}
+	for (vpp=&tp->vollist;*vpp!=NULL;vpp=&(*vpp)->next){
+		if (*vpp==volcp){
+			*vpp=volcp->next;
+			break;
+		}
+	}
+	free(volcp);
+}
+
+static int
+tar_par_write(struct par_job_s *jp,void *arg)
+{
+	struct tar_par_s *tp;
+	struct tar_par_job_s *tjp;
+	int ret;
+
+	tp=(struct tar_par_s *)arg;
+	tjp=(struct tar_par_job_s *)jp->arg;
+
+	/* export member, WAV already checked, read and converted */
+	/* Note: tag-filter already checked by submitter */
+	ret=tar_export_ctx(tp->op,tjp->pp,tjp->vp,(tjp->flags&TAR_EXPORT_FILE)?&jp->file:NULL,tjp->ti,tjp->flags,tp->verbose,NULL,
+					   jp->wavflag?&jp->s2w:NULL);
+	tar_par_volrelease(tp,tjp->volcp);
+
+	return ret;
+}
+
+static int
+tar_par_start(struct tar_par_s *tp,struct tar_out_s *op,int verbose)
+{
+
+	bzero(tp,sizeof(struct tar_par_s));
+	tp->op=op;
+	tp->verbose=verbose;
+
+	/* tar output in order by this thread */
+	return par_s2w_start(&tp->par,par_convnum,0,par_memmax, /* 0: no writer threads */
+						 tar_par_write,(void *)tp,1); /* 1: stop on error */
+}
+
+static int
+tar_par_end(struct tar_par_s *tp)
+{
+	struct tar_par_vol_s *volcp;
+	int ret;
+
+	ret=par_s2w_end(&tp->par);
+
+	/* volumes of jobs not written */
+	while (tp->vollist!=NULL){
+		volcp=tp->vollist;
+		tp->vollist=volcp->next;
+		free(volcp);
+	}
+
+	return ret;
+}
+
+/* export member directly or submit it to pipeline (if tp!=NULL) */
+static int
+tar_export_job(struct tar_out_s *op,struct tar_par_s *tp,struct part_s *pp,struct vol_s *vp,struct tar_par_vol_s *volcp,struct file_s *fp,
+			   u_int ti,u_int flags,int verbose,u_char *filtertagp)
+{
+	struct tar_par_job_s tj;
+	int wavflag;
+
+	if (tp==NULL){
+		return tar_export(op,pp,vp,fp,ti,flags,verbose,filtertagp);
+	}
+
+	wavflag=((flags&TAR_EXPORT_FILE)&&(flags&TAR_EXPORT_WAV))?1:0;
+	if (flags&TAR_EXPORT_FILE){
+		if ((fp==NULL)||(fp->type==AKAI_FTYPE_FREE)){
 			return -1;
 		}
-	}
-#endif
-#ifndef TAR_NOVOLPARAMFILE
-	if (flags&TAR_EXPORT_VOLPARAMFILE){
-		/* export volparam-file */
-		if (WRITE(fd,(void *)vp->param,size)!=(int)size){
-			perror("write");
-			return -1;
+		/* test if tag-filter matches */
+		if (akai_match_filetags(filtertagp,fp->tag)<0){ /* no match? */
+			return 0; /* skip this file w/o error */
 		}
 	}
-#endif
 
-	/* fill rest of TAR_BLOCKSIZE bytes */
-	n=size%TAR_BLOCKSIZE;
-	n=(TAR_BLOCKSIZE-n)%TAR_BLOCKSIZE;
-	if (n>0){
-		bzero(buf,n);
-		/* write */
-		if (WRITE(fd,(void *)buf,n)!=(int)n){
-			perror("write");
+	tj.pp=pp;
+	tj.vp=vp;
+	tj.volcp=volcp;
+	tj.ti=ti;
+	tj.flags=flags;
+	if (volcp!=NULL){
+		volcp->refcount++; /* job */
+	}
+	if (par_s2w_submitjob(&tp->par,fp,wavflag,(void *)&tj,sizeof(struct tar_par_job_s))!=0){
+		tar_par_volrelease(tp,volcp);
+		if (tp->par.errcount>0){
 			return -1;
 		}
+		/* Note: error or not for WAV: skip this file w/o error (as in tar_export()) */
 	}
 
 	return 0;
 }
 
-int
-tar_export_vol(int fd,struct vol_s *vp,u_int flags,int verbose,u_char *filtertagp)
+static int
+tar_export_vol_ctx(struct tar_out_s *op,struct tar_par_s *tp,struct vol_s *vp,struct tar_par_vol_s *volcp,u_int flags,int verbose,u_char *filtertagp)
 {
 	u_int fi;
 	struct file_s tmpfile; /* current file */
 
-	if ((fd<0)||(vp==NULL)||(vp->type==AKAI_VOL_TYPE_INACT)||(vp->partp==NULL)||(!vp->partp->valid)||(vp->partp->fd<0)){
+	if ((op==NULL)||(vp==NULL)||(vp->type==AKAI_VOL_TYPE_INACT)||(vp->partp==NULL)||(!vp->partp->valid)||(vp->partp->fd<0)){
 		return -1;
 	}
 
@@ -394,7 +2043,7 @@ tar_export_vol(int fd,struct vol_s *vp,u_int flags,int verbose,u_char *filtertag
 	if ((vp->param!=NULL)
 		&&((flags&TAR_EXPORT_WAV)==0)){
 		/* export volparam-file */
-		if (tar_export(fd,vp->partp,vp,NULL,0,flags|TAR_EXPORT_VOLPARAMFILE,verbose,NULL)){
+		if (tar_export_job(op,tp,vp->partp,vp,volcp,NULL,0,flags|TAR_EXPORT_VOLPARAMFILE,verbose,NULL)){
 			return -1;
 		}
 	}
@@ -408,7 +2057,7 @@ tar_export_vol(int fd,struct vol_s *vp,u_int flags,int verbose,u_char *filtertag
 		}
 
 		/* export [part/volume/]file */
-		if (tar_export(fd,vp->partp,vp,&tmpfile,0,flags|TAR_EXPORT_FILE,verbose,filtertagp)){
+		if (tar_export_job(op,tp,vp->partp,vp,volcp,&tmpfile,0,flags|TAR_EXPORT_FILE,verbose,filtertagp)){
 			return -1;
 		}
 	}
@@ -416,13 +2065,16 @@ tar_export_vol(int fd,struct vol_s *vp,u_int flags,int verbose,u_char *filtertag
 	return 0;
 }
 
-int
-tar_export_part(int fd,struct part_s *pp,u_int flags,int verbose,u_char *filtertagp)
+static int
+tar_export_part_ctx(struct tar_out_s *op,struct tar_par_s *tp,struct part_s *pp,u_int flags,int verbose,u_char *filtertagp)
 {
 	u_int vi;
 	struct vol_s tmpvol; /* current volume */
+	struct vol_s *vp;
+	struct tar_par_vol_s *volcp;
+	int ret;
 
-	if ((fd<0)||(pp==NULL)||(!pp->valid)||(pp->fd<0)){
+	if ((op==NULL)||(pp==NULL)||(!pp->valid)||(pp->fd<0)){
 		return -1;
 	}
 
@@ -438,7 +2090,7 @@ tar_export_part(int fd,struct part_s *pp,u_int flags,int verbose,u_char *filtert
 			if (cstarts==0){ /* empty? */
 				continue; /* next */
 			}
-			if (tar_export(fd,pp,NULL,NULL,ti,flags|TAR_EXPORT_DDFILE,verbose,filtertagp)){
+			if (tar_export_job(op,tp,pp,NULL,NULL,NULL,ti,flags|TAR_EXPORT_DDFILE,verbose,filtertagp)){
 				return -1;
 			}
 		}
@@ -451,7 +2103,7 @@ tar_export_part(int fd,struct part_s *pp,u_int flags,int verbose,u_char *filtert
 		&&((flags&TAR_EXPORT_WAV)==0)){
 		/* export tags-file */
 		/* Note: tar_export() will check for valid tags magic */
-		if (tar_export(fd,pp,NULL,NULL,0,flags|TAR_EXPORT_TAGSFILE,verbose,NULL)){
+		if (tar_export_job(op,tp,pp,NULL,NULL,NULL,0,flags|TAR_EXPORT_TAGSFILE,verbose,NULL)){
 			return -1;
 		}
 	}
@@ -459,22 +2111,36 @@ tar_export_part(int fd,struct part_s *pp,u_int flags,int verbose,u_char *filtert
 
 	/* volumes in root directory of partition */
 	for (vi=0;vi<pp->volnummax;vi++){
+		if (tp!=NULL){
+			/* Note: volume must stay valid for jobs in pipeline */
+			if ((volcp=tar_par_volalloc(tp))==NULL){
+				return -1;
+			}
+			vp=&volcp->vol;
+		}else{
+			volcp=NULL;
+			vp=&tmpvol;
+		}
 		/* get volume */
-		if (akai_get_vol(pp,&tmpvol,vi)<0){
+		if (akai_get_vol(pp,vp,vi)<0){
+			tar_par_volrelease(tp,volcp);
 			continue; /* XXX ignore error, next volume */
 		}
-		if ((tmpvol.type!=AKAI_VOL_TYPE_S900)
-			&&(tmpvol.type!=AKAI_VOL_TYPE_S1000)
-			&&(tmpvol.type!=AKAI_VOL_TYPE_S3000)
-			&&(tmpvol.type!=AKAI_VOL_TYPE_CD3000)){
+		if ((vp->type!=AKAI_VOL_TYPE_S900)
+			&&(vp->type!=AKAI_VOL_TYPE_S1000)
+			&&(vp->type!=AKAI_VOL_TYPE_S3000)
+			&&(vp->type!=AKAI_VOL_TYPE_CD3000)){
+			tar_par_volrelease(tp,volcp);
 			continue; /* next volume */
 		}
 		/* create vol/ */
-		if (tar_export(fd,pp,&tmpvol,NULL,0,flags|TAR_EXPORT_VOL,verbose,NULL)){
-			return -1;
+		ret=tar_export_job(op,tp,pp,vp,volcp,NULL,0,flags|TAR_EXPORT_VOL,verbose,NULL);
+		if (ret==0){
+			/* export volume */
+			ret=tar_export_vol_ctx(op,tp,vp,volcp,flags|TAR_EXPORT_VOL,verbose,filtertagp);
 		}
-		/* export volume */
-		if (tar_export_vol(fd,&tmpvol,flags|TAR_EXPORT_VOL,verbose,filtertagp)<0){
+		tar_par_volrelease(tp,volcp);
+		if (ret){
 			return -1;
 		}
 	}
@@ -482,12 +2148,12 @@ tar_export_part(int fd,struct part_s *pp,u_int flags,int verbose,u_char *filtert
 	return 0;
 }
 
-int
-tar_export_disk(int fd,struct disk_s *dp,u_int flags,int verbose,u_char *filtertagp)
+static int
+tar_export_disk_ctx(struct tar_out_s *op,struct tar_par_s *tp,struct disk_s *dp,u_int flags,int verbose,u_char *filtertagp)
 {
 	u_int pi;
 
-	if ((fd<0)||(dp==NULL)){
+	if ((op==NULL)||(dp==NULL)){
 		return -1;
 	}
 
@@ -498,11 +2164,11 @@ tar_export_disk(int fd,struct disk_s *dp,u_int flags,int verbose,u_char *filtert
 			continue; /* next partition */
 		}
 		/* create part/ */
-		if (tar_export(fd,&part[pi],NULL,NULL,0,flags|TAR_EXPORT_PART,verbose,NULL)){
+		if (tar_export_job(op,tp,&part[pi],NULL,NULL,NULL,0,flags|TAR_EXPORT_PART,verbose,NULL)){
 			return -1;
 		}
 		/* export partition (sampler or DD) */
-		if (tar_export_part(fd,&part[pi],flags|TAR_EXPORT_PART,verbose,filtertagp)<0){
+		if (tar_export_part_ctx(op,tp,&part[pi],flags|TAR_EXPORT_PART,verbose,filtertagp)<0){
 			return -1;
 		}
 	}
@@ -510,8 +2176,69 @@ tar_export_disk(int fd,struct disk_s *dp,u_int flags,int verbose,u_char *filtert
 	return 0;
 }
 
+/* Note: one pipeline for whole export if parallel WAV conversion */
+int
+tar_export_vol(struct tar_out_s *op,struct vol_s *vp,u_int flags,int verbose,u_char *filtertagp)
+{
+	struct tar_par_s par;
+	int ret;
+
+	if ((flags&TAR_EXPORT_WAV)&&(par_convnum>0)){
+		if (tar_par_start(&par,op,verbose)<0){
+			return -1;
+		}
+		ret=tar_export_vol_ctx(op,&par,vp,NULL,flags,verbose,filtertagp);
+		if (tar_par_end(&par)<0){
+			ret=-1;
+		}
+		return ret;
+	}
+
+	return tar_export_vol_ctx(op,NULL,vp,NULL,flags,verbose,filtertagp);
+}
+
+int
+tar_export_part(struct tar_out_s *op,struct part_s *pp,u_int flags,int verbose,u_char *filtertagp)
+{
+	struct tar_par_s par;
+	int ret;
+
+	if ((flags&TAR_EXPORT_WAV)&&(par_convnum>0)){
+		if (tar_par_start(&par,op,verbose)<0){
+			return -1;
+		}
+		ret=tar_export_part_ctx(op,&par,pp,flags,verbose,filtertagp);
+		if (tar_par_end(&par)<0){
+			ret=-1;
+		}
+		return ret;
+	}
+
+	return tar_export_part_ctx(op,NULL,pp,flags,verbose,filtertagp);
+}
+
+int
+tar_export_disk(struct tar_out_s *op,struct disk_s *dp,u_int flags,int verbose,u_char *filtertagp)
+{
+	struct tar_par_s par;
+	int ret;
+
+	if ((flags&TAR_EXPORT_WAV)&&(par_convnum>0)){
+		if (tar_par_start(&par,op,verbose)<0){
+			return -1;
+		}
+		ret=tar_export_disk_ctx(op,&par,dp,flags,verbose,filtertagp);
+		if (tar_par_end(&par)<0){
+			ret=-1;
+		}
+		return ret;
+	}
+
+	return tar_export_disk_ctx(op,NULL,dp,flags,verbose,filtertagp);
+}
+
 int
-tar_export_curdir(int fd,int verbose,u_int flags)
+tar_export_curdir(struct tar_out_s *op,int verbose,u_int flags)
 {
 
 	if (curdiskp==NULL){ /* no disk? */
@@ -520,39 +2247,493 @@ tar_export_curdir(int fd,int verbose,u_int flags)
 	}
 	if (curpartp==NULL){ /* no partition? */
 		/* no, on disk */
-		return tar_export_disk(fd,curdiskp,flags,verbose,curfiltertag);
+		return tar_export_disk(op,curdiskp,flags,verbose,curfiltertag);
 	}
 	if (curvolp==NULL){ /* no sampler volume? */
 		/* now, in partition (sampler or DD) */
-		return tar_export_part(fd,curpartp,flags,verbose,curfiltertag);
+		return tar_export_part(op,curpartp,flags,verbose,curfiltertag);
 	}
 	/* now, in sampler volume */
-	return tar_export_vol(fd,curvolp,flags,verbose,curfiltertag);
+	return tar_export_vol(op,curvolp,flags,verbose,curfiltertag);
 }
 
 int
-tar_export_tailzero(int fd)
+tar_export_tailzero(struct tar_out_s *op)
 {
-	u_char buf[TAR_TAILZERO_BLOCKS*TAR_BLOCKSIZE];
 
-	/* zero blocks */
-	bzero(buf,TAR_TAILZERO_BLOCKS*TAR_BLOCKSIZE);
+	/* write zero blocks */
+	return tar_out_write(op,NULL,TAR_TAILZERO_BLOCKS*TAR_BLOCKSIZE); /* NULL: zeros */
+}
 
-	/* write blocks */
-	if (WRITE(fd,buf,TAR_TAILZERO_BLOCKS*TAR_BLOCKSIZE)!=TAR_TAILZERO_BLOCKS*TAR_BLOCKSIZE){
-		perror("write");
+
+
+/* osver and tags of file in volume vp from metadata */
+/* Note: returns pointer to sorted tags in *mp or NULL */
+static u_char *
+tar_import_fileattr(struct vol_s *vp,u_int vtype0,struct tar_meta_s *mp,u_int *osverp)
+{
+	u_int osver;
+	u_char *tagp;
+
+	/* default osver */
+	osver=vp->osver; /* default: from volume */
+	if (vtype0==AKAI_VOL_TYPE_INACT){ /* no user-supplied type? */
+		if (mp->flags&TAR_META_OSVER){
+			osver=mp->osver;
+		}
+	}else if (vtype0==AKAI_VOL_TYPE_S900){
+		osver=0; /* non-compressed, akai_create_file() will correct osver if necessary */
+	}else if ((vtype0==AKAI_VOL_TYPE_S3000)||(vtype0==AKAI_VOL_TYPE_CD3000)){
+		osver=AKAI_OSVER_S3000MAX; /* XXX */
+	}else{
+		osver=AKAI_OSVER_S1000MAX; /* XXX */
+	}
+	*osverp=osver;
+	/* default tags */
+	tagp=NULL;
+	if ((vp->type==AKAI_VOL_TYPE_S3000)||(vp->type==AKAI_VOL_TYPE_CD3000)){
+		if (mp->flags&TAR_META_TAGS){
+			tagp=mp->tag;
+			/* XXX no check for valid tag entries */
+			akai_sort_filetags(tagp);
+		}
+	}
+
+	return tagp;
+}
+
+/* add regular file with metadata *mp to batch, read file data */
+static int
+tar_plan_add(struct tar_plan_s *planp,int fd,struct tar_meta_s *mp,char *name,u_int size,u_int vtype0)
+{
+	struct tar_plan_file_s *pfp;
+	u_char *tagp;
+	u_int skip;
+
+	pfp=&planp->file[planp->num];
+	strncpy(pfp->name,name,TAR_NAMELEN);
+	pfp->name[TAR_NAMELEN]='\0';
+	pfp->off=planp->count;
+	pfp->size=size;
+	tagp=tar_import_fileattr(curvolp,vtype0,mp,&pfp->osver);
+	pfp->tagflag=(tagp!=NULL);
+	if (tagp!=NULL){
+		bcopy(tagp,pfp->tag,AKAI_FILE_TAGNUM);
+	}
+
+	/* read file data */
+	if (READ(fd,planp->buf+planp->count,size)!=(int)size){
+		perror("read");
+		return -1;
+	}
+	planp->count+=size;
+	planp->num++;
+
+	/* skip rest of full TAR_BLOCKSIZE */
+	skip=(TAR_BLOCKSIZE-(size%TAR_BLOCKSIZE))%TAR_BLOCKSIZE;
+	if ((skip>0)&&(io_skip(fd,(OFF_T)skip)<0)){
+		perror("lseek");
 		return -1;
 	}
 
 	return 0;
 }
 
+/* import batch of regular files into curvolp, starting with file *hp (metadata *mp) named name */
+/* Note: reads ahead headers of consecutive files of the same volume, */
+/*       returns 1 if next header has been read into *nexthp and *nextmp (not part of batch), 0 if not, -1 on error */
+static int
+tar_import_plan(struct tar_plan_s *planp,int fd,struct tar_head_s *hp,struct tar_meta_s *mp,char *name,u_int size,u_int vtype0,int verbose,char *sel,
+				struct tar_head_s *nexthp,struct tar_meta_s *nextmp)
+{
+	struct part_s *pp;
+	struct file_s tmpfile;
+	char hname[TAR_NAMELEN+1];
+	char *np;
+	u_int plen,nsize,chksum;
+	u_int l;
+	u_int i,j;
+	u_int fi;
+	int nextflag;
+	int n;
+	int ret;
 
+	pp=curvolp->partp;
+	planp->num=0;
+	planp->count=0;
 
-int
-tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
+	/* directory prefix of volume */
+	strncpy(hname,hp->name,TAR_NAMELEN);
+	hname[TAR_NAMELEN]='\0';
+	if ((np=strrchr(hname,'/'))!=NULL){
+		plen=(u_int)(np+1-hname);
+	}else{
+		plen=0;
+	}
+
+	/* first file */
+	if (tar_plan_add(planp,fd,mp,name,size,vtype0)<0){
+		return -1;
+	}
+
+	/* read ahead consecutive files in same volume */
+	nextflag=0;
+	while (planp->num<TAR_PLAN_NUM){
+		/* Note: with metadata from PAX extended header if any */
+		n=tar_read_head(fd,nexthp,nextmp,NULL);
+		if (n==0){ /* end of file? */
+			break;
+		}
+		if (n!=sizeof(struct tar_head_s)){
+			perror("read");
+			return -1;
+		}
+		nextflag=1; /* header pending, unless added to batch below */
+		chksum=0;
+		if ((tar_checksum((u_char *)nexthp)==0) /* all zero block? */
+			||(sscanf(nexthp->chksum,"%o",&chksum)!=1)
+			||(chksum!=tar_checksum((u_char *)nexthp))){ /* checksum error? (reported by caller) */
+			break;
+		}
+		if ((nexthp->type!=TAR_TYPE_REG)&&(nexthp->type!=TAR_TYPE_REG0)){
+			break;
+		}
+		strncpy(hname,nexthp->name,TAR_NAMELEN);
+		hname[TAR_NAMELEN]='\0';
+		if ((sel!=NULL)&&(!tar_sel_match(sel,hname))){
+			break;
+		}
+		/* same volume? */
+		if ((strncmp(hname,hp->name,plen)!=0)||(hname[plen]=='\0')||(strchr(hname+plen,'/')!=NULL)){
+			break;
+		}
+		np=hname+plen;
+		/* Note: leave dat-files to caller */
+		l=(u_int)strlen(np);
+		if ((l>=4)&&((strcmp(np+l-4,".dat")==0)||(strcmp(np+l-4,".DAT")==0))){
+			break;
+		}
+		nsize=0;
+		sscanf(nexthp->size,"%o",&nsize);
+		if ((nsize==0)||(nsize>TAR_PLAN_BUFSIZ-planp->count)){
+			break;
+		}
+		/* Note: same name twice must be overwritten in order */
+		for (j=0;j<planp->num;j++){
+			if (strcmp(planp->file[j].name,np)==0){
+				break;
+			}
+		}
+		if (j<planp->num){
+			break;
+		}
+		/* add to batch */
+		if (verbose){
+			printf("%s\n",hname);
+		}
+		if (tar_plan_add(planp,fd,nextmp,np,nsize,vtype0)<0){
+			return -1;
+		}
+		nextflag=0;
+	}
+
+	/* delete existing files */
+	/* Note: no need to search in empty volume */
+	for (fi=0;fi<curvolp->fimax;fi++){
+		if (akai_get_file(curvolp,&tmpfile,fi)==0){
+			break; /* not empty */
+		}
+	}
+	for (i=0;i<planp->num;i++){
+		if ((fi<curvolp->fimax)&&(akai_find_file(curvolp,&tmpfile,planp->file[i].name)==0)){
+			/* exists */
+			/* delete file */
+			if (akai_delete_file(&tmpfile)<0){
+				fprintf(stderr,"cannot overwrite existing file\n");
+				return -1;
+			}
+		}
+		planp->bsize[i]=(planp->file[i].size+pp->blksize-1)/pp->blksize; /* round up */
+	}
+
+	/* allocate FAT chains in one pass */
+	if (akai_allocate_fatchains(pp,planp->num,planp->bsize,planp->bstart,
+								(curvolp->type==AKAI_VOL_TYPE_S900)?AKAI_FAT_CODE_FILEEND900:AKAI_FAT_CODE_FILEEND)<0){ /* end code */
+		fprintf(stderr,"cannot create file\n");
+		return -1;
+	}
+
+	/* create files and write data */
+	ret=nextflag;
+	for (i=0;i<planp->num;i++){
+		/* create destination file */
+		/* Note: akai_create_file_chain() will correct osver if necessary */
+		if (akai_create_file_chain(curvolp,
+								   &tmpfile,
+								   planp->file[i].size,
+								   AKAI_CREATE_FILE_NOINDEX,
+								   planp->file[i].name,
+								   planp->file[i].osver,
+								   planp->file[i].tagflag?planp->file[i].tag:NULL,
+								   planp->bstart[i],
+								   0)<0){ /* 0: write volume directory below */
+			fprintf(stderr,"cannot create file\n");
+			/* free remaining FAT chains */
+			for (j=i;j<planp->num;j++){
+				akai_free_fatchain(pp,planp->bstart[j],1); /* 1: write FAT */
+			}
+			ret=-1;
+			break;
+		}
+		/* import file */
+		if (akai_write_file(-1,planp->buf+planp->file[i].off,&tmpfile,0,tmpfile.size)<0){
+			/* free remaining FAT chains */
+			for (j=i+1;j<planp->num;j++){
+				akai_free_fatchain(pp,planp->bstart[j],1); /* 1: write FAT */
+			}
+			ret=-1;
+			break;
+		}
+		if ((curvolp->type==AKAI_VOL_TYPE_S900)&&(tmpfile.osver!=0) /* compressed file in S900 volume? */
+			&&(planp->file[i].osver==0)){ /* and supplied/determined osver is incompatible? */
+			/* update uncompr value */
+			akai_s900comprfile_updateuncompr(&tmpfile); /* ignore error */
+		}
+#if 1
+		/* fix name in header (if necessary) */
+		akai_fixramname(&tmpfile); /* ignore error */
+#endif
+	}
+
+	/* write volume directory once */
+	if (akai_write_voldir_all(curvolp)<0){
+		ret=-1;
+	}
+
+	return ret;
+}
+
+/* import member of type TAR_TYPE_DEDUPREF with header *hp, metadata *mp and size size into curvolp */
+/* Note: sample data is copied from file of referenced member, */
+/*       returns with curdir of member */
+static int
+tar_import_dedupref(int fd,struct tar_head_s *hp,struct tar_meta_s *mp,char *name,u_int size,u_int vtype0,char *sel)
+{
+	struct tar_dedupref_s ref;
+	struct hash_sha256_s sha;
+	u_char md[HASH_SHA256_SIZE];
+	char srcname[DIRNAMEBUF_LEN+1]; /* +1 for '\0' */
+	struct file_s tmpfile;
+	u_char *buf;
+	u_int hsize,psize,srchsize;
+	u_int osver;
+	u_char *tagp;
+	int ret;
+
+	if (size<sizeof(struct tar_dedupref_s)){
+		fprintf(stderr,"invalid reference\n");
+		return -1;
+	}
+	if (READ(fd,(void *)&ref,sizeof(struct tar_dedupref_s))!=(int)sizeof(struct tar_dedupref_s)){
+		perror("read");
+		return -1;
+	}
+	ref.name[TAR_NAMELEN-1]='\0';
+	hsize=size-sizeof(struct tar_dedupref_s);
+	psize=0;
+	if ((sscanf(ref.psize,"%o",&psize)!=1)||(hsize>AKAI_FILE_SIZEMAX)||(psize>AKAI_FILE_SIZEMAX-hsize)){
+		fprintf(stderr,"invalid reference\n");
+		return -1;
+	}
+
+	/* sample header of this member */
+	if ((buf=(u_char *)malloc(hsize+psize))==NULL){
+		perror("malloc");
+		return -1;
+	}
+	if ((hsize>0)&&(READ(fd,(void *)buf,hsize)!=(int)hsize)){
+		perror("read");
+		free(buf);
+		return -1;
+	}
+
+	/* sample data from referenced file */
+	ret=-1;
+	restore_curdir();
+	if ((change_curdir(ref.name,0,srcname,0)<0)||(curvolp==NULL)
+		||(akai_find_file(curvolp,&tmpfile,srcname)<0)){
+		if ((sel!=NULL)&&(!tar_sel_match(sel,ref.name))){
+			/* Note: without index, source outside selection is not imported */
+			fprintf(stderr,"referenced file \"%s\" outside selection, not imported\n",ref.name);
+		}else{
+			fprintf(stderr,"referenced file \"%s\" not found\n",ref.name);
+		}
+		goto tar_import_dedupref_done;
+	}
+	srchsize=tar_dedup_headsize(&tmpfile);
+	if ((tmpfile.size<srchsize)||(tmpfile.size-srchsize!=psize)){
+		fprintf(stderr,"referenced file \"%s\" has changed\n",ref.name);
+		goto tar_import_dedupref_done;
+	}
+	if (akai_read_file(-1,buf+hsize,&tmpfile,srchsize,tmpfile.size)<0){
+		goto tar_import_dedupref_done;
+	}
+	hash_sha256_init(&sha);
+	hash_sha256_update(&sha,buf+hsize,psize);
+	hash_sha256_final(&sha,md);
+	if (memcmp(md,ref.md,HASH_SHA256_SIZE)!=0){
+		fprintf(stderr,"referenced file \"%s\" has changed\n",ref.name);
+		goto tar_import_dedupref_done;
+	}
+
+	/* back to volume of member */
+	restore_curdir();
+	if ((change_curdir(hp->name,0,srcname,0)<0)||(curvolp==NULL)){
+		fprintf(stderr,"directory not found\n");
+		goto tar_import_dedupref_done;
+	}
+
+	tagp=tar_import_fileattr(curvolp,vtype0,mp,&osver);
+	/* check if destination file already exists */
+	if (akai_find_file(curvolp,&tmpfile,name)==0){
+		/* exists */
+		/* delete file */
+		if (akai_delete_file(&tmpfile)<0){
+			fprintf(stderr,"cannot overwrite existing file\n");
+			goto tar_import_dedupref_done;
+		}
+	}
+	/* create destination file */
+	/* Note: akai_create_file() will correct osver if necessary */
+	if (akai_create_file(curvolp,
+						 &tmpfile,
+						 hsize+psize,
+						 AKAI_CREATE_FILE_NOINDEX,
+						 name,
+						 osver,
+						 tagp)<0){
+		fprintf(stderr,"cannot create file\n");
+		goto tar_import_dedupref_done;
+	}
+	/* import file */
+	if (akai_write_file(-1,buf,&tmpfile,0,tmpfile.size)<0){
+		goto tar_import_dedupref_done;
+	}
+	if ((curvolp->type==AKAI_VOL_TYPE_S900)&&(tmpfile.osver!=0) /* compressed file in S900 volume? */
+		&&(osver==0)){ /* and supplied/determined osver is incompatible? */
+		/* update uncompr value */
+		akai_s900comprfile_updateuncompr(&tmpfile); /* ignore error */
+	}
+#if 1
+	/* fix name in header (if necessary) */
+	akai_fixramname(&tmpfile); /* ignore error */
+#endif
+	ret=0;
+
+tar_import_dedupref_done:
+	free(buf);
+	return ret;
+}
+
+/* find DD take with tar name name (incl. AKAI_DDTAKE_FNAMEEND) in partition pp */
+/* Note: returns AKAI_DDTAKE_MAXNUM if not found */
+static u_int
+tar_find_ddtake(struct part_s *pp,char *name)
+{
+	char namebuf[AKAI_NAME_LEN+4+1]; /* +4 for ".<type>", +1 for '\0' */
+	u_int ti;
+	u_int cstarts;
+
+	for (ti=0;ti<AKAI_DDTAKE_MAXNUM;ti++){
+		cstarts=(pp->head.dd.take[ti].cstarts[1]<<8)
+				+pp->head.dd.take[ti].cstarts[0];
+		if (cstarts==0){ /* free? */
+			continue; /* next */
+		}
+		akai2ascii_name(pp->head.dd.take[ti].name,namebuf,0); /* 0: not S900 */
+		strcpy(namebuf+strlen(namebuf),AKAI_DDTAKE_FNAMEEND);
+		if (strcmp(namebuf,name)==0){
+			break; /* found */
+		}
+	}
+
+	return ti;
+}
+
+/* delete member name of deletion list of incremental tar-file */
+/* Note: ignore members not found */
+static int
+tar_inc_delete(char *name,int verbose)
+{
+	char namebuf[TAR_NAMELEN+1]; /* +1 for '\0' */
+	char lastname[DIRNAMEBUF_LEN+1]; /* +1 for '\0' */
+	struct vol_s tmpvol;
+	struct file_s tmpfile;
+	u_int ti;
+	u_int l;
+	int ret;
+
+	strncpy(namebuf,name,TAR_NAMELEN);
+	namebuf[TAR_NAMELEN]='\0';
+	l=(u_int)strlen(namebuf);
+	if ((l>0)&&(namebuf[l-1]=='/')){
+		namebuf[--l]='\0'; /* directory */
+	}else{
+		name=NULL; /* file */
+	}
+	if (l==0){
+		return 0;
+	}
+
+	save_curdir(1); /* 1: could be modifications */
+	if (change_curdir(namebuf,0,lastname,0)<0){
+		restore_curdir();
+		return 0; /* not found */
+	}
+	ret=0;
+	if (name!=NULL){
+		/* directory */
+		/* Note: only volumes, partitions remain */
+		if ((curpartp!=NULL)&&(curpartp->type!=PART_TYPE_DD)&&(curvolp==NULL)
+			&&(akai_find_vol(curpartp,&tmpvol,lastname)==0)){
+			if (verbose){
+				printf("deleting %s/\n",namebuf);
+			}
+			ret=akai_wipe_vol(&tmpvol,1); /* 1: delete */
+		}
+	}else if (curvolp!=NULL){
+		/* file */
+		if (akai_find_file(curvolp,&tmpfile,lastname)==0){
+			if (verbose){
+				printf("deleting %s\n",namebuf);
+			}
+			ret=akai_delete_file(&tmpfile);
+		}
+	}else if ((curpartp!=NULL)&&(curpartp->type==PART_TYPE_DD)){
+		/* DD take */
+		if ((ti=tar_find_ddtake(curpartp,lastname))<AKAI_DDTAKE_MAXNUM){
+			if (verbose){
+				printf("deleting %s\n",namebuf);
+			}
+			ret=akai_delete_ddtake(curpartp,ti);
+		}
+	}
+	restore_curdir();
+
+	if (ret<0){
+		fprintf(stderr,"cannot delete %s\n",namebuf);
+	}
+	return ret;
+}
+
+/* import from tar-file, members in sel only (if sel!=NULL) */
+/* Note: if offp!=NULL, seek to offsets of selected members in offp[0..offnum-1], */
+/*       these are imported even if not in sel */
+static int
+tar_import_ctx(int fd,u_int vtype0,int verbose,u_int flags,char *sel,OFF_T *offp,u_int offnum)
 {
 	struct tar_head_s tarhd;
+	struct tar_meta_s meta;
 	u_int byteend,skip;
 	u_int chksum,chksum0;
 	u_int l;
@@ -565,6 +2746,11 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 	u_char *tagp;
 	struct akai_volparam_s *parp;
 	u_int wavbcount;
+	u_int offi;
+	struct tar_plan_s *planp;
+	struct tar_head_s nexthd;
+	struct tar_meta_s nextmeta;
+	int nextflag;
 
 	if (curdiskp==NULL){
 		printf("must be on disk\n");
@@ -574,7 +2760,10 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 	save_curdir(1); /* 1: could be modifications */
 
 	/* interpret tar file */
+	planp=NULL;
+	nextflag=0;
 	skip=0;
+	offi=0;
 	ret=-1; /* no success so far */
 	for (;;){
 		if (verbose){
@@ -585,10 +2774,20 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 #endif
 		restore_curdir();
 
-		/* skip if necessary */
-		if (skip>0){
+		if (offp!=NULL){
+			/* seek to next selected member */
+			if (offi>=offnum){
+				ret=0; /* success */
+				goto tar_import_done;
+			}
+			if (LSEEK(fd,offp[offi++],SEEK_SET)<0){
+				perror("lseek");
+				ret=-1;
+				goto tar_import_done;
+			}
+		}else if (skip>0){ /* skip if necessary */
 			/* skip file */
-			if (LSEEK(fd,(long)skip,SEEK_CUR)<0){
+			if (io_skip(fd,(OFF_T)skip)<0){
 				perror("lseek");
 				ret=-1;
 				goto tar_import_done;
@@ -597,8 +2796,16 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 		skip=0;
 
 		/* read header */
-		/* XXX size must not exceed SSIZE_MAX! */
-		ret=(int)READ(fd,(void *)&tarhd,sizeof(struct tar_head_s));
+		if (nextflag){
+			/* already read ahead by planner */
+			tarhd=nexthd;
+			meta=nextmeta;
+			nextflag=0;
+			ret=sizeof(struct tar_head_s);
+		}else{
+			/* Note: metadata from PAX extended header or legacy encoding */
+			ret=tar_read_head(fd,&tarhd,&meta,NULL);
+		}
 		if (ret==0){
 			/* end of file */
 			ret=0; /* success */
@@ -633,11 +2840,17 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 		/* check type */
 		if ((tarhd.type!=TAR_TYPE_DIR)
 			&&(tarhd.type!=TAR_TYPE_REG)
-			&&(tarhd.type!=TAR_TYPE_REG0)){
+			&&(tarhd.type!=TAR_TYPE_REG0)
+			&&(tarhd.type!=TAR_TYPE_DEDUPREF)){
+			skip+=byteend; /* skip file */
+			continue; /* next */
+		}
+		/* check selection */
+		if ((sel!=NULL)&&(offp==NULL)&&(!tar_sel_match(sel,tarhd.name))){
 			skip+=byteend; /* skip file */
 			continue; /* next */
 		}
-		/* now, directory or regular file */
+		/* now, directory, regular file or reference */
 
 		/* get name */
 		if (verbose){
@@ -696,9 +2909,9 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 				}
 				/* load number */
 				lnum=AKAI_VOL_LNUM_OFF; /* default */
-				/* XXX use devminor field for load number */
-				sscanf(tarhd.devminor,"%o",&lnum);
-				/* Note: if sscanf finds nothing, lnum remains! */
+				if (meta.flags&TAR_META_LNUM){
+					lnum=meta.lnum;
+				}
 				/* correct lnum */
 				if ((lnum!=AKAI_VOL_LNUM_OFF)
 					&&((lnum<AKAI_VOL_LNUM_MIN)||(lnum>AKAI_VOL_LNUM_MAX))){
@@ -707,9 +2920,8 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 				/* volume parameters */
 				parp=NULL; /* default volume parameters or keep old ones */
 #ifndef TAR_NOVOLPARAMTARHD
-				/* XXX use linkname for volume parameters */
-				if ((tarhd.linkname[0]=='\0')&&(tarhd.linkname[1]=='P')){ /* XXX correct magic? */
-					parp=(struct akai_volparam_s *)(&tarhd.linkname[0]+2); /* XXX +2: linkname starts with magic */
+				if (meta.flags&TAR_META_VOLPARAM){
+					parp=&meta.param;
 				}
 #endif
 				/* on partition level */
@@ -719,9 +2931,9 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 					/* user-supplied volume type, Note: will be corrected below if bad or inactive */
 					vtype=vtype0;
 					if (vtype0==AKAI_VOL_TYPE_INACT){ /* no user-supplied type? */
-						/* XXX use devmajor field for type */
-						sscanf(tarhd.devmajor,"%o",&vtype);
-						/* Note: if sscanf finds nothing, vtype remains! */
+						if (meta.flags&TAR_META_VTYPE){
+							vtype=meta.vtype;
+						}
 						/* correct vtype */
 						if (curpartp->type==PART_TYPE_HD9){
 							vtype=AKAI_VOL_TYPE_S900;
@@ -741,8 +2953,7 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 				}else{
 					/* volume already exists */
 					/* Note: keep volume type (even if user-supplied type) */
-					/* XXX use devminor field for load number */
-					if (tarhd.devminor[0]==0x00){ /* no load number? */
+					if (!(meta.flags&TAR_META_LNUM)){ /* no load number? */
 						lnum=tmpvol.lnum; /* keep old value */
 					}
 					osver=tmpvol.osver; /* keep old value */
@@ -757,12 +2968,43 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 					printf("volume parameters imported\n");
 				}
 			}
-
-			skip+=byteend; /* skip file */
+
+			skip+=byteend; /* skip file */
+			continue; /* next */
+		}
+		/* now, regular file */
+
+		/* handle deletion list of incremental tar-file */
+		if ((flags&TAR_IMPORT_INC)&&(strcmp(tarhd.name,TAR_INC_DELFILENAME)==0)){
+			char *delbuf,*p,*q;
+
+			if ((delbuf=(char *)malloc(byteend+1))==NULL){
+				perror("malloc");
+				ret=-1;
+				goto tar_import_done;
+			}
+			if (READ(fd,(void *)delbuf,byteend)!=(int)byteend){
+				perror("read");
+				free(delbuf);
+				ret=-1;
+				goto tar_import_done;
+			}
+			delbuf[byteend]='\0';
+			/* Note: restore_curdir() in tar_inc_delete() returns to top level */
+			for (p=delbuf;*p!='\0';p=q){
+				for (q=p;(*q!='\0')&&(*q!='\n');q++);
+				if (*q=='\n'){
+					*q++='\0';
+				}
+				if (tar_inc_delete(p,verbose)<0){
+					free(delbuf);
+					ret=-1;
+					goto tar_import_done;
+				}
+			}
+			free(delbuf);
 			continue; /* next */
 		}
-		/* now, regular file */
-
 #ifndef TAR_NOTAGSFILE
 		/* handle tags-file */
 		if (strcmp(dirnamebuf,TAR_TAGSFILENAME)==0){
@@ -856,7 +3098,7 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 		if (strcmp(dirnamebuf,TAR_VOLINFO1FILENAME)==0){
 			if ((curvolp!=NULL)&&(curvolp->param!=NULL)){ /* on volume level and volume has parameters? */
 				if (byteend==(TAR_VOLINFO1FILE_SKIPB+sizeof(struct akai_volparam_s))){ /* valid file size? */
-					if (LSEEK(fd,TAR_VOLINFO1FILE_SKIPB,SEEK_CUR)<0){
+					if (io_skip(fd,TAR_VOLINFO1FILE_SKIPB)<0){
 						perror("lssek");
 						ret=-1;
 						goto tar_import_done;
@@ -915,6 +3157,19 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 			ret=-1;
 			goto tar_import_done;
 		}
+		if (tarhd.type==TAR_TYPE_DEDUPREF){
+			/* reference to sample data of earlier member */
+			if ((curpartp->type==PART_TYPE_DD)||(curvolp==NULL)||(flags&TAR_IMPORT_WAV)){
+				fprintf(stderr,"reference only allowed in volume without WAV conversion\n");
+				ret=-1;
+				goto tar_import_done;
+			}
+			if (tar_import_dedupref(fd,&tarhd,&meta,dirnamebuf,byteend,vtype0,sel)<0){
+				ret=-1;
+				goto tar_import_done;
+			}
+			continue; /* next */
+		}
 		if (curpartp->type==PART_TYPE_DD){
 			/* harddisk DD partition */
 			if (flags&TAR_IMPORT_WAV){
@@ -964,6 +3219,16 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 					continue; /* next */
 				}
 
+				/* incremental tar-file: replace DD take with same name */
+				if ((flags&TAR_IMPORT_INC)
+					&&((ti=tar_find_ddtake(curpartp,dirnamebuf))<AKAI_DDTAKE_MAXNUM)){
+					if (akai_delete_ddtake(curpartp,ti)<0){
+						fprintf(stderr,"cannot overwrite existing take\n");
+						ret=-1;
+						goto tar_import_done;
+					}
+				}
+
 				/* find free index */
 				for (ti=0;ti<AKAI_DDTAKE_MAXNUM;ti++){
 					/* take */
@@ -1037,29 +3302,33 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 
 		/* import file */
 
-		/* default osver */
-		osver=curvolp->osver; /* default: from volume */
-		if (vtype0==AKAI_VOL_TYPE_INACT){ /* no user-supplied type? */
-			/* XXX use devmajor field for osver */
-			sscanf(tarhd.devmajor,"%o",&osver);
-		}else if (vtype0==AKAI_VOL_TYPE_S900){
-			osver=0; /* non-compressed, akai_create_file() will correct osver if necessary */
-		}else if ((vtype0==AKAI_VOL_TYPE_S3000)||(vtype0==AKAI_VOL_TYPE_CD3000)){
-			osver=AKAI_OSVER_S3000MAX; /* XXX */
-		}else{
-			osver=AKAI_OSVER_S1000MAX; /* XXX */
-		}
-		/* Note: if sscanf finds nothing, osver remains! */
-		/* default tags */
-		tagp=NULL;
-		if ((curvolp->type==AKAI_VOL_TYPE_S3000)||(curvolp->type==AKAI_VOL_TYPE_CD3000)){
-			/* XXX use linkname for file tags */
-			if ((tarhd.linkname[0]=='\0')&&(tarhd.linkname[1]=='T')){ /* XXX correct magic? */
-				tagp=(u_char *)&tarhd.linkname[2];/* XXX +2: linkname starts with magic */
-				/* XXX no check for valid tag entries */
-				akai_sort_filetags(tagp);
+#ifndef TAR_PLAN_DISABLE
+		/* batch of files for this volume */
+		if ((!(flags&TAR_IMPORT_WAV))&&(offp==NULL)
+			&&(byteend>0)&&(byteend<=TAR_PLAN_BUFSIZ)){
+			if (planp==NULL){
+				if ((planp=(struct tar_plan_s *)malloc(sizeof(struct tar_plan_s)))!=NULL){
+					if ((planp->buf=(u_char *)malloc(TAR_PLAN_BUFSIZ))==NULL){
+						free(planp);
+						planp=NULL;
+					}
+				}
+				/* Note: if no memory, import file by file below */
+			}
+			if (planp!=NULL){
+				nextflag=tar_import_plan(planp,fd,&tarhd,&meta,dirnamebuf,byteend,vtype0,verbose,sel,&nexthd,&nextmeta);
+				if (nextflag<0){
+					nextflag=0;
+					ret=-1;
+					goto tar_import_done;
+				}
+				skip=0; /* file data and rest of block already read */
+				continue; /* next */
 			}
 		}
+#endif
+
+		tagp=tar_import_fileattr(curvolp,vtype0,&meta,&osver);
 		if (flags&TAR_IMPORT_WAV){
 			/* file type */
 			if (flags&(TAR_IMPORT_WAVS9|TAR_IMPORT_WAVS9C)){
@@ -1136,10 +3405,675 @@ tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
 	}
 
 tar_import_done:
+	if (planp!=NULL){
+		free(planp->buf);
+		free(planp);
+	}
 	restore_curdir();
 	return ret;
 }
 
+int
+tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags)
+{
+
+	return tar_import_ctx(fd,vtype0,verbose,flags,NULL,NULL,0);
+}
+
+/* check if index entry *ip matches header in tar-file, returns 1 if not */
+static int
+tar_idx_check(int fd,struct tar_idx_s *ip)
+{
+	struct tar_head_s tarhd;
+	struct tar_meta_s meta;
+	u_int chksum,chksum0;
+
+	if (LSEEK(fd,ip->off,SEEK_SET)<0){
+		perror("lseek");
+		return -1;
+	}
+	if (tar_read_head(fd,&tarhd,&meta,NULL)!=sizeof(struct tar_head_s)){
+		return 1; /* beyond end of tar-file or read error */
+	}
+	chksum0=tar_checksum((u_char *)&tarhd);
+	if ((chksum0==0)||(sscanf(tarhd.chksum,"%o",&chksum)!=1)||(chksum!=chksum0)){
+		return 1; /* no header */
+	}
+	if ((strncmp(tarhd.name,ip->name,TAR_NAMELEN)!=0)
+		||(((tarhd.type=='\0')?TAR_TYPE_REG:tarhd.type)!=ip->type)){
+		return 1; /* other member */
+	}
+	return 0;
+}
+
+/* import members in sel from tar-file, use index of tarname if possible */
+/* Note: with index, source of reference outside sel is imported as well */
+int
+tar_import_sel(int fd,char *tarname,char *sel,u_int vtype0,int verbose,u_int flags)
+{
+	struct tar_idx_s *idxp;
+	struct tar_dedupref_s ref;
+	u_char *markp;
+	OFF_T *offp;
+	OFF_T off0;
+	u_int num,offnum;
+	u_int i,j;
+	int ret;
+
+	if (sel==NULL){
+		return -1;
+	}
+
+	/* Note: index only if tar-file is seekable (e.g. not compressed) */
+	if ((tarname==NULL)||((off0=LSEEK(fd,0,SEEK_CUR))<0)
+		||((ret=tar_idx_load(fd,tarname,&idxp,&num))>0)){
+		/* no index: scan whole tar-file */
+		return tar_import_ctx(fd,vtype0,verbose,flags,sel,NULL,0);
+	}
+	if (ret<0){
+		return -1;
+	}
+
+	/* offsets of selected members */
+	offp=NULL;
+	offnum=0;
+	if (num>0){
+		if ((offp=(OFF_T *)malloc(num*sizeof(OFF_T)))==NULL){
+			perror("malloc");
+			free(idxp);
+			return -1;
+		}
+		if ((markp=(u_char *)malloc(num))==NULL){
+			perror("malloc");
+			free(offp);
+			free(idxp);
+			return -1;
+		}
+		for (i=0;i<num;i++){
+			markp[i]=tar_sel_match(sel,idxp[i].name);
+		}
+		/* add sources of selected references */
+		/* Note: source is an earlier member, with its parent directories */
+		for (i=0;i<num;i++){
+			if ((!markp[i])||(idxp[i].type!=TAR_TYPE_DEDUPREF)){
+				continue;
+			}
+			if ((ret=tar_idx_check(fd,&idxp[i]))!=0){
+				break;
+			}
+			if (READ(fd,(void *)&ref,sizeof(struct tar_dedupref_s))!=(int)sizeof(struct tar_dedupref_s)){
+				ret=1; /* truncated member */
+				break;
+			}
+			ref.name[TAR_NAMELEN-1]='\0';
+			for (j=0;j<i;j++){
+				if ((!markp[j])&&tar_sel_match(ref.name,idxp[j].name)){
+					if (verbose&&(strcmp(idxp[j].name,ref.name)==0)){
+						printf("adding referenced file \"%s\"\n",ref.name);
+					}
+					markp[j]=1;
+				}
+			}
+		}
+		for (i=0;(i<num)&&(ret==0);i++){
+			if (markp[i]){
+				/* Note: verify before import, no partial import from a bad index */
+				if ((ret=tar_idx_check(fd,&idxp[i]))!=0){
+					break;
+				}
+				offp[offnum++]=idxp[i].off;
+			}
+		}
+		free(markp);
+	}
+	free(idxp);
+	if ((num>0)&&(ret!=0)){
+		free(offp);
+		if (ret<0){
+			return -1;
+		}
+		printf("index does not match tar-file, ignored\n");
+		if (LSEEK(fd,off0,SEEK_SET)<0){
+			perror("lseek");
+			return -1;
+		}
+		/* scan whole tar-file */
+		return tar_import_ctx(fd,vtype0,verbose,flags,sel,NULL,0);
+	}
+
+	if (offnum==0){
+		printf("no matching member in index\n");
+		ret=0;
+	}else{
+		ret=tar_import_ctx(fd,vtype0,verbose,flags,sel,offp,offnum);
+	}
+	if (offp!=NULL){
+		free(offp);
+	}
+	return ret;
+}
+
+
+
+/* gzip compression of tar-file */
+
+int tar_zlevel=-1; /* <0: by file name, 0: off, else: gzip level */
+
+/* block for compression */
+struct tar_z_blk_s{
+	struct tar_z_blk_s *next;
+	u_int seq; /* sequence number */
+	u_int insize;
+	u_char *inbuf;
+};
+
+/* check for gzip file name */
+int
+tar_z_name(char *name)
+{
+	size_t l;
+
+	if (name==NULL){
+		return 0;
+	}
+	l=strlen(name);
+	if ((l>3)&&(strcasecmp(name+l-3,".gz")==0)){
+		return 1;
+	}
+	if ((l>4)&&(strcasecmp(name+l-4,".tgz")==0)){
+		return 1;
+	}
+	return 0;
+}
+
+/* check for gzip magic at current position, doesn't change position */
+/* Note: returns 2 if fd is not seekable, detection by TAR_Z_AUTO */
+int
+tar_z_detect(int fd)
+{
+	u_char m[2];
+	int n;
+
+	if (LSEEK(fd,0,SEEK_CUR)<0){
+#ifdef TAR_GZIP
+		return 2;
+#else
+		return 0; /* cannot decompress anyway */
+#endif
+	}
+	if ((n=READ(fd,m,2))<0){
+		return -1;
+	}
+	if ((n>0)&&(LSEEK(fd,-(OFF_T)n,SEEK_CUR)<0)){
+		return -1;
+	}
+	if ((n==2)&&(m[0]==0x1f)&&(m[1]==0x8b)){
+		return 1;
+	}
+	return 0;
+}
+
+#ifdef TAR_GZIP
+static void
+tar_z_seterr(struct tar_z_s *zp)
+{
+
+	pthread_mutex_lock(&zp->mutex);
+	zp->err=1;
+	pthread_mutex_unlock(&zp->mutex);
+}
+
+/* compress block and write it in order */
+static void
+tar_z_blkrun(struct tar_z_s *zp,struct tar_z_blk_s *bp)
+{
+	z_stream zs;
+	u_char *outbuf;
+	u_int outsize;
+	int err;
+
+	outbuf=NULL;
+	outsize=0;
+	pthread_mutex_lock(&zp->mutex);
+	err=zp->err;
+	pthread_mutex_unlock(&zp->mutex);
+	if (!err){
+		/* compress into gzip member */
+		bzero(&zs,sizeof(z_stream));
+		if (deflateInit2(&zs,zp->level,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY)!=Z_OK){ /* 15+16: gzip */
+			fprintf(stderr,"cannot compress\n");
+			err=1;
+		}else{
+			outsize=(u_int)deflateBound(&zs,bp->insize);
+			if ((outbuf=(u_char *)malloc(outsize))==NULL){
+				perror("malloc");
+				err=1;
+			}else{
+				zs.next_in=bp->inbuf;
+				zs.avail_in=bp->insize;
+				zs.next_out=outbuf;
+				zs.avail_out=outsize;
+				if (deflate(&zs,Z_FINISH)!=Z_STREAM_END){
+					fprintf(stderr,"cannot compress\n");
+					err=1;
+				}
+				outsize=(u_int)zs.total_out;
+			}
+			deflateEnd(&zs);
+		}
+	}
+
+	/* wait for turn */
+	pthread_mutex_lock(&zp->mutex);
+	while (zp->seqwrite!=bp->seq){
+		pthread_cond_wait(&zp->cond,&zp->mutex);
+	}
+	err|=zp->err;
+	pthread_mutex_unlock(&zp->mutex);
+
+	/* write in order */
+	if (!err){
+		if (WRITE(zp->zfd,outbuf,outsize)!=(int)outsize){
+			perror("write");
+			err=1;
+		}
+	}
+
+	pthread_mutex_lock(&zp->mutex);
+	if (err){
+		zp->err=1;
+	}
+	zp->seqwrite++;
+	zp->blknum--;
+	pthread_cond_broadcast(&zp->cond);
+	pthread_mutex_unlock(&zp->mutex);
+
+	if (outbuf!=NULL){
+		free(outbuf);
+	}
+	free(bp->inbuf);
+	free(bp);
+}
+
+/* read uncompressed blocks from pipe */
+static void *
+tar_z_readthread(void *arg)
+{
+	struct tar_z_s *zp;
+	struct tar_z_blk_s *bp;
+	int n;
+
+	zp=(struct tar_z_s *)arg;
+
+	for (;;){
+		/* bound blocks in flight */
+		pthread_mutex_lock(&zp->mutex);
+		while (zp->blknum>=zp->blkmax){
+			pthread_cond_wait(&zp->cond,&zp->mutex);
+		}
+		zp->blknum++;
+		pthread_mutex_unlock(&zp->mutex);
+
+		bp=(struct tar_z_blk_s *)malloc(sizeof(struct tar_z_blk_s));
+		if (bp!=NULL){
+			if ((bp->inbuf=(u_char *)malloc(TAR_Z_BLKSIZ))==NULL){
+				free(bp);
+				bp=NULL;
+			}
+		}
+		if (bp==NULL){
+			perror("malloc");
+			tar_z_seterr(zp);
+			/* Note: must drain pipe anyway */
+			{
+				u_char buf[0x1000];
+
+				while (READ(zp->pfd,buf,sizeof(buf))>0);
+			}
+			pthread_mutex_lock(&zp->mutex);
+			zp->blknum--;
+			pthread_mutex_unlock(&zp->mutex);
+			break;
+		}
+
+		n=READ(zp->pfd,bp->inbuf,TAR_Z_BLKSIZ);
+		if (n<0){
+			perror("read");
+			tar_z_seterr(zp);
+			n=0;
+		}
+		if (n==0){ /* EOF? */
+			free(bp->inbuf);
+			free(bp);
+			pthread_mutex_lock(&zp->mutex);
+			zp->blknum--;
+			pthread_mutex_unlock(&zp->mutex);
+			break;
+		}
+		bp->insize=(u_int)n;
+		bp->next=NULL;
+		bp->seq=zp->seqnext++;
+
+		if (zp->threadnum==0){
+			/* compress and write by this thread */
+			tar_z_blkrun(zp,bp);
+		}else{
+			/* append to queue */
+			pthread_mutex_lock(&zp->mutex);
+			if (zp->tail!=NULL){
+				zp->tail->next=bp;
+			}else{
+				zp->head=bp;
+			}
+			zp->tail=bp;
+			pthread_cond_broadcast(&zp->cond);
+			pthread_mutex_unlock(&zp->mutex);
+		}
+		if (n<TAR_Z_BLKSIZ){ /* EOF? */
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&zp->mutex);
+	zp->eof=1;
+	pthread_cond_broadcast(&zp->cond);
+	pthread_mutex_unlock(&zp->mutex);
+
+	return NULL;
+}
+
+static void *
+tar_z_compthread(void *arg)
+{
+	struct tar_z_s *zp;
+	struct tar_z_blk_s *bp;
+
+	zp=(struct tar_z_s *)arg;
+
+	pthread_mutex_lock(&zp->mutex);
+	for (;;){
+		while ((zp->head==NULL)&&(!zp->eof)){
+			pthread_cond_wait(&zp->cond,&zp->mutex);
+		}
+		if (zp->head==NULL){ /* done? */
+			break;
+		}
+		/* get block */
+		bp=zp->head;
+		zp->head=bp->next;
+		if (zp->head==NULL){
+			zp->tail=NULL;
+		}
+		pthread_mutex_unlock(&zp->mutex);
+
+		tar_z_blkrun(zp,bp);
+
+		pthread_mutex_lock(&zp->mutex);
+	}
+	pthread_mutex_unlock(&zp->mutex);
+
+	return NULL;
+}
+
+/* copy file into pipe, first n bytes already in buf */
+static int
+tar_z_copy(struct tar_z_s *zp,u_char *buf,u_int n)
+{
+	int r;
+
+	for (;;){
+		if ((n>0)&&(WRITE(zp->pfd,buf,n)!=(int)n)){
+			/* Note: EPIPE if tar code has stopped reading */
+			if (errno!=EPIPE){
+				perror("write");
+				return -1;
+			}
+			return 0;
+		}
+		r=READ(zp->zfd,buf,TAR_Z_IOBUFSIZ);
+		if (r<0){
+			perror("read");
+			return -1;
+		}
+		if (r==0){ /* EOF? */
+			return 0;
+		}
+		n=(u_int)r;
+	}
+}
+
+/* decompress gzip file into pipe */
+static void *
+tar_z_decompthread(void *arg)
+{
+	struct tar_z_s *zp;
+	z_stream zs;
+	u_char *inbuf,*outbuf;
+	u_int n;
+	int r;
+	int member; /* number of complete gzip members */
+	int err;
+
+	zp=(struct tar_z_s *)arg;
+
+	err=0;
+	inbuf=(u_char *)malloc(TAR_Z_IOBUFSIZ);
+	outbuf=(u_char *)malloc(TAR_Z_IOBUFSIZ);
+	bzero(&zs,sizeof(z_stream));
+	if ((inbuf==NULL)||(outbuf==NULL)){
+		perror("malloc");
+		err=1;
+		goto tar_z_decompthread_exit;
+	}
+	if (zp->mode==TAR_Z_AUTO){
+		/* Note: input not seekable, check gzip magic here */
+		if ((r=READ(zp->zfd,inbuf,2))<0){
+			perror("read");
+			err=1;
+			goto tar_z_decompthread_exit;
+		}
+		if ((r<2)||(inbuf[0]!=0x1f)||(inbuf[1]!=0x8b)){
+			/* not gzip: copy */
+			if (tar_z_copy(zp,inbuf,(u_int)r)<0){
+				err=1;
+			}
+			goto tar_z_decompthread_exit;
+		}
+		/* magic is start of first gzip member */
+		zs.next_in=inbuf;
+		zs.avail_in=2;
+	}
+	if (inflateInit2(&zs,15+16)!=Z_OK){ /* 15+16: gzip */
+		fprintf(stderr,"cannot decompress\n");
+		err=1;
+		goto tar_z_decompthread_exit;
+	}
+
+	member=0;
+	for (;;){
+		if (zs.avail_in==0){
+			r=READ(zp->zfd,inbuf,TAR_Z_IOBUFSIZ);
+			if (r<0){
+				perror("read");
+				err=1;
+				break;
+			}
+			if (r==0){ /* EOF? */
+				if ((member==0)||(zs.total_in>0)){ /* incomplete gzip member? */
+					fprintf(stderr,"unexpected end of gzip file\n");
+					err=1;
+				}
+				break;
+			}
+			zs.next_in=inbuf;
+			zs.avail_in=(u_int)r;
+		}
+		zs.next_out=outbuf;
+		zs.avail_out=TAR_Z_IOBUFSIZ;
+		r=inflate(&zs,Z_NO_FLUSH);
+		if ((r!=Z_OK)&&(r!=Z_STREAM_END)){
+			if ((r==Z_DATA_ERROR)&&(member>0)&&(zs.total_out==0)){
+				break; /* XXX ignore trailing garbage after gzip member (as gzip) */
+			}
+			fprintf(stderr,"gzip data error\n");
+			err=1;
+			break;
+		}
+		n=TAR_Z_IOBUFSIZ-zs.avail_out;
+		if ((n>0)&&(WRITE(zp->pfd,outbuf,n)!=(int)n)){
+			/* Note: EPIPE if tar code has stopped reading */
+			if (errno!=EPIPE){
+				perror("write");
+				err=1;
+			}
+			break;
+		}
+		if (r==Z_STREAM_END){
+			/* next gzip member if any */
+			member++;
+			inflateReset(&zs);
+		}
+	}
+	inflateEnd(&zs);
+
+tar_z_decompthread_exit:
+	if (inbuf!=NULL){
+		free(inbuf);
+	}
+	if (outbuf!=NULL){
+		free(outbuf);
+	}
+	/* EOF for tar code */
+	CLOSE(zp->pfd);
+	zp->pfd=-1;
+	if (err){
+		tar_z_seterr(zp);
+	}
+
+	return NULL;
+}
+#endif
+
+/* start compression (into zfd) or decompression (from zfd), zp->fd for tar code */
+/* Note: TAR_Z_AUTO for decompression of input which is not seekable */
+int
+tar_z_start(struct tar_z_s *zp,int zfd,int mode,int level,u_int threadnum)
+{
+#ifdef TAR_GZIP
+	int pfd[2];
+	sigset_t sigs,osigs;
+	u_int i;
+
+	if ((zp==NULL)||(zfd<0)){
+		return -1;
+	}
+	bzero(zp,sizeof(struct tar_z_s));
+	zp->zfd=zfd;
+	zp->mode=mode;
+	zp->level=((level>=1)&&(level<=9))?level:TAR_Z_LEVEL_DEF;
+	if (threadnum>TAR_Z_THREADS_MAX){
+		threadnum=TAR_Z_THREADS_MAX;
+	}
+	zp->blkmax=2*threadnum+1; /* Note: all threads busy and as many blocks waiting */
+
+	if (pipe(pfd)<0){
+		perror("pipe");
+		return -1;
+	}
+	if (mode==TAR_Z_COMPRESS){
+		zp->fd=pfd[1];
+		zp->pfd=pfd[0];
+	}else{
+		zp->fd=pfd[0];
+		zp->pfd=pfd[1];
+	}
+	pthread_mutex_init(&zp->mutex,NULL);
+	pthread_cond_init(&zp->cond,NULL);
+
+	/* Note: helper threads must not get SIGPIPE */
+	sigemptyset(&sigs);
+	sigaddset(&sigs,SIGPIPE);
+	pthread_sigmask(SIG_BLOCK,&sigs,&osigs);
+	if (mode==TAR_Z_COMPRESS){
+		for (i=0;i<threadnum;i++){
+			if (pthread_create(&zp->zthread[i],NULL,tar_z_compthread,(void *)zp)!=0){
+				fprintf(stderr,"cannot create thread\n");
+				break;
+			}
+		}
+		zp->threadnum=i;
+		zp->blkmax=2*zp->threadnum+1;
+		i=pthread_create(&zp->thread,NULL,tar_z_readthread,(void *)zp);
+	}else{
+		i=pthread_create(&zp->thread,NULL,tar_z_decompthread,(void *)zp);
+	}
+	pthread_sigmask(SIG_SETMASK,&osigs,NULL);
+	if (i!=0){
+		fprintf(stderr,"cannot create thread\n");
+		pthread_mutex_lock(&zp->mutex);
+		zp->eof=1;
+		pthread_cond_broadcast(&zp->cond);
+		pthread_mutex_unlock(&zp->mutex);
+		for (i=0;i<zp->threadnum;i++){
+			pthread_join(zp->zthread[i],NULL);
+		}
+		pthread_cond_destroy(&zp->cond);
+		pthread_mutex_destroy(&zp->mutex);
+		CLOSE(pfd[0]);
+		CLOSE(pfd[1]);
+		return -1;
+	}
+
+	return 0;
+#else
+	(void)zp;
+	(void)zfd;
+	(void)mode;
+	(void)level;
+	(void)threadnum;
+	fprintf(stderr,"gzip not supported\n");
+	return -1;
+#endif
+}
+
+/* finish compression or decompression, closes zp->fd but not zfd */
+int
+tar_z_end(struct tar_z_s *zp)
+{
+#ifdef TAR_GZIP
+	u_int i;
+	int err;
+
+	if (zp==NULL){
+		return -1;
+	}
+
+	/* Note: EOF for reader thread or EPIPE for decompressor thread */
+	CLOSE(zp->fd);
+	zp->fd=-1;
+	pthread_join(zp->thread,NULL);
+	pthread_mutex_lock(&zp->mutex);
+	zp->eof=1;
+	pthread_cond_broadcast(&zp->cond);
+	pthread_mutex_unlock(&zp->mutex);
+	for (i=0;i<zp->threadnum;i++){
+		pthread_join(zp->zthread[i],NULL);
+	}
+	if ((zp->mode==TAR_Z_COMPRESS)&&(zp->pfd>=0)){
+		CLOSE(zp->pfd);
+		zp->pfd=-1;
+	}
+	err=zp->err;
+	pthread_cond_destroy(&zp->cond);
+	pthread_mutex_destroy(&zp->mutex);
+
+	return err?-1:0;
+#else
+	(void)zp;
+	return -1;
+#endif
+}
+
 
 
 /* EOF */
@@ -23,6 +23,12 @@
 
 
 #include "akaiutil_io.h"
+#include "akaiutil_hash.h"
+
+#if !defined(WIN32)&&!defined(PAR_THREADS_DISABLE)&&!defined(TAR_GZIP_DISABLE)
+#define TAR_GZIP
+#include <pthread.h>
+#endif
 
 
 
@@ -57,36 +63,264 @@ struct tar_head_s{
 #define TAR_TYPE_REG  '0'  /* regular file */
 #define TAR_TYPE_REG0 '\0' /* regular file */
 #define TAR_TYPE_DIR  '5'  /* directory */
+#define TAR_TYPE_DEDUPREF 'R' /* XXX vendor type: reference to sample data of earlier member (see below) */
 
 #define TAR_TAILZERO_BLOCKS	6 /* number or zero blocks at file end */
 
 
 
+/* AKAI metadata of member */
+/* Note: PAX extended header (type TAR_TYPE_PAX) before member, records "<len> AKAI.<key>=<value>\n", */
+/*       values decimal, volume parameters and tags in hex, */
+/*       legacy encoding (still read, written if TAR_PAX_DISABLE): devmajor: volume type or osver, */
+/*       devminor: load number, linkname: '\0','P',volume parameters or '\0','T',file tags */
+#define TAR_TYPE_PAX		'x' /* PAX extended header for next member */
+#define TAR_PAX_NAMEPREFIX	"PaxHeaders/"
+#define TAR_PAX_VTYPE		"AKAI.voltype"
+#define TAR_PAX_LNUM		"AKAI.loadnum"
+#define TAR_PAX_VOLPARAM	"AKAI.volparam"
+#define TAR_PAX_OSVER		"AKAI.osver"
+#define TAR_PAX_TAGS		"AKAI.tags"
+#define TAR_PAX_BUFSIZ		TAR_BLOCKSIZE /* for AKAI records */
+#define TAR_PAX_SIZEMAX		0x100000 /* max. size of PAX extended header data to import */
+struct tar_meta_s{
+	u_int flags;
+#define TAR_META_VTYPE		0x01
+#define TAR_META_LNUM		0x02
+#define TAR_META_VOLPARAM	0x04
+#define TAR_META_OSVER		0x08
+#define TAR_META_TAGS		0x10
+	u_int vtype; /* volume type */
+	u_int lnum; /* load number of volume */
+	u_int osver; /* osver of file */
+	u_char tag[AKAI_FILE_TAGNUM]; /* file tags */
+	struct akai_volparam_s param; /* volume parameters */
+};
+
+
+
+/* tar output stream */
+/* Note: collects headers, file data and padding for large writes, */
+/*       writes end at multiples of bufsiz in output */
+#define TAR_OUT_BUFSIZ		(1024*1024) /* in bytes, multiple of TAR_BLOCKSIZE */
+struct tar_inc_s;
+struct tar_dedup_s;
+struct tar_out_s{
+	int fd;
+	u_char *buf;
+	u_int bufsiz;
+	u_int count; /* number of bytes in buf */
+	OFF_T off; /* position of buf in output */
+	int idxfd; /* index file, -1 if none */
+	struct tar_inc_s *incp; /* incremental export, NULL if none */
+	struct tar_dedup_s *dedupp; /* deduplicating export, NULL if none */
+};
+
+
+
+/* incremental export */
+/* Note: manifest is a text file, one line per member in tar-file order: */
+/*       <hash> <metahash> <exthash> <size> <name> */
+/*       hash: XXH64 of data, metahash: XXH64 of devmajor, devminor and linkname in tar header, */
+/*       exthash: XXH64 of FAT extents (if "quick": same extents, size and metahash => data not read) */
+/* Note: deletion list as regular file in top level of tar-file, one name per line */
+#define TAR_INC_DELFILENAME	"DELETED.DAT"
+#define TAR_INC_BUFSIZ		0x40000 /* buffer size for hash */
+struct tar_inc_ent_s{
+	U_INT64 hash;
+	U_INT64 mhash;
+	U_INT64 ehash;
+	u_int size;
+	int seen; /* found in current export */
+	char name[TAR_NAMELEN+1]; /* +1 for '\0' */
+};
+struct tar_inc_s{
+	char *mname; /* manifest file name */
+	int quick;
+	struct tar_inc_ent_s *oldp; /* previous manifest, sorted by name */
+	u_int oldnum;
+	struct tar_inc_ent_s *newp; /* new manifest */
+	u_int newnum;
+	u_int newmax;
+	u_int chgnum; /* number of changed or new members */
+	u_int samenum; /* number of unchanged members */
+	u_char *buf;
+	char *delbuf; /* deletion list */
+	u_int delsize;
+};
+
+
+
+/* deduplicating export */
+/* Note: sample data (file without sample header) keyed by SHA-256, */
+/*       first file with new sample data as regular member, */
+/*       further files as member of type TAR_TYPE_DEDUPREF with struct tar_dedupref_s and sample header as data, */
+/*       other header fields (osver, tags) as for regular member */
+/* Note: import copies sample data from file of referenced member (imported before), */
+/*       no seek in tar-file required, tar xsel with index adds referenced member to selection */
+#define TAR_DEDUP_HASHNUM	4096 /* number of hash buckets, power of 2 */
+struct tar_dedupref_s{
+	char name[TAR_NAMELEN]; /* name of referenced member, '\0'-terminated */
+	char psize[12]; /* size of sample data, octal, trailing '\0' */
+	u_char md[HASH_SHA256_SIZE]; /* SHA-256 of sample data */
+}; /* followed by sample header */
+struct tar_dedup_ent_s{
+	u_char md[HASH_SHA256_SIZE];
+	u_int psize; /* size of sample data in bytes */
+	u_int next; /* next entry in hash bucket, TAR_DEDUP_NONE if none */
+	char name[TAR_NAMELEN]; /* name of member */
+};
+#define TAR_DEDUP_NONE		0xffffffff
+struct tar_dedup_s{
+	struct tar_dedup_ent_s *entp; /* sample data stored so far */
+	u_int entnum;
+	u_int entmax;
+	u_int bucket[TAR_DEDUP_HASHNUM]; /* first entry, TAR_DEDUP_NONE if none */
+	u_char *buf; /* file data */
+	u_int bufsiz;
+	u_int filenum; /* number of files */
+	u_int refnum; /* number of references */
+	U_INT64 insize; /* total size of files in bytes */
+	U_INT64 outsize; /* total size of members in bytes */
+	/* current member */
+	int refflag; /* is reference */
+	struct tar_dedupref_s ref;
+	u_int hsize; /* size of sample header */
+};
+
+
+
+/* sidecar index of tar-file */
+/* Note: text file "<tar-file>.idx", first line "# tar <size> <mtime>" of tar-file when index was */
+/*       written (index ignored if tar-file differs), then one line per member in tar-file order: */
+/*       <offset> <size> <type> <devmajor> <devminor> <tags> <name> */
+/*       offset of header in (uncompressed) tar-file, devmajor: osver of file or volume type, */
+/*       devminor: load number of volume, tags: hex or "-" */
+#define TAR_IDX_FNAMEEND	".idx"
+#define TAR_IDX_STAMPFMT	"# tar %20llu %20llu\n" /* fixed width: rewritten in place when tar-file complete */
+#define TAR_IDX_LINELEN		(20+1+10+1+1+1+10+1+10+1+2*AKAI_FILE_TAGNUM+1+TAR_NAMELEN+1+1)
+struct tar_idx_s{
+	OFF_T off; /* offset of header */
+	char type;
+	char name[TAR_NAMELEN+1]; /* +1 for '\0' */
+};
+
+
+
+/* import planner */
+/* Note: consecutive regular files of the same volume are read ahead into memory, */
+/*       FAT chains are allocated in one pass and the volume directory is written once */
+#define TAR_PLAN_NUM		256 /* max. number of files per batch */
+#define TAR_PLAN_BUFSIZ		(4*1024*1024) /* max. file data per batch in bytes */
+struct tar_plan_s{
+	u_int num; /* number of files */
+	u_int count; /* bytes in buf */
+	u_char *buf; /* file data */
+	struct tar_plan_file_s{
+		char name[TAR_NAMELEN+1]; /* file name in volume, +1 for '\0' */
+		u_int off; /* offset in buf */
+		u_int size; /* in bytes */
+		u_int osver;
+		int tagflag; /* tags valid */
+		u_char tag[AKAI_FILE_TAGNUM];
+	} file[TAR_PLAN_NUM];
+	u_int bsize[TAR_PLAN_NUM]; /* size of FAT chains in blocks */
+	u_int bstart[TAR_PLAN_NUM]; /* start of FAT chains */
+};
+
+
+
+/* gzip compression of tar-file */
+/* Note: helper threads connected to tar code via pipe, */
+/*       compressed in blocks as independent gzip members (concatenation is valid gzip) */
+#define TAR_Z_BLKSIZ		(1024*1024) /* uncompressed block size in bytes */
+#define TAR_Z_IOBUFSIZ		0x40000 /* buffer size for decompression */
+#define TAR_Z_THREADS_MAX	64 /* max. number of compressor threads */
+#define TAR_Z_LEVEL_DEF		6 /* default gzip level */
+#define TAR_Z_COMPRESS		1
+#define TAR_Z_DECOMPRESS	2
+#define TAR_Z_AUTO		3 /* decompress if gzip, else copy (input not seekable) */
+struct tar_z_blk_s;
+struct tar_z_s{
+	int fd; /* pipe end for tar code */
+	int zfd; /* gzip file */
+	int mode;
+	int level;
+#ifdef TAR_GZIP
+	int pfd; /* pipe end for helper threads */
+	u_int threadnum; /* number of compressor threads, 0: by reader thread */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; /* any state change */
+	pthread_t thread; /* reader thread (compression) or decompressor thread */
+	pthread_t zthread[TAR_Z_THREADS_MAX];
+	struct tar_z_blk_s *head,*tail; /* blocks to compress */
+	u_int blknum; /* number of blocks in flight */
+	u_int blkmax; /* max. number of blocks in flight */
+	u_int seqnext; /* next sequence number */
+	u_int seqwrite; /* next sequence number to write in order */
+	int eof;
+	int err;
+#endif
+};
+
+
+
 /* Declarations */
 
 extern u_int tar_checksum(u_char *hp);
 
+extern int tar_out_init(struct tar_out_s *op,int fd);
+extern int tar_out_flush(struct tar_out_s *op);
+extern int tar_out_write(struct tar_out_s *op,u_char *data,u_int size);
+extern u_char *tar_out_reserve(struct tar_out_s *op,u_int size);
+extern int tar_out_commit(struct tar_out_s *op,u_int size);
+extern int tar_out_end(struct tar_out_s *op);
+
 #define TAR_EXPORT_PART				0x0001
 #define TAR_EXPORT_VOL				0x0002
 #define TAR_EXPORT_FILE				0x0004
 #define TAR_EXPORT_DDFILE			0x0008
 #define TAR_EXPORT_TAGSFILE			0x0010
 #define TAR_EXPORT_VOLPARAMFILE		0x0020
-#define TAR_EXPORT_ANYFILE			(TAR_EXPORT_FILE|TAR_EXPORT_DDFILE|TAR_EXPORT_TAGSFILE|TAR_EXPORT_VOLPARAMFILE)
+#define TAR_EXPORT_DELFILE			0x0040
+#define TAR_EXPORT_ANYFILE			(TAR_EXPORT_FILE|TAR_EXPORT_DDFILE|TAR_EXPORT_TAGSFILE|TAR_EXPORT_VOLPARAMFILE|TAR_EXPORT_DELFILE)
 #define TAR_EXPORT_WAV				0x0100
-extern int tar_export(int fd,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,u_int flags,int verbose,u_char *filtertagp);
-extern int tar_export_vol(int fd,struct vol_s *vp,u_int flags,int verbose,u_char *filtertagp);
-extern int tar_export_part(int fd,struct part_s *pp,u_int flags,int verbose,u_char *filtertagp);
-extern int tar_export_disk(int fd,struct disk_s *dp,u_int flags,int verbose,u_char *filtertagp);
-extern int tar_export_curdir(int fd,int verbose,u_int flags);
-extern int tar_export_tailzero(int fd);
+extern int tar_export(struct tar_out_s *op,struct part_s *pp,struct vol_s *vp,struct file_s *fp,u_int ti,u_int flags,int verbose,u_char *filtertagp);
+extern int tar_export_vol(struct tar_out_s *op,struct vol_s *vp,u_int flags,int verbose,u_char *filtertagp);
+extern int tar_export_part(struct tar_out_s *op,struct part_s *pp,u_int flags,int verbose,u_char *filtertagp);
+extern int tar_export_disk(struct tar_out_s *op,struct disk_s *dp,u_int flags,int verbose,u_char *filtertagp);
+extern int tar_export_curdir(struct tar_out_s *op,int verbose,u_int flags);
+extern int tar_export_tailzero(struct tar_out_s *op);
 
 #define TAR_IMPORT_WAV				0x0100
+#define TAR_IMPORT_INC				0x0200
 #define TAR_IMPORT_WAVS9			0x1000
 #define TAR_IMPORT_WAVS9C			0x2000
 #define TAR_IMPORT_WAVS1			0x4000
 #define TAR_IMPORT_WAVS3			0x8000
 extern int tar_import_curdir(int fd,u_int vtype0,int verbose,u_int flags);
+extern int tar_import_sel(int fd,char *tarname,char *sel,u_int vtype0,int verbose,u_int flags);
+
+extern int tar_idxflag;
+extern int tar_idx_open(char *tarname);
+extern int tar_idx_close(int idxfd,int tarfd);
+extern int tar_idx_load(int fd,char *tarname,struct tar_idx_s **idxpp,u_int *nump);
+extern int tar_list(int fd,char *tarname);
+
+extern int tar_inc_start(struct tar_inc_s *ip,char *mname,int quick);
+extern int tar_inc_end(struct tar_inc_s *ip,struct tar_out_s *op,int verbose);
+extern int tar_inc_save(struct tar_inc_s *ip);
+extern void tar_inc_free(struct tar_inc_s *ip);
+
+extern int tar_dedup_start(struct tar_dedup_s *dp);
+extern void tar_dedup_end(struct tar_dedup_s *dp);
+extern void tar_dedup_print(struct tar_dedup_s *dp);
+
+extern int tar_zlevel;
+extern int tar_z_name(char *name);
+extern int tar_z_detect(int fd);
+extern int tar_z_start(struct tar_z_s *zp,int zfd,int mode,int level,u_int threadnum);
+extern int tar_z_end(struct tar_z_s *zp);
 
 
 
@@ -23,12 +23,23 @@
 #include "akaiutil_io.h"
 #include "akaiutil_wav.h"
 
+#ifndef WAV_SIMD_DISABLE
+#if defined(__SSE2__)||defined(_M_X64)||(defined(_M_IX86_FP)&&(_M_IX86_FP>=2))
+#define WAV_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)||defined(__ARM_NEON__)
+#define WAV_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
 
 
-int
-wav_write_head(int outdes,
-			   u_int datasize,u_int chnr,u_int samprate,u_int bitnr,
-			   u_int extrasize)
+
+/* set WAV header in buf, buf must have space for WAV_HEAD_SIZE bytes */
+void
+wav_set_head(u_char *buf,
+			 u_int datasize,u_int chnr,u_int samprate,u_int bitnr,
+			 u_int extrasize)
 {
 	struct wav_riffhead_s wavriffhead;
 	struct wav_chunkhead_s wavchunkhead;
@@ -49,11 +60,9 @@ wav_write_head(int outdes,
 	}
 	bcopy(WAV_RIFFHEAD_WAVESTR,wavriffhead.wavestr,4);
 
-	/* write WAVE RIFF header */
-	if (WRITE(outdes,&wavriffhead,sizeof(struct wav_riffhead_s))!=sizeof(struct wav_riffhead_s)){
-		perror("write WAVE RIFF header");
-		return -1;
-	}
+	/* WAVE RIFF header */
+	bcopy(&wavriffhead,buf,sizeof(struct wav_riffhead_s));
+	buf+=sizeof(struct wav_riffhead_s);
 
 	/* create FMT chunk header */
 	bcopy(WAV_CHUNKHEAD_FMTSTR,wavchunkhead.typestr,4);
@@ -66,11 +75,9 @@ wav_write_head(int outdes,
 		wavchunkhead.csize[2]=0xff&(csize>>16);
 		wavchunkhead.csize[3]=0xff&(csize>>24);
 	}
-	/* write chunk header */
-	if (WRITE(outdes,&wavchunkhead,sizeof(struct wav_chunkhead_s))!=sizeof(struct wav_chunkhead_s)){
-		perror("write WAVE FMT header");
-		return -1;
-	}
+	/* chunk header */
+	bcopy(&wavchunkhead,buf,sizeof(struct wav_chunkhead_s));
+	buf+=sizeof(struct wav_chunkhead_s);
 
 	/* set FMT header */
 	wavfmthead.ftag[0]=0xff&WAV_HEAD_FTAG;
@@ -91,11 +98,9 @@ wav_write_head(int outdes,
 	wavfmthead.bitnr[0]=0xff&bitnr;
 	wavfmthead.bitnr[1]=0xff&(bitnr>>8);
 
-	/* write WAVE FMT header */
-	if (WRITE(outdes,&wavfmthead,sizeof(struct wav_fmthead_s))!=sizeof(struct wav_fmthead_s)){
-		perror("write WAVE FMT header");
-		return -1;
-	}
+	/* WAVE FMT header */
+	bcopy(&wavfmthead,buf,sizeof(struct wav_fmthead_s));
+	buf+=sizeof(struct wav_fmthead_s);
 
 	/* create WAVE DATA chunk header */
 	bcopy(WAV_CHUNKHEAD_DATASTR,wavchunkhead.typestr,4);
@@ -104,12 +109,136 @@ wav_write_head(int outdes,
 	wavchunkhead.csize[2]=0xff&(datasize>>16);
 	wavchunkhead.csize[3]=0xff&(datasize>>24);
 
-	/* write chunk header */
-	if (WRITE(outdes,&wavchunkhead,sizeof(struct wav_chunkhead_s))!=sizeof(struct wav_chunkhead_s)){
-		perror("write WAVE DATA header");
+	/* chunk header */
+	bcopy(&wavchunkhead,buf,sizeof(struct wav_chunkhead_s));
+}
+
+int
+wav_write_head(int outdes,
+			   u_int datasize,u_int chnr,u_int samprate,u_int bitnr,
+			   u_int extrasize)
+{
+	u_char buf[WAV_HEAD_SIZE];
+
+	wav_set_head(buf,datasize,chnr,samprate,bitnr,extrasize);
+
+	/* write WAV header */
+	if (WRITE(outdes,buf,WAV_HEAD_SIZE)!=(int)WAV_HEAD_SIZE){
+		perror("write WAV header");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+/* buffered RIFF chunk parser */
+/* Note: reads WAV_PARSE_BUFSIZ bytes in one call, seeks only beyond buffer */
+
+#define WAV_PARSE_BUFSIZ	0x2000 /* bytes */
+
+struct wav_parse_s{
+	int fd;
+	u_char buf[WAV_PARSE_BUFSIZ];
+	u_int bufsize; /* number of valid bytes in buf */
+	u_int bufpos; /* current position in buf */
+	OFF_T skip; /* pending forward seek in file beyond buf */
+};
+
+static int
+wav_parse_init(struct wav_parse_s *wp,int fd,u_int size)
+{
+	int n;
+
+	wp->fd=fd;
+	wp->bufsize=0;
+	wp->bufpos=0;
+	wp->skip=0;
+
+	if (size>WAV_PARSE_BUFSIZ){
+		size=WAV_PARSE_BUFSIZ;
+	}
+	if (size==0){
+		return 0;
+	}
+	if (LSEEK(fd,0,SEEK_CUR)<0){
+		/* not seekable (e.g. pipe): no read-ahead, cannot seek back */
+		return 0;
+	}
+	if ((n=READ(fd,wp->buf,size))<0){
+		return -1;
+	}
+	wp->bufsize=(u_int)n;
+	return 0;
+}
+
+/* read size bytes, returns number of bytes read or -1 on error */
+static int
+wav_parse_read(struct wav_parse_s *wp,u_char *dst,u_int size)
+{
+	u_int n;
+	int r;
+
+	/* from buffer */
+	n=0;
+	if ((wp->skip==0)&&(wp->bufpos<wp->bufsize)){
+		n=wp->bufsize-wp->bufpos;
+		if (n>size){
+			n=size;
+		}
+		bcopy(wp->buf+wp->bufpos,dst,n);
+		wp->bufpos+=n;
+	}
+	if (n==size){
+		return (int)n;
+	}
+	/* beyond buffer */
+	if (wp->skip>0){
+		if (io_skip(wp->fd,wp->skip)<0){
+			return -1;
+		}
+		wp->skip=0;
+	}
+	if ((r=READ(wp->fd,dst+n,size-n))<0){
 		return -1;
 	}
+	return (int)n+r;
+}
+
+/* skip size bytes */
+static void
+wav_parse_skip(struct wav_parse_s *wp,u_int size)
+{
+	u_int n;
+
+	if ((wp->skip==0)&&(wp->bufpos<wp->bufsize)){
+		n=wp->bufsize-wp->bufpos;
+		if (n>size){
+			n=size;
+		}
+		wp->bufpos+=n;
+		size-=n;
+	}
+	/* Note: seek deferred until next read beyond buffer */
+	wp->skip+=(OFF_T)size;
+}
+
+/* set file position to current parser position */
+static int
+wav_parse_end(struct wav_parse_s *wp)
+{
+	OFF_T off;
 
+	off=wp->skip-(OFF_T)(wp->bufsize-wp->bufpos);
+	wp->bufpos=wp->bufsize;
+	wp->skip=0;
+	if (off==0){
+		return 0;
+	}
+	if (io_skip(wp->fd,off)<0){
+		return -1;
+	}
 	return 0;
 }
 
@@ -118,14 +247,16 @@ wav_write_head(int outdes,
 int
 wav_read_head(int indes,
 			  u_int *bcountp,
-			  u_int *datasizep,u_int *chnrp,u_int *sampratep,u_int *bitnrp,
+			  u_int *datasizep,u_int *chnrp,u_int *sampratep,u_int *bitnrp,u_int *ftagp,
 			  u_int *extrasizep,
 			  char **errstrp,
 			  int *ltype, u_int *lstart, u_int *lend)
 {
+	struct wav_parse_s wp;
 	struct wav_riffhead_s wavriffhead;
 	struct wav_chunkhead_s wavchunkhead;
 	struct wav_fmthead_s wavfmthead;
+	struct wav_fmtexthead_s wavfmtexthead;
 	struct wav_smplhead_s wavsmplhead;
 	struct wav_loophead_s wavloophead;
 	u_int i;
@@ -135,11 +266,20 @@ wav_read_head(int indes,
 	u_int chnr;
 	u_int samprate;
 	u_int bitnr;
+	u_int ftag;
 
 	bcount=0; /* no bytes read yet */
 
-	/* read WAVE RIFF header */
-	if (READ(indes,(char *)&wavriffhead,sizeof(struct wav_riffhead_s))!=sizeof(struct wav_riffhead_s)){
+	/* read beginning of WAV file in one call */
+	if (wav_parse_init(&wp,indes,WAV_PARSE_BUFSIZ)<0){
+		if (errstrp!=NULL){
+			*errstrp="read WAVE RIFF header";
+		}
+		return -1;
+	}
+
+	/* WAVE RIFF header */
+	if (wav_parse_read(&wp,(u_char *)&wavriffhead,sizeof(struct wav_riffhead_s))!=sizeof(struct wav_riffhead_s)){
 		if (errstrp!=NULL){
 			*errstrp="read WAVE RIFF header";
 		}
@@ -182,14 +322,14 @@ wav_read_head(int indes,
 
 	/* search for fmt chunk */
 	for (;;){
-		/* read next chunk */
+		/* next chunk */
 		if (remain<sizeof(struct wav_chunkhead_s)){
 			if (errstrp!=NULL){
 				*errstrp="invalid file size";
 			}
 			return -1;
 		}
-		if (READ(indes,(char *)&wavchunkhead,sizeof(struct wav_chunkhead_s))!=sizeof(struct wav_chunkhead_s)){
+		if (wav_parse_read(&wp,(u_char *)&wavchunkhead,sizeof(struct wav_chunkhead_s))!=sizeof(struct wav_chunkhead_s)){
 			if (errstrp!=NULL){
 				*errstrp="read WAVE FMT header";
 			}
@@ -220,24 +360,19 @@ wav_read_head(int indes,
 		}
 
 		/* skip rest of chunk */
-		if (LSEEK(indes,(OFF_T)csize,SEEK_CUR)<0){
-			if (errstrp!=NULL){
-				*errstrp="lseek WAVE FMT header";
-			}
-			return -1;
-		}
+		wav_parse_skip(&wp,csize);
 		bcount+=csize;
 		remain-=csize;
 	}
-	if (csize!=sizeof(struct wav_fmthead_s)){
+	if (csize<sizeof(struct wav_fmthead_s)){
 		if (errstrp!=NULL){
 			*errstrp="invalid FMT csize";
 		}
 		return -1;
 	}
 
-	/* read rest of fmt chunk */
-	if (READ(indes,(char *)&wavfmthead,sizeof(struct wav_fmthead_s))!=sizeof(struct wav_fmthead_s)){
+	/* rest of fmt chunk */
+	if (wav_parse_read(&wp,(u_char *)&wavfmthead,sizeof(struct wav_fmthead_s))!=sizeof(struct wav_fmthead_s)){
 		if (errstrp!=NULL){
 			*errstrp="read WAVE FMT header";
 		}
@@ -245,11 +380,34 @@ wav_read_head(int indes,
 	}
 	bcount+=sizeof(struct wav_fmthead_s);
 	remain-=sizeof(struct wav_fmthead_s);
+	csize-=sizeof(struct wav_fmthead_s);
+
+	/* get ftag */
+	ftag=wavfmthead.ftag[0]
+		+(wavfmthead.ftag[1]<<8);
+	if ((ftag==WAV_HEAD_FTAG_EXT)&&(csize>=sizeof(struct wav_fmtexthead_s))){
+		/* WAVE_FORMAT_EXTENSIBLE */
+		if (wav_parse_read(&wp,(u_char *)&wavfmtexthead,sizeof(struct wav_fmtexthead_s))!=sizeof(struct wav_fmtexthead_s)){
+			if (errstrp!=NULL){
+				*errstrp="read WAVE FMT header";
+			}
+			return -1;
+		}
+		bcount+=sizeof(struct wav_fmtexthead_s);
+		remain-=sizeof(struct wav_fmtexthead_s);
+		csize-=sizeof(struct wav_fmtexthead_s);
+		/* Note: samples are left-justified in container of bitnr Bits, ignore vbitnr */
+		ftag=wavfmtexthead.subformat[0]
+			+(wavfmtexthead.subformat[1]<<8);
+	}
+	/* skip rest of fmt chunk */
+	wav_parse_skip(&wp,csize);
+	bcount+=csize;
+	remain-=csize;
 
 	/* check ftag */
-	/* XXX allow only particular format */
-	if ((wavfmthead.ftag[0]!=(0xff&WAV_HEAD_FTAG))
-		||(wavfmthead.ftag[1]!=(0xff&(WAV_HEAD_FTAG>>8)))){
+	if ((ftag!=WAV_HEAD_FTAG)
+		&&((ftagp==NULL)||(ftag!=WAV_HEAD_FTAG_FLOAT))){
 		if (errstrp!=NULL){
 			*errstrp="invalid ftag";
 		}
@@ -285,69 +443,17 @@ wav_read_head(int indes,
 	}
 
 	/* XXX check balign: must be (bitnr/8)*chnr */
-	READ(indes,(char *)&wavchunkhead,sizeof(struct wav_chunkhead_s));	
-	if(wavchunkhead.typestr[0] == 's' && 
-		wavchunkhead.typestr[1] == 'm' &&
-		wavchunkhead.typestr[2] == 'p' &&
-		wavchunkhead.typestr[3] == 'l') {
-		int nloops;
-		
-		READ(indes,(char *)&wavsmplhead,sizeof(struct wav_smplhead_s));
-		
-		nloops = wavsmplhead.sloops[0]
-			+(wavsmplhead.sloops[1]<<8)
-			+(wavsmplhead.sloops[2]<<16)
-			+(wavsmplhead.sloops[3]<<24);
-		printf("nloops = %d\n", nloops);
-		
-		if(nloops > 0) {
-			int type, start, end;
-
-			READ(indes,(char *)&wavloophead,sizeof(struct wav_loophead_s));
-			
-			type = wavloophead.type[0]
-				+(wavloophead.type[1]<<8)
-				+(wavloophead.type[2]<<16)
-				+(wavloophead.type[3]<<24);
-			start = wavloophead.start[0]
-				+(wavloophead.start[1]<<8)
-				+(wavloophead.start[2]<<16)
-				+(wavloophead.start[3]<<24);
-			end = wavloophead.end[0]
-				+(wavloophead.end[1]<<8)
-				+(wavloophead.end[2]<<16)
-				+(wavloophead.end[3]<<24);
-
-			if(ltype) {
-				*ltype = type;
-			}
-			if(lstart) {
-				*lstart = start;
-			}
-			if(lend) {
-				*lend = end;
-			}
-
-			printf("type = %d, start = %d, end = %d\n", type, start, end);
-			
-			LSEEK(indes,-((long)sizeof(struct wav_loophead_s)),SEEK_CUR);
-		}
-
-		LSEEK(indes,-((long)sizeof(struct wav_smplhead_s)),SEEK_CUR);
-	}
-		
-	LSEEK(indes,-((long)sizeof(struct wav_chunkhead_s)),SEEK_CUR);
-
-	/* search for data chunk */
+
+	/* search for data chunk, parse smpl chunk on the way */
 	for (;;){
-		/* read next chunk */
+		/* next chunk */
 		if (remain<sizeof(struct wav_chunkhead_s)){
 			if (errstrp!=NULL){
 				*errstrp="invalid file size (DATA)";
 			}
 			return -1;
 		}
-		if (READ(indes,(char *)&wavchunkhead,sizeof(struct wav_chunkhead_s))!=sizeof(struct wav_chunkhead_s)){
+		if (wav_parse_read(&wp,(u_char *)&wavchunkhead,sizeof(struct wav_chunkhead_s))!=sizeof(struct wav_chunkhead_s)){
 			if (errstrp!=NULL){
 				*errstrp="read WAVE DATA header";
 			}
@@ -374,16 +480,78 @@ wav_read_head(int indes,
 			}
 		}
 		if (i==4){
-			break; /* found fmt */
+			break; /* found data */
 		}
 
-		/* skip rest of chunk */
-		if (LSEEK(indes,(OFF_T)csize,SEEK_CUR)<0){
-			if (errstrp!=NULL){
-				*errstrp="lseek WAVE DATA header";
+		for (i=0;i<4;i++){
+			if (WAV_CHUNKHEAD_SMPLSTR[i]!=wavchunkhead.typestr[i]){
+				break; /* not smpl chunk */
 			}
-			return -1;
 		}
+		if ((i==4)&&(csize>=sizeof(struct wav_smplhead_s))){
+			u_int ssize;
+			int nloops;
+
+			/* smpl chunk */
+			ssize=0;
+			if (wav_parse_read(&wp,(u_char *)&wavsmplhead,sizeof(struct wav_smplhead_s))!=sizeof(struct wav_smplhead_s)){
+				if (errstrp!=NULL){
+					*errstrp="read WAVE SMPL header";
+				}
+				return -1;
+			}
+			ssize+=sizeof(struct wav_smplhead_s);
+
+			nloops = wavsmplhead.sloops[0]
+				+(wavsmplhead.sloops[1]<<8)
+				+(wavsmplhead.sloops[2]<<16)
+				+(wavsmplhead.sloops[3]<<24);
+
+			if((nloops > 0) && (csize >= ssize+sizeof(struct wav_loophead_s))) {
+				int type, start, end;
+
+				/* first loop only */
+				if (wav_parse_read(&wp,(u_char *)&wavloophead,sizeof(struct wav_loophead_s))!=sizeof(struct wav_loophead_s)){
+					if (errstrp!=NULL){
+						*errstrp="read WAVE SMPL header";
+					}
+					return -1;
+				}
+				ssize+=sizeof(struct wav_loophead_s);
+
+				type = wavloophead.type[0]
+					+(wavloophead.type[1]<<8)
+					+(wavloophead.type[2]<<16)
+					+(wavloophead.type[3]<<24);
+				start = wavloophead.start[0]
+					+(wavloophead.start[1]<<8)
+					+(wavloophead.start[2]<<16)
+					+(wavloophead.start[3]<<24);
+				end = wavloophead.end[0]
+					+(wavloophead.end[1]<<8)
+					+(wavloophead.end[2]<<16)
+					+(wavloophead.end[3]<<24);
+
+				if(ltype) {
+					*ltype = type;
+				}
+				if(lstart) {
+					*lstart = start;
+				}
+				if(lend) {
+					*lend = end;
+				}
+			}
+
+			/* skip rest of chunk */
+			wav_parse_skip(&wp,csize-ssize);
+			bcount+=csize;
+			remain-=csize;
+			continue;
+		}
+
+		/* skip rest of chunk */
+		wav_parse_skip(&wp,csize);
 		bcount+=csize;
 		remain-=csize;
 	}
@@ -394,6 +562,14 @@ wav_read_head(int indes,
 		return -1;
 	}
 
+	/* set file position to beginning of samples */
+	if (wav_parse_end(&wp)<0){
+		if (errstrp!=NULL){
+			*errstrp="lseek WAVE DATA";
+		}
+		return -1;
+	}
+
 	if (bcountp!=NULL){
 		*bcountp=bcount;
 	}
@@ -409,6 +585,9 @@ wav_read_head(int indes,
 	if (bitnrp!=NULL){
 		*bitnrp=bitnr;
 	}
+	if (ftagp!=NULL){
+		*ftagp=ftag;
+	}
 	if (extrasizep!=NULL){
 		*extrasizep=remain-csize;
 	}
@@ -422,26 +601,37 @@ wav_read_head(int indes,
 int
 wav_find_akaihead(int indes,u_int *bcountp,u_int *csizep,u_int remain,u_int searchtype)
 {
+	struct wav_parse_s wp;
 	struct wav_chunkhead_s wavchunkhead;
 	u_int bcount;
 	u_int csize;
 	u_int type;
 	u_int i;
+	int n;
 
 	bcount=0; /* no bytes read yet */
 	csize=0; /* no chunk yet */
 	type=WAV_AKAIHEADTYPE_NONE; /* no AKAI header chunk found yet */
 
+	/* read rest of WAV file (up to buffer size) in one call */
+	if (wav_parse_init(&wp,indes,remain)<0){
+		perror("cannot read WAV chunk");
+		return -1;
+	}
+
 	/* search for AKAI header chunk */
 	for (;;){
-		/* read next chunk */
+		/* next chunk */
 		if (remain<sizeof(struct wav_chunkhead_s)){
 			break;
 		}
-		if (READ(indes,(char *)&wavchunkhead,sizeof(struct wav_chunkhead_s))<0){
+		if ((n=wav_parse_read(&wp,(u_char *)&wavchunkhead,sizeof(struct wav_chunkhead_s)))<0){
 			perror("cannot read WAV chunk");
 			return -1;
 		}
+		if (n!=sizeof(struct wav_chunkhead_s)){
+			break; /* truncated */
+		}
 		bcount+=sizeof(struct wav_chunkhead_s);
 		remain-=sizeof(struct wav_chunkhead_s);
 
@@ -453,7 +643,6 @@ wav_find_akaihead(int indes,u_int *bcountp,u_int *csizep,u_int remain,u_int sear
 		if (remain<csize){
 			break;
 		}
-
 		if ((searchtype==WAV_AKAIHEADTYPE_NONE)||(searchtype==WAV_AKAIHEADTYPE_SAMPLE900)){
 			/* check if S900 sample header chunk */
 			for (i=0;i<4;i++){
@@ -511,10 +700,7 @@ wav_find_akaihead(int indes,u_int *bcountp,u_int *csizep,u_int remain,u_int sear
 		}
 
 		/* skip rest of chunk */
-		if (LSEEK(indes,(OFF_T)csize,SEEK_CUR)<0){
-			perror("cannot lseek WAV chunk");
-			return -1;
-		}
+		wav_parse_skip(&wp,csize);
 		bcount+=csize;
 		remain-=csize;
 	}
@@ -522,6 +708,12 @@ wav_find_akaihead(int indes,u_int *bcountp,u_int *csizep,u_int remain,u_int sear
 		csize=0;
 	}
 
+	/* set file position after last chunk header */
+	if (wav_parse_end(&wp)<0){
+		perror("cannot lseek WAV chunk");
+		return -1;
+	}
+
 	if (bcountp!=NULL){
 		*bcountp=bcount;
 	}
@@ -534,4 +726,706 @@ wav_find_akaihead(int indes,u_int *bcountp,u_int *csizep,u_int remain,u_int sear
 
 
 
+/* conversion of WAV samples to 16bit */
+/* Note: all formats are scaled to 24bit first, then optional TPDF dither of +/-1 LSB (16bit) */
+/*       is added, then rounded to 16bit with saturation */
+/* Note: SIMD and scalar code give identical results */
+
+int wav_dither=0; /* off */
+
+int
+wav_conv_init(struct wav_conv_s *wcp,u_int ftag,u_int bitnr)
+{
+
+	if (wcp==NULL){
+		return -1;
+	}
+
+	wcp->ftag=ftag;
+	wcp->bitnr=bitnr;
+	wcp->bytenr=(bitnr+7)/8;
+	wcp->dither=0;
+	wcp->buf=NULL; /* not allocated yet */
+	wcp->bcount=0;
+	wcp->rsp=NULL; /* no resampling */
+	/* Note: fixed seeds for reproducible results */
+	wcp->rnd[0]=0x9e3779b9;
+	wcp->rnd[1]=0x7f4a7c15;
+	wcp->rnd[2]=0x85ebca6b;
+	wcp->rnd[3]=0xc2b2ae35;
+
+	if (ftag==WAV_HEAD_FTAG_FLOAT){
+		if (bitnr!=32){
+			return -1;
+		}
+	}else if (ftag==WAV_HEAD_FTAG){
+		if ((bitnr==0)||(bitnr>32)){
+			return -1;
+		}
+	}else{
+		return -1;
+	}
+
+	if ((ftag==WAV_HEAD_FTAG_FLOAT)||(wcp->bytenr>2)){
+		/* Note: no dither if lossless */
+		wcp->dither=wav_dither;
+	}
+
+	return 0;
+}
+
+void
+wav_conv_free(struct wav_conv_s *wcp)
+{
+
+	if (wcp==NULL){
+		return;
+	}
+
+	if (wcp->buf!=NULL){
+		free(wcp->buf);
+		wcp->buf=NULL;
+	}
+	if (wcp->rsp!=NULL){
+		if (wcp->rsp->coef!=NULL){
+			free(wcp->rsp->coef);
+		}
+		if (wcp->rsp->hist[0]!=NULL){
+			free(wcp->rsp->hist[0]);
+		}
+		if (wcp->rsp->hist[1]!=NULL){
+			free(wcp->rsp->hist[1]);
+		}
+		if (wcp->rsp->outbuf!=NULL){
+			free(wcp->rsp->outbuf);
+		}
+		wav_conv_free(&wcp->rsp->fconv);
+		free(wcp->rsp);
+		wcp->rsp=NULL;
+	}
+}
+
+#if defined(WAV_SIMD_SSE2)
+/* 4 samples of 24bit in x to 16bit */
+static __m128i
+wav_conv_round16_sse2(__m128i x,__m128i *rndp,int dither)
+{
+
+	if (dither){
+		__m128i r;
+
+		/* xorshift32 in each lane */
+		r=*rndp;
+		r=_mm_xor_si128(r,_mm_slli_epi32(r,13));
+		r=_mm_xor_si128(r,_mm_srli_epi32(r,17));
+		r=_mm_xor_si128(r,_mm_slli_epi32(r,5));
+		*rndp=r;
+		/* TPDF: sum of two uniform 8bit values */
+		x=_mm_add_epi32(x,_mm_sub_epi32(_mm_add_epi32(_mm_and_si128(r,_mm_set1_epi32(0xff)),
+													  _mm_and_si128(_mm_srli_epi32(r,8),_mm_set1_epi32(0xff))),
+										_mm_set1_epi32(0xff)));
+	}
+	/* round: ((x>>7)+1)>>1 */
+	return _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(x,7),_mm_set1_epi32(1)),1);
+}
+
+static __m128i
+wav_conv_load24_sse2(struct wav_conv_s *wcp,u_char *p)
+{
+	u_int w[4];
+
+	if (wcp->ftag==WAV_HEAD_FTAG_FLOAT){
+		__m128 f;
+
+		f=_mm_mul_ps(_mm_castsi128_ps(_mm_loadu_si128((__m128i *)p)),_mm_set1_ps(8388608.0f));
+		/* Note: NaN -> min. */
+		f=_mm_min_ps(_mm_max_ps(f,_mm_set1_ps(-1073741824.0f)),_mm_set1_ps(1073741824.0f));
+		return _mm_cvtps_epi32(f);
+	}
+	if (wcp->bytenr==4){
+		return _mm_srai_epi32(_mm_loadu_si128((__m128i *)p),8);
+	}
+	/* 24bit: 4 Bytes per sample, upper Byte is discarded */
+	/* Note: one more Byte after 4th sample is read */
+	bcopy(p+0,&w[0],4);
+	bcopy(p+3,&w[1],4);
+	bcopy(p+6,&w[2],4);
+	bcopy(p+9,&w[3],4);
+	return _mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128((__m128i *)w),8),8);
+}
+#endif
+
+/* convert count WAV samples in src to 16bit in dst */
+void
+wav_conv16(struct wav_conv_s *wcp,u_char *dst,u_char *src,u_int count)
+{
+	u_char *p;
+	u_int i;
+	int x;
+	int v;
+
+	if (wcp->bytenr==2){
+		/* 16bit */
+		bcopy(src,dst,2*count);
+		return;
+	}
+
+	i=0;
+#if defined(WAV_SIMD_SSE2)
+	if (wcp->bytenr==1){
+		/* 8bit unsigned: (x-0x80)<<8 */
+		for (;i+16<=count;i+=16){
+			__m128i a;
+
+			a=_mm_xor_si128(_mm_loadu_si128((__m128i *)(src+i)),_mm_set1_epi8((char)0x80));
+			_mm_storeu_si128((__m128i *)(dst+2*i+0),_mm_unpacklo_epi8(_mm_setzero_si128(),a));
+			_mm_storeu_si128((__m128i *)(dst+2*i+16),_mm_unpackhi_epi8(_mm_setzero_si128(),a));
+		}
+	}else{
+		__m128i rnd;
+		u_int n;
+
+		rnd=_mm_loadu_si128((__m128i *)wcp->rnd);
+		/* Note: 24bit reads one more Byte */
+		n=(wcp->bytenr==3)?((count>0)?(count-1):0):count;
+		for (;i+8<=n;i+=8){
+			__m128i a,b;
+
+			a=wav_conv_round16_sse2(wav_conv_load24_sse2(wcp,src+wcp->bytenr*i),&rnd,wcp->dither);
+			b=wav_conv_round16_sse2(wav_conv_load24_sse2(wcp,src+wcp->bytenr*(i+4)),&rnd,wcp->dither);
+			/* saturate */
+			_mm_storeu_si128((__m128i *)(dst+2*i),_mm_packs_epi32(a,b));
+		}
+		_mm_storeu_si128((__m128i *)wcp->rnd,rnd);
+	}
+#endif
+	/* rest */
+	for (;i<count;i++){
+		p=src+wcp->bytenr*i;
+		if (wcp->ftag==WAV_HEAD_FTAG_FLOAT){
+			u_int w;
+			float f;
+
+			w=p[0]+(p[1]<<8)+(p[2]<<16)+(((u_int)p[3])<<24);
+			bcopy(&w,&f,4);
+			f*=8388608.0f;
+			/* Note: NaN -> min. */
+			if (!(f>=-1073741824.0f)){
+				f=-1073741824.0f;
+			}
+			if (f>1073741824.0f){
+				f=1073741824.0f;
+			}
+			x=(int)lrintf(f);
+		}else if (wcp->bytenr==1){
+			x=((int)p[0]-0x80)<<16;
+		}else if (wcp->bytenr==3){
+			x=((int)((p[0]<<8)+(p[1]<<16)+(((u_int)p[2])<<24)))>>8;
+		}else{
+			x=((int)(p[0]+(p[1]<<8)+(p[2]<<16)+(((u_int)p[3])<<24)))>>8;
+		}
+		if (wcp->dither){
+			u_int r;
+
+			/* xorshift32, lane as in SIMD code */
+			r=wcp->rnd[i&3];
+			r^=r<<13;
+			r^=r>>17;
+			r^=r<<5;
+			wcp->rnd[i&3]=r;
+			/* TPDF: sum of two uniform 8bit values */
+			x+=(int)((r&0xff)+((r>>8)&0xff))-0xff;
+		}
+		/* round and saturate */
+		v=((x>>7)+1)>>1;
+		if (v>0x7fff){
+			v=0x7fff;
+		}else if (v<-0x8000){
+			v=-0x8000;
+		}
+		dst[2*i+0]=0xff&v;
+		dst[2*i+1]=0xff&(v>>8);
+	}
+}
+
+/* resampling */
+/* Note: frame n of output is centered at input position n*down/up, */
+/*       input before start and after end is zero */
+/* Note: phase of filter is quantized if up>WAV_RS_PHASEMAX */
+
+u_int wav_rsrate=0; /* off */
+
+#ifndef M_PI
+#define M_PI	3.14159265358979323846
+#endif
+
+static u_int
+wav_rs_gcd(u_int a,u_int b)
+{
+	u_int t;
+
+	while (b!=0){
+		t=a%b;
+		a=b;
+		b=t;
+	}
+	return a;
+}
+
+/* modified Bessel function of order 0 */
+static double
+wav_rs_i0(double x)
+{
+	double s,t;
+	u_int k;
+
+	s=1.0;
+	t=1.0;
+	for (k=1;k<100;k++){
+		t*=(x/(2.0*(double)k))*(x/(2.0*(double)k));
+		s+=t;
+		if (t<1e-12*s){
+			break;
+		}
+	}
+	return s;
+}
+
+/* filter bank of resampler *rsp for ratio rsp->up/rsp->down */
+/* Note: own filter bank per resampler, freed by wav_conv_free() */
+static int
+wav_rs_bank(struct wav_rs_s *rsp)
+{
+	double fc,d,x,h,sum;
+	double i0beta;
+	u_int up,down;
+	u_int half;
+	u_int p,k;
+	float *c;
+
+	up=rsp->up;
+	down=rsp->down;
+
+	/* cutoff relative to input Nyquist frequency */
+	fc=WAV_RS_ROLLOFF;
+	if (up<down){
+		/* downsampling: lowpass at output Nyquist frequency */
+		fc*=((double)up)/((double)down);
+	}
+	/* number of taps on each side, multiple of 4 */
+	half=(WAV_RS_ZEROS*down+up-1)/up;
+	if (half<WAV_RS_ZEROS){
+		half=WAV_RS_ZEROS;
+	}
+	half=(half+3)&~3;
+
+	rsp->phasenr=(up<WAV_RS_PHASEMAX)?up:WAV_RS_PHASEMAX;
+	rsp->tapnr=2*half;
+	rsp->coef=(float *)malloc(rsp->phasenr*rsp->tapnr*sizeof(float));
+	if (rsp->coef==NULL){
+		perror("malloc");
+		return -1;
+	}
+
+	i0beta=wav_rs_i0(WAV_RS_BETA);
+	for (p=0;p<rsp->phasenr;p++){
+		c=rsp->coef+p*rsp->tapnr;
+		sum=0.0;
+		for (k=0;k<rsp->tapnr;k++){
+			/* distance of tap k from center in input samples */
+			d=((double)k)-((double)(half-1))-((double)p)/((double)rsp->phasenr);
+			/* sinc */
+			x=M_PI*fc*d;
+			h=(fabs(x)<1e-9)?fc:(fc*sin(x)/x);
+			/* Kaiser window */
+			x=d/((double)half);
+			if (fabs(x)<1.0){
+				h*=wav_rs_i0(WAV_RS_BETA*sqrt(1.0-x*x))/i0beta;
+			}else{
+				h=0.0;
+			}
+			c[k]=(float)h;
+			sum+=h;
+		}
+		/* normalize DC gain of phase */
+		for (k=0;k<rsp->tapnr;k++){
+			c[k]=(float)(((double)c[k])/sum);
+		}
+	}
+
+	return 0;
+}
+
+/* enable resampling of framenr frames from srate to drate for wav_read16() */
+/* Note: call after wav_conv_init() */
+/* returns 1 if unsupported */
+int
+wav_conv_resample(struct wav_conv_s *wcp,u_int chnr,u_int srate,u_int drate,u_int framenr,u_int *outframesp)
+{
+	struct wav_rs_s *rsp;
+	U_INT64 n;
+	u_int g;
+
+	if ((wcp==NULL)||(wcp->rsp!=NULL)){
+		return -1;
+	}
+	if ((chnr<1)||(chnr>2)){
+		return -1;
+	}
+
+	if ((srate==drate)||(drate==0)){
+		/* nothing to do */
+		if (outframesp!=NULL){
+			*outframesp=framenr;
+		}
+		return 0;
+	}
+	if ((srate==0)||(srate>WAV_RS_RATIOMAX*drate)||(drate>WAV_RS_RATIOMAX*srate)){
+		fprintf(stderr,"unsupported ratio of sample rates\n");
+		return 1; /* no error */
+	}
+
+	/* number of output frames, round up */
+	g=wav_rs_gcd(srate,drate);
+	n=(((U_INT64)framenr)*(drate/g)+(srate/g)-1)/(srate/g);
+	if (n>0x3fffffff/chnr){
+		fprintf(stderr,"WAV too large\n");
+		return 1; /* no error */
+	}
+
+	if ((rsp=(struct wav_rs_s *)malloc(sizeof(struct wav_rs_s)))==NULL){
+		perror("malloc");
+		return -1;
+	}
+	bzero(rsp,sizeof(struct wav_rs_s));
+	/* Note: wav_conv_free() will free rsp */
+	wcp->rsp=rsp;
+	wav_conv_init(&rsp->fconv,WAV_HEAD_FTAG_FLOAT,32);
+	rsp->chnr=chnr;
+	rsp->up=drate/g;
+	rsp->down=srate/g;
+	if (wav_rs_bank(rsp)<0){
+		return -1;
+	}
+	rsp->inframes=framenr;
+	rsp->outframes=(u_int)n;
+	rsp->inpos=0;
+	rsp->histpos=0;
+	rsp->frac=0;
+	/* start with zeros before first tap of first frame */
+	rsp->histnr=rsp->tapnr/2-1;
+	for (g=0;g<chnr;g++){
+		rsp->hist[g]=(float *)malloc((rsp->tapnr+WAV_RS_BLKSIZ)*sizeof(float));
+		if (rsp->hist[g]==NULL){
+			perror("malloc");
+			return -1;
+		}
+		bzero(rsp->hist[g],rsp->histnr*sizeof(float));
+	}
+	rsp->outbuf=(u_char *)malloc(WAV_RS_BLKSIZ*chnr*4); /* 4: 32bit float */
+	if (rsp->outbuf==NULL){
+		perror("malloc");
+		return -1;
+	}
+	if (wcp->buf==NULL){
+		/* Note: akai_wav_conv_free() will free buffer */
+		if ((wcp->buf=(u_char *)malloc(WAV_RS_BLKSIZ*chnr*4))==NULL){ /* 4: max. Bytes per sample */
+			perror("malloc");
+			return -1;
+		}
+	}
+
+	if (outframesp!=NULL){
+		*outframesp=rsp->outframes;
+	}
+
+	return 0;
+}
+
+/* WAV sample in src to float */
+static float
+wav_rs_getsample(struct wav_conv_s *wcp,u_char *p)
+{
+	u_int w;
+	float f;
+
+	if (wcp->ftag==WAV_HEAD_FTAG_FLOAT){
+		w=p[0]+(p[1]<<8)+(p[2]<<16)+(((u_int)p[3])<<24);
+		bcopy(&w,&f,4);
+		/* Note: NaN -> min. */
+		if (!(f>=-64.0f)){
+			f=-64.0f;
+		}
+		if (f>64.0f){
+			f=64.0f;
+		}
+		return f;
+	}
+	if (wcp->bytenr==1){
+		return ((float)((int)p[0]-0x80))*(1.0f/128.0f);
+	}
+	if (wcp->bytenr==2){
+		return ((float)((int)((p[0]<<16)+(((u_int)p[1])<<24))>>16))*(1.0f/32768.0f);
+	}
+	if (wcp->bytenr==3){
+		return ((float)((int)((p[0]<<8)+(p[1]<<16)+(((u_int)p[2])<<24))>>8))*(1.0f/8388608.0f);
+	}
+	return ((float)((int)(p[0]+(p[1]<<8)+(p[2]<<16)+(((u_int)p[3])<<24))>>8))*(1.0f/8388608.0f);
+}
+
+/* drop used input, read more input from WAV file */
+static int
+wav_rs_fill(struct wav_conv_s *wcp,int indes)
+{
+	struct wav_rs_s *rsp;
+	u_char *p;
+	u_int ch,i,n;
+
+	rsp=wcp->rsp;
+
+	if (rsp->histpos>0){
+		for (ch=0;ch<rsp->chnr;ch++){
+			memmove(rsp->hist[ch],rsp->hist[ch]+rsp->histpos,(rsp->histnr-rsp->histpos)*sizeof(float));
+		}
+		rsp->histnr-=rsp->histpos;
+		rsp->histpos=0;
+	}
+
+	while (rsp->histnr<rsp->tapnr+WAV_RS_BLKSIZ){
+		n=rsp->tapnr+WAV_RS_BLKSIZ-rsp->histnr;
+		if (rsp->inpos<rsp->inframes){
+			if (n>rsp->inframes-rsp->inpos){
+				n=rsp->inframes-rsp->inpos;
+			}
+			if (n>WAV_RS_BLKSIZ){
+				n=WAV_RS_BLKSIZ;
+			}
+			if (READ(indes,wcp->buf,n*rsp->chnr*wcp->bytenr)!=(int)(n*rsp->chnr*wcp->bytenr)){
+				return -1;
+			}
+			wcp->bcount+=n*rsp->chnr*wcp->bytenr;
+			rsp->inpos+=n;
+			/* de-interleave */
+			p=wcp->buf;
+			for (i=0;i<n;i++){
+				for (ch=0;ch<rsp->chnr;ch++){
+					rsp->hist[ch][rsp->histnr+i]=wav_rs_getsample(wcp,p);
+					p+=wcp->bytenr;
+				}
+			}
+		}else{
+			/* after end */
+			for (ch=0;ch<rsp->chnr;ch++){
+				bzero(rsp->hist[ch]+rsp->histnr,n*sizeof(float));
+			}
+		}
+		rsp->histnr+=n;
+	}
+
+	return 0;
+}
+
+/* sum of c[k]*x[k] for k<n, n must be multiple of 8 */
+/* Note: SIMD and scalar code give identical results */
+static float
+wav_rs_dot(float *c,float *x,u_int n)
+{
+	float s[8];
+	u_int k;
+#if defined(WAV_SIMD_SSE2)
+	__m128 a,b;
+
+	a=_mm_setzero_ps();
+	b=_mm_setzero_ps();
+	for (k=0;k<n;k+=8){
+		a=_mm_add_ps(a,_mm_mul_ps(_mm_loadu_ps(c+k+0),_mm_loadu_ps(x+k+0)));
+		b=_mm_add_ps(b,_mm_mul_ps(_mm_loadu_ps(c+k+4),_mm_loadu_ps(x+k+4)));
+	}
+	_mm_storeu_ps(s+0,a);
+	_mm_storeu_ps(s+4,b);
+#elif defined(WAV_SIMD_NEON)
+	float32x4_t a,b;
+
+	a=vdupq_n_f32(0.0f);
+	b=vdupq_n_f32(0.0f);
+	for (k=0;k<n;k+=8){
+		a=vaddq_f32(a,vmulq_f32(vld1q_f32(c+k+0),vld1q_f32(x+k+0)));
+		b=vaddq_f32(b,vmulq_f32(vld1q_f32(c+k+4),vld1q_f32(x+k+4)));
+	}
+	vst1q_f32(s+0,a);
+	vst1q_f32(s+4,b);
+#else
+	u_int j;
+
+	for (j=0;j<8;j++){
+		s[j]=0.0f;
+	}
+	for (k=0;k<n;k+=8){
+		for (j=0;j<8;j++){
+			s[j]+=c[k+j]*x[k+j];
+		}
+	}
+#endif
+	return ((s[0]+s[4])+(s[1]+s[5]))+((s[2]+s[6])+(s[3]+s[7]));
+}
+
+/* read and resample WAV, count samples (all channels) to 16bit in buf */
+static int
+wav_rs_read16(struct wav_conv_s *wcp,int indes,u_char *buf,u_int count)
+{
+	struct wav_rs_s *rsp;
+	u_int framenr;
+	u_int i,j,n;
+	u_int ch,p,pos;
+	u_char *q;
+	float f;
+	u_int w;
+
+	rsp=wcp->rsp;
+	if ((count%rsp->chnr)!=0){
+		return -1;
+	}
+	framenr=count/rsp->chnr;
+
+	for (i=0;i<framenr;i+=n){
+		n=framenr-i;
+		if (n>WAV_RS_BLKSIZ){
+			n=WAV_RS_BLKSIZ;
+		}
+		q=rsp->outbuf;
+		for (j=0;j<n;j++){
+			/* phase */
+			pos=0;
+			if (rsp->phasenr==rsp->up){
+				p=rsp->frac;
+			}else{
+				/* quantize to nearest phase */
+				p=(u_int)((((U_INT64)rsp->frac)*rsp->phasenr*2+rsp->up)/(2*rsp->up));
+				if (p>=rsp->phasenr){
+					p=0;
+					pos=1;
+				}
+			}
+			if (rsp->histpos+pos+rsp->tapnr>rsp->histnr){
+				if (wav_rs_fill(wcp,indes)<0){
+					return -1;
+				}
+			}
+			pos+=rsp->histpos;
+			for (ch=0;ch<rsp->chnr;ch++){
+				f=wav_rs_dot(rsp->coef+p*rsp->tapnr,rsp->hist[ch]+pos,rsp->tapnr);
+				bcopy(&f,&w,4);
+				q[0]=0xff&w;
+				q[1]=0xff&(w>>8);
+				q[2]=0xff&(w>>16);
+				q[3]=0xff&(w>>24);
+				q+=4;
+			}
+			/* next frame */
+			rsp->frac+=rsp->down;
+			rsp->histpos+=rsp->frac/rsp->up;
+			rsp->frac%=rsp->up;
+		}
+		/* to 16bit */
+		wav_conv16(&rsp->fconv,buf+2*rsp->chnr*i,rsp->outbuf,n*rsp->chnr);
+	}
+
+	return 0;
+}
+
+
+
+/* read count WAV samples and convert them to 16bit in buf */
+/* Note: reads count*wcp->bytenr Bytes if no resampling */
+int
+wav_read16(struct wav_conv_s *wcp,int indes,u_char *buf,u_int count)
+{
+	u_int i,n;
+
+	if (wcp->rsp!=NULL){
+		return wav_rs_read16(wcp,indes,buf,count);
+	}
+
+	if (wcp->bytenr==2){
+		/* 16bit: no conversion */
+		if (READ(indes,buf,2*count)!=(int)(2*count)){
+			return -1;
+		}
+		wcp->bcount+=2*count;
+		return 0;
+	}
+
+	if (wcp->buf==NULL){
+		/* allocate buffer */
+		/* Note: akai_wav_conv_free() will free buffer */
+		if ((wcp->buf=(u_char *)malloc(WAV_CONV_BUFSIZ*4))==NULL){ /* 4: max. Bytes per sample */
+			perror("malloc");
+			return -1;
+		}
+	}
+	for (i=0;i<count;i+=n){
+		n=count-i;
+		if (n>WAV_CONV_BUFSIZ){
+			n=WAV_CONV_BUFSIZ;
+		}
+		if (READ(indes,wcp->buf,n*wcp->bytenr)!=(int)(n*wcp->bytenr)){
+			return -1;
+		}
+		wcp->bcount+=n*wcp->bytenr;
+		wav_conv16(wcp,buf+2*i,wcp->buf,n);
+	}
+
+	return 0;
+}
+
+
+
+/* 16bit stereo de-interleave */
+/* Note: copies 16bit words, independent of byte order */
+
+void
+wav_deinterleave16(u_char *lbuf,u_char *rbuf,u_char *buf,u_int count)
+{
+	u_short *l,*r,*s;
+	u_int i;
+
+	/* Note: no alignment required */
+	l=(u_short *)lbuf;
+	r=(u_short *)rbuf;
+	s=(u_short *)buf;
+	i=0;
+#if defined(WAV_SIMD_SSE2)
+	for (;i+8<=count;i+=8){
+		__m128i a,b;
+
+		/* 8 frames L0 R0 L1 R1 ... */
+		a=_mm_loadu_si128((__m128i *)(s+2*i+0));
+		b=_mm_loadu_si128((__m128i *)(s+2*i+8));
+		/* L: lower 16bit of each 32bit frame, sign-extended, so that pack does not saturate */
+		_mm_storeu_si128((__m128i *)(l+i),
+						 _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a,16),16),
+										 _mm_srai_epi32(_mm_slli_epi32(b,16),16)));
+		/* R: upper 16bit of each 32bit frame */
+		_mm_storeu_si128((__m128i *)(r+i),
+						 _mm_packs_epi32(_mm_srai_epi32(a,16),
+										 _mm_srai_epi32(b,16)));
+	}
+#elif defined(WAV_SIMD_NEON)
+	for (;i+8<=count;i+=8){
+		uint16x8x2_t v;
+
+		v=vld2q_u16(s+2*i);
+		vst1q_u16(l+i,v.val[0]);
+		vst1q_u16(r+i,v.val[1]);
+	}
+#endif
+	/* rest */
+	for (;i<count;i++){
+		l[i]=s[2*i+0];
+		r[i]=s[2*i+1];
+	}
+}
+
+
+
 /* EOF */
@@ -50,6 +50,8 @@ struct wav_chunkhead_s{
 struct wav_fmthead_s{
 /* continued FormatChunk */
 #define WAV_HEAD_FTAG 0x0001 /* 1: PCM/umcompressed */
+#define WAV_HEAD_FTAG_FLOAT 0x0003 /* 3: IEEE float */
+#define WAV_HEAD_FTAG_EXT 0xfffe /* WAVE_FORMAT_EXTENSIBLE, format tag in subformat */
 	u_char ftag[2];    /* format tag */
 	u_char chnr[2];    /* number of channels */
 	u_char srate[4];   /* sample rate in samples/sec */
@@ -59,6 +61,15 @@ struct wav_fmthead_s{
 /* end FormatChunk */
 };
 
+struct wav_fmtexthead_s{
+/* continued FormatChunk for WAVE_FORMAT_EXTENSIBLE */
+	u_char cbsize[2];  /* size of extension */
+	u_char vbitnr[2];  /* number of valid Bits per sample */
+	u_char chmask[4];  /* speaker position mask */
+	u_char subformat[16]; /* GUID, format tag in first 2 Bytes */
+/* end FormatChunk */
+};
+
 struct wav_loophead_s{
 /* continued SamplerLoop */
 	u_char ident[4];
@@ -98,14 +109,60 @@ struct wav_smplhead_s{
 
 
 
+/* conversion of WAV samples to 16bit */
+struct wav_rs_s;
+#define WAV_CONV_BUFSIZ	0x8000 /* in samples */
+struct wav_conv_s{
+	u_int ftag; /* WAV_HEAD_FTAG or WAV_HEAD_FTAG_FLOAT */
+	u_int bitnr; /* number of Bits per WAV sample */
+	u_int bytenr; /* number of Bytes per WAV sample */
+	int dither; /* TPDF dither */
+	u_int rnd[4]; /* dither state */
+	u_char *buf; /* buffer for raw WAV samples, NULL if none */
+	u_int bcount; /* number of Bytes read by wav_read16() */
+	struct wav_rs_s *rsp; /* resampler, NULL if none */
+};
+
+/* resampling with polyphase windowed-sinc filter */
+#define WAV_RS_ZEROS	32 /* number of zero crossings of sinc on each side */
+#define WAV_RS_ROLLOFF	0.91 /* cutoff relative to lower Nyquist frequency */
+#define WAV_RS_BETA		8.0 /* Kaiser window parameter */
+#define WAV_RS_PHASEMAX	4096 /* max. number of filter phases */
+#define WAV_RS_RATIOMAX	64 /* max. ratio of sample rates */
+#define WAV_RS_BLKSIZ	0x1000 /* in frames */
+#define WAV_RS_RATEMIN	1000 /* in Hz */
+#define WAV_RS_RATEMAX	65535 /* in Hz */
+struct wav_rs_s{
+	u_int chnr;
+	u_int up; /* output rate/input rate = up/down */
+	u_int down;
+	u_int phasenr; /* number of filter phases */
+	u_int tapnr; /* number of taps per phase, multiple of 8 */
+	float *coef; /* filter bank, phasenr*tapnr */
+	u_int inframes; /* number of frames in WAV file */
+	u_int outframes; /* number of frames after resampling */
+	u_int inpos; /* number of frames read from WAV file */
+	float *hist[2]; /* input per channel */
+	u_int histnr; /* number of frames in hist */
+	u_int histpos; /* position of first tap in hist */
+	u_int frac; /* fractional position of current frame, 0..up-1 */
+	u_char *outbuf; /* resampled frames as 32bit float */
+	struct wav_conv_s fconv; /* 32bit float to 16bit */
+};
+
+
+
 /* Declarations */
 
+extern void wav_set_head(u_char *buf,
+						 u_int datasize,u_int chnr,u_int samprate,u_int bitnr,
+						 u_int extrasize);
 extern int wav_write_head(int outdes,
 						  u_int datasize,u_int chnr,u_int samprate,u_int bitnr,
 						  u_int extrasize);
 
 extern int wav_read_head(int indes,u_int *bcountp,
-						 u_int *datasizep,u_int *chnrp,u_int *sampratep,u_int *bitnrp,
+						 u_int *datasizep,u_int *chnrp,u_int *sampratep,u_int *bitnrp,u_int *ftagp,
 						 u_int *extrasizep,
 						 char **errstrp,
 						 int *ltype, u_int *lstart, u_int *lend);
@@ -119,6 +176,19 @@ extern int wav_read_head(int indes,u_int *bcountp,
 int wav_find_akaihead(int indes,u_int *bcountp,u_int *csizep,u_int remain,u_int searchtype);
 #endif
 
+extern int wav_dither; /* TPDF dither for conversion to 16bit */
+
+extern int wav_conv_init(struct wav_conv_s *wcp,u_int ftag,u_int bitnr);
+extern void wav_conv_free(struct wav_conv_s *wcp);
+extern void wav_conv16(struct wav_conv_s *wcp,u_char *dst,u_char *src,u_int count);
+extern int wav_read16(struct wav_conv_s *wcp,int indes,u_char *buf,u_int count);
+
+extern u_int wav_rsrate; /* target sample rate for import, 0: no resampling */
+
+extern int wav_conv_resample(struct wav_conv_s *wcp,u_int chnr,u_int srate,u_int drate,u_int framenr,u_int *outframesp);
+
+extern void wav_deinterleave16(u_char *lbuf,u_char *rbuf,u_char *buf,u_int count);
+
 
 
 #endif /* !__AKAIUTIL_WAV_H */